@@ -1,5 +1,7 @@
+#include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <wlr/types/wlr_output_layer.h>
 #include <wlr/util/log.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
@@ -8,14 +10,16 @@
 #include "backend/drm/util.h"
 
 struct atomic {
+	const struct wlr_drm_device_impl *impl;
 	drmModeAtomicReq *req;
 	bool failed;
 };
 
-static void atomic_begin(struct atomic *atom) {
+static void atomic_begin(struct atomic *atom, struct wlr_drm_backend *drm) {
 	memset(atom, 0, sizeof(*atom));
+	atom->impl = drm->dev_impl;
 
-	atom->req = drmModeAtomicAlloc();
+	atom->req = atom->impl->atomic_alloc();
 	if (!atom->req) {
 		wlr_log_errno(WLR_ERROR, "Allocation failed");
 		atom->failed = true;
@@ -30,10 +34,12 @@ static bool atomic_commit(struct atomic *atom,
 		return false;
 	}
 
-	int ret = drmModeAtomicCommit(drm->fd, atom->req, flags, drm);
+	int ret = atom->impl->atomic_commit(drm->fd, atom->req, flags, drm);
 	if (ret != 0) {
-		wlr_drm_conn_log_errno(conn,
-			(flags & DRM_MODE_ATOMIC_TEST_ONLY) ? WLR_DEBUG : WLR_ERROR,
+		// Async page-flips are retried as regular ones on failure
+		bool quiet = flags &
+			(DRM_MODE_ATOMIC_TEST_ONLY | DRM_MODE_PAGE_FLIP_ASYNC);
+		wlr_drm_conn_log_errno(conn, quiet ? WLR_DEBUG : WLR_ERROR,
 			"Atomic %s failed (%s)",
 			(flags & DRM_MODE_ATOMIC_TEST_ONLY) ? "test" : "commit",
 			(flags & DRM_MODE_ATOMIC_ALLOW_MODESET) ? "modeset" : "pageflip");
@@ -44,11 +50,12 @@ static bool atomic_commit(struct atomic *atom,
 }
 
 static void atomic_finish(struct atomic *atom) {
-	drmModeAtomicFree(atom->req);
+	atom->impl->atomic_free(atom->req);
 }
 
 static void atomic_add(struct atomic *atom, uint32_t id, uint32_t prop, uint64_t val) {
-	if (!atom->failed && drmModeAtomicAddProperty(atom->req, id, prop, val) < 0) {
+	if (!atom->failed &&
+			atom->impl->atomic_add_property(atom->req, id, prop, val) < 0) {
 		wlr_log_errno(WLR_ERROR, "Failed to add atomic DRM property");
 		atom->failed = true;
 	}
@@ -56,15 +63,16 @@ static void atomic_add(struct atomic *atom, uint32_t id, uint32_t prop, uint64_t
 
 static bool create_mode_blob(struct wlr_drm_backend *drm,
 		struct wlr_drm_connector *conn,
-		const struct wlr_drm_connector_state *state, uint32_t *blob_id) {
+		const struct wlr_drm_connector_state *state,
+		struct wlr_drm_blob **blob) {
 	if (!state->active) {
-		*blob_id = 0;
+		*blob = NULL;
 		return true;
 	}
 
-	if (drmModeCreatePropertyBlob(drm->fd, &state->mode,
-			sizeof(drmModeModeInfo), blob_id)) {
-		wlr_log_errno(WLR_ERROR, "Unable to create mode property blob");
+	*blob = drm_blob_create(drm, &state->mode, sizeof(drmModeModeInfo));
+	if (*blob == NULL) {
+		wlr_log(WLR_ERROR, "Unable to create mode property blob");
 		return false;
 	}
 
@@ -72,9 +80,9 @@ static bool create_mode_blob(struct wlr_drm_backend *drm,
 }
 
 static bool create_gamma_lut_blob(struct wlr_drm_backend *drm,
-		size_t size, const uint16_t *lut, uint32_t *blob_id) {
+		size_t size, const uint16_t *lut, struct wlr_drm_blob **blob) {
 	if (size == 0) {
-		*blob_id = 0;
+		*blob = NULL;
 		return true;
 	}
 
@@ -93,23 +101,21 @@ static bool create_gamma_lut_blob(struct wlr_drm_backend *drm,
 		gamma[i].blue = b[i];
 	}
 
-	if (drmModeCreatePropertyBlob(drm->fd, gamma,
-			size * sizeof(struct drm_color_lut), blob_id) != 0) {
-		wlr_log_errno(WLR_ERROR, "Unable to create gamma LUT property blob");
-		free(gamma);
+	*blob = drm_blob_create(drm, gamma, size * sizeof(struct drm_color_lut));
+	free(gamma);
+	if (*blob == NULL) {
+		wlr_log(WLR_ERROR, "Unable to create gamma LUT property blob");
 		return false;
 	}
-	free(gamma);
 
 	return true;
 }
 
 static bool create_ctm_blob(struct wlr_drm_backend *drm,
-		const uint32_t *ctm, uint32_t *blob_id) {
-	int size = sizeof(struct drm_color_ctm);
-
-	if (drmModeCreatePropertyBlob(drm->fd, ctm, size, blob_id) != 0) {
-		wlr_log_errno(WLR_ERROR, "Unable to create CTM property blob");
+		const uint32_t *ctm, struct wlr_drm_blob **blob) {
+	*blob = drm_blob_create(drm, ctm, sizeof(struct drm_color_ctm));
+	if (*blob == NULL) {
+		wlr_log(WLR_ERROR, "Unable to create CTM property blob");
 		return false;
 	}
 
@@ -117,24 +123,14 @@ static bool create_ctm_blob(struct wlr_drm_backend *drm,
 }
 
 static void commit_blob(struct wlr_drm_backend *drm,
-		uint32_t *current, uint32_t next) {
-	if (*current == next) {
-		return;
-	}
-	if (*current != 0) {
-		drmModeDestroyPropertyBlob(drm->fd, *current);
-	}
+		struct wlr_drm_blob **current, struct wlr_drm_blob *next) {
+	drm_blob_unref(drm, *current);
 	*current = next;
 }
 
 static void rollback_blob(struct wlr_drm_backend *drm,
-		uint32_t *current, uint32_t next) {
-	if (*current == next) {
-		return;
-	}
-	if (next != 0) {
-		drmModeDestroyPropertyBlob(drm->fd, next);
-	}
+		struct wlr_drm_blob **current, struct wlr_drm_blob *next) {
+	drm_blob_unref(drm, next);
 }
 
 static void plane_disable(struct atomic *atom, struct wlr_drm_plane *plane) {
@@ -176,6 +172,41 @@ error:
 	atom->failed = true;
 }
 
+static void set_layer_props(struct atomic *atom,
+		struct wlr_drm_plane *plane, uint32_t crtc_id) {
+	uint32_t id = plane->id;
+	const union wlr_drm_plane_props *props = &plane->props;
+	const struct wlr_output_layer_state *state = plane->pending_layer;
+	struct wlr_drm_fb *fb = plane->pending_fb;
+	assert(fb != NULL);
+
+	struct wlr_fbox src_box = state->src_box;
+	if (wlr_fbox_empty(&src_box)) {
+		src_box = (struct wlr_fbox){
+			.width = fb->wlr_buf->width,
+			.height = fb->wlr_buf->height,
+		};
+	}
+
+	struct wlr_box dst_box = state->dst_box;
+	if (dst_box.width <= 0 || dst_box.height <= 0) {
+		dst_box.width = (int)src_box.width;
+		dst_box.height = (int)src_box.height;
+	}
+
+	// The src_* properties are in 16.16 fixed point
+	atomic_add(atom, id, props->src_x, (uint64_t)(src_box.x * (1 << 16)));
+	atomic_add(atom, id, props->src_y, (uint64_t)(src_box.y * (1 << 16)));
+	atomic_add(atom, id, props->src_w, (uint64_t)(src_box.width * (1 << 16)));
+	atomic_add(atom, id, props->src_h, (uint64_t)(src_box.height * (1 << 16)));
+	atomic_add(atom, id, props->crtc_w, (uint64_t)dst_box.width);
+	atomic_add(atom, id, props->crtc_h, (uint64_t)dst_box.height);
+	atomic_add(atom, id, props->fb_id, fb->id);
+	atomic_add(atom, id, props->crtc_id, crtc_id);
+	atomic_add(atom, id, props->crtc_x, (uint64_t)dst_box.x);
+	atomic_add(atom, id, props->crtc_y, (uint64_t)dst_box.y);
+}
+
 static bool atomic_crtc_commit(struct wlr_drm_connector *conn,
 		const struct wlr_drm_connector_state *state, uint32_t flags,
 		bool test_only) {
@@ -186,57 +217,66 @@ static bool atomic_crtc_commit(struct wlr_drm_connector *conn,
 	bool modeset = state->modeset;
 	bool active = state->active;
 
-	uint32_t mode_id = crtc->mode_id;
+	// Each of these holds a reference until committed or rolled back
+	struct wlr_drm_blob *mode_id = NULL;
 	if (modeset) {
 		if (!create_mode_blob(drm, conn, state, &mode_id)) {
 			return false;
 		}
+	} else {
+		mode_id = drm_blob_ref(crtc->mode_id);
 	}
 
-	uint32_t gamma_lut = crtc->gamma_lut;
-	if (state->base->committed & WLR_OUTPUT_STATE_GAMMA_LUT) {
+	struct wlr_drm_blob *gamma_lut = NULL;
+	if ((state->base->committed & WLR_OUTPUT_STATE_GAMMA_LUT) &&
+			crtc->props.gamma_lut != 0) {
+		if (!create_gamma_lut_blob(drm, state->base->gamma_lut_size,
+				state->base->gamma_lut, &gamma_lut)) {
+			goto error_mode;
+		}
+	} else {
 		// Fallback to legacy gamma interface when gamma properties are not
 		// available (can happen on older Intel GPUs that support gamma but not
 		// degamma).
-		if (crtc->props.gamma_lut == 0) {
-			if (!drm_legacy_crtc_set_gamma(drm, crtc,
+		if ((state->base->committed & WLR_OUTPUT_STATE_GAMMA_LUT) &&
+				!drm_legacy_crtc_set_gamma(drm, crtc,
 					state->base->gamma_lut_size,
 					state->base->gamma_lut)) {
-				return false;
-			}
-		} else {
-			if (!create_gamma_lut_blob(drm, state->base->gamma_lut_size,
-					state->base->gamma_lut, &gamma_lut)) {
-				return false;
-			}
+			goto error_mode;
 		}
+		gamma_lut = drm_blob_ref(crtc->gamma_lut);
 	}
 
-	uint32_t ctm = crtc->ctm;
+	struct wlr_drm_blob *ctm = NULL;
 	if (state->base->committed & WLR_OUTPUT_STATE_CTM) {
 		fprintf(stderr, "atomic commit!!!\n");
 
 		if (crtc->props.ctm == 0) {
 			free(state->base->ctm);
-			return false;
+			goto error_gamma_lut;
 		}
 		else {
 			if(!create_ctm_blob(drm, state->base->ctm, &ctm)) {
-				return false;
+				goto error_gamma_lut;
 			}
 		}
+	} else {
+		ctm = drm_blob_ref(crtc->ctm);
 	}
 
-	uint32_t fb_damage_clips = 0;
+	// Damage is often identical from one frame to the next (e.g. full
+	// damage, or a blinking cursor), in which case the blob is re-used
+	struct wlr_drm_blob *fb_damage_clips = NULL;
 	if ((state->base->committed & WLR_OUTPUT_STATE_DAMAGE) &&
 			pixman_region32_not_empty((pixman_region32_t *)&state->base->damage) &&
 			crtc->primary->props.fb_damage_clips != 0) {
 		int rects_len;
 		const pixman_box32_t *rects = pixman_region32_rectangles(
 			(pixman_region32_t *)&state->base->damage, &rects_len);
-		if (drmModeCreatePropertyBlob(drm->fd, rects,
-				sizeof(*rects) * rects_len, &fb_damage_clips) != 0) {
-			wlr_log_errno(WLR_ERROR, "Failed to create FB_DAMAGE_CLIPS property blob");
+		fb_damage_clips = drm_blob_create(drm, rects,
+			sizeof(*rects) * rects_len);
+		if (fb_damage_clips == NULL) {
+			wlr_log(WLR_ERROR, "Failed to create FB_DAMAGE_CLIPS property blob");
 		}
 	}
 
@@ -258,20 +298,21 @@ static bool atomic_crtc_commit(struct wlr_drm_connector *conn,
 	}
 
 	struct atomic atom;
-	atomic_begin(&atom);
+	atomic_begin(&atom, drm);
 	atomic_add(&atom, conn->id, conn->props.crtc_id, active ? crtc->id : 0);
 	if (modeset && active && conn->props.link_status != 0) {
 		atomic_add(&atom, conn->id, conn->props.link_status,
 			DRM_MODE_LINK_STATUS_GOOD);
 	}
-	atomic_add(&atom, crtc->id, crtc->props.mode_id, mode_id);
+	atomic_add(&atom, crtc->id, crtc->props.mode_id, drm_blob_id(mode_id));
 	atomic_add(&atom, crtc->id, crtc->props.active, active);
 	if (active) {
 		if (crtc->props.gamma_lut != 0) {
-			atomic_add(&atom, crtc->id, crtc->props.gamma_lut, gamma_lut);
+			atomic_add(&atom, crtc->id, crtc->props.gamma_lut,
+				drm_blob_id(gamma_lut));
 		}
 		if (crtc->props.ctm != 0) {
-			atomic_add(&atom, crtc->id, crtc->props.ctm, ctm);
+			atomic_add(&atom, crtc->id, crtc->props.ctm, drm_blob_id(ctm));
 		}
 		if (crtc->props.vrr_enabled != 0) {
 			atomic_add(&atom, crtc->id, crtc->props.vrr_enabled, vrr_enabled);
@@ -279,7 +320,8 @@ static bool atomic_crtc_commit(struct wlr_drm_connector *conn,
 		set_plane_props(&atom, drm, crtc->primary, crtc->id, 0, 0);
 		if (crtc->primary->props.fb_damage_clips != 0) {
 			atomic_add(&atom, crtc->primary->id,
-				crtc->primary->props.fb_damage_clips, fb_damage_clips);
+				crtc->primary->props.fb_damage_clips,
+				drm_blob_id(fb_damage_clips));
 		}
 		if (crtc->cursor) {
 			if (drm_connector_is_cursor_visible(conn)) {
@@ -289,11 +331,26 @@ static bool atomic_crtc_commit(struct wlr_drm_connector *conn,
 				plane_disable(&atom, crtc->cursor);
 			}
 		}
+		// Overlay planes keep their previous configuration unless the layers
+		// are updated
+		if (state->base->committed & WLR_OUTPUT_STATE_LAYERS) {
+			for (size_t i = 0; i < crtc->overlays_len; i++) {
+				struct wlr_drm_plane *plane = crtc->overlays[i];
+				if (plane->pending_layer != NULL) {
+					set_layer_props(&atom, plane, crtc->id);
+				} else {
+					plane_disable(&atom, plane);
+				}
+			}
+		}
 	} else {
 		plane_disable(&atom, crtc->primary);
 		if (crtc->cursor) {
 			plane_disable(&atom, crtc->cursor);
 		}
+		for (size_t i = 0; i < crtc->overlays_len; i++) {
+			plane_disable(&atom, crtc->overlays[i]);
+		}
 	}
 
 	bool ok = atomic_commit(&atom, conn, flags);
@@ -317,12 +374,15 @@ static bool atomic_crtc_commit(struct wlr_drm_connector *conn,
 		rollback_blob(drm, &crtc->ctm, ctm);
 	}
 
-	if (fb_damage_clips != 0 &&
-			drmModeDestroyPropertyBlob(drm->fd, fb_damage_clips) != 0) {
-		wlr_log_errno(WLR_ERROR, "Failed to destroy FB_DAMAGE_CLIPS property blob");
-	}
+	drm_blob_unref(drm, fb_damage_clips);
 
 	return ok;
+
+error_gamma_lut:
+	drm_blob_unref(drm, gamma_lut);
+error_mode:
+	drm_blob_unref(drm, mode_id);
+	return false;
 }
 
 const struct wlr_drm_interface atomic_iface = {
@@ -22,7 +22,7 @@ struct wlr_drm_backend *get_drm_backend_from_backend(
 
 static bool backend_start(struct wlr_backend *backend) {
 	struct wlr_drm_backend *drm = get_drm_backend_from_backend(backend);
-	scan_drm_connectors(drm, NULL);
+	scan_drm_connectors(drm, true, NULL, 0);
 	return true;
 }
 
@@ -52,6 +52,11 @@ static void backend_destroy(struct wlr_backend *backend) {
 	wl_list_remove(&drm->dev_change.link);
 	wl_list_remove(&drm->dev_remove.link);
 
+	if (drm->hotplug_timer != NULL) {
+		wl_event_source_remove(drm->hotplug_timer);
+	}
+	wl_array_release(&drm->hotplug_conn_ids);
+
 	if (drm->parent) {
 		finish_drm_renderer(&drm->mgpu_renderer);
 	}
@@ -59,7 +64,7 @@ static void backend_destroy(struct wlr_backend *backend) {
 	finish_drm_resources(drm);
 
 	free(drm->name);
-	wlr_session_close_file(drm->session, drm->dev);
+	drm->dev_impl->close(drm->session, drm->dev);
 	wl_event_source_remove(drm->drm_event);
 	free(drm);
 }
@@ -95,6 +100,90 @@ bool wlr_backend_is_drm(struct wlr_backend *b) {
 	return b->impl == &backend_impl;
 }
 
+void wlr_drm_backend_get_stats(struct wlr_backend *backend,
+		struct wlr_drm_backend_stats *stats) {
+	struct wlr_drm_backend *drm = get_drm_backend_from_backend(backend);
+	*stats = drm->stats;
+}
+
+// Time to wait for more hotplug events before scanning connectors
+#define HOTPLUG_DELAY_MS 20
+
+static void drm_clear_hotplug(struct wlr_drm_backend *drm) {
+	if (drm->hotplug_pending) {
+		wl_event_source_timer_update(drm->hotplug_timer, 0);
+	}
+	drm->hotplug_pending = false;
+	drm->hotplug_all = false;
+	drm->hotplug_conn_ids.size = 0;
+}
+
+static int handle_hotplug_timer(void *data) {
+	struct wlr_drm_backend *drm = data;
+
+	const uint32_t *conn_ids = NULL;
+	size_t conn_ids_len = 0;
+	if (!drm->hotplug_all) {
+		conn_ids = drm->hotplug_conn_ids.data;
+		conn_ids_len = drm->hotplug_conn_ids.size / sizeof(uint32_t);
+	}
+
+	drm->hotplug_pending = false;
+	if (drm->session->active) {
+		scan_drm_connectors(drm, false, conn_ids, conn_ids_len);
+	}
+
+	drm->hotplug_all = false;
+	drm->hotplug_conn_ids.size = 0;
+	return 0;
+}
+
+static bool hotplug_has_conn_id(struct wlr_drm_backend *drm,
+		uint32_t conn_id) {
+	const uint32_t *id;
+	wl_array_for_each(id, &drm->hotplug_conn_ids) {
+		if (*id == conn_id) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void queue_hotplug(struct wlr_drm_backend *drm,
+		const struct wlr_device_hotplug_event *event) {
+	if (drm->hotplug_timer == NULL) {
+		struct wl_event_loop *event_loop =
+			wl_display_get_event_loop(drm->display);
+		drm->hotplug_timer = wl_event_loop_add_timer(event_loop,
+			handle_hotplug_timer, drm);
+		if (drm->hotplug_timer == NULL) {
+			wlr_log(WLR_ERROR, "Failed to create hotplug timer");
+			scan_drm_connectors(drm, false, NULL, 0);
+			return;
+		}
+	}
+
+	if (event->connector_id == 0) {
+		drm->hotplug_all = true;
+	} else if (!drm->hotplug_all &&
+			!hotplug_has_conn_id(drm, event->connector_id)) {
+		uint32_t *conn_id = wl_array_add(&drm->hotplug_conn_ids,
+			sizeof(*conn_id));
+		if (conn_id != NULL) {
+			*conn_id = event->connector_id;
+		} else {
+			drm->hotplug_all = true;
+		}
+	}
+
+	// Don't re-arm the timer on each event, so that a continuous stream of
+	// events can't delay the scan forever
+	if (!drm->hotplug_pending) {
+		drm->hotplug_pending = true;
+		wl_event_source_timer_update(drm->hotplug_timer, HOTPLUG_DELAY_MS);
+	}
+}
+
 static void handle_session_active(struct wl_listener *listener, void *data) {
 	struct wlr_drm_backend *drm =
 		wl_container_of(listener, drm, session_active);
@@ -102,7 +191,9 @@ static void handle_session_active(struct wl_listener *listener, void *data) {
 
 	if (session->active) {
 		wlr_log(WLR_INFO, "DRM fd resumed");
-		scan_drm_connectors(drm, NULL);
+		// Pending hotplug events are covered by the full scan
+		drm_clear_hotplug(drm);
+		scan_drm_connectors(drm, true, NULL, 0);
 
 		struct wlr_drm_connector *conn;
 		wl_list_for_each(conn, &drm->outputs, link) {
@@ -136,7 +227,7 @@ static void handle_dev_change(struct wl_listener *listener, void *data) {
 	switch (change->type) {
 	case WLR_DEVICE_HOTPLUG:
 		wlr_log(WLR_DEBUG, "Received hotplug event for %s", drm->name);
-		scan_drm_connectors(drm, &change->hotplug);
+		queue_hotplug(drm, &change->hotplug);
 		break;
 	case WLR_DEVICE_LEASE:
 		wlr_log(WLR_DEBUG, "Received lease event for %s", drm->name);
@@ -172,14 +263,15 @@ static void handle_parent_destroy(struct wl_listener *listener, void *data) {
 	backend_destroy(&drm->backend);
 }
 
-struct wlr_backend *wlr_drm_backend_create(struct wl_display *display,
+struct wlr_backend *drm_backend_create(struct wl_display *display,
 		struct wlr_session *session, struct wlr_device *dev,
-		struct wlr_backend *parent) {
-	assert(display && session && dev);
+		struct wlr_backend *parent,
+		const struct wlr_drm_device_impl *dev_impl) {
+	assert(display && session && dev && dev_impl);
 	assert(!parent || wlr_backend_is_drm(parent));
 
-	char *name = drmGetDeviceNameFromFd2(dev->fd);
-	drmVersion *version = drmGetVersion(dev->fd);
+	char *name = dev_impl->get_device_name_from_fd2(dev->fd);
+	drmVersion *version = dev_impl->get_version(dev->fd);
 	wlr_log(WLR_INFO, "Initializing DRM backend for %s (%s)", name, version->name);
 	drmFreeVersion(version);
 
@@ -191,7 +283,9 @@ struct wlr_backend *wlr_drm_backend_create(struct wl_display *display,
 	wlr_backend_init(&drm->backend, &backend_impl);
 
 	drm->session = session;
+	drm->dev_impl = dev_impl;
 	wl_list_init(&drm->fbs);
+	wl_list_init(&drm->blobs);
 	wl_list_init(&drm->outputs);
 
 	drm->dev = dev;
@@ -281,7 +375,14 @@ error_fd:
 	wl_list_remove(&drm->dev_remove.link);
 	wl_list_remove(&drm->dev_change.link);
 	wl_list_remove(&drm->parent_destroy.link);
-	wlr_session_close_file(drm->session, dev);
+	dev_impl->close(drm->session, dev);
 	free(drm);
 	return NULL;
 }
+
+struct wlr_backend *wlr_drm_backend_create(struct wl_display *display,
+		struct wlr_session *session, struct wlr_device *dev,
+		struct wlr_backend *parent) {
+	return drm_backend_create(display, session, dev, parent,
+		&libdrm_device_impl);
+}
@@ -0,0 +1,118 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wlr/util/log.h>
+#include <xf86drmMode.h>
+#include "backend/drm/drm.h"
+
+// Number of unreferenced blobs kept around for re-use
+#define DRM_BLOB_CACHE_IDLE_CAP 8
+
+static uint32_t blob_hash(const void *data, size_t size) {
+	// FNV-1a
+	const uint8_t *bytes = data;
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static void blob_destroy(struct wlr_drm_backend *drm, struct wlr_drm_blob *blob) {
+	assert(blob->n_refs == 0);
+	if (drm->dev_impl->destroy_property_blob(drm->fd, blob->id) != 0) {
+		wlr_log_errno(WLR_ERROR, "Failed to destroy property blob");
+	}
+	drm->stats.blobs_destroyed++;
+	wl_list_remove(&blob->link);
+	free(blob);
+}
+
+struct wlr_drm_blob *drm_blob_create(struct wlr_drm_backend *drm,
+		const void *data, size_t size) {
+	uint32_t hash = blob_hash(data, size);
+
+	struct wlr_drm_blob *blob;
+	wl_list_for_each(blob, &drm->blobs, link) {
+		if (blob->hash == hash && blob->size == size &&
+				memcmp(blob->data, data, size) == 0) {
+			// Most recently used blobs go first
+			wl_list_remove(&blob->link);
+			wl_list_insert(&drm->blobs, &blob->link);
+			return drm_blob_ref(blob);
+		}
+	}
+
+	blob = calloc(1, sizeof(*blob) + size);
+	if (blob == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+
+	if (drm->dev_impl->create_property_blob(drm->fd, data, size,
+			&blob->id) != 0) {
+		wlr_log_errno(WLR_ERROR, "Failed to create property blob");
+		free(blob);
+		return NULL;
+	}
+	drm->stats.blobs_created++;
+
+	blob->n_refs = 1;
+	blob->hash = hash;
+	blob->size = size;
+	memcpy(blob->data, data, size);
+	wl_list_insert(&drm->blobs, &blob->link);
+
+	return blob;
+}
+
+struct wlr_drm_blob *drm_blob_ref(struct wlr_drm_blob *blob) {
+	if (blob != NULL) {
+		blob->n_refs++;
+	}
+	return blob;
+}
+
+void drm_blob_unref(struct wlr_drm_backend *drm, struct wlr_drm_blob *blob) {
+	if (blob == NULL) {
+		return;
+	}
+
+	assert(blob->n_refs > 0);
+	blob->n_refs--;
+	if (blob->n_refs > 0) {
+		return;
+	}
+
+	// Keep the blob for later re-use, evict the least recently used idle
+	// blob if the cache is full
+	size_t idle_len = 0;
+	struct wlr_drm_blob *iter, *lru = NULL;
+	wl_list_for_each(iter, &drm->blobs, link) {
+		if (iter->n_refs == 0) {
+			idle_len++;
+			lru = iter;
+		}
+	}
+	if (idle_len > DRM_BLOB_CACHE_IDLE_CAP) {
+		blob_destroy(drm, lru);
+	}
+}
+
+uint32_t drm_blob_id(const struct wlr_drm_blob *blob) {
+	return blob != NULL ? blob->id : 0;
+}
+
+void drm_blob_cache_finish(struct wlr_drm_backend *drm) {
+	struct wlr_drm_blob *blob, *tmp;
+	wl_list_for_each_safe(blob, tmp, &drm->blobs, link) {
+		if (blob->n_refs > 0) {
+			wlr_log(WLR_ERROR, "Property blob %"PRIu32" still referenced",
+				blob->id);
+			blob->n_refs = 0;
+		}
+		blob_destroy(drm, blob);
+	}
+}
@@ -0,0 +1,53 @@
+#include <wlr/backend/session.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include "backend/drm/device.h"
+
+static int libdrm_crtc_set_gamma(int fd, uint32_t crtc_id, uint32_t size,
+		uint16_t *r, uint16_t *g, uint16_t *b) {
+	// The constness of the LUT parameters changed between libdrm releases
+	return drmModeCrtcSetGamma(fd, crtc_id, size, r, g, b);
+}
+
+const struct wlr_drm_device_impl libdrm_device_impl = {
+	.close = wlr_session_close_file,
+	.get_device_name_from_fd2 = drmGetDeviceNameFromFd2,
+	.get_version = drmGetVersion,
+	.get_cap = drmGetCap,
+	.set_client_cap = drmSetClientCap,
+	.get_resources = drmModeGetResources,
+	.get_crtc = drmModeGetCrtc,
+	.get_encoder = drmModeGetEncoder,
+	.get_connector = drmModeGetConnector,
+	.get_connector_current = drmModeGetConnectorCurrent,
+	.get_plane_resources = drmModeGetPlaneResources,
+	.get_plane = drmModeGetPlane,
+	.get_fb = drmModeGetFB,
+	.object_get_properties = drmModeObjectGetProperties,
+	.get_property = drmModeGetProperty,
+	.get_property_blob = drmModeGetPropertyBlob,
+	.create_property_blob = drmModeCreatePropertyBlob,
+	.destroy_property_blob = drmModeDestroyPropertyBlob,
+	.prime_fd_to_handle = drmPrimeFDToHandle,
+	.close_buffer_handle = drmCloseBufferHandle,
+	.add_fb = drmModeAddFB,
+	.add_fb2 = drmModeAddFB2,
+	.add_fb2_with_modifiers = drmModeAddFB2WithModifiers,
+	.rm_fb = drmModeRmFB,
+	.atomic_alloc = drmModeAtomicAlloc,
+	.atomic_free = drmModeAtomicFree,
+	.atomic_add_property = drmModeAtomicAddProperty,
+	.atomic_commit = drmModeAtomicCommit,
+	.set_crtc = drmModeSetCrtc,
+	.page_flip = drmModePageFlip,
+	.set_cursor = drmModeSetCursor,
+	.move_cursor = drmModeMoveCursor,
+	.crtc_set_gamma = libdrm_crtc_set_gamma,
+	.connector_set_property = drmModeConnectorSetProperty,
+	.object_set_property = drmModeObjectSetProperty,
+	.crtc_get_sequence = drmCrtcGetSequence,
+	.handle_event = drmHandleEvent,
+	.create_lease = drmModeCreateLease,
+	.list_lessees = drmModeListLessees,
+	.revoke_lease = drmModeRevokeLease,
+};
@@ -17,11 +17,13 @@
 #include <wlr/interfaces/wlr_output.h>
 #include <wlr/render/wlr_renderer.h>
 #include <wlr/types/wlr_matrix.h>
+#include <wlr/types/wlr_output_layer.h>
 #include <wlr/util/box.h>
 #include <wlr/util/log.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 #include "backend/drm/cvt.h"
+#include "backend/drm/device.h"
 #include "backend/drm/drm.h"
 #include "backend/drm/iface.h"
 #include "backend/drm/util.h"
@@ -29,7 +31,14 @@
 #include "render/drm_format_set.h"
 #include "render/swapchain.h"
 #include "render/wlr_renderer.h"
+#include "types/wlr_output.h"
 #include "util/signal.h"
+#include "util/time.h"
+
+// Added in Linux 6.8
+#ifndef DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP
+#define DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP 0x15
+#endif
 
 static const uint32_t SUPPORTED_OUTPUT_STATE =
 	WLR_OUTPUT_STATE_BACKEND_OPTIONAL |
@@ -39,22 +48,25 @@ static const uint32_t SUPPORTED_OUTPUT_STATE =
 	WLR_OUTPUT_STATE_GAMMA_LUT;
 
 bool check_drm_features(struct wlr_drm_backend *drm) {
-	if (drmGetCap(drm->fd, DRM_CAP_CURSOR_WIDTH, &drm->cursor_width)) {
+	const struct wlr_drm_device_impl *impl = drm->dev_impl;
+
+	if (impl->get_cap(drm->fd, DRM_CAP_CURSOR_WIDTH, &drm->cursor_width)) {
 		drm->cursor_width = 64;
 	}
-	if (drmGetCap(drm->fd, DRM_CAP_CURSOR_HEIGHT, &drm->cursor_height)) {
+	if (impl->get_cap(drm->fd, DRM_CAP_CURSOR_HEIGHT, &drm->cursor_height)) {
 		drm->cursor_height = 64;
 	}
 
 	uint64_t cap;
-	if (drmGetCap(drm->fd, DRM_CAP_PRIME, &cap) ||
+	if (impl->get_cap(drm->fd, DRM_CAP_PRIME, &cap) ||
 			!(cap & DRM_PRIME_CAP_IMPORT)) {
 		wlr_log(WLR_ERROR, "PRIME import not supported");
 		return false;
 	}
 
 	if (drm->parent) {
-		if (drmGetCap(drm->parent->fd, DRM_CAP_PRIME, &cap) ||
+		if (drm->parent->dev_impl->get_cap(drm->parent->fd,
+				DRM_CAP_PRIME, &cap) ||
 				!(cap & DRM_PRIME_CAP_EXPORT)) {
 			wlr_log(WLR_ERROR,
 				"PRIME export not supported on primary GPU");
@@ -62,12 +74,12 @@ bool check_drm_features(struct wlr_drm_backend *drm) {
 		}
 	}
 
-	if (drmSetClientCap(drm->fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1)) {
+	if (impl->set_client_cap(drm->fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1)) {
 		wlr_log(WLR_ERROR, "DRM universal planes unsupported");
 		return false;
 	}
 
-	if (drmGetCap(drm->fd, DRM_CAP_CRTC_IN_VBLANK_EVENT, &cap) || !cap) {
+	if (impl->get_cap(drm->fd, DRM_CAP_CRTC_IN_VBLANK_EVENT, &cap) || !cap) {
 		wlr_log(WLR_ERROR, "DRM_CRTC_IN_VBLANK_EVENT unsupported");
 		return false;
 	}
@@ -77,7 +89,7 @@ bool check_drm_features(struct wlr_drm_backend *drm) {
 		wlr_log(WLR_DEBUG,
 			"WLR_DRM_NO_ATOMIC set, forcing legacy DRM interface");
 		drm->iface = &legacy_iface;
-	} else if (drmSetClientCap(drm->fd, DRM_CLIENT_CAP_ATOMIC, 1)) {
+	} else if (impl->set_client_cap(drm->fd, DRM_CLIENT_CAP_ATOMIC, 1)) {
 		wlr_log(WLR_DEBUG,
 			"Atomic modesetting unsupported, using legacy DRM interface");
 		drm->iface = &legacy_iface;
@@ -86,19 +98,27 @@ bool check_drm_features(struct wlr_drm_backend *drm) {
 		drm->iface = &atomic_iface;
 	}
 
-	int ret = drmGetCap(drm->fd, DRM_CAP_TIMESTAMP_MONOTONIC, &cap);
+	int ret = impl->get_cap(drm->fd, DRM_CAP_TIMESTAMP_MONOTONIC, &cap);
 	drm->clock = (ret == 0 && cap == 1) ? CLOCK_MONOTONIC : CLOCK_REALTIME;
 
 	const char *no_modifiers = getenv("WLR_DRM_NO_MODIFIERS");
 	if (no_modifiers != NULL && strcmp(no_modifiers, "1") == 0) {
 		wlr_log(WLR_DEBUG, "WLR_DRM_NO_MODIFIERS set, disabling modifiers");
 	} else {
-		ret = drmGetCap(drm->fd, DRM_CAP_ADDFB2_MODIFIERS, &cap);
+		ret = impl->get_cap(drm->fd, DRM_CAP_ADDFB2_MODIFIERS, &cap);
 		drm->addfb2_modifiers = ret == 0 && cap == 1;
 		wlr_log(WLR_DEBUG, "ADDFB2 modifiers %s",
 			drm->addfb2_modifiers ? "supported" : "unsupported");
 	}
 
+	// The legacy and atomic interfaces advertise async page-flips separately
+	uint64_t async_cap = drm->iface == &atomic_iface ?
+		DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP : DRM_CAP_ASYNC_PAGE_FLIP;
+	ret = impl->get_cap(drm->fd, async_cap, &cap);
+	drm->async_page_flip = ret == 0 && cap == 1;
+	wlr_log(WLR_DEBUG, "Async page-flips %s",
+		drm->async_page_flip ? "supported" : "unsupported");
+
 	return true;
 }
 
@@ -131,12 +151,13 @@ static bool add_plane(struct wlr_drm_backend *drm,
 
 	if (p->props.in_formats && drm->addfb2_modifiers) {
 		uint64_t blob_id;
-		if (!get_drm_prop(drm->fd, p->id, p->props.in_formats, &blob_id)) {
+		if (!get_drm_prop(drm, p->id, p->props.in_formats, &blob_id)) {
 			wlr_log(WLR_ERROR, "Failed to read IN_FORMATS property");
 			goto error;
 		}
 
-		drmModePropertyBlobRes *blob = drmModeGetPropertyBlob(drm->fd, blob_id);
+		drmModePropertyBlobRes *blob =
+			drm->dev_impl->get_property_blob(drm->fd, blob_id);
 		if (!blob) {
 			wlr_log(WLR_ERROR, "Failed to read IN_FORMATS blob");
 			goto error;
@@ -150,6 +171,12 @@ static bool add_plane(struct wlr_drm_backend *drm,
 		drmModeFreePropertyBlob(blob);
 	}
 
+	if (type != DRM_PLANE_TYPE_CURSOR && p->props.zpos != 0 &&
+			!get_drm_prop(drm, p->id, p->props.zpos, &p->zpos)) {
+		wlr_log(WLR_ERROR, "Failed to read zpos property");
+		goto error;
+	}
+
 	switch (type) {
 	case DRM_PLANE_TYPE_PRIMARY:
 		crtc->primary = p;
@@ -157,6 +184,16 @@ static bool add_plane(struct wlr_drm_backend *drm,
 	case DRM_PLANE_TYPE_CURSOR:
 		crtc->cursor = p;
 		break;
+	case DRM_PLANE_TYPE_OVERLAY:;
+		struct wlr_drm_plane **overlays = realloc(crtc->overlays,
+			(crtc->overlays_len + 1) * sizeof(*overlays));
+		if (overlays == NULL) {
+			wlr_log_errno(WLR_ERROR, "Allocation failed");
+			goto error;
+		}
+		crtc->overlays = overlays;
+		crtc->overlays[crtc->overlays_len++] = p;
+		break;
 	default:
 		abort();
 	}
@@ -164,12 +201,62 @@ static bool add_plane(struct wlr_drm_backend *drm,
 	return true;
 
 error:
+	wlr_drm_format_set_finish(&p->formats);
 	free(p);
 	return false;
 }
 
+static int cmp_overlay_zpos(const void *arg1, const void *arg2) {
+	const struct wlr_drm_plane *const *a = arg1;
+	const struct wlr_drm_plane *const *b = arg2;
+	if ((*a)->zpos != (*b)->zpos) {
+		return (*a)->zpos < (*b)->zpos ? -1 : 1;
+	}
+	return (*a)->id < (*b)->id ? -1 : (*a)->id > (*b)->id;
+}
+
+static bool plane_zpos_is_immutable(struct wlr_drm_backend *drm,
+		struct wlr_drm_plane *plane) {
+	drmModePropertyRes *prop =
+		drm->dev_impl->get_property(drm->fd, plane->props.zpos);
+	if (prop == NULL) {
+		return false;
+	}
+	bool immutable = prop->flags & DRM_MODE_PROP_IMMUTABLE;
+	drmModeFreeProperty(prop);
+	return immutable;
+}
+
+/**
+ * Drop the overlay planes which are stuck below the primary plane: layers
+ * are displayed above the primary buffer.
+ */
+static void crtc_drop_underlays(struct wlr_drm_backend *drm,
+		struct wlr_drm_crtc *crtc) {
+	struct wlr_drm_plane *primary = crtc->primary;
+	if (primary == NULL || primary->props.zpos == 0) {
+		return;
+	}
+
+	size_t len = 0;
+	for (size_t i = 0; i < crtc->overlays_len; i++) {
+		struct wlr_drm_plane *plane = crtc->overlays[i];
+		if (plane->props.zpos != 0 && plane->zpos <= primary->zpos &&
+				plane_zpos_is_immutable(drm, plane)) {
+			wlr_log(WLR_DEBUG, "Ignoring overlay plane %"PRIu32": "
+				"zpos %"PRIu64" isn't above the primary plane",
+				plane->id, plane->zpos);
+			wlr_drm_format_set_finish(&plane->formats);
+			free(plane);
+			continue;
+		}
+		crtc->overlays[len++] = plane;
+	}
+	crtc->overlays_len = len;
+}
+
 static bool init_planes(struct wlr_drm_backend *drm) {
-	drmModePlaneRes *plane_res = drmModeGetPlaneResources(drm->fd);
+	drmModePlaneRes *plane_res = drm->dev_impl->get_plane_resources(drm->fd);
 	if (!plane_res) {
 		wlr_log_errno(WLR_ERROR, "Failed to get DRM plane resources");
 		return false;
@@ -180,27 +267,27 @@ static bool init_planes(struct wlr_drm_backend *drm) {
 	for (uint32_t i = 0; i < plane_res->count_planes; ++i) {
 		uint32_t id = plane_res->planes[i];
 
-		drmModePlane *plane = drmModeGetPlane(drm->fd, id);
+		drmModePlane *plane = drm->dev_impl->get_plane(drm->fd, id);
 		if (!plane) {
 			wlr_log_errno(WLR_ERROR, "Failed to get DRM plane");
 			goto error;
 		}
 
 		union wlr_drm_plane_props props = {0};
-		if (!get_drm_plane_props(drm->fd, id, &props)) {
+		if (!get_drm_plane_props(drm, id, &props)) {
 			drmModeFreePlane(plane);
 			goto error;
 		}
 
 		uint64_t type;
-		if (!get_drm_prop(drm->fd, id, props.type, &type)) {
+		if (!get_drm_prop(drm, id, props.type, &type)) {
 			drmModeFreePlane(plane);
 			goto error;
 		}
 
-		// We don't really care about overlay planes, as we don't support them
-		// yet.
-		if (type == DRM_PLANE_TYPE_OVERLAY) {
+		// Overlay planes are only driven by the atomic interface, via output
+		// layers
+		if (type == DRM_PLANE_TYPE_OVERLAY && drm->iface != &atomic_iface) {
 			drmModeFreePlane(plane);
 			continue;
 		}
@@ -214,6 +301,16 @@ static bool init_planes(struct wlr_drm_backend *drm) {
 			}
 
 			struct wlr_drm_crtc *candidate = &drm->crtcs[j];
+			if (type == DRM_PLANE_TYPE_OVERLAY) {
+				// Overlay planes can often be used with several CRTCs. Hand
+				// each of them to a single CRTC, spreading them evenly, so
+				// that outputs never compete for a plane.
+				if (crtc == NULL ||
+						candidate->overlays_len < crtc->overlays_len) {
+					crtc = candidate;
+				}
+				continue;
+			}
 			if ((type == DRM_PLANE_TYPE_PRIMARY && !candidate->primary) ||
 					(type == DRM_PLANE_TYPE_CURSOR && !candidate->cursor)) {
 				crtc = candidate;
@@ -233,6 +330,17 @@ static bool init_planes(struct wlr_drm_backend *drm) {
 		drmModeFreePlane(plane);
 	}
 
+	for (size_t i = 0; i < drm->num_crtcs; i++) {
+		struct wlr_drm_crtc *crtc = &drm->crtcs[i];
+		crtc_drop_underlays(drm, crtc);
+		qsort(crtc->overlays, crtc->overlays_len, sizeof(crtc->overlays[0]),
+			cmp_overlay_zpos);
+		if (crtc->overlays_len > 0) {
+			wlr_log(WLR_DEBUG, "CRTC %"PRIu32" has %zu overlay planes",
+				crtc->id, crtc->overlays_len);
+		}
+	}
+
 	drmModeFreePlaneResources(plane_res);
 	return true;
 
@@ -242,7 +350,7 @@ error:
 }
 
 bool init_drm_resources(struct wlr_drm_backend *drm) {
-	drmModeRes *res = drmModeGetResources(drm->fd);
+	drmModeRes *res = drm->dev_impl->get_resources(drm->fd);
 	if (!res) {
 		wlr_log_errno(WLR_ERROR, "Failed to get DRM resources");
 		return false;
@@ -265,8 +373,8 @@ bool init_drm_resources(struct wlr_drm_backend *drm) {
 	for (size_t i = 0; i < drm->num_crtcs; ++i) {
 		struct wlr_drm_crtc *crtc = &drm->crtcs[i];
 		crtc->id = res->crtcs[i];
-		crtc->legacy_crtc = drmModeGetCrtc(drm->fd, crtc->id);
-		get_drm_crtc_props(drm->fd, crtc->id, &crtc->props);
+		crtc->legacy_crtc = drm->dev_impl->get_crtc(drm->fd, crtc->id);
+		get_drm_crtc_props(drm, crtc->id, &crtc->props);
 	}
 
 	if (!init_planes(drm)) {
@@ -294,12 +402,9 @@ void finish_drm_resources(struct wlr_drm_backend *drm) {
 
 		drmModeFreeCrtc(crtc->legacy_crtc);
 
-		if (crtc->mode_id) {
-			drmModeDestroyPropertyBlob(drm->fd, crtc->mode_id);
-		}
-		if (crtc->gamma_lut) {
-			drmModeDestroyPropertyBlob(drm->fd, crtc->gamma_lut);
-		}
+		drm_blob_unref(drm, crtc->mode_id);
+		drm_blob_unref(drm, crtc->gamma_lut);
+		drm_blob_unref(drm, crtc->ctm);
 
 		if (crtc->primary) {
 			wlr_drm_format_set_finish(&crtc->primary->formats);
@@ -309,8 +414,15 @@ void finish_drm_resources(struct wlr_drm_backend *drm) {
 			wlr_drm_format_set_finish(&crtc->cursor->formats);
 			free(crtc->cursor);
 		}
+		for (size_t j = 0; j < crtc->overlays_len; j++) {
+			wlr_drm_format_set_finish(&crtc->overlays[j]->formats);
+			free(crtc->overlays[j]);
+		}
+		free(crtc->overlays);
 	}
 
+	drm_blob_cache_finish(drm);
+
 	free(drm->crtcs);
 }
 
@@ -320,6 +432,39 @@ static struct wlr_drm_connector *get_drm_connector_from_output(
 	return (struct wlr_drm_connector *)wlr_output;
 }
 
+static bool drm_iface_commit(struct wlr_drm_connector *conn,
+		const struct wlr_drm_connector_state *state,
+		uint32_t flags, bool test_only) {
+	struct wlr_drm_backend *drm = conn->backend;
+	struct wlr_drm_backend_stats *stats = &drm->stats;
+	if (test_only) {
+		stats->tests++;
+		return drm->iface->crtc_commit(conn, state, flags, true);
+	}
+
+	struct timespec start, end, elapsed;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	bool ok = drm->iface->crtc_commit(conn, state, flags, false);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	timespec_sub(&elapsed, &end, &start);
+
+	stats->commits++;
+	if (state->modeset) {
+		stats->modesets++;
+	}
+	if (!ok) {
+		stats->failed_commits++;
+	}
+	stats->last_commit_ns = timespec_to_nsec(&elapsed);
+	stats->total_commit_ns += stats->last_commit_ns;
+	if (stats->last_commit_ns > stats->max_commit_ns) {
+		stats->max_commit_ns = stats->last_commit_ns;
+	}
+	return ok;
+}
+
+static bool drm_connector_layers_unchanged(struct wlr_drm_connector *conn);
+
 static bool drm_crtc_commit(struct wlr_drm_connector *conn,
 		const struct wlr_drm_connector_state *state,
 		uint32_t flags, bool test_only) {
@@ -331,14 +476,67 @@ static bool drm_crtc_commit(struct wlr_drm_connector *conn,
 
 	struct wlr_drm_backend *drm = conn->backend;
 	struct wlr_drm_crtc *crtc = conn->crtc;
-	bool ok = drm->iface->crtc_commit(conn, state, flags, test_only);
+	// Compositors test the same configuration over and over again (e.g. for
+	// direct scan-out), so remember the outcome of test commits
+	struct wlr_drm_test_key test_key;
+	bool ok;
+	if (test_only && drm_test_key_init(&test_key, conn, state, flags)) {
+		if (drm_test_cache_get(&drm->test_cache, &test_key, &ok)) {
+			drm->stats.test_cache_hits++;
+		} else {
+			ok = drm_iface_commit(conn, state, flags, true);
+			drm_test_cache_add(&drm->test_cache, &test_key, ok);
+		}
+	} else {
+		ok = drm_iface_commit(conn, state, flags, test_only);
+	}
+	if (!ok && !test_only && (flags & DRM_MODE_PAGE_FLIP_ASYNC)) {
+		// The kernel may refuse async page-flips depending on what changes,
+		// e.g. when planes other than the primary one are updated
+		wlr_drm_conn_log(conn, WLR_DEBUG,
+			"Async page-flip failed, falling back to a regular one");
+		flags &= ~DRM_MODE_PAGE_FLIP_ASYNC;
+		ok = drm_iface_commit(conn, state, flags, test_only);
+	}
+	if (ok && !test_only && (flags & DRM_MODE_PAGE_FLIP_EVENT)) {
+		conn->page_flip_async = flags & DRM_MODE_PAGE_FLIP_ASYNC;
+	}
+	if (ok && !test_only && state->modeset) {
+		// A modeset may change the resources available to other CRTCs
+		drm_test_cache_invalidate(&drm->test_cache);
+		// The vblank timings change with the mode
+		crtc->last_vblank_ns = 0;
+	}
+	bool layers = state->base->committed & WLR_OUTPUT_STATE_LAYERS;
 	if (ok && !test_only) {
+		if (layers && !drm_connector_layers_unchanged(conn)) {
+			drm->layers_seq++;
+		}
+		conn->cursor_committed = crtc->cursor != NULL && state->active &&
+			drm_connector_is_cursor_visible(conn);
+		// The commit carries the latest cursor position
+		conn->cursor_move_pending = false;
 		drm_fb_move(&crtc->primary->queued_fb, &crtc->primary->pending_fb);
 		if (crtc->cursor != NULL) {
 			drm_fb_move(&crtc->cursor->queued_fb, &crtc->cursor->pending_fb);
 		}
+		for (size_t i = 0; layers && i < crtc->overlays_len; i++) {
+			struct wlr_drm_plane *plane = crtc->overlays[i];
+			if (plane->pending_layer != NULL) {
+				plane->layer_src_box = plane->pending_layer->src_box;
+				plane->layer_dst_box = plane->pending_layer->dst_box;
+			}
+			drm_fb_move(&plane->queued_fb, &plane->pending_fb);
+			plane->layer_queued = true;
+			plane->pending_layer = NULL;
+		}
 	} else {
 		drm_fb_clear(&crtc->primary->pending_fb);
+		for (size_t i = 0; i < crtc->overlays_len; i++) {
+			struct wlr_drm_plane *plane = crtc->overlays[i];
+			drm_fb_clear(&plane->pending_fb);
+			plane->pending_layer = NULL;
+		}
 		// The set_cursor() hook is a bit special: it's not really synchronized
 		// to commit() or test(). Once set_cursor() returns true, the new
 		// cursor is effectively committed. So don't roll it back here, or we
@@ -366,7 +564,12 @@ static bool drm_crtc_page_flip(struct wlr_drm_connector *conn,
 
 	assert(state->active);
 	assert(plane_get_next_fb(crtc->primary));
-	if (!drm_crtc_commit(conn, state, DRM_MODE_PAGE_FLIP_EVENT, false)) {
+	uint32_t flags = DRM_MODE_PAGE_FLIP_EVENT;
+	if (state->present_mode == WLR_OUTPUT_PRESENT_MODE_IMMEDIATE &&
+			!state->modeset && conn->backend->async_page_flip) {
+		flags |= DRM_MODE_PAGE_FLIP_ASYNC;
+	}
+	if (!drm_crtc_commit(conn, state, flags, false)) {
 		return false;
 	}
 
@@ -388,6 +591,8 @@ static void drm_connector_state_init(struct wlr_drm_connector_state *state,
 		(WLR_OUTPUT_STATE_ENABLED | WLR_OUTPUT_STATE_MODE);
 	state->active = (base->committed & WLR_OUTPUT_STATE_ENABLED) ?
 		base->enabled : conn->output.enabled;
+	state->present_mode = (base->committed & WLR_OUTPUT_STATE_PRESENT_MODE) ?
+		base->present_mode : conn->output.present_mode;
 
 	if (base->committed & WLR_OUTPUT_STATE_MODE) {
 		switch (base->mode_type) {
@@ -439,7 +644,11 @@ static bool drm_connector_set_pending_fb(struct wlr_drm_connector *conn,
 			return false;
 		}
 
-		local_buf = drm_surface_blit(&plane->mgpu_surf, state->buffer);
+		const pixman_region32_t *damage = NULL;
+		if (state->committed & WLR_OUTPUT_STATE_DAMAGE) {
+			damage = &state->damage;
+		}
+		local_buf = drm_surface_blit(&plane->mgpu_surf, state->buffer, damage);
 		if (local_buf == NULL) {
 			return false;
 		}
@@ -459,6 +668,47 @@ static bool drm_connector_set_pending_fb(struct wlr_drm_connector *conn,
 	return true;
 }
 
+/**
+ * Assign an overlay plane to each accepted layer, from bottom to top. Layers
+ * which can't be assigned a plane are marked as rejected.
+ */
+static void drm_connector_set_pending_layers(struct wlr_drm_connector *conn,
+		const struct wlr_output_state *state) {
+	struct wlr_drm_backend *drm = conn->backend;
+	struct wlr_drm_crtc *crtc = conn->crtc;
+	assert(state->committed & WLR_OUTPUT_STATE_LAYERS);
+
+	size_t plane_index = 0;
+	for (size_t i = 0; i < state->layers_len; i++) {
+		struct wlr_output_layer_state *layer_state = &state->layers[i];
+		if (!layer_state->accepted) {
+			continue;
+		}
+		if (plane_index == crtc->overlays_len) {
+			layer_state->accepted = false;
+			continue;
+		}
+
+		struct wlr_drm_plane *plane = crtc->overlays[plane_index];
+		if (!drm_fb_import(&plane->pending_fb, drm, layer_state->buffer,
+				&plane->formats)) {
+			wlr_drm_conn_log(conn, WLR_DEBUG,
+				"Failed to import buffer for overlay plane %"PRIu32,
+				plane->id);
+			layer_state->accepted = false;
+			continue;
+		}
+		plane->pending_layer = layer_state;
+		plane_index++;
+	}
+
+	for (; plane_index < crtc->overlays_len; plane_index++) {
+		struct wlr_drm_plane *plane = crtc->overlays[plane_index];
+		drm_fb_clear(&plane->pending_fb);
+		plane->pending_layer = NULL;
+	}
+}
+
 static bool drm_connector_alloc_crtc(struct wlr_drm_connector *conn);
 
 static bool drm_connector_test(struct wlr_output *output) {
@@ -522,7 +772,54 @@ static bool drm_connector_test(struct wlr_output *output) {
 		}
 	}
 
-	return drm_crtc_commit(conn, &pending, 0, true);
+	if (!(output->pending.committed & WLR_OUTPUT_STATE_LAYERS)) {
+		return drm_crtc_commit(conn, &pending, 0, true);
+	}
+
+	// Tentatively accept all layers which have a buffer, then give up on
+	// the bottom-most one until the kernel is happy with the configuration.
+	// Rejected layers get composited into the primary plane, below all
+	// other layers: rejecting from the bottom preserves the stacking order.
+	size_t accepted_len = 0;
+	for (size_t i = 0; i < output->pending.layers_len; i++) {
+		struct wlr_output_layer_state *layer_state = &output->pending.layers[i];
+		layer_state->accepted = pending.active && layer_state->buffer != NULL;
+		if (layer_state->accepted) {
+			accepted_len++;
+		}
+	}
+
+	while (true) {
+		if (accepted_len > 0) {
+			drm_connector_set_pending_layers(conn, pending.base);
+		}
+		if (drm_crtc_commit(conn, &pending, 0, true)) {
+			return true;
+		}
+
+		// The primary plane FB is dropped after each test
+		if (output->pending.committed & WLR_OUTPUT_STATE_BUFFER) {
+			if (!drm_connector_set_pending_fb(conn, pending.base)) {
+				return false;
+			}
+		}
+
+		accepted_len = 0;
+		struct wlr_output_layer_state *bottom = NULL;
+		for (size_t i = 0; i < output->pending.layers_len; i++) {
+			if (output->pending.layers[i].accepted) {
+				if (bottom == NULL) {
+					bottom = &output->pending.layers[i];
+				}
+				accepted_len++;
+			}
+		}
+		if (bottom == NULL) {
+			return false;
+		}
+		bottom->accepted = false;
+		accepted_len--;
+	}
 }
 
 bool drm_connector_supports_vrr(struct wlr_drm_connector *conn) {
@@ -535,7 +832,7 @@ bool drm_connector_supports_vrr(struct wlr_drm_connector *conn) {
 
 	uint64_t vrr_capable;
 	if (conn->props.vrr_capable == 0 ||
-			!get_drm_prop(drm->fd, conn->id, conn->props.vrr_capable,
+			!get_drm_prop(drm, conn->id, conn->props.vrr_capable,
 			&vrr_capable) || !vrr_capable) {
 		wlr_drm_conn_log(conn, WLR_DEBUG, "Failed to enable adaptive sync: "
 			"connector doesn't support VRR");
@@ -554,6 +851,311 @@ bool drm_connector_supports_vrr(struct wlr_drm_connector *conn) {
 static bool drm_connector_set_mode(struct wlr_drm_connector *conn,
 	const struct wlr_drm_connector_state *state);
 
+static void drm_connector_discard_mailbox(struct wlr_drm_connector *conn) {
+	struct wlr_drm_plane *plane = conn->crtc->primary;
+	if (plane->mailbox_fb == NULL) {
+		return;
+	}
+
+	drm_fb_clear(&plane->mailbox_fb);
+
+	struct wlr_output_event_present present_event = {
+		.commit_seq = conn->mailbox_seq,
+		.presented = false,
+	};
+	wlr_output_send_present(&conn->output, &present_event);
+}
+
+static void drm_connector_clear_pending_layers(struct wlr_drm_connector *conn) {
+	struct wlr_drm_crtc *crtc = conn->crtc;
+	for (size_t i = 0; i < crtc->overlays_len; i++) {
+		struct wlr_drm_plane *plane = crtc->overlays[i];
+		drm_fb_clear(&plane->pending_fb);
+		plane->pending_layer = NULL;
+	}
+}
+
+static void drm_connector_queue_mailbox(struct wlr_drm_connector *conn) {
+	struct wlr_drm_plane *plane = conn->crtc->primary;
+	if (plane->mailbox_fb != NULL) {
+		drm_connector_discard_mailbox(conn);
+	} else {
+		// The pending page-flip is for the last committed frame
+		conn->page_flip_seq = conn->output.commit_seq;
+	}
+
+	drm_fb_move(&plane->mailbox_fb, &plane->pending_fb);
+	// We're called from wlr_output_commit(), before the sequence number is
+	// incremented
+	conn->mailbox_seq = conn->output.commit_seq + 1;
+}
+
+static void drm_connector_flip_mailbox(struct wlr_drm_connector *conn) {
+	struct wlr_drm_plane *plane = conn->crtc->primary;
+
+	// Only the primary buffer changes
+	struct wlr_output_state base = {0};
+	struct wlr_drm_connector_state pending = {0};
+	drm_connector_state_init(&pending, conn, &base);
+
+	drm_fb_move(&plane->pending_fb, &plane->mailbox_fb);
+	if (!drm_crtc_page_flip(conn, &pending)) {
+		struct wlr_output_event_present present_event = {
+			.commit_seq = conn->mailbox_seq,
+			.presented = false,
+		};
+		wlr_output_send_present(&conn->output, &present_event);
+	}
+}
+
+static void handle_mailbox_idle_frame(void *data) {
+	struct wlr_drm_connector *conn = data;
+	conn->mailbox_idle_frame = NULL;
+	if (conn->backend->session->active && conn->crtc != NULL) {
+		wlr_output_send_frame(&conn->output);
+	}
+}
+
+static void drm_connector_schedule_mailbox_frame(
+		struct wlr_drm_connector *conn) {
+	if (conn->mailbox_idle_frame != NULL) {
+		return;
+	}
+	// Let the compositor render the next frame without waiting for the
+	// page-flip to complete
+	struct wl_event_loop *ev = wl_display_get_event_loop(conn->backend->display);
+	conn->mailbox_idle_frame =
+		wl_event_loop_add_idle(ev, handle_mailbox_idle_frame, conn);
+}
+
+static int handle_frame_repeat_timer(void *data) {
+	struct wlr_drm_connector *conn = data;
+	if (!conn->backend->session->active || conn->crtc == NULL ||
+			conn->pending_page_flip_crtc ||
+			output_get_frame_repeat_period(&conn->output) == 0) {
+		return 0;
+	}
+	// The compositor is about to commit, don't get in its way
+	if (conn->output.pending.committed != 0) {
+		return 0;
+	}
+
+	struct wlr_drm_plane *plane = conn->crtc->primary;
+	if (plane->current_fb == NULL) {
+		return 0;
+	}
+
+	// Flip to the buffer currently displayed, cursor updates are picked up
+	// along the way
+	struct wlr_output_state base = {0};
+	struct wlr_drm_connector_state pending = {0};
+	drm_connector_state_init(&pending, conn, &base);
+	pending.present_mode = WLR_OUTPUT_PRESENT_MODE_VSYNC;
+
+	if (!drm_fb_import(&plane->pending_fb, conn->backend,
+			plane->current_fb->wlr_buf, &plane->formats)) {
+		return 0;
+	}
+	if (drm_crtc_page_flip(conn, &pending)) {
+		conn->page_flip_repeat = true;
+	}
+	return 0;
+}
+
+static void drm_connector_finish_deferred(struct wlr_drm_connector *conn) {
+	struct wlr_output_state *state = &conn->deferred_state;
+	free(state->gamma_lut);
+	free(state->ctm);
+	for (size_t i = 0; i < state->layers_len; i++) {
+		wlr_buffer_unlock(state->layers[i].buffer);
+	}
+	free(state->layers);
+	*state = (struct wlr_output_state){0};
+}
+
+/**
+ * Save the non-buffer state of a commit submitted while a frame is being
+ * repeated. The compositor isn't aware of repeats, so instead of failing,
+ * the commit is applied once the repeat completes. Newer state replaces the
+ * one deferred by previous commits.
+ */
+static bool drm_connector_defer_state(struct wlr_drm_connector *conn,
+		const struct wlr_output_state *base) {
+	struct wlr_output_state *state = &conn->deferred_state;
+
+	if (base->committed & WLR_OUTPUT_STATE_GAMMA_LUT) {
+		uint16_t *gamma_lut = NULL;
+		if (base->gamma_lut_size > 0) {
+			size_t size = 3 * base->gamma_lut_size * sizeof(uint16_t);
+			gamma_lut = malloc(size);
+			if (gamma_lut == NULL) {
+				wlr_log_errno(WLR_ERROR, "Allocation failed");
+				return false;
+			}
+			memcpy(gamma_lut, base->gamma_lut, size);
+		}
+		free(state->gamma_lut);
+		state->gamma_lut = gamma_lut;
+		state->gamma_lut_size = base->gamma_lut_size;
+	}
+
+	if (base->committed & WLR_OUTPUT_STATE_CTM) {
+		uint32_t *ctm = NULL;
+		if (base->ctm != NULL) {
+			ctm = malloc(18 * sizeof(uint32_t));
+			if (ctm == NULL) {
+				wlr_log_errno(WLR_ERROR, "Allocation failed");
+				return false;
+			}
+			memcpy(ctm, base->ctm, 18 * sizeof(uint32_t));
+		}
+		free(state->ctm);
+		state->ctm = ctm;
+	}
+
+	if (base->committed & WLR_OUTPUT_STATE_LAYERS) {
+		struct wlr_output_layer_state *layers = NULL;
+		if (base->layers_len > 0) {
+			layers = calloc(base->layers_len, sizeof(*layers));
+			if (layers == NULL) {
+				wlr_log_errno(WLR_ERROR, "Allocation failed");
+				return false;
+			}
+		}
+		for (size_t i = 0; i < base->layers_len; i++) {
+			// The layer itself may be destroyed in the meantime
+			layers[i] = base->layers[i];
+			layers[i].layer = NULL;
+			if (layers[i].buffer != NULL) {
+				wlr_buffer_lock(layers[i].buffer);
+			}
+		}
+		for (size_t i = 0; i < state->layers_len; i++) {
+			wlr_buffer_unlock(state->layers[i].buffer);
+		}
+		free(state->layers);
+		state->layers = layers;
+		state->layers_len = base->layers_len;
+		drm_connector_clear_pending_layers(conn);
+	}
+
+	if (base->committed & WLR_OUTPUT_STATE_ADAPTIVE_SYNC_ENABLED) {
+		state->adaptive_sync_enabled = base->adaptive_sync_enabled;
+	}
+
+	state->committed |= base->committed & (WLR_OUTPUT_STATE_GAMMA_LUT |
+		WLR_OUTPUT_STATE_CTM | WLR_OUTPUT_STATE_LAYERS |
+		WLR_OUTPUT_STATE_ADAPTIVE_SYNC_ENABLED);
+	return true;
+}
+
+/**
+ * Apply the state deferred behind a repeated frame, along with the buffer
+ * waiting in the mailbox if any.
+ */
+static void drm_connector_apply_deferred(struct wlr_drm_connector *conn) {
+	struct wlr_drm_plane *plane = conn->crtc->primary;
+	struct wlr_drm_connector_state pending = {0};
+	drm_connector_state_init(&pending, conn, &conn->deferred_state);
+
+	if (conn->deferred_state.committed & WLR_OUTPUT_STATE_LAYERS) {
+		drm_connector_set_pending_layers(conn, &conn->deferred_state);
+	}
+
+	bool ok;
+	if (plane->mailbox_fb != NULL) {
+		drm_fb_move(&plane->pending_fb, &plane->mailbox_fb);
+		ok = drm_crtc_page_flip(conn, &pending);
+		if (!ok) {
+			struct wlr_output_event_present present_event = {
+				.commit_seq = conn->mailbox_seq,
+				.presented = false,
+			};
+			wlr_output_send_present(&conn->output, &present_event);
+		}
+	} else {
+		ok = drm_crtc_commit(conn, &pending, 0, false);
+	}
+	if (!ok) {
+		wlr_drm_conn_log(conn, WLR_ERROR,
+			"Failed to apply state committed during a repeated frame");
+	}
+
+	drm_connector_finish_deferred(conn);
+}
+
+static void drm_connector_schedule_frame_repeat(
+		struct wlr_drm_connector *conn) {
+	int64_t period = output_get_frame_repeat_period(&conn->output);
+	if (period == 0) {
+		if (conn->frame_repeat_timer != NULL) {
+			wl_event_source_timer_update(conn->frame_repeat_timer, 0);
+		}
+		return;
+	}
+
+	if (conn->frame_repeat_timer == NULL) {
+		struct wl_event_loop *ev =
+			wl_display_get_event_loop(conn->backend->display);
+		conn->frame_repeat_timer =
+			wl_event_loop_add_timer(ev, handle_frame_repeat_timer, conn);
+		if (conn->frame_repeat_timer == NULL) {
+			wlr_drm_conn_log(conn, WLR_ERROR,
+				"Failed to create frame repeat timer");
+			return;
+		}
+	}
+
+	int ms = period / 1000000;
+	wl_event_source_timer_update(conn->frame_repeat_timer, ms > 0 ? ms : 1);
+}
+
+/**
+ * Check whether the pending layer update leaves all overlay planes as they
+ * were last committed.
+ */
+static bool drm_connector_layers_unchanged(struct wlr_drm_connector *conn) {
+	struct wlr_drm_crtc *crtc = conn->crtc;
+	for (size_t i = 0; i < crtc->overlays_len; i++) {
+		struct wlr_drm_plane *plane = crtc->overlays[i];
+		const struct wlr_output_layer_state *layer = plane->pending_layer;
+		struct wlr_drm_fb *fb =
+			plane->layer_queued ? plane->queued_fb : plane->current_fb;
+		if (layer == NULL) {
+			if (fb != NULL) {
+				return false;
+			}
+			continue;
+		}
+		if (plane->pending_fb != fb ||
+				memcmp(&layer->src_box, &plane->layer_src_box,
+					sizeof(layer->src_box)) != 0 ||
+				memcmp(&layer->dst_box, &plane->layer_dst_box,
+					sizeof(layer->dst_box)) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Check whether a commit only updates the primary buffer, and can replace the
+ * buffer waiting for a pending page-flip.
+ */
+static bool drm_connector_can_queue_commit(struct wlr_drm_connector *conn,
+		const struct wlr_output_state *base) {
+	uint32_t buffer_only = WLR_OUTPUT_STATE_BUFFER |
+		WLR_OUTPUT_STATE_DAMAGE | WLR_OUTPUT_STATE_PRESENT_MODE;
+	// Compositors may set the same layers on every commit
+	if (base->committed & WLR_OUTPUT_STATE_LAYERS) {
+		if (!drm_connector_layers_unchanged(conn)) {
+			return false;
+		}
+		buffer_only |= WLR_OUTPUT_STATE_LAYERS;
+	}
+	return (base->committed & ~buffer_only) == 0;
+}
+
 bool drm_connector_commit_state(struct wlr_drm_connector *conn,
 		const struct wlr_output_state *base) {
 	struct wlr_drm_backend *drm = conn->backend;
@@ -562,6 +1164,33 @@ bool drm_connector_commit_state(struct wlr_drm_connector *conn,
 		return false;
 	}
 
+	// A modeset waits for the repeated frame to complete: submit the state
+	// deferred behind it along with the modeset, unless it's overridden
+	struct wlr_output_state merged;
+	bool merge_deferred = conn->deferred_state.committed != 0 &&
+		(base->committed & (WLR_OUTPUT_STATE_ENABLED | WLR_OUTPUT_STATE_MODE));
+	if (merge_deferred) {
+		const struct wlr_output_state *deferred = &conn->deferred_state;
+		merged = *base;
+		uint32_t fields = deferred->committed & ~base->committed;
+		if (fields & WLR_OUTPUT_STATE_GAMMA_LUT) {
+			merged.gamma_lut = deferred->gamma_lut;
+			merged.gamma_lut_size = deferred->gamma_lut_size;
+		}
+		if (fields & WLR_OUTPUT_STATE_CTM) {
+			merged.ctm = deferred->ctm;
+		}
+		if (fields & WLR_OUTPUT_STATE_LAYERS) {
+			merged.layers = deferred->layers;
+			merged.layers_len = deferred->layers_len;
+		}
+		if (fields & WLR_OUTPUT_STATE_ADAPTIVE_SYNC_ENABLED) {
+			merged.adaptive_sync_enabled = deferred->adaptive_sync_enabled;
+		}
+		merged.committed |= fields;
+		base = &merged;
+	}
+
 	struct wlr_drm_connector_state pending = {0};
 	drm_connector_state_init(&pending, conn, base);
 
@@ -579,16 +1208,58 @@ bool drm_connector_commit_state(struct wlr_drm_connector *conn,
 		}
 	}
 
+	// Layers have been accepted or rejected by drm_connector_test()
+	if ((pending.base->committed & WLR_OUTPUT_STATE_LAYERS) &&
+			conn->crtc != NULL) {
+		drm_connector_set_pending_layers(conn, pending.base);
+	}
+
 	if (pending.modeset) {
+		if (conn->crtc != NULL) {
+			drm_connector_discard_mailbox(conn);
+		}
 		if (!drm_connector_set_mode(conn, &pending)) {
 			return false;
 		}
+		if (merge_deferred) {
+			drm_connector_finish_deferred(conn);
+		}
+	} else if (conn->page_flip_repeat && conn->pending_page_flip_crtc) {
+		// Buffers wait for the repeated frame in the mailbox, other state
+		// is deferred until it completes
+		bool can_queue = drm_connector_can_queue_commit(conn, pending.base);
+		if (!drm_connector_defer_state(conn, pending.base)) {
+			return false;
+		}
+		if (pending.base->committed & WLR_OUTPUT_STATE_BUFFER) {
+			drm_connector_clear_pending_layers(conn);
+			drm_connector_queue_mailbox(conn);
+			if (pending.present_mode == WLR_OUTPUT_PRESENT_MODE_MAILBOX &&
+					can_queue) {
+				drm_connector_schedule_mailbox_frame(conn);
+			}
+		}
 	} else if (pending.base->committed & WLR_OUTPUT_STATE_BUFFER) {
-		if (!drm_crtc_page_flip(conn, &pending)) {
+		bool mailbox =
+			pending.present_mode == WLR_OUTPUT_PRESENT_MODE_MAILBOX;
+		// With the mailbox present mode, buffer-only commits replace the
+		// buffer waiting for the pending page-flip to complete
+		bool can_queue = drm_connector_can_queue_commit(conn, pending.base);
+		if (mailbox && conn->pending_page_flip_crtc && can_queue) {
+			drm_connector_clear_pending_layers(conn);
+			drm_connector_queue_mailbox(conn);
+		} else if (!drm_crtc_page_flip(conn, &pending)) {
 			return false;
 		}
-	} else if (pending.base->committed & (WLR_OUTPUT_STATE_ADAPTIVE_SYNC_ENABLED |
-			WLR_OUTPUT_STATE_GAMMA_LUT | WLR_OUTPUT_STATE_CTM)) {
+		// Only invite the compositor to commit again before the page-flip
+		// completes if its next commit is likely to be queued as well
+		if (mailbox && can_queue) {
+			drm_connector_schedule_mailbox_frame(conn);
+		}
+	} else if ((pending.base->committed & (WLR_OUTPUT_STATE_ADAPTIVE_SYNC_ENABLED |
+			WLR_OUTPUT_STATE_GAMMA_LUT | WLR_OUTPUT_STATE_CTM)) ||
+			((pending.base->committed & WLR_OUTPUT_STATE_LAYERS) &&
+			conn->crtc != NULL)) {
 		assert(conn->crtc != NULL);
 		// TODO: maybe request a page-flip event here?
 		if (!drm_crtc_commit(conn, &pending, 0, false)) {
@@ -616,7 +1287,7 @@ size_t drm_crtc_get_gamma_lut_size(struct wlr_drm_backend *drm,
 	}
 
 	uint64_t gamma_lut_size;
-	if (!get_drm_prop(drm->fd, crtc->id, crtc->props.gamma_lut_size,
+	if (!get_drm_prop(drm, crtc->id, crtc->props.gamma_lut_size,
 			&gamma_lut_size)) {
 		wlr_log(WLR_ERROR, "Unable to get gamma lut size");
 		return 0;
@@ -770,6 +1441,14 @@ struct wlr_output_mode *wlr_drm_connector_add_mode(struct wlr_output *output,
 	return &mode->wlr_mode;
 }
 
+static void drm_connector_update_cursor_frame(struct wlr_output *output) {
+	// With adaptive sync, cursor updates are displayed with the next content
+	// or repeated frame, so that they don't bump the refresh rate
+	if (!output_defer_cursor_update(output)) {
+		wlr_output_update_needs_frame(output);
+	}
+}
+
 static bool drm_connector_set_cursor(struct wlr_output *output,
 		struct wlr_buffer *buffer, int hotspot_x, int hotspot_y) {
 	struct wlr_drm_connector *conn = get_drm_connector_from_output(output);
@@ -793,7 +1472,7 @@ static bool drm_connector_set_cursor(struct wlr_output *output,
 		conn->cursor_hotspot_x = hotspot_x;
 		conn->cursor_hotspot_y = hotspot_y;
 
-		wlr_output_update_needs_frame(output);
+		drm_connector_update_cursor_frame(output);
 	}
 
 	conn->cursor_enabled = false;
@@ -820,7 +1499,7 @@ static bool drm_connector_set_cursor(struct wlr_output *output,
 				return false;
 			}
 
-			local_buf = drm_surface_blit(&plane->mgpu_surf, buffer);
+			local_buf = drm_surface_blit(&plane->mgpu_surf, buffer, NULL);
 			if (local_buf == NULL) {
 				return false;
 			}
@@ -840,7 +1519,95 @@ static bool drm_connector_set_cursor(struct wlr_output *output,
 		conn->cursor_height = buffer->height;
 	}
 
-	wlr_output_update_needs_frame(output);
+	drm_connector_update_cursor_frame(output);
+	return true;
+}
+
+static bool drm_connector_get_next_vblank(struct wlr_output *output,
+	struct timespec *when);
+
+static bool drm_connector_can_move_cursor_fast(struct wlr_drm_connector *conn) {
+	// With atomic drivers, the legacy cursor ioctl is turned into an atomic
+	// commit which may block until the pending page-flip completes, unless
+	// the driver supports async plane updates. Only the legacy interface
+	// moves the cursor without a commit. Image and visibility changes always
+	// need a commit.
+	struct wlr_drm_crtc *crtc = conn->crtc;
+	return conn->backend->iface == &legacy_iface &&
+		conn->backend->session->active && crtc != NULL &&
+		crtc->cursor != NULL && crtc->cursor->pending_fb == NULL &&
+		conn->cursor_committed && drm_connector_is_cursor_visible(conn);
+}
+
+static bool drm_connector_apply_cursor_move(struct wlr_drm_connector *conn) {
+	struct wlr_drm_backend *drm = conn->backend;
+	if (drm->dev_impl->move_cursor(drm->fd, conn->crtc->id,
+			conn->cursor_x, conn->cursor_y) != 0) {
+		wlr_drm_conn_log_errno(conn, WLR_DEBUG, "drmModeMoveCursor failed");
+		return false;
+	}
+
+	struct timespec now;
+	clock_gettime(drm->clock, &now);
+	conn->cursor_move_ns = timespec_to_nsec(&now);
+	return true;
+}
+
+static int handle_cursor_move_timer(void *data) {
+	struct wlr_drm_connector *conn = data;
+	if (!conn->cursor_move_pending) {
+		return 0;
+	}
+	conn->cursor_move_pending = false;
+
+	if (!drm_connector_can_move_cursor_fast(conn) ||
+			!drm_connector_apply_cursor_move(conn)) {
+		wlr_output_update_needs_frame(&conn->output);
+	}
+	return 0;
+}
+
+/**
+ * Move the cursor without waiting for the next commit. Motion is coalesced
+ * so that the cursor plane is updated at most once per refresh cycle.
+ */
+static bool drm_connector_move_cursor_fast(struct wlr_drm_connector *conn) {
+	if (!drm_connector_can_move_cursor_fast(conn)) {
+		return false;
+	}
+	if (conn->cursor_move_pending) {
+		return true;
+	}
+
+	struct timespec next_vblank;
+	if (!drm_connector_get_next_vblank(&conn->output, &next_vblank)) {
+		return drm_connector_apply_cursor_move(conn);
+	}
+	struct wlr_drm_mode *mode =
+		(struct wlr_drm_mode *)conn->output.current_mode;
+	int64_t next_ns = timespec_to_nsec(&next_vblank);
+	int64_t prev_ns = next_ns - calculate_refresh_period(&mode->drm_mode);
+	if (conn->cursor_move_ns < prev_ns) {
+		return drm_connector_apply_cursor_move(conn);
+	}
+
+	// The cursor has already moved during this refresh cycle
+	if (conn->cursor_move_timer == NULL) {
+		struct wl_event_loop *ev =
+			wl_display_get_event_loop(conn->backend->display);
+		conn->cursor_move_timer =
+			wl_event_loop_add_timer(ev, handle_cursor_move_timer, conn);
+		if (conn->cursor_move_timer == NULL) {
+			return false;
+		}
+	}
+
+	struct timespec now;
+	clock_gettime(conn->backend->clock, &now);
+	int64_t delay_ns = next_ns - timespec_to_nsec(&now);
+	int ms = (delay_ns + 999999) / 1000000;
+	wl_event_source_timer_update(conn->cursor_move_timer, ms > 0 ? ms : 1);
+	conn->cursor_move_pending = true;
 	return true;
 }
 
@@ -870,7 +1637,10 @@ static bool drm_connector_move_cursor(struct wlr_output *output,
 	conn->cursor_x = box.x;
 	conn->cursor_y = box.y;
 
-	wlr_output_update_needs_frame(output);
+	if (output_defer_cursor_update(output) ||
+			!drm_connector_move_cursor_fast(conn)) {
+		drm_connector_update_cursor_frame(output);
+	}
 	return true;
 }
 
@@ -899,6 +1669,23 @@ static void drm_connector_destroy_output(struct wlr_output *output) {
 	conn->desired_enabled = false;
 	conn->possible_crtcs = 0;
 	conn->pending_page_flip_crtc = 0;
+	if (conn->mailbox_idle_frame != NULL) {
+		wl_event_source_remove(conn->mailbox_idle_frame);
+		conn->mailbox_idle_frame = NULL;
+	}
+	if (conn->frame_repeat_timer != NULL) {
+		wl_event_source_remove(conn->frame_repeat_timer);
+		conn->frame_repeat_timer = NULL;
+	}
+	conn->page_flip_repeat = false;
+	drm_connector_finish_deferred(conn);
+	if (conn->cursor_move_timer != NULL) {
+		wl_event_source_remove(conn->cursor_move_timer);
+		conn->cursor_move_timer = NULL;
+	}
+	conn->cursor_committed = false;
+	conn->cursor_move_pending = false;
+	conn->cursor_move_ns = 0;
 
 	struct wlr_drm_mode *mode, *mode_tmp;
 	wl_list_for_each_safe(mode, mode_tmp, &conn->output.modes, wlr_mode.link) {
@@ -909,6 +1696,56 @@ static void drm_connector_destroy_output(struct wlr_output *output) {
 	memset(&conn->output, 0, sizeof(struct wlr_output));
 }
 
+// Re-synchronize with the hardware if the last known vblank is older than this
+#define VBLANK_RESYNC_NSEC 1000000000
+
+static bool drm_connector_get_next_vblank(struct wlr_output *output,
+		struct timespec *when) {
+	struct wlr_drm_connector *conn = get_drm_connector_from_output(output);
+	struct wlr_drm_backend *drm = conn->backend;
+	struct wlr_drm_crtc *crtc = conn->crtc;
+	if (crtc == NULL || output->current_mode == NULL ||
+			!drm->session->active) {
+		return false;
+	}
+
+	struct wlr_drm_mode *mode = (struct wlr_drm_mode *)output->current_mode;
+	int64_t period = calculate_refresh_period(&mode->drm_mode);
+	if (period <= 0) {
+		return false;
+	}
+
+	struct timespec now;
+	clock_gettime(drm->clock, &now);
+	int64_t now_ns = timespec_to_nsec(&now);
+
+	// Page-flip events keep the last vblank time up-to-date. Idle outputs
+	// need to ask the kernel, since extrapolating from an old vblank
+	// accumulates errors. The kernel reports CLOCK_MONOTONIC timestamps.
+	if ((crtc->last_vblank_ns == 0 ||
+			now_ns - crtc->last_vblank_ns > VBLANK_RESYNC_NSEC) &&
+			drm->clock == CLOCK_MONOTONIC) {
+		uint64_t seq, ns;
+		if (drm->dev_impl->crtc_get_sequence(drm->fd, crtc->id,
+				&seq, &ns) == 0 && ns != 0) {
+			crtc->last_vblank_ns = (int64_t)ns;
+		} else {
+			wlr_drm_conn_log_errno(conn, WLR_DEBUG,
+				"drmCrtcGetSequence failed");
+		}
+	}
+	if (crtc->last_vblank_ns == 0) {
+		return false;
+	}
+
+	int64_t next_ns = crtc->last_vblank_ns + period;
+	if (next_ns <= now_ns) {
+		next_ns += ((now_ns - next_ns) / period + 1) * period;
+	}
+	timespec_from_nsec(when, next_ns);
+	return true;
+}
+
 static const struct wlr_drm_format_set *drm_connector_get_cursor_formats(
 		struct wlr_output *output, uint32_t buffer_caps) {
 	if (!(buffer_caps & WLR_BUFFER_CAP_DMABUF)) {
@@ -960,6 +1797,7 @@ static const struct wlr_output_impl output_impl = {
 	.get_cursor_formats = drm_connector_get_cursor_formats,
 	.get_cursor_size = drm_connector_get_cursor_size,
 	.get_primary_formats = drm_connector_get_primary_formats,
+	.get_next_vblank = drm_connector_get_next_vblank,
 };
 
 bool wlr_output_is_drm(struct wlr_output *output) {
@@ -978,7 +1816,7 @@ enum wl_output_transform wlr_drm_connector_get_panel_orientation(
 		return WL_OUTPUT_TRANSFORM_NORMAL;
 	}
 
-	char *orientation = get_drm_prop_enum(conn->backend->fd, conn->id,
+	char *orientation = get_drm_prop_enum(conn->backend, conn->id,
 		conn->props.panel_orientation);
 	if (orientation == NULL) {
 		return WL_OUTPUT_TRANSFORM_NORMAL;
@@ -1034,6 +1872,12 @@ static void dealloc_crtc(struct wlr_drm_connector *conn) {
 
 	drm_plane_finish_surface(conn->crtc->primary);
 	drm_plane_finish_surface(conn->crtc->cursor);
+	for (size_t i = 0; i < conn->crtc->overlays_len; i++) {
+		struct wlr_drm_plane *plane = conn->crtc->overlays[i];
+		drm_plane_finish_surface(plane);
+		plane->pending_layer = NULL;
+		plane->layer_queued = false;
+	}
 
 	conn->cursor_enabled = false;
 	conn->crtc = NULL;
@@ -1152,11 +1996,13 @@ static void realloc_crtcs(struct wlr_drm_backend *drm) {
 	}
 }
 
-static uint32_t get_possible_crtcs(int fd, const drmModeConnector *conn) {
+static uint32_t get_possible_crtcs(struct wlr_drm_backend *drm,
+		const drmModeConnector *conn) {
 	uint32_t possible_crtcs = 0;
 
 	for (int i = 0; i < conn->count_encoders; ++i) {
-		drmModeEncoder *enc = drmModeGetEncoder(fd, conn->encoders[i]);
+		drmModeEncoder *enc =
+			drm->dev_impl->get_encoder(drm->fd, conn->encoders[i]);
 		if (!enc) {
 			continue;
 		}
@@ -1171,8 +2017,40 @@ static uint32_t get_possible_crtcs(int fd, const drmModeConnector *conn) {
 
 static void disconnect_drm_connector(struct wlr_drm_connector *conn);
 
-void scan_drm_connectors(struct wlr_drm_backend *drm,
-		struct wlr_device_hotplug_event *event) {
+static bool has_conn_id(const uint32_t *conn_ids, size_t conn_ids_len,
+		uint32_t conn_id) {
+	for (size_t i = 0; i < conn_ids_len; i++) {
+		if (conn_ids[i] == conn_id) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static drmModeConnector *get_drm_connector(struct wlr_drm_backend *drm,
+		struct wlr_drm_connector *wlr_conn, uint32_t conn_id, bool probe) {
+	if (!probe && wlr_conn != NULL) {
+		// The kernel has already detected the connector status before sending
+		// the hotplug event. Probing is expensive (e.g. EDID reads over the
+		// AUX channel for each MST monitor), only do it if the status
+		// changed.
+		drmModeConnector *drm_conn =
+			drm->dev_impl->get_connector_current(drm->fd, conn_id);
+		if (drm_conn != NULL) {
+			bool connected = drm_conn->connection == DRM_MODE_CONNECTED;
+			bool was_connected =
+				wlr_conn->status != WLR_DRM_CONN_DISCONNECTED;
+			if (connected == was_connected) {
+				return drm_conn;
+			}
+			drmModeFreeConnector(drm_conn);
+		}
+	}
+	return drm->dev_impl->get_connector(drm->fd, conn_id);
+}
+
+void scan_drm_connectors(struct wlr_drm_backend *drm, bool probe,
+		const uint32_t *conn_ids, size_t conn_ids_len) {
 	/*
 	 * This GPU is not really a modesetting device.
 	 * It's just being used as a renderer.
@@ -1181,14 +2059,19 @@ void scan_drm_connectors(struct wlr_drm_backend *drm,
 		return;
 	}
 
-	if (event != NULL && event->connector_id != 0) {
-		wlr_log(WLR_INFO, "Scanning DRM connector %"PRIu32" on %s",
-			event->connector_id, drm->name);
+	// Hotplug and session changes may leave the device in a different state
+	drm_test_cache_invalidate(&drm->test_cache);
+
+	if (conn_ids != NULL) {
+		for (size_t i = 0; i < conn_ids_len; i++) {
+			wlr_log(WLR_INFO, "Scanning DRM connector %"PRIu32" on %s",
+				conn_ids[i], drm->name);
+		}
 	} else {
 		wlr_log(WLR_INFO, "Scanning DRM connectors on %s", drm->name);
 	}
 
-	drmModeRes *res = drmModeGetResources(drm->fd);
+	drmModeRes *res = drm->dev_impl->get_resources(drm->fd);
 	if (!res) {
 		wlr_log_errno(WLR_ERROR, "Failed to get DRM resources");
 		return;
@@ -1201,6 +2084,8 @@ void scan_drm_connectors(struct wlr_drm_backend *drm,
 	memset(seen, false, sizeof(seen));
 	size_t new_outputs_len = 0;
 	struct wlr_drm_connector *new_outputs[res->count_connectors + 1];
+	// Whether the CRTCs need to be re-allocated
+	bool changed = false;
 
 	for (int i = 0; i < res->count_connectors; ++i) {
 		uint32_t conn_id = res->connectors[i];
@@ -1215,22 +2100,24 @@ void scan_drm_connectors(struct wlr_drm_backend *drm,
 			}
 		}
 
-		// If the hotplug event contains a connector ID, ignore any other
+		// If the hotplug events contain connector IDs, ignore any other
 		// connector.
-		if (event != NULL && event->connector_id != 0 &&
-				event->connector_id != conn_id) {
+		if (conn_ids != NULL &&
+				!has_conn_id(conn_ids, conn_ids_len, conn_id)) {
 			if (wlr_conn != NULL) {
 				seen[index] = true;
 			}
 			continue;
 		}
 
-		drmModeConnector *drm_conn = drmModeGetConnector(drm->fd, conn_id);
+		// Connectors named by hotplug events always need to be probed
+		drmModeConnector *drm_conn = get_drm_connector(drm, wlr_conn,
+			conn_id, probe || conn_ids != NULL);
 		if (!drm_conn) {
 			wlr_log_errno(WLR_ERROR, "Failed to get DRM connector");
 			continue;
 		}
-		drmModeEncoder *curr_enc = drmModeGetEncoder(drm->fd,
+		drmModeEncoder *curr_enc = drm->dev_impl->get_encoder(drm->fd,
 			drm_conn->encoder_id);
 
 		if (!wlr_conn) {
@@ -1271,7 +2158,7 @@ void scan_drm_connectors(struct wlr_drm_backend *drm,
 		// connector properties yet
 		if (wlr_conn->props.link_status != 0) {
 			uint64_t link_status;
-			if (!get_drm_prop(drm->fd, wlr_conn->id,
+			if (!get_drm_prop(drm, wlr_conn->id,
 					wlr_conn->props.link_status, &link_status)) {
 				wlr_drm_conn_log(wlr_conn, WLR_ERROR,
 					"Failed to get link status prop");
@@ -1282,6 +2169,7 @@ void scan_drm_connectors(struct wlr_drm_backend *drm,
 				// We need to reload our list of modes and force a modeset
 				wlr_drm_conn_log(wlr_conn, WLR_INFO, "Bad link detected");
 				disconnect_drm_connector(wlr_conn);
+				changed = true;
 			}
 		}
 
@@ -1302,10 +2190,14 @@ void scan_drm_connectors(struct wlr_drm_backend *drm,
 				wlr_conn->output.phys_width, wlr_conn->output.phys_height);
 			wlr_conn->output.subpixel = subpixel_map[drm_conn->subpixel];
 
-			get_drm_connector_props(drm->fd, wlr_conn->id, &wlr_conn->props);
+			// Property IDs don't change during the lifetime of a connector
+			if (!wlr_conn->props_scanned) {
+				wlr_conn->props_scanned = get_drm_connector_props(drm,
+					wlr_conn->id, &wlr_conn->props);
+			}
 
 			uint64_t non_desktop;
-			if (get_drm_prop(drm->fd, wlr_conn->id,
+			if (get_drm_prop(drm, wlr_conn->id,
 						wlr_conn->props.non_desktop, &non_desktop)) {
 				if (non_desktop == 1) {
 					wlr_log(WLR_INFO, "Non-desktop connector");
@@ -1314,14 +2206,14 @@ void scan_drm_connectors(struct wlr_drm_backend *drm,
 			}
 
 			size_t edid_len = 0;
-			uint8_t *edid = get_drm_prop_blob(drm->fd,
+			uint8_t *edid = get_drm_prop_blob(drm,
 				wlr_conn->id, wlr_conn->props.edid, &edid_len);
 			parse_edid(&wlr_conn->output, edid_len, edid);
 			free(edid);
 
 			char *subconnector = NULL;
 			if (wlr_conn->props.subconnector) {
-				subconnector = get_drm_prop_enum(drm->fd,
+				subconnector = get_drm_prop_enum(drm,
 					wlr_conn->id, wlr_conn->props.subconnector);
 			}
 			if (subconnector && strcmp(subconnector, "Native") == 0) {
@@ -1368,7 +2260,7 @@ void scan_drm_connectors(struct wlr_drm_backend *drm,
 				wl_list_insert(wlr_conn->output.modes.prev, &mode->wlr_mode.link);
 			}
 
-			wlr_conn->possible_crtcs = get_possible_crtcs(drm->fd, drm_conn);
+			wlr_conn->possible_crtcs = get_possible_crtcs(drm, drm_conn);
 			if (wlr_conn->possible_crtcs == 0) {
 				wlr_drm_conn_log(wlr_conn, WLR_ERROR, "No CRTC possible");
 			}
@@ -1380,11 +2272,13 @@ void scan_drm_connectors(struct wlr_drm_backend *drm,
 
 			wlr_conn->status = WLR_DRM_CONN_NEEDS_MODESET;
 			new_outputs[new_outputs_len++] = wlr_conn;
+			changed = true;
 		} else if ((wlr_conn->status == WLR_DRM_CONN_CONNECTED ||
 				wlr_conn->status == WLR_DRM_CONN_NEEDS_MODESET) &&
 				drm_conn->connection != DRM_MODE_CONNECTED) {
 			wlr_log(WLR_INFO, "'%s' disconnected", wlr_conn->name);
 			disconnect_drm_connector(wlr_conn);
+			changed = true;
 		}
 
 		drmModeFreeEncoder(curr_enc);
@@ -1405,9 +2299,13 @@ void scan_drm_connectors(struct wlr_drm_backend *drm,
 
 		wlr_log(WLR_INFO, "'%s' disappeared", conn->name);
 		destroy_drm_connector(conn);
+		changed = true;
 	}
 
-	realloc_crtcs(drm);
+	// Bursts of hotplug events often don't change anything
+	if (changed) {
+		realloc_crtcs(drm);
+	}
 
 	for (size_t i = 0; i < new_outputs_len; ++i) {
 		struct wlr_drm_connector *conn = new_outputs[i];
@@ -1419,7 +2317,7 @@ void scan_drm_connectors(struct wlr_drm_backend *drm,
 }
 
 void scan_drm_leases(struct wlr_drm_backend *drm) {
-	drmModeLesseeListRes *list = drmModeListLessees(drm->fd);
+	drmModeLesseeListRes *list = drm->dev_impl->list_lessees(drm->fd);
 	if (list == NULL) {
 		wlr_log_errno(WLR_ERROR, "drmModeListLessees failed");
 		return;
@@ -1470,6 +2368,11 @@ static void handle_page_flip(int fd, unsigned seq,
 	}
 
 	conn->pending_page_flip_crtc = 0;
+	drm->stats.page_flip_events++;
+
+	// Repeated frames don't correspond to any commit
+	bool repeat = conn->page_flip_repeat;
+	conn->page_flip_repeat = false;
 
 	if (conn->status != WLR_DRM_CONN_CONNECTED || conn->crtc == NULL) {
 		wlr_drm_conn_log(conn, WLR_DEBUG,
@@ -1485,9 +2388,19 @@ static void handle_page_flip(int fd, unsigned seq,
 		drm_fb_move(&conn->crtc->cursor->current_fb,
 			&conn->crtc->cursor->queued_fb);
 	}
+	for (size_t i = 0; i < conn->crtc->overlays_len; i++) {
+		struct wlr_drm_plane *overlay = conn->crtc->overlays[i];
+		if (overlay->layer_queued) {
+			drm_fb_move(&overlay->current_fb, &overlay->queued_fb);
+			overlay->layer_queued = false;
+		}
+	}
 
-	uint32_t present_flags = WLR_OUTPUT_PRESENT_VSYNC |
+	uint32_t present_flags =
 		WLR_OUTPUT_PRESENT_HW_CLOCK | WLR_OUTPUT_PRESENT_HW_COMPLETION;
+	if (!conn->page_flip_async) {
+		present_flags |= WLR_OUTPUT_PRESENT_VSYNC;
+	}
 	/* Don't report ZERO_COPY in multi-gpu situations, because we had to copy
 	 * data between the GPUs, even if we were using the direct scanout
 	 * interface.
@@ -1501,19 +2414,40 @@ static void handle_page_flip(int fd, unsigned seq,
 		.tv_sec = tv_sec,
 		.tv_nsec = tv_usec * 1000,
 	};
+	// Async page-flips don't complete on a vblank
+	if (!conn->page_flip_async) {
+		conn->crtc->last_vblank_ns = timespec_to_nsec(&present_time);
+	}
 	struct wlr_output_event_present present_event = {
 		/* The DRM backend guarantees that the presentation event will be for
-		 * the last submitted frame. */
-		.commit_seq = conn->output.commit_seq,
+		 * the last submitted frame, unless a mailbox buffer is waiting. */
+		.commit_seq = plane->mailbox_fb != NULL ?
+			conn->page_flip_seq : conn->output.commit_seq,
 		.presented = true,
 		.when = &present_time,
 		.seq = seq,
 		.refresh = mhz_to_nsec(conn->output.refresh),
 		.flags = present_flags,
 	};
-	wlr_output_send_present(&conn->output, &present_event);
+	if (!repeat) {
+		wlr_output_send_present(&conn->output, &present_event);
+	}
 
 	if (drm->session->active) {
+		if (conn->deferred_state.committed != 0) {
+			drm_connector_apply_deferred(conn);
+		} else if (plane->mailbox_fb != NULL) {
+			drm_connector_flip_mailbox(conn);
+		}
+	}
+
+	drm_connector_schedule_frame_repeat(conn);
+
+	// Without the mailbox present mode, a buffer committed while a frame was
+	// being repeated has just been flipped: wait for it
+	bool flip_pending = conn->pending_page_flip_crtc != 0 &&
+		conn->output.present_mode != WLR_OUTPUT_PRESENT_MODE_MAILBOX;
+	if (drm->session->active && !flip_pending) {
 		wlr_output_send_frame(&conn->output);
 	}
 }
@@ -1526,7 +2460,7 @@ int handle_drm_event(int fd, uint32_t mask, void *data) {
 		.page_flip_handler2 = handle_page_flip,
 	};
 
-	if (drmHandleEvent(fd, &event) != 0) {
+	if (drm->dev_impl->handle_event(fd, &event) != 0) {
 		wlr_log(WLR_ERROR, "drmHandleEvent failed");
 		wl_display_terminate(drm->display);
 	}
@@ -1556,7 +2490,7 @@ int wlr_drm_backend_get_non_master_fd(struct wlr_backend *backend) {
 	assert(backend);
 
 	struct wlr_drm_backend *drm = get_drm_backend_from_backend(backend);
-	char *path = drmGetDeviceNameFromFd2(drm->fd);
+	char *path = drm->dev_impl->get_device_name_from_fd2(drm->fd);
 	if (!path) {
 		wlr_log(WLR_ERROR, "Failed to get device name from DRM fd");
 		return -1;
@@ -1632,7 +2566,7 @@ struct wlr_drm_lease *wlr_drm_create_lease(struct wlr_output **outputs,
 	wl_signal_init(&lease->events.destroy);
 
 	wlr_log(WLR_DEBUG, "Issuing DRM lease with %d objects", n_objects);
-	int lease_fd = drmModeCreateLease(drm->fd, objects, n_objects, 0,
+	int lease_fd = drm->dev_impl->create_lease(drm->fd, objects, n_objects, 0,
 			&lease->lessee_id);
 	if (lease_fd < 0) {
 		free(lease);
@@ -1655,7 +2589,7 @@ void wlr_drm_lease_terminate(struct wlr_drm_lease *lease) {
 	struct wlr_drm_backend *drm = lease->backend;
 
 	wlr_log(WLR_DEBUG, "Terminating DRM lease %d", lease->lessee_id);
-	int ret = drmModeRevokeLease(drm->fd, lease->lessee_id);
+	int ret = drm->dev_impl->revoke_lease(drm->fd, lease->lessee_id);
 	if (ret < 0) {
 		wlr_log_errno(WLR_ERROR, "Failed to terminate lease");
 	}
@@ -94,14 +94,14 @@ static bool legacy_crtc_commit(struct wlr_drm_connector *conn,
 		}
 
 		uint32_t dpms = state->active ? DRM_MODE_DPMS_ON : DRM_MODE_DPMS_OFF;
-		if (drmModeConnectorSetProperty(drm->fd, conn->id, conn->props.dpms,
-				dpms) != 0) {
+		if (drm->dev_impl->connector_set_property(drm->fd, conn->id,
+				conn->props.dpms, dpms) != 0) {
 			wlr_drm_conn_log_errno(conn, WLR_ERROR,
 				"Failed to set DPMS property");
 			return false;
 		}
 
-		if (drmModeSetCrtc(drm->fd, crtc->id, fb_id, 0, 0,
+		if (drm->dev_impl->set_crtc(drm->fd, crtc->id, fb_id, 0, 0,
 				conns, conns_len, mode)) {
 			wlr_drm_conn_log_errno(conn, WLR_ERROR, "Failed to set CRTC");
 			return false;
@@ -117,8 +117,8 @@ static bool legacy_crtc_commit(struct wlr_drm_connector *conn,
 
 	if ((state->base->committed & WLR_OUTPUT_STATE_ADAPTIVE_SYNC_ENABLED) &&
 			drm_connector_supports_vrr(conn)) {
-		if (drmModeObjectSetProperty(drm->fd, crtc->id, DRM_MODE_OBJECT_CRTC,
-				crtc->props.vrr_enabled,
+		if (drm->dev_impl->object_set_property(drm->fd, crtc->id,
+				DRM_MODE_OBJECT_CRTC, crtc->props.vrr_enabled,
 				state->base->adaptive_sync_enabled) != 0) {
 			wlr_drm_conn_log_errno(conn, WLR_ERROR,
 				"drmModeObjectSetProperty(VRR_ENABLED) failed");
@@ -138,7 +138,7 @@ static bool legacy_crtc_commit(struct wlr_drm_connector *conn,
 			return false;
 		}
 
-		drmModeFB *drm_fb = drmModeGetFB(drm->fd, cursor_fb->id);
+		drmModeFB *drm_fb = drm->dev_impl->get_fb(drm->fd, cursor_fb->id);
 		if (drm_fb == NULL) {
 			wlr_drm_conn_log_errno(conn, WLR_DEBUG, "Failed to get cursor "
 				"BO handle: drmModeGetFB failed");
@@ -149,10 +149,10 @@ static bool legacy_crtc_commit(struct wlr_drm_connector *conn,
 		uint32_t cursor_height = drm_fb->height;
 		drmModeFreeFB(drm_fb);
 
-		int ret = drmModeSetCursor(drm->fd, crtc->id, cursor_handle,
+		int ret = drm->dev_impl->set_cursor(drm->fd, crtc->id, cursor_handle,
 			cursor_width, cursor_height);
 		int set_cursor_errno = errno;
-		if (drmCloseBufferHandle(drm->fd, cursor_handle) != 0) {
+		if (drm->dev_impl->close_buffer_handle(drm->fd, cursor_handle) != 0) {
 			wlr_log_errno(WLR_ERROR, "drmCloseBufferHandle failed");
 		}
 		if (ret != 0) {
@@ -161,21 +161,20 @@ static bool legacy_crtc_commit(struct wlr_drm_connector *conn,
 			return false;
 		}
 
-		if (drmModeMoveCursor(drm->fd,
+		if (drm->dev_impl->move_cursor(drm->fd,
 			crtc->id, conn->cursor_x, conn->cursor_y) != 0) {
 			wlr_drm_conn_log_errno(conn, WLR_ERROR, "drmModeMoveCursor failed");
 			return false;
 		}
 	} else {
-		if (drmModeSetCursor(drm->fd, crtc->id, 0, 0, 0)) {
+		if (drm->dev_impl->set_cursor(drm->fd, crtc->id, 0, 0, 0)) {
 			wlr_drm_conn_log_errno(conn, WLR_DEBUG, "drmModeSetCursor failed");
 			return false;
 		}
 	}
 
 	if (flags & DRM_MODE_PAGE_FLIP_EVENT) {
-		if (drmModePageFlip(drm->fd, crtc->id, fb_id,
-				DRM_MODE_PAGE_FLIP_EVENT, drm)) {
+		if (drm->dev_impl->page_flip(drm->fd, crtc->id, fb_id, flags, drm)) {
 			wlr_drm_conn_log_errno(conn, WLR_ERROR, "drmModePageFlip failed");
 			return false;
 		}
@@ -215,7 +214,7 @@ bool drm_legacy_crtc_set_gamma(struct wlr_drm_backend *drm,
 	}
 
 	uint16_t *r = lut, *g = lut + size, *b = lut + 2 * size;
-	if (drmModeCrtcSetGamma(drm->fd, crtc->id, size, r, g, b) != 0) {
+	if (drm->dev_impl->crtc_set_gamma(drm->fd, crtc->id, size, r, g, b) != 0) {
 		wlr_log_errno(WLR_ERROR, "Failed to set gamma LUT on CRTC %"PRIu32,
 			crtc->id);
 		free(linear_lut);
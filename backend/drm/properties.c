@@ -6,6 +6,7 @@
 #include <wlr/util/log.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
+#include "backend/drm/drm.h"
 #include "backend/drm/properties.h"
 
 /*
@@ -59,6 +60,7 @@ static const struct prop_info plane_info[] = {
 	{ "SRC_Y", INDEX(src_y) },
 	{ "rotation", INDEX(rotation) },
 	{ "type", INDEX(type) },
+	{ "zpos", INDEX(zpos) },
 #undef INDEX
 };
 
@@ -69,16 +71,19 @@ static int cmp_prop_info(const void *arg1, const void *arg2) {
 	return strcmp(key, elem->name);
 }
 
-static bool scan_properties(int fd, uint32_t id, uint32_t type, uint32_t *result,
-		const struct prop_info *info, size_t info_len) {
-	drmModeObjectProperties *props = drmModeObjectGetProperties(fd, id, type);
+static bool scan_properties(struct wlr_drm_backend *drm, uint32_t id,
+		uint32_t type, uint32_t *result, const struct prop_info *info,
+		size_t info_len) {
+	drmModeObjectProperties *props =
+		drm->dev_impl->object_get_properties(drm->fd, id, type);
 	if (!props) {
 		wlr_log_errno(WLR_ERROR, "Failed to get DRM object properties");
 		return false;
 	}
 
 	for (uint32_t i = 0; i < props->count_props; ++i) {
-		drmModePropertyRes *prop = drmModeGetProperty(fd, props->props[i]);
+		drmModePropertyRes *prop =
+			drm->dev_impl->get_property(drm->fd, props->props[i]);
 		if (!prop) {
 			wlr_log_errno(WLR_ERROR, "Failed to get DRM object property");
 			continue;
@@ -97,25 +102,28 @@ static bool scan_properties(int fd, uint32_t id, uint32_t type, uint32_t *result
 	return true;
 }
 
-bool get_drm_connector_props(int fd, uint32_t id,
+bool get_drm_connector_props(struct wlr_drm_backend *drm, uint32_t id,
 		union wlr_drm_connector_props *out) {
-	return scan_properties(fd, id, DRM_MODE_OBJECT_CONNECTOR, out->props,
+	return scan_properties(drm, id, DRM_MODE_OBJECT_CONNECTOR, out->props,
 		connector_info, sizeof(connector_info) / sizeof(connector_info[0]));
 }
 
-bool get_drm_crtc_props(int fd, uint32_t id, union wlr_drm_crtc_props *out) {
-	return scan_properties(fd, id, DRM_MODE_OBJECT_CRTC, out->props,
+bool get_drm_crtc_props(struct wlr_drm_backend *drm, uint32_t id,
+		union wlr_drm_crtc_props *out) {
+	return scan_properties(drm, id, DRM_MODE_OBJECT_CRTC, out->props,
 		crtc_info, sizeof(crtc_info) / sizeof(crtc_info[0]));
 }
 
-bool get_drm_plane_props(int fd, uint32_t id, union wlr_drm_plane_props *out) {
-	return scan_properties(fd, id, DRM_MODE_OBJECT_PLANE, out->props,
+bool get_drm_plane_props(struct wlr_drm_backend *drm, uint32_t id,
+		union wlr_drm_plane_props *out) {
+	return scan_properties(drm, id, DRM_MODE_OBJECT_PLANE, out->props,
 		plane_info, sizeof(plane_info) / sizeof(plane_info[0]));
 }
 
-bool get_drm_prop(int fd, uint32_t obj, uint32_t prop, uint64_t *ret) {
-	drmModeObjectProperties *props =
-		drmModeObjectGetProperties(fd, obj, DRM_MODE_OBJECT_ANY);
+bool get_drm_prop(struct wlr_drm_backend *drm, uint32_t obj, uint32_t prop,
+		uint64_t *ret) {
+	drmModeObjectProperties *props = drm->dev_impl->object_get_properties(
+		drm->fd, obj, DRM_MODE_OBJECT_ANY);
 	if (!props) {
 		return false;
 	}
@@ -134,13 +142,15 @@ bool get_drm_prop(int fd, uint32_t obj, uint32_t prop, uint64_t *ret) {
 	return found;
 }
 
-void *get_drm_prop_blob(int fd, uint32_t obj, uint32_t prop, size_t *ret_len) {
+void *get_drm_prop_blob(struct wlr_drm_backend *drm, uint32_t obj,
+		uint32_t prop, size_t *ret_len) {
 	uint64_t blob_id;
-	if (!get_drm_prop(fd, obj, prop, &blob_id)) {
+	if (!get_drm_prop(drm, obj, prop, &blob_id)) {
 		return NULL;
 	}
 
-	drmModePropertyBlobRes *blob = drmModeGetPropertyBlob(fd, blob_id);
+	drmModePropertyBlobRes *blob =
+		drm->dev_impl->get_property_blob(drm->fd, blob_id);
 	if (!blob) {
 		return NULL;
 	}
@@ -158,13 +168,14 @@ void *get_drm_prop_blob(int fd, uint32_t obj, uint32_t prop, size_t *ret_len) {
 	return ptr;
 }
 
-char *get_drm_prop_enum(int fd, uint32_t obj, uint32_t prop_id) {
+char *get_drm_prop_enum(struct wlr_drm_backend *drm, uint32_t obj,
+		uint32_t prop_id) {
 	uint64_t value;
-	if (!get_drm_prop(fd, obj, prop_id, &value)) {
+	if (!get_drm_prop(drm, obj, prop_id, &value)) {
 		return NULL;
 	}
 
-	drmModePropertyRes *prop = drmModeGetProperty(fd, prop_id);
+	drmModePropertyRes *prop = drm->dev_impl->get_property(drm->fd, prop_id);
 	if (!prop) {
 		return NULL;
 	}
@@ -9,6 +9,7 @@
 #include <wayland-util.h>
 #include <wlr/render/wlr_renderer.h>
 #include <wlr/types/wlr_matrix.h>
+#include <wlr/util/box.h>
 #include <wlr/util/log.h>
 #include "backend/drm/drm.h"
 #include "backend/drm/util.h"
@@ -48,6 +49,19 @@ void finish_drm_renderer(struct wlr_drm_renderer *renderer) {
 	wlr_renderer_destroy(renderer->wlr_rend);
 }
 
+static void finish_drm_surface(struct wlr_drm_surface *surf) {
+	if (!surf || !surf->renderer) {
+		return;
+	}
+
+	wlr_swapchain_destroy(surf->swapchain);
+	for (size_t i = 0; i < WLR_DRM_SURFACE_DAMAGE_HISTORY_LEN; i++) {
+		pixman_region32_fini(&surf->damage_history[i]);
+	}
+
+	memset(surf, 0, sizeof(*surf));
+}
+
 bool init_drm_surface(struct wlr_drm_surface *surf,
 		struct wlr_drm_renderer *renderer, uint32_t width, uint32_t height,
 		const struct wlr_drm_format *drm_format) {
@@ -55,13 +69,12 @@ bool init_drm_surface(struct wlr_drm_surface *surf,
 		return true;
 	}
 
+	finish_drm_surface(surf);
+
 	surf->renderer = renderer;
 	surf->width = width;
 	surf->height = height;
 
-	wlr_swapchain_destroy(surf->swapchain);
-	surf->swapchain = NULL;
-
 	surf->swapchain = wlr_swapchain_create(renderer->allocator, width, height,
 			drm_format);
 	if (surf->swapchain == NULL) {
@@ -70,21 +83,59 @@ bool init_drm_surface(struct wlr_drm_surface *surf,
 		return false;
 	}
 
+	for (size_t i = 0; i < WLR_DRM_SURFACE_DAMAGE_HISTORY_LEN; i++) {
+		pixman_region32_init(&surf->damage_history[i]);
+	}
+
 	return true;
 }
 
-static void finish_drm_surface(struct wlr_drm_surface *surf) {
-	if (!surf || !surf->renderer) {
-		return;
+static void drm_surface_get_frame_damage(struct wlr_drm_surface *surf,
+		const pixman_region32_t *damage, pixman_region32_t *frame_damage) {
+	if (damage != NULL) {
+		pixman_region32_init(frame_damage);
+		pixman_region32_intersect_rect(frame_damage, damage,
+			0, 0, surf->width, surf->height);
+	} else {
+		pixman_region32_init_rect(frame_damage,
+			0, 0, surf->width, surf->height);
 	}
+}
 
-	wlr_swapchain_destroy(surf->swapchain);
+/**
+ * Compute the region of a swapchain buffer of the given age which needs to be
+ * copied.
+ */
+static void drm_surface_get_blit_damage(struct wlr_drm_surface *surf,
+		const pixman_region32_t *frame_damage, int age,
+		pixman_region32_t *out) {
+	if (age <= 0 || age > WLR_DRM_SURFACE_DAMAGE_HISTORY_LEN + 1) {
+		pixman_region32_union_rect(out, out, 0, 0, surf->width, surf->height);
+	} else {
+		pixman_region32_copy(out, frame_damage);
+		for (int i = 0; i < age - 1; i++) {
+			pixman_region32_union(out, out, &surf->damage_history[i]);
+		}
+	}
+}
 
-	memset(surf, 0, sizeof(*surf));
+/**
+ * Record the damage of a frame in the history. Takes ownership of
+ * frame_damage. Must only be called once the frame has been submitted, so
+ * that buffer ages match the history.
+ */
+static void drm_surface_push_damage(struct wlr_drm_surface *surf,
+		pixman_region32_t *frame_damage) {
+	pixman_region32_t *last =
+		&surf->damage_history[WLR_DRM_SURFACE_DAMAGE_HISTORY_LEN - 1];
+	pixman_region32_fini(last);
+	memmove(&surf->damage_history[1], &surf->damage_history[0],
+		(WLR_DRM_SURFACE_DAMAGE_HISTORY_LEN - 1) * sizeof(*last));
+	surf->damage_history[0] = *frame_damage;
 }
 
 struct wlr_buffer *drm_surface_blit(struct wlr_drm_surface *surf,
-		struct wlr_buffer *buffer) {
+		struct wlr_buffer *buffer, const pixman_region32_t *damage) {
 	struct wlr_renderer *renderer = surf->renderer->wlr_rend;
 
 	if (surf->width != (uint32_t)buffer->width ||
@@ -93,34 +144,63 @@ struct wlr_buffer *drm_surface_blit(struct wlr_drm_surface *surf,
 		return NULL;
 	}
 
+	// Renderers keep the import of a buffer around until the buffer is
+	// destroyed, so this is cheap for the primary GPU's swapchain buffers
 	struct wlr_texture *tex = wlr_texture_from_buffer(renderer, buffer);
 	if (tex == NULL) {
 		return NULL;
 	}
 
-	struct wlr_buffer *dst = wlr_swapchain_acquire(surf->swapchain, NULL);
+	int age;
+	struct wlr_buffer *dst = wlr_swapchain_acquire(surf->swapchain, &age);
 	if (!dst) {
 		wlr_texture_destroy(tex);
 		return NULL;
 	}
 
-	float mat[9];
-	wlr_matrix_identity(mat);
-	wlr_matrix_scale(mat, surf->width, surf->height);
-
-	if (!wlr_renderer_begin_with_buffer(renderer, dst)) {
-		wlr_buffer_unlock(dst);
-		wlr_texture_destroy(tex);
-		return NULL;
-	}
+	pixman_region32_t frame_damage, blit_damage;
+	drm_surface_get_frame_damage(surf, damage, &frame_damage);
+	pixman_region32_init(&blit_damage);
+	drm_surface_get_blit_damage(surf, &frame_damage, age, &blit_damage);
+
+	if (pixman_region32_not_empty(&blit_damage)) {
+		float mat[9];
+		wlr_matrix_identity(mat);
+		wlr_matrix_scale(mat, surf->width, surf->height);
+
+		if (!wlr_renderer_begin_with_buffer(renderer, dst)) {
+			pixman_region32_fini(&blit_damage);
+			pixman_region32_fini(&frame_damage);
+			wlr_buffer_unlock(dst);
+			wlr_texture_destroy(tex);
+			return NULL;
+		}
 
-	wlr_renderer_clear(renderer, (float[]){ 0.0, 0.0, 0.0, 0.0 });
-	wlr_render_texture_with_matrix(renderer, tex, mat, 1.0f);
+		int rects_len;
+		const pixman_box32_t *rects =
+			pixman_region32_rectangles(&blit_damage, &rects_len);
+		for (int i = 0; i < rects_len; i++) {
+			struct wlr_box box = {
+				.x = rects[i].x1,
+				.y = rects[i].y1,
+				.width = rects[i].x2 - rects[i].x1,
+				.height = rects[i].y2 - rects[i].y1,
+			};
+			wlr_renderer_scissor(renderer, &box);
+			wlr_renderer_clear(renderer, (float[]){ 0.0, 0.0, 0.0, 0.0 });
+			wlr_render_texture_with_matrix(renderer, tex, mat, 1.0f);
+		}
+		wlr_renderer_scissor(renderer, NULL);
 
-	wlr_renderer_end(renderer);
+		wlr_renderer_end(renderer);
+	}
+	pixman_region32_fini(&blit_damage);
 
 	wlr_texture_destroy(tex);
 
+	drm_surface_push_damage(surf, &frame_damage);
+	wlr_swapchain_set_buffer_submitted(surf->swapchain, dst);
+
 	return dst;
 }
 
@@ -133,6 +213,7 @@ void drm_plane_finish_surface(struct wlr_drm_plane *plane) {
 	drm_fb_clear(&plane->pending_fb);
 	drm_fb_clear(&plane->queued_fb);
 	drm_fb_clear(&plane->current_fb);
+	drm_fb_clear(&plane->mailbox_fb);
 
 	finish_drm_surface(&plane->mgpu_surf);
 }
@@ -214,9 +295,9 @@ static uint32_t get_fb_for_bo(struct wlr_drm_backend *drm,
 
 	uint32_t id = 0;
 	if (drm->addfb2_modifiers && dmabuf->modifier != DRM_FORMAT_MOD_INVALID) {
-		if (drmModeAddFB2WithModifiers(drm->fd, dmabuf->width, dmabuf->height,
-				dmabuf->format, handles, dmabuf->stride, dmabuf->offset,
-				modifiers, &id, DRM_MODE_FB_MODIFIERS) != 0) {
+		if (drm->dev_impl->add_fb2_with_modifiers(drm->fd, dmabuf->width,
+				dmabuf->height, dmabuf->format, handles, dmabuf->stride,
+				dmabuf->offset, modifiers, &id, DRM_MODE_FB_MODIFIERS) != 0) {
 			wlr_log_errno(WLR_DEBUG, "drmModeAddFB2WithModifiers failed");
 		}
 	} else {
@@ -227,8 +308,9 @@ static uint32_t get_fb_for_bo(struct wlr_drm_backend *drm,
 			return 0;
 		}
 
-		int ret = drmModeAddFB2(drm->fd, dmabuf->width, dmabuf->height,
-			dmabuf->format, handles, dmabuf->stride, dmabuf->offset, &id, 0);
+		int ret = drm->dev_impl->add_fb2(drm->fd, dmabuf->width,
+			dmabuf->height, dmabuf->format, handles, dmabuf->stride,
+			dmabuf->offset, &id, 0);
 		if (ret != 0 && dmabuf->format == DRM_FORMAT_ARGB8888 &&
 				dmabuf->n_planes == 1 && dmabuf->offset[0] == 0) {
 			// Some big-endian machines don't support drmModeAddFB2. Try a
@@ -239,8 +321,9 @@ static uint32_t get_fb_for_bo(struct wlr_drm_backend *drm,
 
 			uint32_t depth = 32;
 			uint32_t bpp = 32;
-			ret = drmModeAddFB(drm->fd, dmabuf->width, dmabuf->height, depth,
-				bpp, dmabuf->stride[0], handles[0], &id);
+			ret = drm->dev_impl->add_fb(drm->fd, dmabuf->width,
+				dmabuf->height, depth, bpp, dmabuf->stride[0], handles[0],
+				&id);
 			if (ret != 0) {
 				wlr_log_errno(WLR_DEBUG, "drmModeAddFB failed");
 			}
@@ -271,7 +354,7 @@ static void close_all_bo_handles(struct wlr_drm_backend *drm,
 			continue;
 		}
 
-		if (drmCloseBufferHandle(drm->fd, handles[i]) != 0) {
+		if (drm->dev_impl->close_buffer_handle(drm->fd, handles[i]) != 0) {
 			wlr_log_errno(WLR_ERROR, "drmCloseBufferHandle failed");
 		}
 	}
@@ -346,7 +429,8 @@ static struct wlr_drm_fb *drm_fb_create(struct wlr_drm_backend *drm,
 
 	uint32_t handles[4] = {0};
 	for (int i = 0; i < attribs.n_planes; ++i) {
-		int ret = drmPrimeFDToHandle(drm->fd, attribs.fd[i], &handles[i]);
+		int ret = drm->dev_impl->prime_fd_to_handle(drm->fd, attribs.fd[i],
+			&handles[i]);
 		if (ret != 0) {
 			wlr_log_errno(WLR_DEBUG, "drmPrimeFDToHandle failed");
 			goto error_bo_handle;
@@ -367,6 +451,7 @@ static struct wlr_drm_fb *drm_fb_create(struct wlr_drm_backend *drm,
 
 	wlr_addon_init(&fb->addon, &buf->addons, drm, &fb_addon_impl);
 	wl_list_insert(&drm->fbs, &fb->link);
+	drm->stats.fbs_created++;
 
 	return fb;
 
@@ -383,9 +468,11 @@ void drm_fb_destroy(struct wlr_drm_fb *fb) {
 	wl_list_remove(&fb->link);
 	wlr_addon_finish(&fb->addon);
 
-	if (drmModeRmFB(drm->fd, fb->id) != 0) {
+	drm_test_cache_forget_fb(&drm->test_cache, fb->id);
+	if (drm->dev_impl->rm_fb(drm->fd, fb->id) != 0) {
 		wlr_log(WLR_ERROR, "drmModeRmFB failed");
 	}
+	drm->stats.fbs_destroyed++;
 
 	free(fb);
 }
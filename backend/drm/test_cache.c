@@ -0,0 +1,135 @@
+#include <string.h>
+#include <wlr/types/wlr_output_layer.h>
+#include "backend/drm/drm.h"
+#include "backend/drm/iface.h"
+
+static void plane_key_init(struct wlr_drm_test_plane_key *key,
+		struct wlr_drm_fb *fb) {
+	if (fb == NULL) {
+		return;
+	}
+
+	key->enabled = true;
+	key->fb_id = fb->id;
+}
+
+static bool plane_key_uses_fb(const struct wlr_drm_test_plane_key *key,
+		uint32_t fb_id) {
+	return key->enabled && key->fb_id == fb_id;
+}
+
+static bool key_uses_fb(const struct wlr_drm_test_key *key, uint32_t fb_id) {
+	if (plane_key_uses_fb(&key->primary, fb_id) ||
+			plane_key_uses_fb(&key->cursor, fb_id)) {
+		return true;
+	}
+	for (size_t i = 0; i < WLR_DRM_TEST_MAX_OVERLAYS; i++) {
+		if (plane_key_uses_fb(&key->overlays[i], fb_id)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool drm_test_key_init(struct wlr_drm_test_key *key,
+		struct wlr_drm_connector *conn,
+		const struct wlr_drm_connector_state *state, uint32_t flags) {
+	struct wlr_drm_crtc *crtc = conn->crtc;
+	const struct wlr_output_state *base = state->base;
+
+	// Legacy tests don't hit the kernel
+	if (conn->backend->iface != &atomic_iface ||
+			crtc->overlays_len > WLR_DRM_TEST_MAX_OVERLAYS) {
+		return false;
+	}
+
+	memset(key, 0, sizeof(*key));
+	key->conn_id = conn->id;
+	key->crtc_id = crtc->id;
+	key->flags = flags;
+	key->committed = base->committed & (WLR_OUTPUT_STATE_ENABLED |
+		WLR_OUTPUT_STATE_MODE | WLR_OUTPUT_STATE_BUFFER |
+		WLR_OUTPUT_STATE_ADAPTIVE_SYNC_ENABLED | WLR_OUTPUT_STATE_GAMMA_LUT |
+		WLR_OUTPUT_STATE_CTM | WLR_OUTPUT_STATE_LAYERS);
+	key->modeset = state->modeset;
+	key->active = state->active;
+	if (!state->active) {
+		return true;
+	}
+
+	key->mode = state->mode;
+	if (base->committed & WLR_OUTPUT_STATE_ADAPTIVE_SYNC_ENABLED) {
+		key->adaptive_sync_enabled = base->adaptive_sync_enabled;
+	}
+	if (base->committed & WLR_OUTPUT_STATE_GAMMA_LUT) {
+		key->gamma_lut_size = base->gamma_lut_size;
+	}
+
+	plane_key_init(&key->primary, plane_get_next_fb(crtc->primary));
+	// The cursor position is left out on purpose: it changes all the time
+	// and doesn't affect the outcome of the test in practice
+	if (crtc->cursor != NULL && drm_connector_is_cursor_visible(conn)) {
+		plane_key_init(&key->cursor, plane_get_next_fb(crtc->cursor));
+	}
+
+	// Overlays in use on other CRTCs share the display engine's resources
+	key->layers_seq = conn->backend->layers_seq;
+	if (!(base->committed & WLR_OUTPUT_STATE_LAYERS)) {
+		return true;
+	}
+	for (size_t i = 0; i < crtc->overlays_len; i++) {
+		struct wlr_drm_plane *plane = crtc->overlays[i];
+		const struct wlr_output_layer_state *layer = plane->pending_layer;
+		if (layer == NULL) {
+			continue;
+		}
+
+		struct wlr_drm_test_plane_key *plane_key = &key->overlays[i];
+		plane_key_init(plane_key, plane->pending_fb);
+		plane_key->src_box = layer->src_box;
+		plane_key->dst_box = layer->dst_box;
+	}
+
+	return true;
+}
+
+bool drm_test_cache_get(const struct wlr_drm_test_cache *cache,
+		const struct wlr_drm_test_key *key, bool *result) {
+	for (size_t i = 0; i < cache->len; i++) {
+		if (memcmp(&cache->entries[i].key, key, sizeof(*key)) == 0) {
+			*result = cache->entries[i].result;
+			return true;
+		}
+	}
+	return false;
+}
+
+void drm_test_cache_add(struct wlr_drm_test_cache *cache,
+		const struct wlr_drm_test_key *key, bool result) {
+	size_t i = cache->next;
+	cache->entries[i].key = *key;
+	cache->entries[i].result = result;
+	cache->next = (i + 1) % WLR_DRM_TEST_CACHE_LEN;
+	if (cache->len < WLR_DRM_TEST_CACHE_LEN) {
+		cache->len++;
+	}
+}
+
+void drm_test_cache_invalidate(struct wlr_drm_test_cache *cache) {
+	cache->len = 0;
+	cache->next = 0;
+}
+
+void drm_test_cache_forget_fb(struct wlr_drm_test_cache *cache,
+		uint32_t fb_id) {
+	size_t len = 0;
+	for (size_t i = 0; i < cache->len; i++) {
+		if (!key_uses_fb(&cache->entries[i].key, fb_id)) {
+			cache->entries[len++] = cache->entries[i];
+		}
+	}
+	if (len != cache->len) {
+		cache->len = len;
+		cache->next = len;
+	}
+}
@@ -26,6 +26,25 @@ int32_t calculate_refresh_rate(const drmModeModeInfo *mode) {
 	return refresh;
 }
 
+int64_t calculate_refresh_period(const drmModeModeInfo *mode) {
+	int64_t period = (int64_t)mode->htotal * mode->vtotal * 1000000 /
+		mode->clock;
+
+	if (mode->flags & DRM_MODE_FLAG_INTERLACE) {
+		period /= 2;
+	}
+
+	if (mode->flags & DRM_MODE_FLAG_DBLSCAN) {
+		period *= 2;
+	}
+
+	if (mode->vscan > 1) {
+		period *= mode->vscan;
+	}
+
+	return period;
+}
+
 // Constructed from http://edid.tv/manufacturer
 static const char *get_manufacturer(uint16_t id) {
 #define ID(a, b, c) ((a & 0x1f) << 10) | ((b & 0x1f) << 5) | (c & 0x1f)
@@ -140,6 +159,20 @@ void parse_edid(struct wlr_output *restrict output, size_t len, const uint8_t *d
 			if (nl) {
 				*nl = '\0';
 			}
+		} else if (flag == 0 && data[i + 3] == 0xFD) {
+			// Display range limits, EDID 1.4 adds 255 Hz offsets
+			int min_hz = data[i + 5];
+			int max_hz = data[i + 6];
+			if (data[i + 4] & 0x02) {
+				max_hz += 255;
+				if (data[i + 4] & 0x01) {
+					min_hz += 255;
+				}
+			}
+			if (min_hz > 0 && min_hz < max_hz) {
+				output->adaptive_sync_min_refresh = min_hz * 1000;
+				output->adaptive_sync_max_refresh = max_hz * 1000;
+			}
 		}
 	}
 }
@@ -1,10 +1,14 @@
+#define _POSIX_C_SOURCE 200809L
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <time.h>
 #include <wlr/interfaces/wlr_output.h>
 #include <wlr/util/log.h>
 #include "backend/headless.h"
+#include "types/wlr_output.h"
 #include "util/signal.h"
+#include "util/time.h"
 
 static const uint32_t SUPPORTED_OUTPUT_STATE =
 	WLR_OUTPUT_STATE_BACKEND_OPTIONAL |
@@ -26,6 +30,17 @@ static bool output_set_custom_mode(struct wlr_headless_output *output,
 
 	output->frame_delay = 1000000 / refresh;
 
+	struct wlr_output *wlr_output = &output->wlr_output;
+	if (refresh > HEADLESS_ADAPTIVE_SYNC_MIN_REFRESH) {
+		wlr_output->adaptive_sync_min_refresh =
+			HEADLESS_ADAPTIVE_SYNC_MIN_REFRESH;
+		wlr_output->adaptive_sync_max_refresh = refresh;
+	} else {
+		wlr_output->adaptive_sync_min_refresh = 0;
+		wlr_output->adaptive_sync_max_refresh = 0;
+		wlr_output->adaptive_sync_status = WLR_OUTPUT_ADAPTIVE_SYNC_DISABLED;
+	}
+
 	wlr_output_update_custom_mode(&output->wlr_output, width, height, refresh);
 	return true;
 }
@@ -46,6 +61,62 @@ static bool output_test(struct wlr_output *wlr_output) {
 	return true;
 }
 
+static void handle_idle_frame(void *data) {
+	struct wlr_headless_output *output = data;
+	output->idle_frame = NULL;
+	wlr_output_send_frame(&output->wlr_output);
+}
+
+static void output_commit_buffer(struct wlr_headless_output *output) {
+	struct wlr_output *wlr_output = &output->wlr_output;
+	enum wlr_output_present_mode mode = wlr_output->present_mode;
+	if (wlr_output->pending.committed & WLR_OUTPUT_STATE_PRESENT_MODE) {
+		mode = wlr_output->pending.present_mode;
+	}
+
+	// We're called before the sequence number is incremented
+	uint32_t commit_seq = wlr_output->commit_seq + 1;
+
+	if (mode == WLR_OUTPUT_PRESENT_MODE_MAILBOX) {
+		// The buffer is displayed on the next simulated vblank, replacing any
+		// buffer still waiting for it
+		if (output->mailbox_pending) {
+			struct wlr_output_event_present present_event = {
+				.commit_seq = output->mailbox_seq,
+				.presented = false,
+			};
+			wlr_output_send_present(wlr_output, &present_event);
+		}
+		output->mailbox_pending = true;
+		output->mailbox_seq = commit_seq;
+	} else {
+		struct wlr_output_event_present present_event = {
+			.commit_seq = commit_seq,
+			.presented = true,
+		};
+		wlr_output_send_present(wlr_output, &present_event);
+
+		if (wlr_output->adaptive_sync_status ==
+				WLR_OUTPUT_ADAPTIVE_SYNC_ENABLED) {
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			output->last_frame_ns = timespec_to_nsec(&now);
+		}
+	}
+
+	if (mode == WLR_OUTPUT_PRESENT_MODE_VSYNC) {
+		return;
+	}
+
+	// Don't wait for the simulated vblank to let the compositor render the
+	// next frame
+	if (output->idle_frame == NULL) {
+		struct wl_event_loop *ev =
+			wl_display_get_event_loop(wlr_output->display);
+		output->idle_frame = wl_event_loop_add_idle(ev, handle_idle_frame, output);
+	}
+}
+
 static bool output_commit(struct wlr_output *wlr_output) {
 	struct wlr_headless_output *output =
 		headless_output_from_output(wlr_output);
@@ -63,14 +134,61 @@ static bool output_commit(struct wlr_output *wlr_output) {
 		}
 	}
 
+	if (wlr_output->pending.committed & WLR_OUTPUT_STATE_ADAPTIVE_SYNC_ENABLED) {
+		bool enabled = wlr_output->pending.adaptive_sync_enabled &&
+			wlr_output->adaptive_sync_min_refresh > 0;
+		wlr_output->adaptive_sync_status = enabled ?
+			WLR_OUTPUT_ADAPTIVE_SYNC_ENABLED : WLR_OUTPUT_ADAPTIVE_SYNC_DISABLED;
+	}
+
 	if (wlr_output->pending.committed & WLR_OUTPUT_STATE_BUFFER) {
-		struct wlr_output_event_present present_event = {
-			.commit_seq = wlr_output->commit_seq + 1,
-			.presented = true,
-		};
-		wlr_output_send_present(wlr_output, &present_event);
+		output_commit_buffer(output);
+	}
+
+	return true;
+}
+
+/**
+ * Get the longest interval between two simulated vblanks with adaptive sync,
+ * or zero if the display refreshes at a fixed rate.
+ */
+static int64_t output_get_max_vblank_period(
+		struct wlr_headless_output *output) {
+	struct wlr_output *wlr_output = &output->wlr_output;
+	if (wlr_output->adaptive_sync_status != WLR_OUTPUT_ADAPTIVE_SYNC_ENABLED) {
+		return 0;
+	}
+	int64_t period = output_get_frame_repeat_period(wlr_output);
+	if (period == 0) {
+		// Nothing to repeat: the display refreshes at its lowest rate
+		period = 1000000000000LL / wlr_output->adaptive_sync_min_refresh;
+	}
+	return period;
+}
+
+static bool output_get_next_vblank(struct wlr_output *wlr_output,
+		struct timespec *when) {
+	struct wlr_headless_output *output =
+		headless_output_from_output(wlr_output);
+	if (output->last_frame_ns == 0) {
+		return false;
 	}
 
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int64_t now_ns = timespec_to_nsec(&now);
+
+	// With adaptive sync, predict the latest time at which the display
+	// refreshes
+	int64_t period = output_get_max_vblank_period(output);
+	if (period == 0) {
+		period = (int64_t)output->frame_delay * 1000000;
+	}
+	int64_t next_ns = output->last_frame_ns + period;
+	if (next_ns <= now_ns) {
+		next_ns += ((now_ns - next_ns) / period + 1) * period;
+	}
+	timespec_from_nsec(when, next_ns);
 	return true;
 }
 
@@ -79,12 +197,16 @@ static void output_destroy(struct wlr_output *wlr_output) {
 		headless_output_from_output(wlr_output);
 	wl_list_remove(&output->link);
 	wl_event_source_remove(output->frame_timer);
+	if (output->idle_frame != NULL) {
+		wl_event_source_remove(output->idle_frame);
+	}
 	free(output);
 }
 
 static const struct wlr_output_impl output_impl = {
 	.destroy = output_destroy,
 	.commit = output_commit,
+	.get_next_vblank = output_get_next_vblank,
 };
 
 bool wlr_output_is_headless(struct wlr_output *wlr_output) {
@@ -93,6 +215,28 @@ bool wlr_output_is_headless(struct wlr_output *wlr_output) {
 
 static int signal_frame(void *data) {
 	struct wlr_headless_output *output = data;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int64_t now_ns = timespec_to_nsec(&now);
+
+	// With adaptive sync, the simulated display only refreshes on its own
+	// when no buffer has been committed in time
+	int64_t max_period = output_get_max_vblank_period(output);
+	if (max_period == 0 || output->mailbox_pending ||
+			now_ns - output->last_frame_ns >= max_period) {
+		output->last_frame_ns = now_ns;
+	}
+
+	if (output->mailbox_pending) {
+		output->mailbox_pending = false;
+		struct wlr_output_event_present present_event = {
+			.commit_seq = output->mailbox_seq,
+			.presented = true,
+			.flags = WLR_OUTPUT_PRESENT_VSYNC,
+		};
+		wlr_output_send_present(&output->wlr_output, &present_event);
+	}
 	wlr_output_send_frame(&output->wlr_output);
 	wl_event_source_timer_update(output->frame_timer, output->frame_delay);
 	return 0;
@@ -80,6 +80,11 @@ static void render_surface(struct wlr_surface *surface,
 	wlr_surface_send_frame_done(surface, rdata->when);
 }
 
+static void upload_surface(struct wlr_surface *surface,
+		int sx, int sy, void *data) {
+	wlr_surface_get_texture(surface);
+}
+
 static void output_handle_frame(struct wl_listener *listener, void *data) {
 	struct fullscreen_output *output =
 		wl_container_of(listener, output, frame);
@@ -90,6 +95,11 @@ static void output_handle_frame(struct wl_listener *listener, void *data) {
 	int width, height;
 	wlr_output_effective_resolution(output->wlr_output, &width, &height);
 
+	// Buffers can't be uploaded during the render pass
+	if (output->surface != NULL) {
+		wlr_surface_for_each_surface(output->surface, upload_surface, NULL);
+	}
+
 	if (!wlr_output_attach_render(output->wlr_output, NULL)) {
 		return;
 	}
@@ -0,0 +1,98 @@
+#ifndef BACKEND_DRM_DEVICE_H
+#define BACKEND_DRM_DEVICE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+struct wlr_device;
+struct wlr_session;
+
+/**
+ * Access to a KMS device. Each member mirrors the libdrm function of the same
+ * name, and follows its conventions for return values and errno.
+ *
+ * Objects returned by the getters are released with the matching
+ * drmModeFree*() function, so implementations must allocate them the way
+ * libdrm does.
+ *
+ * This is what the backend uses to talk to the kernel, so that it can be run
+ * against a fake device in tests.
+ */
+struct wlr_drm_device_impl {
+	// Release the device, see wlr_session_close_file()
+	void (*close)(struct wlr_session *session, struct wlr_device *dev);
+
+	char *(*get_device_name_from_fd2)(int fd);
+	drmVersion *(*get_version)(int fd);
+	int (*get_cap)(int fd, uint64_t cap, uint64_t *value);
+	int (*set_client_cap)(int fd, uint64_t cap, uint64_t value);
+
+	drmModeRes *(*get_resources)(int fd);
+	drmModeCrtc *(*get_crtc)(int fd, uint32_t crtc_id);
+	drmModeEncoder *(*get_encoder)(int fd, uint32_t encoder_id);
+	drmModeConnector *(*get_connector)(int fd, uint32_t connector_id);
+	drmModeConnector *(*get_connector_current)(int fd, uint32_t connector_id);
+	drmModePlaneRes *(*get_plane_resources)(int fd);
+	drmModePlane *(*get_plane)(int fd, uint32_t plane_id);
+	drmModeFB *(*get_fb)(int fd, uint32_t fb_id);
+
+	drmModeObjectProperties *(*object_get_properties)(int fd,
+		uint32_t obj_id, uint32_t obj_type);
+	drmModePropertyRes *(*get_property)(int fd, uint32_t prop_id);
+	drmModePropertyBlobRes *(*get_property_blob)(int fd, uint32_t blob_id);
+	int (*create_property_blob)(int fd, const void *data, size_t size,
+		uint32_t *blob_id);
+	int (*destroy_property_blob)(int fd, uint32_t blob_id);
+
+	int (*prime_fd_to_handle)(int fd, int prime_fd, uint32_t *handle);
+	int (*close_buffer_handle)(int fd, uint32_t handle);
+	int (*add_fb)(int fd, uint32_t width, uint32_t height, uint8_t depth,
+		uint8_t bpp, uint32_t pitch, uint32_t handle, uint32_t *fb_id);
+	int (*add_fb2)(int fd, uint32_t width, uint32_t height, uint32_t format,
+		const uint32_t handles[static 4], const uint32_t pitches[static 4],
+		const uint32_t offsets[static 4], uint32_t *fb_id, uint32_t flags);
+	int (*add_fb2_with_modifiers)(int fd, uint32_t width, uint32_t height,
+		uint32_t format, const uint32_t handles[static 4],
+		const uint32_t pitches[static 4], const uint32_t offsets[static 4],
+		const uint64_t modifiers[static 4], uint32_t *fb_id, uint32_t flags);
+	int (*rm_fb)(int fd, uint32_t fb_id);
+
+	drmModeAtomicReq *(*atomic_alloc)(void);
+	void (*atomic_free)(drmModeAtomicReq *req);
+	int (*atomic_add_property)(drmModeAtomicReq *req, uint32_t obj_id,
+		uint32_t prop_id, uint64_t value);
+	int (*atomic_commit)(int fd, drmModeAtomicReq *req, uint32_t flags,
+		void *user_data);
+
+	// Legacy interface
+	int (*set_crtc)(int fd, uint32_t crtc_id, uint32_t fb_id, uint32_t x,
+		uint32_t y, uint32_t *connectors, int connectors_len,
+		drmModeModeInfo *mode);
+	int (*page_flip)(int fd, uint32_t crtc_id, uint32_t fb_id, uint32_t flags,
+		void *user_data);
+	int (*set_cursor)(int fd, uint32_t crtc_id, uint32_t handle,
+		uint32_t width, uint32_t height);
+	int (*move_cursor)(int fd, uint32_t crtc_id, int x, int y);
+	int (*crtc_set_gamma)(int fd, uint32_t crtc_id, uint32_t size,
+		uint16_t *r, uint16_t *g, uint16_t *b);
+	int (*connector_set_property)(int fd, uint32_t connector_id,
+		uint32_t prop_id, uint64_t value);
+	int (*object_set_property)(int fd, uint32_t obj_id, uint32_t obj_type,
+		uint32_t prop_id, uint64_t value);
+
+	int (*crtc_get_sequence)(int fd, uint32_t crtc_id, uint64_t *seq,
+		uint64_t *ns);
+	int (*handle_event)(int fd, drmEventContext *event);
+
+	int (*create_lease)(int fd, const uint32_t *objects, int objects_len,
+		int flags, uint32_t *lessee_id);
+	drmModeLesseeListRes *(*list_lessees)(int fd);
+	int (*revoke_lease)(int fd, uint32_t lessee_id);
+};
+
+extern const struct wlr_drm_device_impl libdrm_device_impl;
+
+#endif
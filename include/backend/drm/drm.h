@@ -10,7 +10,9 @@
 #include <wlr/backend/drm.h>
 #include <wlr/backend/session.h>
 #include <wlr/render/drm_format_set.h>
+#include <wlr/util/box.h>
 #include <xf86drmMode.h>
+#include "backend/drm/device.h"
 #include "backend/drm/iface.h"
 #include "backend/drm/properties.h"
 #include "backend/drm/renderer.h"
@@ -28,10 +30,78 @@ struct wlr_drm_plane {
 	struct wlr_drm_fb *queued_fb;
 	/* Buffer currently displayed on screen */
 	struct wlr_drm_fb *current_fb;
+	/* Primary plane only, with the mailbox present mode: buffer to be
+	 * submitted once the queued buffer has been presented */
+	struct wlr_drm_fb *mailbox_fb;
 
 	struct wlr_drm_format_set formats;
 
 	union wlr_drm_plane_props props;
+
+	/* Primary and overlay planes only, zero if the zpos property is missing */
+	uint64_t zpos;
+	/* Output layer to be displayed on the next commit, NULL if disabled */
+	struct wlr_output_layer_state *pending_layer;
+	/* Whether queued_fb holds a layer update yet to be presented, which
+	 * may be a NULL FB if the plane has been disabled */
+	bool layer_queued;
+	/* Boxes of the last committed layer update, only valid if the plane is
+	 * enabled */
+	struct wlr_fbox layer_src_box;
+	struct wlr_box layer_dst_box;
+};
+
+/**
+ * A KMS property blob, shared between all users of the same contents.
+ */
+struct wlr_drm_blob {
+	uint32_t id;
+	size_t n_refs;
+	struct wl_list link; // wlr_drm_backend.blobs
+
+	uint32_t hash;
+	size_t size;
+	char data[];
+};
+
+#define WLR_DRM_TEST_CACHE_LEN 16
+#define WLR_DRM_TEST_MAX_OVERLAYS 4
+
+struct wlr_drm_test_plane_key {
+	bool enabled;
+	// FBs capture everything about a buffer which matters for scan-out
+	// (format, modifier, strides, offsets, memory placement)
+	uint32_t fb_id;
+	// Overlay planes only
+	struct wlr_fbox src_box;
+	struct wlr_box dst_box;
+};
+
+/**
+ * The parts of a connector state which may influence the outcome of an
+ * atomic test commit. Compared byte-wise, so needs to be zero-initialized.
+ */
+struct wlr_drm_test_key {
+	uint32_t conn_id, crtc_id;
+	uint32_t flags;
+	uint32_t committed;
+	bool modeset, active;
+	drmModeModeInfo mode;
+	bool adaptive_sync_enabled;
+	size_t gamma_lut_size;
+	// Overlay configuration generation of all CRTCs
+	uint32_t layers_seq;
+	struct wlr_drm_test_plane_key primary, cursor;
+	struct wlr_drm_test_plane_key overlays[WLR_DRM_TEST_MAX_OVERLAYS];
+};
+
+struct wlr_drm_test_cache {
+	struct {
+		struct wlr_drm_test_key key;
+		bool result;
+	} entries[WLR_DRM_TEST_CACHE_LEN];
+	size_t len;
+	size_t next; // entry to evict next
 };
 
 struct wlr_drm_crtc {
@@ -39,15 +109,22 @@ struct wlr_drm_crtc {
 	struct wlr_drm_lease *lease;
 
 	// Atomic modesetting only
-	uint32_t mode_id;
-	uint32_t gamma_lut;
-	uint32_t ctm;
+	struct wlr_drm_blob *mode_id;
+	struct wlr_drm_blob *gamma_lut;
+	struct wlr_drm_blob *ctm;
 
 	// Legacy only
 	drmModeCrtc *legacy_crtc;
 
 	struct wlr_drm_plane *primary;
 	struct wlr_drm_plane *cursor;
+	// Sorted by ascending zpos, only used with atomic modesetting
+	struct wlr_drm_plane **overlays;
+	size_t overlays_len;
+
+	// Time of the last known vblank in the backend clock domain, zero if
+	// unknown. Used to predict the next vblanks.
+	int64_t last_vblank_ns;
 
 	union wlr_drm_crtc_props props;
 };
@@ -56,9 +133,11 @@ struct wlr_drm_backend {
 	struct wlr_backend backend;
 
 	struct wlr_drm_backend *parent;
+	const struct wlr_drm_device_impl *dev_impl;
 	const struct wlr_drm_interface *iface;
 	clockid_t clock;
 	bool addfb2_modifiers;
+	bool async_page_flip;
 
 	int fd;
 	char *name;
@@ -77,7 +156,20 @@ struct wlr_drm_backend {
 	struct wl_listener dev_change;
 	struct wl_listener dev_remove;
 
+	// Hotplug events are coalesced and handled after a short delay
+	struct wl_event_source *hotplug_timer;
+	bool hotplug_pending;
+	bool hotplug_all; // some events didn't name a connector
+	struct wl_array hotplug_conn_ids; // uint32_t
+
 	struct wl_list fbs; // wlr_drm_fb.link
+	struct wl_list blobs; // wlr_drm_blob.link, most recently used first
+	// Results of previous test commits, see drm_crtc_commit()
+	struct wlr_drm_test_cache test_cache;
+	// Incremented each time the overlay planes configuration of any CRTC
+	// changes, since it may affect the outcome of tests on other CRTCs
+	uint32_t layers_seq;
+	struct wlr_drm_backend_stats stats;
 	struct wl_list outputs;
 
 	/* Only initialized on multi-GPU setups */
@@ -109,6 +201,7 @@ struct wlr_drm_connector_state {
 	bool modeset;
 	bool active;
 	drmModeModeInfo mode;
+	enum wlr_output_present_mode present_mode;
 };
 
 struct wlr_drm_connector {
@@ -125,11 +218,20 @@ struct wlr_drm_connector {
 	uint32_t possible_crtcs;
 
 	union wlr_drm_connector_props props;
+	bool props_scanned;
 
 	bool cursor_enabled;
 	int cursor_x, cursor_y;
 	int cursor_width, cursor_height;
 	int cursor_hotspot_x, cursor_hotspot_y;
+	/* Whether the last commit displayed the cursor plane */
+	bool cursor_committed;
+	/* Cursor moves bypassing commits are applied at most once per refresh
+	 * cycle: time of the last one, and whether a newer position waits for
+	 * the next vblank */
+	int64_t cursor_move_ns;
+	bool cursor_move_pending;
+	struct wl_event_source *cursor_move_timer;
 
 	struct wl_list link;
 
@@ -141,15 +243,44 @@ struct wlr_drm_connector {
 	 * they're sent.
 	 */
 	uint32_t pending_page_flip_crtc;
+	/* Whether the pending page-flip doesn't wait for the vblank */
+	bool page_flip_async;
+	/* Commit sequence number of the pending page-flip, only valid when a
+	 * mailbox buffer is waiting */
+	uint32_t page_flip_seq;
+	/* Commit sequence number of the primary plane's mailbox buffer */
+	uint32_t mailbox_seq;
+	struct wl_event_source *mailbox_idle_frame;
+	/* Adaptive sync: repeats the current frame when the compositor doesn't
+	 * commit a new one in time */
+	struct wl_event_source *frame_repeat_timer;
+	/* Whether the pending page-flip repeats the current frame */
+	bool page_flip_repeat;
+	/* State committed while a frame was being repeated, applied once the
+	 * repeat completes. The primary buffer waits in the mailbox. */
+	struct wlr_output_state deferred_state;
 };
 
+/**
+ * Create a DRM backend which accesses the device through dev_impl. The
+ * device is released with dev_impl->close() when the backend is destroyed.
+ */
+struct wlr_backend *drm_backend_create(struct wl_display *display,
+	struct wlr_session *session, struct wlr_device *dev,
+	struct wlr_backend *parent, const struct wlr_drm_device_impl *dev_impl);
 struct wlr_drm_backend *get_drm_backend_from_backend(
 	struct wlr_backend *wlr_backend);
 bool check_drm_features(struct wlr_drm_backend *drm);
 bool init_drm_resources(struct wlr_drm_backend *drm);
 void finish_drm_resources(struct wlr_drm_backend *drm);
-void scan_drm_connectors(struct wlr_drm_backend *state,
-	struct wlr_device_hotplug_event *event);
+/**
+ * Scan the connectors of the device. If conn_ids is non-NULL, only these
+ * connectors are probed and other connectors are left as is. Otherwise, all
+ * connectors are scanned: they are always probed if probe is true, and only
+ * if their status changed otherwise.
+ */
+void scan_drm_connectors(struct wlr_drm_backend *drm, bool probe,
+	const uint32_t *conn_ids, size_t conn_ids_len);
 void scan_drm_leases(struct wlr_drm_backend *drm);
 int handle_drm_event(int fd, uint32_t mask, void *data);
 void destroy_drm_connector(struct wlr_drm_connector *conn);
@@ -163,6 +294,43 @@ void drm_lease_destroy(struct wlr_drm_lease *lease);
 
 struct wlr_drm_fb *plane_get_next_fb(struct wlr_drm_plane *plane);
 
+/**
+ * Get a reference to a property blob with the specified contents. Blobs are
+ * cached by contents, so the same blob is returned for identical data.
+ */
+struct wlr_drm_blob *drm_blob_create(struct wlr_drm_backend *drm,
+	const void *data, size_t size);
+struct wlr_drm_blob *drm_blob_ref(struct wlr_drm_blob *blob);
+void drm_blob_unref(struct wlr_drm_backend *drm, struct wlr_drm_blob *blob);
+/**
+ * Get the KMS object ID of a blob, zero if the blob is NULL.
+ */
+uint32_t drm_blob_id(const struct wlr_drm_blob *blob);
+void drm_blob_cache_finish(struct wlr_drm_backend *drm);
+
+/**
+ * Fill the test cache key for a connector state. Returns false if the state
+ * can't be cached.
+ */
+bool drm_test_key_init(struct wlr_drm_test_key *key,
+	struct wlr_drm_connector *conn,
+	const struct wlr_drm_connector_state *state, uint32_t flags);
+bool drm_test_cache_get(const struct wlr_drm_test_cache *cache,
+	const struct wlr_drm_test_key *key, bool *result);
+void drm_test_cache_add(struct wlr_drm_test_cache *cache,
+	const struct wlr_drm_test_key *key, bool result);
+/**
+ * Drop all cached test results. Needs to be called whenever the state of the
+ * KMS device changes outside of the cached keys, e.g. on modeset or hotplug.
+ */
+void drm_test_cache_invalidate(struct wlr_drm_test_cache *cache);
+/**
+ * Drop the cached test results involving an FB. Needs to be called when the
+ * FB is destroyed, since the kernel may re-use its ID.
+ */
+void drm_test_cache_forget_fb(struct wlr_drm_test_cache *cache,
+	uint32_t fb_id);
+
 #define wlr_drm_conn_log(conn, verb, fmt, ...) \
 	wlr_log(verb, "connector %s: " fmt, conn->name, ##__VA_ARGS__)
 #define wlr_drm_conn_log_errno(conn, verb, fmt, ...) \
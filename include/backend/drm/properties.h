@@ -49,6 +49,7 @@ union wlr_drm_plane_props {
 		uint32_t type;
 		uint32_t rotation; // Not guaranteed to exist
 		uint32_t in_formats; // Not guaranteed to exist
+		uint32_t zpos; // Not guaranteed to exist
 
 		// atomic-modesetting only
 
@@ -64,16 +65,23 @@ union wlr_drm_plane_props {
 		uint32_t crtc_id;
 		uint32_t fb_damage_clips;
 	};
-	uint32_t props[14];
+	uint32_t props[15];
 };
 
-bool get_drm_connector_props(int fd, uint32_t id,
+struct wlr_drm_backend;
+
+bool get_drm_connector_props(struct wlr_drm_backend *drm, uint32_t id,
 	union wlr_drm_connector_props *out);
-bool get_drm_crtc_props(int fd, uint32_t id, union wlr_drm_crtc_props *out);
-bool get_drm_plane_props(int fd, uint32_t id, union wlr_drm_plane_props *out);
+bool get_drm_crtc_props(struct wlr_drm_backend *drm, uint32_t id,
+	union wlr_drm_crtc_props *out);
+bool get_drm_plane_props(struct wlr_drm_backend *drm, uint32_t id,
+	union wlr_drm_plane_props *out);
 
-bool get_drm_prop(int fd, uint32_t obj, uint32_t prop, uint64_t *ret);
-void *get_drm_prop_blob(int fd, uint32_t obj, uint32_t prop, size_t *ret_len);
-char *get_drm_prop_enum(int fd, uint32_t obj, uint32_t prop);
+bool get_drm_prop(struct wlr_drm_backend *drm, uint32_t obj, uint32_t prop,
+	uint64_t *ret);
+void *get_drm_prop_blob(struct wlr_drm_backend *drm, uint32_t obj,
+	uint32_t prop, size_t *ret_len);
+char *get_drm_prop_enum(struct wlr_drm_backend *drm, uint32_t obj,
+	uint32_t prop);
 
 #endif
@@ -1,6 +1,7 @@
 #ifndef BACKEND_DRM_RENDERER_H
 #define BACKEND_DRM_RENDERER_H
 
+#include <pixman.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <wlr/backend.h>
@@ -17,6 +18,8 @@ struct wlr_drm_renderer {
 	struct wlr_allocator *allocator;
 };
 
+#define WLR_DRM_SURFACE_DAMAGE_HISTORY_LEN 4
+
 struct wlr_drm_surface {
 	struct wlr_drm_renderer *renderer;
 
@@ -24,6 +27,9 @@ struct wlr_drm_surface {
 	uint32_t height;
 
 	struct wlr_swapchain *swapchain;
+
+	// Damage of the previous blits, most recent first
+	pixman_region32_t damage_history[WLR_DRM_SURFACE_DAMAGE_HISTORY_LEN];
 };
 
 struct wlr_drm_fb {
@@ -50,8 +56,12 @@ void drm_fb_destroy(struct wlr_drm_fb *fb);
 void drm_fb_clear(struct wlr_drm_fb **fb);
 void drm_fb_move(struct wlr_drm_fb **new, struct wlr_drm_fb **old);
 
+/**
+ * Copy a buffer into the next buffer of the surface. If damage is non-NULL,
+ * only the region which changed since the last blit is copied.
+ */
 struct wlr_buffer *drm_surface_blit(struct wlr_drm_surface *surf,
-	struct wlr_buffer *buffer);
+	struct wlr_buffer *buffer, const pixman_region32_t *damage);
 
 struct wlr_drm_format *drm_plane_pick_render_format(
 		struct wlr_drm_plane *plane, struct wlr_drm_renderer *renderer);
@@ -8,6 +8,8 @@
 
 // Calculates a more accurate refresh rate (mHz) than what mode itself provides
 int32_t calculate_refresh_rate(const drmModeModeInfo *mode);
+// Calculates the duration of a refresh cycle in nanoseconds
+int64_t calculate_refresh_period(const drmModeModeInfo *mode);
 // Populates the make/model/phys_{width,height} of output from the edid data
 void parse_edid(struct wlr_output *restrict output, size_t len,
 	const uint8_t *data);
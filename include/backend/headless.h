@@ -5,6 +5,8 @@
 #include <wlr/backend/interface.h>
 
 #define HEADLESS_DEFAULT_REFRESH (60 * 1000) // 60 Hz
+// Lower bound of the simulated adaptive sync range
+#define HEADLESS_ADAPTIVE_SYNC_MIN_REFRESH (48 * 1000) // 48 Hz
 
 struct wlr_headless_backend {
 	struct wlr_backend backend;
@@ -24,6 +26,17 @@ struct wlr_headless_output {
 
 	struct wl_event_source *frame_timer;
 	int frame_delay; // ms
+	// Time of the last simulated vblank, zero if none. With adaptive sync,
+	// simulated vblanks happen when a buffer is committed or when the display
+	// needs to refresh on its own, instead of on each frame_timer tick.
+	int64_t last_frame_ns;
+
+	// Frame event sent right after a commit, for present modes which don't
+	// wait for the simulated vblank
+	struct wl_event_source *idle_frame;
+	// Mailbox present mode: buffer waiting for the next simulated vblank
+	bool mailbox_pending;
+	uint32_t mailbox_seq;
 };
 
 struct wlr_headless_input_device {
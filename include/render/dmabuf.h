@@ -0,0 +1,36 @@
+#ifndef RENDER_DMABUF_H
+#define RENDER_DMABUF_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <wlr/render/dmabuf.h>
+
+// Copied from <linux/dma-buf.h> to avoid #ifdef soup
+#define DMA_BUF_SYNC_READ      (1 << 0)
+#define DMA_BUF_SYNC_WRITE     (2 << 0)
+#define DMA_BUF_SYNC_RW        (DMA_BUF_SYNC_READ | DMA_BUF_SYNC_WRITE)
+
+/**
+ * Extract the implicit fences of a DMA-BUF as a single sync_file. flags is
+ * DMA_BUF_SYNC_READ to get the fences a reader needs to wait on (pending
+ * writes), or DMA_BUF_SYNC_WRITE to get the fences a writer needs to wait on
+ * (all pending accesses).
+ *
+ * Returns a sync_file FD, or -1 if the kernel doesn't support it. Always
+ * fails on platforms without sync_file support.
+ */
+int dmabuf_export_sync_file(const struct wlr_dmabuf_attributes *dmabuf,
+	uint32_t flags);
+
+/**
+ * Returns true if the sync_file has already been signaled.
+ */
+bool sync_file_is_signaled(int sync_file_fd);
+
+/**
+ * Returns true if the FD refers to a sync_file. Always false on platforms
+ * without sync_file support.
+ */
+bool sync_file_is_valid(int sync_file_fd);
+
+#endif
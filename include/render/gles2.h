@@ -15,6 +15,8 @@
 #include <wlr/util/addon.h>
 #include <wlr/util/log.h>
 
+#define WLR_GLES2_TIMER_QUERY_COUNT 4
+
 struct wlr_gles2_pixel_format {
 	uint32_t drm_format;
 	GLint gl_format, gl_type;
@@ -45,6 +47,7 @@ struct wlr_gles2_renderer {
 		bool OES_egl_image;
 		bool EXT_texture_type_2_10_10_10_REV;
 		bool OES_texture_half_float_linear;
+		bool EXT_disjoint_timer_query;
 	} exts;
 
 	struct {
@@ -54,6 +57,12 @@ struct wlr_gles2_renderer {
 		PFNGLPOPDEBUGGROUPKHRPROC glPopDebugGroupKHR;
 		PFNGLPUSHDEBUGGROUPKHRPROC glPushDebugGroupKHR;
 		PFNGLEGLIMAGETARGETRENDERBUFFERSTORAGEOESPROC glEGLImageTargetRenderbufferStorageOES;
+		PFNGLGENQUERIESEXTPROC glGenQueriesEXT;
+		PFNGLDELETEQUERIESEXTPROC glDeleteQueriesEXT;
+		PFNGLBEGINQUERYEXTPROC glBeginQueryEXT;
+		PFNGLENDQUERYEXTPROC glEndQueryEXT;
+		PFNGLGETQUERYOBJECTUIVEXTPROC glGetQueryObjectuivEXT;
+		PFNGLGETQUERYOBJECTUI64VEXTPROC glGetQueryObjectui64vEXT;
 	} procs;
 
 	struct {
@@ -73,6 +82,23 @@ struct wlr_gles2_renderer {
 
 	struct wlr_gles2_buffer *current_buffer;
 	uint32_t viewport_width, viewport_height;
+
+	// GL_TIME_ELAPSED_EXT queries, one per render pass. Results arrive
+	// asynchronously, so a few passes can be in flight.
+	struct {
+		GLuint queries[WLR_GLES2_TIMER_QUERY_COUNT];
+		bool pending[WLR_GLES2_TIMER_QUERY_COUNT];
+		size_t next;
+		bool active;
+		int64_t last_ns;
+	} timer;
+
+	// Staging memory for read_pixels when the destination can't be written
+	// to directly
+	struct {
+		void *data;
+		size_t size;
+	} read_scratch;
 };
 
 struct wlr_gles2_buffer {
@@ -4,6 +4,7 @@
 #include <wlr/render/pixman.h>
 #include <wlr/render/wlr_renderer.h>
 #include <wlr/render/drm_format_set.h>
+#include <wlr/util/addon.h>
 #include "render/pixel_format.h"
 
 struct wlr_pixman_pixel_format {
@@ -13,6 +14,14 @@ struct wlr_pixman_pixel_format {
 
 struct wlr_pixman_buffer;
 
+#define WLR_PIXMAN_SOLID_FILL_CACHE_SIZE 8
+
+struct wlr_pixman_solid_fill {
+	struct pixman_color color;
+	pixman_image_t *image; // NULL if the slot is unused
+	uint32_t last_used;
+};
+
 struct wlr_pixman_renderer {
 	struct wlr_renderer wlr_renderer;
 
@@ -23,6 +32,18 @@ struct wlr_pixman_renderer {
 	int32_t width, height;
 
 	struct wlr_drm_format_set drm_formats;
+
+	// Solid-fill images are immutable, keep the most recently used ones
+	// around instead of re-creating them for every draw call
+	struct wlr_pixman_solid_fill solid_fills[WLR_PIXMAN_SOLID_FILL_CACHE_SIZE];
+	uint32_t solid_fill_seq;
+
+	// Scratch image used to rasterize quads, re-used while the size matches
+	pixman_image_t *quad_image;
+
+	pixman_region32_t scissor;
+
+	struct wlr_pixman_renderer_stats stats;
 };
 
 struct wlr_pixman_buffer {
@@ -31,7 +52,7 @@ struct wlr_pixman_buffer {
 
 	pixman_image_t *image;
 
-	struct wl_listener buffer_destroy;
+	struct wlr_addon addon;
 	struct wl_list link; // wlr_pixman_renderer.buffers
 };
 
@@ -46,6 +67,7 @@ struct wlr_pixman_texture {
 
 	void *data; // if created via texture_from_pixels
 	struct wlr_buffer *buffer; // if created via texture_from_buffer
+	struct wlr_addon buffer_addon;
 };
 
 pixman_format_code_t get_pixman_format_from_drm(uint32_t fmt);
@@ -55,6 +55,9 @@ struct wlr_vk_device {
 	// we only ever need one queue for rendering and transfer commands
 	uint32_t queue_family;
 	VkQueue queue;
+	// zero if the queue doesn't support timestamp queries
+	uint32_t timestamp_valid_bits;
+	float timestamp_period; // nanoseconds per timestamp tick
 
 	struct {
 		PFN_vkGetMemoryFdPropertiesKHR getMemoryFdPropertiesKHR;
@@ -166,10 +169,16 @@ struct wlr_vk_renderer {
 
 	VkDescriptorSetLayout ds_layout;
 	VkPipelineLayout pipe_layout;
+	VkPipelineCache pipeline_cache;
 	VkSampler sampler;
 
 	VkFence fence;
 
+	// Timestamps written at the start and end of the render command buffer,
+	// VK_NULL_HANDLE if unsupported
+	VkQueryPool timestamp_pool;
+	int64_t gpu_time_ns;
+
 	struct wlr_vk_render_buffer *current_render_buffer;
 
 	// current frame id. Used in wlr_vk_texture.last_used
@@ -204,6 +213,16 @@ struct wlr_vk_renderer {
 // Creates a vulkan renderer for the given device.
 struct wlr_renderer *vulkan_renderer_create_for_device(struct wlr_vk_device *dev);
 
+// Creates a pipeline cache for the given device, pre-populated from the
+// on-disk cache in $XDG_CACHE_HOME/wlroots if a compatible one exists.
+// Returns VK_NULL_HANDLE on failure, in which case pipelines are simply
+// created without a cache.
+VkPipelineCache vulkan_load_pipeline_cache(struct wlr_vk_device *dev);
+// Writes the contents of the given pipeline cache to disk, keyed by the
+// device's pipeline cache UUID and driver version.
+void vulkan_save_pipeline_cache(struct wlr_vk_device *dev,
+	VkPipelineCache cache);
+
 // stage utility - for uploading/retrieving data
 // Gets an command buffer in recording state which is guaranteed to be
 // executed before the next frame.
@@ -20,6 +20,17 @@ struct wlr_shm_client_buffer {
 
 	struct wl_listener resource_destroy;
 	struct wl_listener release;
+
+	// Recycling cache of the client, NULL once the client is gone
+	struct shm_client_buffer_cache *cache;
+	struct wl_list link; // shm_client_buffer_cache.buffers
+	// Set while the wrapper sits in the recycling cache, waiting for the
+	// client to create a new wl_buffer at the same address. Cached wrappers
+	// don't keep the pool alive: cached_data is only compared, never
+	// dereferenced.
+	struct wl_list cache_link; // shm_client_buffer_cache.cached
+	void *cached_data;
+	uint32_t cached_msec;
 };
 
 /**
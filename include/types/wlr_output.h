@@ -12,4 +12,24 @@ struct wlr_drm_format *output_pick_format(struct wlr_output *output,
 void output_clear_back_buffer(struct wlr_output *output);
 bool output_ensure_buffer(struct wlr_output *output);
 
+bool output_layers_test(struct wlr_output *output,
+	const struct wlr_output_state *state);
+void output_layers_reset_feedback(const struct wlr_output_state *state);
+void output_layers_apply_order(struct wlr_output *output,
+	const struct wlr_output_state *state);
+
+/**
+ * Get the interval after which backends need to repeat the current frame when
+ * no new buffer has been committed, in nanoseconds. This keeps the refresh
+ * rate within the adaptive sync range. Returns zero if frames don't need to
+ * be repeated, which is the case unless content is being animated below the
+ * minimum refresh rate.
+ */
+int64_t output_get_frame_repeat_period(struct wlr_output *output);
+/**
+ * Check whether a hardware cursor update should wait for the next content or
+ * repeated frame instead of triggering a new frame.
+ */
+bool output_defer_cursor_update(struct wlr_output *output);
+
 #endif
@@ -0,0 +1,33 @@
+#ifndef UTIL_PIXEL_CONVERT_H
+#define UTIL_PIXEL_CONVERT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Returns true if pixel_convert() can convert pixel data from src_format to
+ * dst_format. Conversions are supported between the 8888 formats, between the
+ * 2101010 formats and from/to RGB565. Identical formats are always supported.
+ */
+bool pixel_convert_supported(uint32_t dst_format, uint32_t src_format);
+
+/**
+ * Converts a width x height rectangle of pixels from src_format to dst_format.
+ * Strides are in bytes. dst and src may be the same pointer if both formats
+ * have the same size and strides are identical.
+ *
+ * Returns false if the conversion isn't supported.
+ */
+bool pixel_convert(uint32_t dst_format, void *dst, size_t dst_stride,
+	uint32_t src_format, const void *src, size_t src_stride,
+	uint32_t width, uint32_t height);
+
+/**
+ * Copies height rows of row_size bytes, taking into account the source and
+ * destination strides.
+ */
+void pixel_copy(void *dst, size_t dst_stride, const void *src,
+	size_t src_stride, size_t row_size, uint32_t height);
+
+#endif
@@ -16,6 +16,28 @@
 
 struct wlr_drm_backend;
 
+/**
+ * Counters for the KMS requests issued by a DRM backend. They only ever
+ * increase: compositors can compare two snapshots to find out how many
+ * requests a frame needed.
+ */
+struct wlr_drm_backend_stats {
+	// Commits which aren't tests (atomic commits, legacy page-flips and
+	// modesets), including failed ones
+	uint64_t commits;
+	uint64_t modesets;
+	uint64_t failed_commits;
+	// Test commits sent to the kernel, and test commits answered from the
+	// cache of previous results
+	uint64_t tests;
+	uint64_t test_cache_hits;
+	uint64_t fbs_created, fbs_destroyed;
+	uint64_t blobs_created, blobs_destroyed;
+	uint64_t page_flip_events;
+	// Time spent waiting for the kernel to accept commits
+	int64_t last_commit_ns, max_commit_ns, total_commit_ns;
+};
+
 struct wlr_drm_lease {
 	int fd;
 	uint32_t lessee_id;
@@ -54,6 +76,12 @@ uint32_t wlr_drm_connector_get_id(struct wlr_output *output);
  */
 int wlr_drm_backend_get_non_master_fd(struct wlr_backend *backend);
 
+/**
+ * Get the KMS request counters of the DRM backend.
+ */
+void wlr_drm_backend_get_stats(struct wlr_backend *backend,
+	struct wlr_drm_backend_stats *stats);
+
 /**
  * Leases the given outputs to the caller. The outputs must be from the
  * associated DRM backend.
@@ -22,7 +22,9 @@
 	WLR_OUTPUT_STATE_SCALE | \
 	WLR_OUTPUT_STATE_TRANSFORM | \
 	WLR_OUTPUT_STATE_RENDER_FORMAT | \
-	WLR_OUTPUT_STATE_ADAPTIVE_SYNC_ENABLED)
+	WLR_OUTPUT_STATE_ADAPTIVE_SYNC_ENABLED | \
+	WLR_OUTPUT_STATE_LAYERS | \
+	WLR_OUTPUT_STATE_PRESENT_MODE)
 
 /**
  * A backend implementation of wlr_output.
@@ -94,6 +96,13 @@ struct wlr_output_impl {
 	 */
 	const struct wlr_drm_format_set *(*get_primary_formats)(
 		struct wlr_output *output, uint32_t buffer_caps);
+	/**
+	 * Predict the time of the next vertical blanking period, in the clock
+	 * domain of the backend's presentation clock.
+	 *
+	 * Returns false if the time can't be predicted.
+	 */
+	bool (*get_next_vblank)(struct wlr_output *output, struct timespec *when);
 };
 
 /**
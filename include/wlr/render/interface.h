@@ -48,6 +48,9 @@ struct wlr_renderer_impl {
 	uint32_t (*get_render_buffer_caps)(struct wlr_renderer *renderer);
 	struct wlr_texture *(*texture_from_buffer)(struct wlr_renderer *renderer,
 		struct wlr_buffer *buffer);
+	// Returns the GPU time in nanoseconds of the most recent render pass
+	// whose result is available, or -1. Called from wlr_renderer_end().
+	int64_t (*get_gpu_time)(struct wlr_renderer *renderer);
 };
 
 void wlr_renderer_init(struct wlr_renderer *renderer,
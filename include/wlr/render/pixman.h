@@ -13,6 +13,19 @@
 #include <wlr/backend.h>
 #include <wlr/render/wlr_renderer.h>
 
+/**
+ * Allocation counters of the pixman renderer. They only ever increase:
+ * compositors can compare two snapshots to find out how many images a frame
+ * needed.
+ */
+struct wlr_pixman_renderer_stats {
+	// Solid-fill images created, and solid-fill images re-used from the cache
+	uint64_t solid_fill_allocs;
+	uint64_t solid_fill_reuses;
+	// Scratch images created to rasterize quads
+	uint64_t quad_image_allocs;
+};
+
 struct wlr_renderer *wlr_pixman_renderer_create(void);
 /**
  * Returns the image of current buffer.
@@ -20,6 +33,12 @@ struct wlr_renderer *wlr_pixman_renderer_create(void);
 pixman_image_t *wlr_pixman_renderer_get_current_image(
 	struct wlr_renderer *wlr_renderer);
 
+/**
+ * Get the allocation counters of the renderer.
+ */
+void wlr_pixman_renderer_get_stats(struct wlr_renderer *wlr_renderer,
+	struct wlr_pixman_renderer_stats *stats);
+
 bool wlr_renderer_is_pixman(struct wlr_renderer *wlr_renderer);
 bool wlr_texture_is_pixman(struct wlr_texture *texture);
 pixman_image_t *wlr_pixman_texture_get_image(struct wlr_texture *wlr_texture);
@@ -10,6 +10,7 @@
 #define WLR_RENDER_WLR_RENDERER_H
 
 #include <stdint.h>
+#include <time.h>
 #include <wayland-server-core.h>
 #include <wlr/backend.h>
 #include <wlr/render/wlr_texture.h>
@@ -24,6 +25,25 @@ struct wlr_buffer;
 struct wlr_box;
 struct wlr_fbox;
 
+/**
+ * Statistics about a render pass, i.e. everything between
+ * wlr_renderer_begin() and wlr_renderer_end().
+ */
+struct wlr_render_pass_stats {
+	uint32_t draws; // textures and quads rendered
+	uint32_t texture_binds; // draws using another texture than the previous one
+	uint32_t clears;
+	uint32_t scissor_changes;
+	// Pixels covered by draws and clears, not taking scissoring into account
+	uint64_t pixels;
+	// Time spent between wlr_renderer_begin() and wlr_renderer_end()
+	int64_t cpu_time_ns;
+	// GPU time of the most recent render pass whose result is available, or
+	// -1 if the renderer can't measure it. Since GPU work is asynchronous, this
+	// may lag a few frames behind the other fields.
+	int64_t gpu_time_ns;
+};
+
 struct wlr_renderer {
 	const struct wlr_renderer_impl *impl;
 
@@ -33,6 +53,16 @@ struct wlr_renderer {
 	struct {
 		struct wl_signal destroy;
 	} events;
+
+	// private state
+
+	struct {
+		struct wlr_render_pass_stats current, last;
+		struct timespec start;
+		const struct wlr_texture *texture;
+		uint32_t width, height;
+		uint64_t scissor_area;
+	} stats;
 };
 
 struct wlr_renderer *wlr_renderer_autocreate(struct wlr_backend *backend);
@@ -98,6 +128,12 @@ bool wlr_renderer_read_pixels(struct wlr_renderer *r, uint32_t fmt,
 	uint32_t *flags, uint32_t stride, uint32_t width, uint32_t height,
 	uint32_t src_x, uint32_t src_y, uint32_t dst_x, uint32_t dst_y, void *data);
 
+/**
+ * Get statistics about the last completed render pass.
+ */
+void wlr_renderer_get_pass_stats(struct wlr_renderer *r,
+	struct wlr_render_pass_stats *stats);
+
 /**
  * Initializes wl_shm, linux-dmabuf and other buffer factory protocols.
  *
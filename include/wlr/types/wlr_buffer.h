@@ -25,6 +25,7 @@ struct wlr_shm_attributes {
 };
 
 struct wlr_buffer_impl {
+	const char *name; // optional, used for tracing
 	void (*destroy)(struct wlr_buffer *buffer);
 	bool (*get_dmabuf)(struct wlr_buffer *buffer,
 		struct wlr_dmabuf_attributes *attribs);
@@ -70,6 +71,10 @@ struct wlr_buffer {
 	} events;
 
 	struct wlr_addon_set addons;
+
+	// private state
+
+	struct wlr_buffer_trace_entry *trace; // NULL if not traced
 };
 
 struct wlr_buffer_resource_interface {
@@ -164,6 +169,39 @@ bool wlr_buffer_begin_data_ptr_access(struct wlr_buffer *buffer, uint32_t flags,
 	void **data, uint32_t *format, size_t *stride);
 void wlr_buffer_end_data_ptr_access(struct wlr_buffer *buffer);
 
+/**
+ * Statistics about live buffers, see wlr_buffer_trace_get_stats().
+ */
+struct wlr_buffer_trace_stats {
+	size_t buffers;
+	size_t bytes; // estimated memory backing the buffers
+	size_t locked; // buffers with at least one lock
+	size_t dropped; // buffers dropped by their producer, but still locked
+};
+
+/**
+ * Enable or disable buffer lifetime tracing. Tracing is enabled at startup if
+ * the WLR_BUFFER_TRACE environment variable is set to 1.
+ *
+ * Only buffers created while tracing is enabled are tracked.
+ */
+void wlr_buffer_trace_enable(bool enabled);
+/**
+ * Get statistics about live traced buffers. impl_name filters by
+ * wlr_buffer_impl.name and client filters by the client which created the
+ * wl_buffer, either can be NULL to match all buffers.
+ *
+ * Returns false if tracing has never been enabled.
+ */
+bool wlr_buffer_trace_get_stats(const char *impl_name,
+	struct wl_client *client, struct wlr_buffer_trace_stats *stats);
+/**
+ * Write a report of live traced buffers, per implementation and per client
+ * totals, and the most recent lock, unlock, release, drop and destroy events
+ * to a file. Callers are written as return addresses.
+ */
+bool wlr_buffer_trace_dump(const char *path);
+
 /**
  * A client buffer.
  */
@@ -0,0 +1,41 @@
+/*
+ * This an unstable interface of wlroots. No guarantees are made regarding the
+ * future consistency of this API.
+ */
+#ifndef WLR_USE_UNSTABLE
+#error "Add -DWLR_USE_UNSTABLE to enable unstable wlroots features"
+#endif
+
+#ifndef WLR_TYPES_WLR_LINUX_EXPLICIT_SYNCHRONIZATION_V1_H
+#define WLR_TYPES_WLR_LINUX_EXPLICIT_SYNCHRONIZATION_V1_H
+
+#include <wayland-server-core.h>
+
+/**
+ * Implementation for the linux-explicit-synchronization-unstable-v1 protocol.
+ *
+ * Clients attach an acquire fence (sync_file) to a commit. The commit is
+ * delayed until the fence is signaled, without blocking the compositor: the
+ * fence is waited on in the event loop and the surface state is cached in the
+ * meantime (see wlr_surface_lock_pending()).
+ *
+ * When the compositor is done with a buffer, the client is sent a release
+ * fence extracted from the implicit fences of the DMA-BUF, so that it can
+ * reuse the buffer as soon as the GPU has finished reading from it.
+ */
+struct wlr_linux_explicit_synchronization_v1 {
+	struct wl_global *global;
+
+	struct {
+		struct wl_signal destroy;
+	} events;
+
+	struct wl_listener display_destroy;
+
+	void *data;
+};
+
+struct wlr_linux_explicit_synchronization_v1 *
+	wlr_linux_explicit_synchronization_v1_create(struct wl_display *display);
+
+#endif
@@ -52,6 +52,18 @@ enum wlr_output_adaptive_sync_status {
 	WLR_OUTPUT_ADAPTIVE_SYNC_UNKNOWN, // requested, but maybe disabled
 };
 
+enum wlr_output_present_mode {
+	// Buffers are displayed during the vertical blanking period, one buffer
+	// per refresh cycle
+	WLR_OUTPUT_PRESENT_MODE_VSYNC,
+	// Buffers are displayed during the vertical blanking period, but a new
+	// buffer can be submitted while another one is waiting to be displayed:
+	// the waiting buffer is replaced and never displayed
+	WLR_OUTPUT_PRESENT_MODE_MAILBOX,
+	// Buffers are displayed as soon as possible, which may result in tearing
+	WLR_OUTPUT_PRESENT_MODE_IMMEDIATE,
+};
+
 enum wlr_output_state_field {
 	WLR_OUTPUT_STATE_BUFFER = 1 << 0,
 	WLR_OUTPUT_STATE_DAMAGE = 1 << 1,
@@ -63,6 +75,8 @@ enum wlr_output_state_field {
 	WLR_OUTPUT_STATE_GAMMA_LUT = 1 << 7,
 	WLR_OUTPUT_STATE_RENDER_FORMAT = 1 << 8,
 	WLR_OUTPUT_STATE_CTM = 1 << 10,
+	WLR_OUTPUT_STATE_LAYERS = 1 << 11,
+	WLR_OUTPUT_STATE_PRESENT_MODE = 1 << 12,
 };
 
 enum wlr_output_state_mode_type {
@@ -81,6 +95,7 @@ struct wlr_output_state {
 	enum wl_output_transform transform;
 	bool adaptive_sync_enabled;
 	uint32_t render_format;
+	enum wlr_output_present_mode present_mode;
 
 	// only valid if WLR_OUTPUT_STATE_BUFFER
 	struct wlr_buffer *buffer;
@@ -99,9 +114,15 @@ struct wlr_output_state {
 
 	// only valid if WLR_OUTPUT_STATE_CTM
 	uint32_t *ctm;
+
+	// only valid if WLR_OUTPUT_STATE_LAYERS, owned by the caller of
+	// wlr_output_set_layers()
+	struct wlr_output_layer_state *layers;
+	size_t layers_len;
 };
 
 struct wlr_output_impl;
+struct wlr_output_layer_state;
 
 /**
  * A compositor output region. This typically corresponds to a monitor that
@@ -134,6 +155,8 @@ struct wlr_output {
 	struct wlr_output_mode *current_mode;
 	int32_t width, height;
 	int32_t refresh; // mHz, may be zero
+	// Refresh rate range supported with adaptive sync, zero if unknown
+	int32_t adaptive_sync_min_refresh, adaptive_sync_max_refresh; // mHz
 
 	bool enabled;
 	float scale;
@@ -141,6 +164,7 @@ struct wlr_output {
 	enum wl_output_transform transform;
 	enum wlr_output_adaptive_sync_status adaptive_sync_status;
 	uint32_t render_format;
+	enum wlr_output_present_mode present_mode;
 
 	bool needs_frame;
 	// damage for cursors and fullscreen surface, in output-local coordinates
@@ -155,6 +179,10 @@ struct wlr_output {
 	// Commit sequence number. Incremented on each commit, may overflow.
 	uint32_t commit_seq;
 
+	// Time of the last commit with a buffer and estimated interval between
+	// such commits, zero if unknown. Used for adaptive sync frame pacing.
+	int64_t last_buffer_commit_ns, content_period_ns;
+
 	struct {
 		// Request to render a frame
 		struct wl_signal frame;
@@ -194,6 +222,8 @@ struct wlr_output {
 	struct wlr_swapchain *swapchain;
 	struct wlr_buffer *back_buffer;
 
+	struct wl_list layers; // wlr_output_layer.link
+
 	struct wl_listener display_destroy;
 
 	struct wlr_addon_set addons;
@@ -216,6 +246,9 @@ struct wlr_output_event_commit {
 	uint32_t committed; // bitmask of enum wlr_output_state_field
 	struct timespec *when;
 	struct wlr_buffer *buffer; // NULL if no buffer is committed
+	// Statistics about the render pass which produced the buffer, NULL if
+	// the buffer wasn't rendered via wlr_output_attach_render()
+	const struct wlr_render_pass_stats *render_stats;
 };
 
 enum wlr_output_present_flag {
@@ -311,11 +344,33 @@ void wlr_output_set_transform(struct wlr_output *output,
  * output. This is just a hint, the backend is free to ignore this setting.
  *
  * When enabled, compositors can submit frames a little bit later than the
- * deadline without dropping a frame.
+ * deadline without dropping a frame. If frames are submitted slower than the
+ * minimum refresh rate of the adaptive sync range, the backend repeats the
+ * current frame. While content is being animated, hardware cursor updates
+ * don't trigger new frames and are displayed with the next (repeated) frame
+ * instead, so that they don't disturb the refresh rate.
  *
  * Adaptive sync is double-buffered state, see `wlr_output_commit`.
  */
 void wlr_output_enable_adaptive_sync(struct wlr_output *output, bool enabled);
+/**
+ * Set the presentation mode of this output. Default value:
+ * WLR_OUTPUT_PRESENT_MODE_VSYNC.
+ *
+ * This is just a hint, the backend is free to fall back to
+ * WLR_OUTPUT_PRESENT_MODE_VSYNC if it doesn't support the requested mode. The
+ * `present` event doesn't carry the WLR_OUTPUT_PRESENT_VSYNC flag when a
+ * buffer has been displayed immediately.
+ *
+ * With WLR_OUTPUT_PRESENT_MODE_MAILBOX and WLR_OUTPUT_PRESENT_MODE_IMMEDIATE,
+ * backends may send `frame` events before the previous buffer has been
+ * displayed. Buffers replaced before being displayed get a `present` event
+ * with `presented` set to false.
+ *
+ * The presentation mode is double-buffered state, see `wlr_output_commit`.
+ */
+void wlr_output_set_present_mode(struct wlr_output *output,
+	enum wlr_output_present_mode mode);
 /**
  * Set the output buffer render format. Default value: DRM_FORMAT_XRGB8888
  *
@@ -438,6 +493,18 @@ void wlr_output_schedule_frame(struct wlr_output *output);
  * Returns the maximum length of each gamma ramp, or 0 if unsupported.
  */
 size_t wlr_output_get_gamma_size(struct wlr_output *output);
+/**
+ * Get the predicted time of the next vertical blanking period of the output,
+ * in the clock domain returned by `wlr_backend_get_presentation_clock`. This
+ * can be used to render frames just in time before the deadline.
+ *
+ * With adaptive sync enabled, this is the earliest time the next buffer can
+ * be displayed.
+ *
+ * Returns false if the output is disabled or the backend can't predict it.
+ */
+bool wlr_output_get_next_vblank(struct wlr_output *output,
+	struct timespec *when);
 /**
  * Sets the gamma table for this output. `r`, `g` and `b` are gamma ramps for
  * red, green and blue. `size` is the length of the ramps and must not exceed
@@ -455,6 +522,19 @@ void wlr_output_set_gamma(struct wlr_output *output, size_t size,
  * The gamma table is double-buffered state, see `wlr_output_commit`.
  */
 void wlr_output_set_ctm(struct wlr_output *output, const uint32_t *ctm);
+/**
+ * Sets the output layers. `layers` is an array of `layers_len` layer states
+ * sorted from bottom to top. Layers of the output which aren't part of the
+ * array are disabled. See `wlr_output_layer` for more details.
+ *
+ * The array is not copied: it needs to remain valid until
+ * `wlr_output_commit` or `wlr_output_rollback` is called. The backend fills
+ * in the `accepted` field of each state on test and commit.
+ *
+ * The set of layers is double-buffered state, see `wlr_output_commit`.
+ */
+void wlr_output_set_layers(struct wlr_output *output,
+	struct wlr_output_layer_state *layers, size_t layers_len);
 /**
  * Returns the wlr_output matching the provided wl_output resource. If the
  * resource isn't a wl_output, it aborts. If the resource is inert (because the
@@ -0,0 +1,81 @@
+/*
+ * This an unstable interface of wlroots. No guarantees are made regarding the
+ * future consistency of this API.
+ */
+#ifndef WLR_USE_UNSTABLE
+#error "Add -DWLR_USE_UNSTABLE to enable unstable wlroots features"
+#endif
+
+#ifndef WLR_TYPES_WLR_OUTPUT_LAYER_H
+#define WLR_TYPES_WLR_OUTPUT_LAYER_H
+
+#include <stdbool.h>
+#include <wayland-util.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/util/addon.h>
+#include <wlr/util/box.h>
+
+/**
+ * An output layer.
+ *
+ * Output layers are displayed above the output's primary buffer. They are
+ * typically mapped to hardware planes by the backend. Compositors can use
+ * them to display a buffer without compositing it into the primary buffer,
+ * e.g. for video playback.
+ *
+ * Backends may have arbitrary limitations regarding the buffers and the
+ * positions accepted for a layer. Compositors need to check the `accepted`
+ * field of the layer state after calling wlr_output_test() or
+ * wlr_output_commit(): layers which haven't been accepted need to be
+ * composited into the primary buffer by the compositor.
+ *
+ * The primary buffer is displayed below all layers, so only the top-most run
+ * of accepted layers can be kept without breaking the stacking order. Layers
+ * which are composited should be disabled before wlr_output_commit(), so
+ * that the backend doesn't display them a second time.
+ */
+struct wlr_output_layer {
+	struct wlr_output *output;
+	struct wl_list link; // wlr_output.layers, bottom to top
+
+	struct wlr_addon_set addons;
+
+	void *data;
+};
+
+/**
+ * State for an output layer.
+ */
+struct wlr_output_layer_state {
+	struct wlr_output_layer *layer;
+
+	// Buffer to display, or NULL to disable the layer
+	struct wlr_buffer *buffer;
+	// Source box in buffer coordinates, leave empty to use the whole buffer
+	struct wlr_fbox src_box;
+	// Destination box in output-buffer-local coordinates, leave the size
+	// empty to use the size of the source box
+	struct wlr_box dst_box;
+
+	// Populated by the backend after wlr_output_test() and
+	// wlr_output_commit(), indicates whether the backend has acknowledged
+	// and will take care of displaying the layer
+	bool accepted;
+};
+
+/**
+ * Create a new output layer.
+ *
+ * The layer is disabled until a buffer is committed for it with
+ * wlr_output_set_layers(). New layers are placed on top of existing ones.
+ */
+struct wlr_output_layer *wlr_output_layer_create(struct wlr_output *output);
+/**
+ * Destroy an output layer.
+ *
+ * The backend may keep displaying the last buffer of the layer until the next
+ * output commit which updates the set of layers.
+ */
+void wlr_output_layer_destroy(struct wlr_output_layer *layer);
+
+#endif
@@ -24,6 +24,8 @@
 #include <wlr/types/wlr_surface.h>
 
 struct wlr_output;
+struct wlr_output_layer;
+struct wlr_output_layer_state;
 struct wlr_output_layout;
 struct wlr_xdg_surface;
 
@@ -94,6 +96,7 @@ struct wlr_scene_surface {
 
 	struct wl_listener surface_destroy;
 	struct wl_listener surface_commit;
+	struct wl_listener surface_queue;
 };
 
 /** A scene-graph node displaying a solid-colored rectangle */
@@ -130,6 +133,21 @@ struct wlr_scene_output {
 	// private state
 
 	bool prev_scanout;
+
+	// Scratch array for wlr_scene_output_send_frame_done()
+	struct wl_array frame_done_surfaces; // struct wlr_surface *
+	// Scratch array for surfaces to latch in wlr_scene_output_commit()
+	struct wl_array latch_surfaces; // struct wlr_surface *
+
+	// Output layers used to offload the top-most buffers, see
+	// wlr_scene_output_set_max_layers()
+	struct wlr_output_layer **layers;
+	struct wlr_output_layer_state *layer_states;
+	struct wlr_scene_node **layer_nodes; // node of each layer state
+	size_t max_layers;
+	// Nodes displayed by an accepted output layer instead of being composited
+	struct wlr_scene_node **offloaded_nodes;
+	size_t offloaded_nodes_len;
 };
 
 typedef void (*wlr_scene_node_iterator_func_t)(struct wlr_scene_node *node,
@@ -204,6 +222,11 @@ struct wlr_scene *wlr_scene_create(void);
  * wlr_renderer_begin before and wlr_renderer_end after calling this function.
  * Damage is given in output-buffer-local coordinates and can be set to NULL to
  * disable damage tracking.
+ *
+ * Surface buffers are uploaded lazily, which can't happen during a render
+ * pass: the compositor needs to call wlr_surface_get_texture() on the visible
+ * surfaces (e.g. with wlr_scene_output_for_each_surface()) before
+ * wlr_renderer_begin.
  */
 void wlr_scene_render_output(struct wlr_scene *scene, struct wlr_output *output,
 	int lx, int ly, pixman_region32_t *damage);
@@ -298,8 +321,21 @@ void wlr_scene_output_destroy(struct wlr_scene_output *scene_output);
  */
 void wlr_scene_output_set_position(struct wlr_scene_output *scene_output,
 	int lx, int ly);
+/**
+ * Set the maximum number of output layers used to display the top-most
+ * buffers of the scene without compositing them, see wlr_output_layer.
+ * Buffers are only offloaded if the backend accepts them.
+ *
+ * Zero, the default, disables output layers. Returns false on allocation
+ * failure.
+ */
+bool wlr_scene_output_set_max_layers(struct wlr_scene_output *scene_output,
+	size_t max_layers);
 /**
  * Render and commit an output.
+ *
+ * Surfaces visible on the output which have a commit queued in mailbox mode
+ * are latched first, see wlr_surface_set_commit_mailbox().
  */
 bool wlr_scene_output_commit(struct wlr_scene_output *scene_output);
 /**
@@ -93,6 +93,9 @@ struct wlr_surface {
 	 * commits with a non-null buffer in its pending state. A surface will not
 	 * have a buffer if it has never committed one, has committed a null buffer,
 	 * or something went wrong with uploading the buffer.
+	 *
+	 * The buffer is uploaded lazily: it is only updated when
+	 * wlr_surface_get_texture() is called.
 	 */
 	struct wlr_client_buffer *buffer;
 	/**
@@ -136,11 +139,38 @@ struct wlr_surface {
 
 	struct wl_list cached; // wlr_surface_state.cached_link
 
+	/**
+	 * Number of cached states allocated so far. Cached states are recycled,
+	 * so this shouldn't grow once a client has reached a steady state.
+	 */
+	size_t cached_state_allocs;
+	/**
+	 * Number of input regions tested by the last wlr_surface_surface_at()
+	 * call on this surface.
+	 */
+	size_t input_region_tests;
+	/**
+	 * Number of commits superseded by a newer commit before being latched,
+	 * see wlr_surface_set_commit_mailbox().
+	 */
+	size_t queued_merges;
+
 	const struct wlr_surface_role *role; // the lifetime-bound role or NULL
 	void *role_data; // role-specific data
 
 	struct {
+		/**
+		 * The client has sent wl_surface.commit, the pending state is about
+		 * to be applied or cached. Listeners may lock the pending state with
+		 * wlr_surface_lock_pending() to delay it.
+		 */
+		struct wl_signal client_commit;
 		struct wl_signal commit;
+		/**
+		 * A commit has been queued in mailbox mode and waits for
+		 * wlr_surface_latch(), see wlr_surface_set_commit_mailbox().
+		 */
+		struct wl_signal queue;
 		struct wl_signal new_subsurface;
 		struct wl_signal destroy;
 	} events;
@@ -154,6 +184,33 @@ struct wlr_surface {
 
 	struct wl_listener renderer_destroy;
 
+	// Bounding box of the input regions of the surface and its mapped
+	// subsurfaces, in surface-local coordinates. Used to skip whole
+	// subsurface trees in wlr_surface_surface_at().
+	pixman_box32_t input_bounds;
+	bool input_bounds_dirty;
+
+	// Cached result of wlr_surface_get_extends()
+	pixman_box32_t extents;
+	bool extents_dirty;
+
+	// Unused cached states, kept for reuse
+	struct wl_list cached_pool; // wlr_surface_state.cached_state_link
+	size_t cached_pool_len;
+
+	// Cached result of wlr_surface_get_effective_damage(), valid until the
+	// next commit
+	pixman_region32_t effective_damage;
+	bool effective_damage_valid;
+
+	// Commit waiting for wlr_surface_latch() in mailbox mode
+	struct wlr_surface_state *queued;
+	bool commit_mailbox;
+
+	// Damage accumulated since the texture was last updated, in buffer-local
+	// coordinates
+	pixman_region32_t texture_damage;
+
 	struct {
 		int32_t scale;
 		enum wl_output_transform transform;
@@ -197,6 +254,11 @@ struct wlr_subsurface {
 	} events;
 
 	void *data;
+
+	// private state
+
+	// True if this subsurface or any of its ancestors is synchronized
+	bool effective_synchronized;
 };
 
 typedef void (*wlr_surface_iterator_func_t)(struct wlr_surface *surface,
@@ -222,6 +284,12 @@ bool wlr_surface_has_buffer(struct wlr_surface *surface);
  * Get the texture of the buffer currently attached to this surface. Returns
  * NULL if no buffer is currently attached or if something went wrong with
  * uploading the buffer.
+ *
+ * The buffer is uploaded to the renderer on the first call after a commit, so
+ * this should only be called when the texture is actually needed. Since
+ * uploading isn't allowed during a render pass, this must not be called
+ * between wlr_renderer_begin() and wlr_renderer_end(): get the textures of the
+ * surfaces to be rendered beforehand.
  */
 struct wlr_texture *wlr_surface_get_texture(struct wlr_surface *surface);
 
@@ -256,6 +324,16 @@ void wlr_surface_send_leave(struct wlr_surface *surface,
 void wlr_surface_send_frame_done(struct wlr_surface *surface,
 		const struct timespec *when);
 
+/**
+ * Send frame done events to many surfaces at once, e.g. all surfaces rendered
+ * on an output. Surfaces are grouped by client and each client with pending
+ * frame callbacks is flushed once, after all of its events have been queued.
+ *
+ * The surfaces array is reordered. Duplicate entries are allowed.
+ */
+void wlr_surface_send_frame_done_batch(struct wlr_surface **surfaces,
+		size_t surfaces_len, const struct timespec *when);
+
 /**
  * Get the bounding box that contains the surface and all subsurfaces in
  * surface coordinates.
@@ -317,4 +395,29 @@ uint32_t wlr_surface_lock_pending(struct wlr_surface *surface);
  */
 void wlr_surface_unlock_cached(struct wlr_surface *surface, uint32_t seq);
 
+/**
+ * Enable or disable mailbox mode for surface commits.
+ *
+ * In mailbox mode, commits updating the buffer of an already mapped surface
+ * aren't applied immediately. Instead, they're queued until the compositor
+ * calls wlr_surface_latch(), typically right before rendering an output. The
+ * queue event is emitted when a commit is queued, so that the compositor can
+ * schedule a frame on the outputs displaying the surface. If
+ * the client commits again in the meantime, the newer commit replaces the
+ * queued one: damage and frame callbacks accumulate and the superseded buffer
+ * is released right away.
+ *
+ * Commits which can't be merged (e.g. changing the buffer scale or transform)
+ * cause the queued commit to be latched first. Disabling mailbox mode latches
+ * the queued commit.
+ */
+void wlr_surface_set_commit_mailbox(struct wlr_surface *surface,
+	bool enabled);
+
+/**
+ * Apply the commit queued in mailbox mode, if any. Returns true if a commit
+ * has been applied.
+ */
+bool wlr_surface_latch(struct wlr_surface *surface);
+
 #endif
@@ -156,6 +156,7 @@ static void buffer_destroy(struct wlr_buffer *wlr_buffer) {
 }
 
 static const struct wlr_buffer_impl buffer_impl = {
+	.name = "drm_dumb",
 	.destroy = buffer_destroy,
 	.get_dmabuf = buffer_get_dmabuf,
 	.begin_data_ptr_access = drm_dumb_buffer_begin_data_ptr_access,
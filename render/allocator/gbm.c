@@ -164,6 +164,7 @@ static bool buffer_get_dmabuf(struct wlr_buffer *wlr_buffer,
 }
 
 static const struct wlr_buffer_impl buffer_impl = {
+	.name = "gbm",
 	.destroy = buffer_destroy,
 	.get_dmabuf = buffer_get_dmabuf,
 };
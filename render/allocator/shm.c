@@ -47,6 +47,7 @@ static void shm_buffer_end_data_ptr_access(struct wlr_buffer *wlr_buffer) {
 }
 
 static const struct wlr_buffer_impl buffer_impl = {
+	.name = "shm",
 	.destroy = buffer_destroy,
 	.get_shm = buffer_get_shm,
 	.begin_data_ptr_access = shm_buffer_begin_data_ptr_access,
@@ -0,0 +1,20 @@
+#include <wlr/util/log.h>
+#include "render/dmabuf.h"
+
+int dmabuf_export_sync_file(const struct wlr_dmabuf_attributes *dmabuf,
+		uint32_t flags) {
+	static bool warned = false;
+	if (!warned) {
+		wlr_log(WLR_ERROR, "DMA-BUF sync_file export not supported on this platform");
+		warned = true;
+	}
+	return -1;
+}
+
+bool sync_file_is_signaled(int sync_file_fd) {
+	return true;
+}
+
+bool sync_file_is_valid(int sync_file_fd) {
+	return false;
+}
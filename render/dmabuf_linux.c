@@ -0,0 +1,83 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <linux/dma-buf.h>
+#include <linux/sync_file.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <wlr/util/log.h>
+#include "render/dmabuf.h"
+
+#ifndef DMA_BUF_IOCTL_EXPORT_SYNC_FILE
+// Added in Linux 6.0
+struct dma_buf_export_sync_file {
+	__u32 flags;
+	__s32 fd;
+};
+#define DMA_BUF_IOCTL_EXPORT_SYNC_FILE \
+	_IOWR(DMA_BUF_BASE, 2, struct dma_buf_export_sync_file)
+#endif
+
+static int sync_file_merge(int fd1, int fd2) {
+	struct sync_merge_data data = {
+		.name = "wlroots",
+		.fd2 = fd2,
+	};
+	if (ioctl(fd1, SYNC_IOC_MERGE, &data) != 0) {
+		wlr_log_errno(WLR_ERROR, "ioctl(SYNC_IOC_MERGE) failed");
+		return -1;
+	}
+	return data.fence;
+}
+
+int dmabuf_export_sync_file(const struct wlr_dmabuf_attributes *dmabuf,
+		uint32_t flags) {
+	int sync_file_fd = -1;
+	for (int i = 0; i < dmabuf->n_planes; i++) {
+		struct dma_buf_export_sync_file data = {
+			.flags = flags,
+			.fd = -1,
+		};
+		if (ioctl(dmabuf->fd[i], DMA_BUF_IOCTL_EXPORT_SYNC_FILE, &data) != 0) {
+			if (errno != ENOTTY) {
+				wlr_log_errno(WLR_ERROR,
+					"ioctl(DMA_BUF_IOCTL_EXPORT_SYNC_FILE) failed");
+			}
+			goto error;
+		}
+
+		if (sync_file_fd < 0) {
+			sync_file_fd = data.fd;
+			continue;
+		}
+
+		// Planes usually share the same DMA-BUF, but not always
+		int merged_fd = sync_file_merge(sync_file_fd, data.fd);
+		close(data.fd);
+		if (merged_fd < 0) {
+			goto error;
+		}
+		close(sync_file_fd);
+		sync_file_fd = merged_fd;
+	}
+	return sync_file_fd;
+
+error:
+	if (sync_file_fd >= 0) {
+		close(sync_file_fd);
+	}
+	return -1;
+}
+
+bool sync_file_is_signaled(int sync_file_fd) {
+	struct pollfd pollfd = {
+		.fd = sync_file_fd,
+		.events = POLLIN,
+	};
+	return poll(&pollfd, 1, 0) == 1 && (pollfd.revents & POLLIN);
+}
+
+bool sync_file_is_valid(int sync_file_fd) {
+	struct sync_file_info info = {0};
+	return ioctl(sync_file_fd, SYNC_IOC_FILE_INFO, &info) == 0;
+}
@@ -18,6 +18,7 @@
 #include "render/egl.h"
 #include "render/gles2.h"
 #include "render/pixel_format.h"
+#include "util/pixel_convert.h"
 
 static const GLfloat verts[] = {
 	1, 0, // top right
@@ -192,6 +193,37 @@ static bool gles2_bind_buffer(struct wlr_renderer *wlr_renderer,
 	return true;
 }
 
+static void poll_timer_queries(struct wlr_gles2_renderer *renderer) {
+	// Reading GL_GPU_DISJOINT_EXT resets it, results of queries which were
+	// in flight at that point are meaningless
+	GLint disjoint = 0;
+	glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+
+	// Queries complete in order, start with the oldest one
+	for (size_t i = 0; i < WLR_GLES2_TIMER_QUERY_COUNT; i++) {
+		size_t idx = (renderer->timer.next + i) % WLR_GLES2_TIMER_QUERY_COUNT;
+		if (!renderer->timer.pending[idx]) {
+			continue;
+		}
+
+		GLuint query = renderer->timer.queries[idx];
+		GLuint available = GL_FALSE;
+		renderer->procs.glGetQueryObjectuivEXT(query,
+			GL_QUERY_RESULT_AVAILABLE_EXT, &available);
+		if (!available) {
+			break;
+		}
+
+		GLuint64 elapsed = 0;
+		renderer->procs.glGetQueryObjectui64vEXT(query,
+			GL_QUERY_RESULT_EXT, &elapsed);
+		renderer->timer.pending[idx] = false;
+		if (!disjoint) {
+			renderer->timer.last_ns = elapsed;
+		}
+	}
+}
+
 static void gles2_begin(struct wlr_renderer *wlr_renderer, uint32_t width,
 		uint32_t height) {
 	struct wlr_gles2_renderer *renderer =
@@ -199,6 +231,19 @@ static void gles2_begin(struct wlr_renderer *wlr_renderer, uint32_t width,
 
 	push_gles2_debug(renderer);
 
+	if (renderer->exts.EXT_disjoint_timer_query) {
+		size_t idx = renderer->timer.next;
+		if (renderer->timer.pending[idx]) {
+			poll_timer_queries(renderer);
+		}
+		// If all queries are still in flight, skip timing this pass
+		if (!renderer->timer.pending[idx]) {
+			renderer->procs.glBeginQueryEXT(GL_TIME_ELAPSED_EXT,
+				renderer->timer.queries[idx]);
+			renderer->timer.active = true;
+		}
+	}
+
 	glViewport(0, 0, width, height);
 	renderer->viewport_width = width;
 	renderer->viewport_height = height;
@@ -216,8 +261,28 @@ static void gles2_begin(struct wlr_renderer *wlr_renderer, uint32_t width,
 }
 
 static void gles2_end(struct wlr_renderer *wlr_renderer) {
-	gles2_get_renderer_in_context(wlr_renderer);
-	// no-op
+	struct wlr_gles2_renderer *renderer =
+		gles2_get_renderer_in_context(wlr_renderer);
+
+	if (renderer->timer.active) {
+		renderer->procs.glEndQueryEXT(GL_TIME_ELAPSED_EXT);
+		renderer->timer.pending[renderer->timer.next] = true;
+		renderer->timer.next =
+			(renderer->timer.next + 1) % WLR_GLES2_TIMER_QUERY_COUNT;
+		renderer->timer.active = false;
+	}
+}
+
+static int64_t gles2_get_gpu_time(struct wlr_renderer *wlr_renderer) {
+	struct wlr_gles2_renderer *renderer =
+		gles2_get_renderer_in_context(wlr_renderer);
+
+	if (!renderer->exts.EXT_disjoint_timer_query) {
+		return -1;
+	}
+
+	poll_timer_queries(renderer);
+	return renderer->timer.last_ns;
 }
 
 static void gles2_clear(struct wlr_renderer *wlr_renderer,
@@ -427,6 +492,22 @@ static uint32_t gles2_preferred_read_format(
 	return DRM_FORMAT_XBGR8888;
 }
 
+static void *get_read_scratch(struct wlr_gles2_renderer *renderer,
+		size_t size) {
+	if (renderer->read_scratch.size >= size) {
+		return renderer->read_scratch.data;
+	}
+
+	void *data = realloc(renderer->read_scratch.data, size);
+	if (data == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+	renderer->read_scratch.data = data;
+	renderer->read_scratch.size = size;
+	return data;
+}
+
 static bool gles2_read_pixels(struct wlr_renderer *wlr_renderer,
 		uint32_t drm_format, uint32_t *flags, uint32_t stride,
 		uint32_t width, uint32_t height, uint32_t src_x, uint32_t src_y,
@@ -437,13 +518,19 @@ static bool gles2_read_pixels(struct wlr_renderer *wlr_renderer,
 	const struct wlr_gles2_pixel_format *fmt =
 		get_gles2_format_from_drm(drm_format);
 	if (fmt == NULL || !is_gles2_pixel_format_supported(renderer, fmt)) {
-		wlr_log(WLR_ERROR, "Cannot read pixels: unsupported pixel format 0x%"PRIX32, drm_format);
-		return false;
+		// GL_RGBA with GL_UNSIGNED_BYTE can always be read, convert from that
+		fmt = get_gles2_format_from_gl(GL_RGBA, GL_UNSIGNED_BYTE, true);
+		if (fmt == NULL || !pixel_convert_supported(drm_format, fmt->drm_format)) {
+			wlr_log(WLR_ERROR, "Cannot read pixels: unsupported pixel format 0x%"PRIX32, drm_format);
+			return false;
+		}
 	}
 
 	const struct wlr_pixel_format_info *drm_fmt =
+		drm_get_pixel_format_info(drm_format);
+	const struct wlr_pixel_format_info *read_fmt =
 		drm_get_pixel_format_info(fmt->drm_format);
-	assert(drm_fmt);
+	assert(drm_fmt && read_fmt);
 
 	push_gles2_debug(renderer);
 
@@ -452,20 +539,28 @@ static bool gles2_read_pixels(struct wlr_renderer *wlr_renderer,
 
 	glGetError(); // Clear the error flag
 
-	unsigned char *p = (unsigned char *)data + dst_y * stride;
-	uint32_t pack_stride = width * drm_fmt->bpp / 8;
-	if (pack_stride == stride && dst_x == 0) {
+	unsigned char *p = (unsigned char *)data + dst_y * stride +
+		dst_x * drm_fmt->bpp / 8;
+	uint32_t pack_stride = width * read_fmt->bpp / 8;
+	bool ok = true;
+	if (fmt->drm_format == drm_format && pack_stride == stride && dst_x == 0) {
 		// Under these particular conditions, we can read the pixels with only
 		// one glReadPixels call
-
 		glReadPixels(src_x, src_y, width, height, fmt->gl_format, fmt->gl_type, p);
 	} else {
-		// Unfortunately GLES2 doesn't support GL_PACK_*, so we have to read
-		// the lines out row by row
-		for (size_t i = 0; i < height; ++i) {
-			uint32_t y = src_y + i;
-			glReadPixels(src_x, y, width, 1, fmt->gl_format,
-				fmt->gl_type, p + i * stride + dst_x * drm_fmt->bpp / 8);
+		// GLES2 doesn't support GL_PACK_ROW_LENGTH, so read everything in
+		// one go into a scratch buffer and copy the rows out from there,
+		// converting the format if necessary. Rows are aligned according to
+		// GL_PACK_ALIGNMENT, which defaults to 4.
+		size_t scratch_stride = (pack_stride + 3) & ~(size_t)3;
+		void *scratch = get_read_scratch(renderer, scratch_stride * height);
+		if (scratch != NULL) {
+			glReadPixels(src_x, src_y, width, height, fmt->gl_format,
+				fmt->gl_type, scratch);
+			ok = pixel_convert(drm_format, p, stride, fmt->drm_format,
+				scratch, scratch_stride, width, height);
+		} else {
+			ok = false;
 		}
 	}
 
@@ -475,7 +570,7 @@ static bool gles2_read_pixels(struct wlr_renderer *wlr_renderer,
 		*flags = 0;
 	}
 
-	return glGetError() == GL_NO_ERROR;
+	return glGetError() == GL_NO_ERROR && ok;
 }
 
 static int gles2_get_drm_fd(struct wlr_renderer *wlr_renderer) {
@@ -519,6 +614,10 @@ static void gles2_destroy(struct wlr_renderer *wlr_renderer) {
 	glDeleteProgram(renderer->shaders.tex_rgba.program);
 	glDeleteProgram(renderer->shaders.tex_rgbx.program);
 	glDeleteProgram(renderer->shaders.tex_ext.program);
+	if (renderer->exts.EXT_disjoint_timer_query) {
+		renderer->procs.glDeleteQueriesEXT(WLR_GLES2_TIMER_QUERY_COUNT,
+			renderer->timer.queries);
+	}
 	pop_gles2_debug(renderer);
 
 	if (renderer->exts.KHR_debug) {
@@ -533,6 +632,7 @@ static void gles2_destroy(struct wlr_renderer *wlr_renderer) {
 		close(renderer->drm_fd);
 	}
 
+	free(renderer->read_scratch.data);
 	free(renderer);
 }
 
@@ -553,6 +653,7 @@ static const struct wlr_renderer_impl renderer_impl = {
 	.get_drm_fd = gles2_get_drm_fd,
 	.get_render_buffer_caps = gles2_get_render_buffer_caps,
 	.texture_from_buffer = gles2_texture_from_buffer,
+	.get_gpu_time = gles2_get_gpu_time,
 };
 
 void push_gles2_debug_(struct wlr_gles2_renderer *renderer,
@@ -727,6 +828,7 @@ struct wlr_renderer *wlr_gles2_renderer_create(struct wlr_egl *egl) {
 	renderer->egl = egl;
 	renderer->exts_str = exts_str;
 	renderer->drm_fd = -1;
+	renderer->timer.last_ns = -1;
 
 	wlr_log(WLR_INFO, "Creating GLES2 renderer");
 	wlr_log(WLR_INFO, "Using %s", glGetString(GL_VERSION));
@@ -779,6 +881,18 @@ struct wlr_renderer *wlr_gles2_renderer_create(struct wlr_egl *egl) {
 			"glEGLImageTargetRenderbufferStorageOES");
 	}
 
+	if (check_gl_ext(exts_str, "GL_EXT_disjoint_timer_query")) {
+		renderer->exts.EXT_disjoint_timer_query = true;
+		load_gl_proc(&renderer->procs.glGenQueriesEXT, "glGenQueriesEXT");
+		load_gl_proc(&renderer->procs.glDeleteQueriesEXT, "glDeleteQueriesEXT");
+		load_gl_proc(&renderer->procs.glBeginQueryEXT, "glBeginQueryEXT");
+		load_gl_proc(&renderer->procs.glEndQueryEXT, "glEndQueryEXT");
+		load_gl_proc(&renderer->procs.glGetQueryObjectuivEXT,
+			"glGetQueryObjectuivEXT");
+		load_gl_proc(&renderer->procs.glGetQueryObjectui64vEXT,
+			"glGetQueryObjectui64vEXT");
+	}
+
 	if (renderer->exts.KHR_debug) {
 		glEnable(GL_DEBUG_OUTPUT_KHR);
 		glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS_KHR);
@@ -838,6 +952,11 @@ struct wlr_renderer *wlr_gles2_renderer_create(struct wlr_egl *egl) {
 		renderer->shaders.tex_ext.tex_attrib = glGetAttribLocation(prog, "texcoord");
 	}
 
+	if (renderer->exts.EXT_disjoint_timer_query) {
+		renderer->procs.glGenQueriesEXT(WLR_GLES2_TIMER_QUERY_COUNT,
+			renderer->timer.queries);
+	}
+
 	pop_gles2_debug(renderer);
 
 	wlr_egl_unset_current(renderer->egl);
@@ -10,6 +10,7 @@
 
 #include "render/pixman.h"
 #include "types/wlr_buffer.h"
+#include "util/pixel_convert.h"
 
 static const struct wlr_renderer_impl renderer_impl;
 
@@ -23,17 +24,6 @@ static struct wlr_pixman_renderer *get_renderer(
 	return (struct wlr_pixman_renderer *)wlr_renderer;
 }
 
-static struct wlr_pixman_buffer *get_buffer(
-		struct wlr_pixman_renderer *renderer, struct wlr_buffer *wlr_buffer) {
-	struct wlr_pixman_buffer *buffer;
-	wl_list_for_each(buffer, &renderer->buffers, link) {
-		if (buffer->buffer == wlr_buffer) {
-			return buffer;
-		}
-	}
-	return NULL;
-}
-
 static const struct wlr_texture_impl texture_impl;
 
 bool wlr_texture_is_pixman(struct wlr_texture *texture) {
@@ -51,18 +41,30 @@ static bool texture_is_opaque(struct wlr_texture *wlr_texture) {
 	return !texture->format_info->has_alpha;
 }
 
-static void texture_destroy(struct wlr_texture *wlr_texture) {
-	struct wlr_pixman_texture *texture = get_texture(wlr_texture);
+static void texture_destroy(struct wlr_pixman_texture *texture) {
 	wl_list_remove(&texture->link);
+	if (texture->buffer != NULL) {
+		wlr_addon_finish(&texture->buffer_addon);
+	}
 	pixman_image_unref(texture->image);
-	wlr_buffer_unlock(texture->buffer);
 	free(texture->data);
 	free(texture);
 }
 
+static void texture_unref(struct wlr_texture *wlr_texture) {
+	struct wlr_pixman_texture *texture = get_texture(wlr_texture);
+	if (texture->buffer != NULL) {
+		// Keep the texture around, in case the buffer is re-used later. We're
+		// still listening to the buffer's destroy event.
+		wlr_buffer_unlock(texture->buffer);
+	} else {
+		texture_destroy(texture);
+	}
+}
+
 static const struct wlr_texture_impl texture_impl = {
 	.is_opaque = texture_is_opaque,
-	.destroy = texture_destroy,
+	.destroy = texture_unref,
 };
 
 struct wlr_pixman_texture *pixman_create_texture(
@@ -70,19 +72,35 @@ struct wlr_pixman_texture *pixman_create_texture(
 
 static void destroy_buffer(struct wlr_pixman_buffer *buffer) {
 	wl_list_remove(&buffer->link);
-	wl_list_remove(&buffer->buffer_destroy.link);
+	wlr_addon_finish(&buffer->addon);
 
 	pixman_image_unref(buffer->image);
 
 	free(buffer);
 }
 
-static void handle_destroy_buffer(struct wl_listener *listener, void *data) {
+static void handle_buffer_destroy(struct wlr_addon *addon) {
 	struct wlr_pixman_buffer *buffer =
-		wl_container_of(listener, buffer, buffer_destroy);
+		wl_container_of(addon, buffer, addon);
 	destroy_buffer(buffer);
 }
 
+static const struct wlr_addon_interface buffer_addon_impl = {
+	.name = "wlr_pixman_buffer",
+	.destroy = handle_buffer_destroy,
+};
+
+static struct wlr_pixman_buffer *get_buffer(
+		struct wlr_pixman_renderer *renderer, struct wlr_buffer *wlr_buffer) {
+	struct wlr_addon *addon =
+		wlr_addon_find(&wlr_buffer->addons, renderer, &buffer_addon_impl);
+	if (addon == NULL) {
+		return NULL;
+	}
+	struct wlr_pixman_buffer *buffer = wl_container_of(addon, buffer, addon);
+	return buffer;
+}
+
 static struct wlr_pixman_buffer *create_buffer(
 		struct wlr_pixman_renderer *renderer, struct wlr_buffer *wlr_buffer) {
 	struct wlr_pixman_buffer *buffer = calloc(1, sizeof(*buffer));
@@ -118,8 +136,8 @@ static struct wlr_pixman_buffer *create_buffer(
 		goto error_buffer;
 	}
 
-	buffer->buffer_destroy.notify = handle_destroy_buffer;
-	wl_signal_add(&wlr_buffer->events.destroy, &buffer->buffer_destroy);
+	wlr_addon_init(&buffer->addon, &wlr_buffer->addons, renderer,
+		&buffer_addon_impl);
 
 	wl_list_insert(&renderer->buffers, &buffer->link);
 
@@ -169,24 +187,72 @@ static void pixman_end(struct wlr_renderer *wlr_renderer) {
 	wlr_buffer_end_data_ptr_access(renderer->current_buffer->buffer);
 }
 
-static void pixman_clear(struct wlr_renderer *wlr_renderer,
-		const float color[static 4]) {
-	struct wlr_pixman_renderer *renderer = get_renderer(wlr_renderer);
-	struct wlr_pixman_buffer *buffer = renderer->current_buffer;
+static bool color_equal(const struct pixman_color *a,
+		const struct pixman_color *b) {
+	return a->red == b->red && a->green == b->green &&
+		a->blue == b->blue && a->alpha == b->alpha;
+}
+
+/**
+ * Returns a solid-fill image for the given color. The image is owned by the
+ * renderer and must not be unreferenced by the caller.
+ */
+static pixman_image_t *get_solid_fill(struct wlr_pixman_renderer *renderer,
+		const struct pixman_color *color) {
+	struct wlr_pixman_solid_fill *lru = &renderer->solid_fills[0];
+	for (size_t i = 0; i < WLR_PIXMAN_SOLID_FILL_CACHE_SIZE; i++) {
+		struct wlr_pixman_solid_fill *fill = &renderer->solid_fills[i];
+		if (fill->image != NULL && color_equal(&fill->color, color)) {
+			fill->last_used = ++renderer->solid_fill_seq;
+			renderer->stats.solid_fill_reuses++;
+			return fill->image;
+		}
+		if (fill->image == NULL ||
+				(lru->image != NULL && fill->last_used < lru->last_used)) {
+			lru = fill;
+		}
+	}
+
+	pixman_image_t *image = pixman_image_create_solid_fill(color);
+	if (image == NULL) {
+		return NULL;
+	}
+	renderer->stats.solid_fill_allocs++;
+
+	if (lru->image != NULL) {
+		pixman_image_unref(lru->image);
+	}
+	lru->image = image;
+	lru->color = *color;
+	lru->last_used = ++renderer->solid_fill_seq;
+	return image;
+}
 
-	const struct pixman_color colour = {
+static void color_to_pixman(struct pixman_color *out,
+		const float color[static 4]) {
+	*out = (struct pixman_color){
 		.red = color[0] * 0xFFFF,
 		.green = color[1] * 0xFFFF,
 		.blue = color[2] * 0xFFFF,
 		.alpha = color[3] * 0xFFFF,
 	};
+}
+
+static void pixman_clear(struct wlr_renderer *wlr_renderer,
+		const float color[static 4]) {
+	struct wlr_pixman_renderer *renderer = get_renderer(wlr_renderer);
+	struct wlr_pixman_buffer *buffer = renderer->current_buffer;
 
-	pixman_image_t *fill = pixman_image_create_solid_fill(&colour);
+	struct pixman_color colour;
+	color_to_pixman(&colour, color);
+
+	pixman_image_t *fill = get_solid_fill(renderer, &colour);
+	if (fill == NULL) {
+		return;
+	}
 
 	pixman_image_composite32(PIXMAN_OP_SRC, fill, NULL, buffer->image, 0, 0, 0,
 			0, 0, 0, renderer->width, renderer->height);
-
-	pixman_image_unref(fill);
 }
 
 static void pixman_scissor(struct wlr_renderer *wlr_renderer,
@@ -195,11 +261,14 @@ static void pixman_scissor(struct wlr_renderer *wlr_renderer,
 	struct wlr_pixman_buffer *buffer = renderer->current_buffer;
 
 	if (box != NULL) {
-		struct pixman_region32 region = {0};
-		pixman_region32_init_rect(&region, box->x, box->y, box->width,
-				box->height);
-		pixman_image_set_clip_region32(buffer->image, &region);
-		pixman_region32_fini(&region);
+		pixman_box32_t rect = {
+			.x1 = box->x,
+			.y1 = box->y,
+			.x2 = box->x + box->width,
+			.y2 = box->y + box->height,
+		};
+		pixman_region32_reset(&renderer->scissor, &rect);
+		pixman_image_set_clip_region32(buffer->image, &renderer->scissor);
 	} else {
 		pixman_image_set_clip_region32(buffer->image, NULL);
 	}
@@ -251,10 +320,12 @@ static bool pixman_render_subtexture_with_matrix(
 		}
 	}
 
-	// TODO: don't create a mask if alpha == 1.0
-	struct pixman_color mask_colour = {0};
-	mask_colour.alpha = 0xFFFF * alpha;
-	pixman_image_t *mask = pixman_image_create_solid_fill(&mask_colour);
+	pixman_image_t *mask = NULL;
+	if (alpha != 1.0) {
+		struct pixman_color mask_colour = {0};
+		mask_colour.alpha = 0xFFFF * alpha;
+		mask = get_solid_fill(renderer, &mask_colour);
+	}
 
 	float m[9];
 	memcpy(m, matrix, sizeof(m));
@@ -275,8 +346,6 @@ static bool pixman_render_subtexture_with_matrix(
 		wlr_buffer_end_data_ptr_access(texture->buffer);
 	}
 
-	pixman_image_unref(mask);
-
 	return true;
 }
 
@@ -285,14 +354,13 @@ static void pixman_render_quad_with_matrix(struct wlr_renderer *wlr_renderer,
 	struct wlr_pixman_renderer *renderer = get_renderer(wlr_renderer);
 	struct wlr_pixman_buffer *buffer = renderer->current_buffer;
 
-	struct pixman_color colour = {
-		.red = color[0] * 0xFFFF,
-		.green = color[1] * 0xFFFF,
-		.blue = color[2] * 0xFFFF,
-		.alpha = color[3] * 0xFFFF,
-	};
+	struct pixman_color colour;
+	color_to_pixman(&colour, color);
 
-	pixman_image_t *fill = pixman_image_create_solid_fill(&colour);
+	pixman_image_t *fill = get_solid_fill(renderer, &colour);
+	if (fill == NULL) {
+		return;
+	}
 
 	float m[9];
 	memcpy(m, matrix, sizeof(m));
@@ -309,13 +377,23 @@ static void pixman_render_quad_with_matrix(struct wlr_renderer *wlr_renderer,
 
 	wlr_matrix_scale(m, 1.0 / width, 1.0 / height);
 
-	pixman_image_t *image = pixman_image_create_bits(PIXMAN_a8r8g8b8, width,
+	pixman_image_t *image = renderer->quad_image;
+	if (image == NULL || pixman_image_get_width(image) != (int)width ||
+			pixman_image_get_height(image) != (int)height) {
+		if (image != NULL) {
+			pixman_image_unref(image);
+		}
+		image = pixman_image_create_bits_no_clear(PIXMAN_a8r8g8b8, width,
 			height, NULL, 0);
+		renderer->quad_image = image;
+		if (image == NULL) {
+			return;
+		}
+		renderer->stats.quad_image_allocs++;
+	}
 
-	// TODO find a way to fill the image without allocating 2 images
 	pixman_image_composite32(PIXMAN_OP_SRC, fill, NULL, image,
 		0, 0, 0, 0, 0, 0, width, height);
-	pixman_image_unref(fill);
 
 	struct pixman_transform transform = {0};
 	matrix_to_pixman_transform(&transform, m);
@@ -325,8 +403,6 @@ static void pixman_render_quad_with_matrix(struct wlr_renderer *wlr_renderer,
 
 	pixman_image_composite32(PIXMAN_OP_OVER, image, NULL, buffer->image,
 			0, 0, 0, 0, 0, 0, renderer->width, renderer->height);
-
-	pixman_image_unref(image);
 }
 
 static const uint32_t *pixman_get_shm_texture_formats(
@@ -373,10 +449,30 @@ static struct wlr_pixman_texture *pixman_texture_create(
 	return texture;
 }
 
+static void texture_handle_buffer_destroy(struct wlr_addon *addon) {
+	struct wlr_pixman_texture *texture =
+		wl_container_of(addon, texture, buffer_addon);
+	texture_destroy(texture);
+}
+
+static const struct wlr_addon_interface texture_addon_impl = {
+	.name = "wlr_pixman_texture",
+	.destroy = texture_handle_buffer_destroy,
+};
+
 static struct wlr_texture *pixman_texture_from_buffer(
 		struct wlr_renderer *wlr_renderer, struct wlr_buffer *buffer) {
 	struct wlr_pixman_renderer *renderer = get_renderer(wlr_renderer);
 
+	struct wlr_addon *addon =
+		wlr_addon_find(&buffer->addons, renderer, &texture_addon_impl);
+	if (addon != NULL) {
+		struct wlr_pixman_texture *texture =
+			wl_container_of(addon, texture, buffer_addon);
+		wlr_buffer_lock(texture->buffer);
+		return &texture->wlr_texture;
+	}
+
 	void *data = NULL;
 	uint32_t drm_format;
 	size_t stride;
@@ -402,6 +498,8 @@ static struct wlr_texture *pixman_texture_from_buffer(
 	}
 
 	texture->buffer = wlr_buffer_lock(buffer);
+	wlr_addon_init(&texture->buffer_addon, &buffer->addons,
+		renderer, &texture_addon_impl);
 
 	return &texture->wlr_texture;
 }
@@ -443,9 +541,19 @@ static void pixman_destroy(struct wlr_renderer *wlr_renderer) {
 
 	struct wlr_pixman_texture *tex, *tex_tmp;
 	wl_list_for_each_safe(tex, tex_tmp, &renderer->textures, link) {
-		wlr_texture_destroy(&tex->wlr_texture);
+		texture_destroy(tex);
 	}
 
+	for (size_t i = 0; i < WLR_PIXMAN_SOLID_FILL_CACHE_SIZE; i++) {
+		if (renderer->solid_fills[i].image != NULL) {
+			pixman_image_unref(renderer->solid_fills[i].image);
+		}
+	}
+	if (renderer->quad_image != NULL) {
+		pixman_image_unref(renderer->quad_image);
+	}
+	pixman_region32_fini(&renderer->scissor);
+
 	wlr_drm_format_set_finish(&renderer->drm_formats);
 
 	free(renderer);
@@ -479,6 +587,24 @@ static bool pixman_read_pixels(struct wlr_renderer *wlr_renderer,
 		drm_get_pixel_format_info(drm_format);
 	assert(drm_fmt);
 
+	// Plain copies and channel swizzles don't need a full pixman composite.
+	// Unlike pixman_image_composite32(), this doesn't clip to the image.
+	uint32_t src_format =
+		get_drm_format_from_pixman(pixman_image_get_format(buffer->image));
+	uint32_t image_width = pixman_image_get_width(buffer->image);
+	uint32_t image_height = pixman_image_get_height(buffer->image);
+	bool in_bounds = src_x <= image_width && width <= image_width - src_x &&
+		src_y <= image_height && height <= image_height - src_y;
+	if (in_bounds && pixel_convert_supported(drm_format, src_format)) {
+		int src_bpp = PIXMAN_FORMAT_BPP(pixman_image_get_format(buffer->image));
+		size_t src_stride = pixman_image_get_stride(buffer->image);
+		const uint8_t *src = (const uint8_t *)pixman_image_get_data(buffer->image) +
+			src_y * src_stride + src_x * src_bpp / 8;
+		uint8_t *dst = (uint8_t *)data + dst_y * stride + dst_x * drm_fmt->bpp / 8;
+		return pixel_convert(drm_format, dst, stride, src_format, src,
+			src_stride, width, height);
+	}
+
 	pixman_image_t *dst = pixman_image_create_bits_no_clear(fmt, width, height,
 			data, stride);
 
@@ -522,6 +648,7 @@ struct wlr_renderer *wlr_pixman_renderer_create(void) {
 	wlr_renderer_init(&renderer->wlr_renderer, &renderer_impl);
 	wl_list_init(&renderer->buffers);
 	wl_list_init(&renderer->textures);
+	pixman_region32_init(&renderer->scissor);
 
 	size_t len = 0;
 	const uint32_t *formats = get_pixman_drm_formats(&len);
@@ -545,3 +672,9 @@ pixman_image_t *wlr_pixman_renderer_get_current_image(
 	assert(renderer->current_buffer);
 	return renderer->current_buffer->image;
 }
+
+void wlr_pixman_renderer_get_stats(struct wlr_renderer *wlr_renderer,
+		struct wlr_pixman_renderer_stats *stats) {
+	struct wlr_pixman_renderer *renderer = get_renderer(wlr_renderer);
+	*stats = renderer->stats;
+}
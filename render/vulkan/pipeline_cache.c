@@ -0,0 +1,235 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vulkan/vulkan.h>
+#include <wlr/util/log.h>
+#include "render/vulkan.h"
+
+// Upper bound for the size of a cache file we are willing to load. Drivers
+// typically produce a few hundred kilobytes for our handful of pipelines.
+static const size_t max_cache_size = 32 * 1024 * 1024; // 32MB
+
+static bool get_cache_dir(char *dir, size_t len) {
+	const char *xdg_cache = getenv("XDG_CACHE_HOME");
+	int n;
+	if (xdg_cache && xdg_cache[0] == '/') {
+		n = snprintf(dir, len, "%s/wlroots", xdg_cache);
+	} else {
+		const char *home = getenv("HOME");
+		if (!home || home[0] != '/') {
+			return false;
+		}
+		n = snprintf(dir, len, "%s/.cache/wlroots", home);
+	}
+	return n > 0 && (size_t)n < len;
+}
+
+static bool ensure_dir(const char *path) {
+	if (mkdir(path, 0700) != 0 && errno != EEXIST) {
+		wlr_log_errno(WLR_DEBUG, "Failed to create directory %s", path);
+		return false;
+	}
+	return true;
+}
+
+// The driver only guarantees that cache data is compatible with a device
+// reporting the same pipelineCacheUUID, so key the file name by it. The
+// driver version is included as well since some drivers don't bump the UUID
+// on every update.
+static bool get_cache_path(struct wlr_vk_device *dev, char *path, size_t len,
+		bool create_dir) {
+	char dir[PATH_MAX];
+	if (!get_cache_dir(dir, sizeof(dir))) {
+		return false;
+	}
+
+	if (create_dir) {
+		// $XDG_CACHE_HOME itself may not exist yet
+		char *slash = strrchr(dir, '/');
+		*slash = '\0';
+		bool ok = ensure_dir(dir);
+		*slash = '/';
+		if (!ok || !ensure_dir(dir)) {
+			return false;
+		}
+	}
+
+	VkPhysicalDeviceProperties props;
+	vkGetPhysicalDeviceProperties(dev->phdev, &props);
+
+	char uuid[2 * VK_UUID_SIZE + 1];
+	for (size_t i = 0; i < VK_UUID_SIZE; ++i) {
+		snprintf(&uuid[2 * i], 3, "%02x", props.pipelineCacheUUID[i]);
+	}
+
+	int n = snprintf(path, len, "%s/vk_pipeline_cache_%04x_%04x_%s_%08x.bin",
+		dir, props.vendorID, props.deviceID, uuid, props.driverVersion);
+	return n > 0 && (size_t)n < len;
+}
+
+// Checks the VkPipelineCacheHeaderVersionOne header against the device.
+// Drivers are required to reject incompatible data themselves, but not all
+// of them do so reliably.
+static bool check_cache_header(struct wlr_vk_device *dev,
+		const uint8_t *data, size_t size) {
+	const size_t header_size = 16 + VK_UUID_SIZE;
+	if (size < header_size) {
+		return false;
+	}
+
+	uint32_t fields[4];
+	memcpy(fields, data, sizeof(fields));
+	if (fields[0] < header_size ||
+			fields[1] != VK_PIPELINE_CACHE_HEADER_VERSION_ONE) {
+		return false;
+	}
+
+	VkPhysicalDeviceProperties props;
+	vkGetPhysicalDeviceProperties(dev->phdev, &props);
+	return fields[2] == props.vendorID && fields[3] == props.deviceID &&
+		memcmp(data + 16, props.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+static void *read_cache_file(struct wlr_vk_device *dev, size_t *size) {
+	char path[PATH_MAX];
+	if (!get_cache_path(dev, path, sizeof(path), false)) {
+		return NULL;
+	}
+
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		if (errno != ENOENT) {
+			wlr_log_errno(WLR_DEBUG, "Failed to open %s", path);
+		}
+		return NULL;
+	}
+
+	void *data = NULL;
+	struct stat st;
+	if (fstat(fileno(f), &st) != 0 || st.st_size <= 0 ||
+			(size_t)st.st_size > max_cache_size) {
+		goto out;
+	}
+
+	data = malloc(st.st_size);
+	if (!data) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		goto out;
+	}
+
+	if (fread(data, 1, st.st_size, f) != (size_t)st.st_size ||
+			!check_cache_header(dev, data, st.st_size)) {
+		wlr_log(WLR_DEBUG, "Ignoring invalid vulkan pipeline cache %s", path);
+		free(data);
+		data = NULL;
+		goto out;
+	}
+
+	*size = st.st_size;
+	wlr_log(WLR_DEBUG, "Loaded vulkan pipeline cache from %s (%zu bytes)",
+		path, *size);
+
+out:
+	fclose(f);
+	return data;
+}
+
+VkPipelineCache vulkan_load_pipeline_cache(struct wlr_vk_device *dev) {
+	size_t size = 0;
+	void *data = read_cache_file(dev, &size);
+
+	VkPipelineCacheCreateInfo info = {0};
+	info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	info.initialDataSize = size;
+	info.pInitialData = data;
+
+	VkPipelineCache cache = VK_NULL_HANDLE;
+	VkResult res = vkCreatePipelineCache(dev->dev, &info, NULL, &cache);
+	if (res != VK_SUCCESS && data) {
+		// retry without the (possibly corrupt) initial data
+		info.initialDataSize = 0;
+		info.pInitialData = NULL;
+		res = vkCreatePipelineCache(dev->dev, &info, NULL, &cache);
+	}
+	free(data);
+
+	if (res != VK_SUCCESS) {
+		wlr_vk_error("vkCreatePipelineCache", res);
+		return VK_NULL_HANDLE;
+	}
+
+	return cache;
+}
+
+void vulkan_save_pipeline_cache(struct wlr_vk_device *dev,
+		VkPipelineCache cache) {
+	if (cache == VK_NULL_HANDLE) {
+		return;
+	}
+
+	size_t size = 0;
+	VkResult res = vkGetPipelineCacheData(dev->dev, cache, &size, NULL);
+	if (res != VK_SUCCESS || size == 0) {
+		return;
+	}
+
+	void *data = malloc(size);
+	if (!data) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return;
+	}
+
+	res = vkGetPipelineCacheData(dev->dev, cache, &size, data);
+	if (res != VK_SUCCESS) {
+		wlr_vk_error("vkGetPipelineCacheData", res);
+		free(data);
+		return;
+	}
+
+	char path[PATH_MAX], tmp_path[PATH_MAX + 16];
+	if (!get_cache_path(dev, path, sizeof(path), true)) {
+		free(data);
+		return;
+	}
+	snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, (int)getpid());
+
+	// Write to a temporary file and rename it so that concurrently starting
+	// compositors never observe a partially written cache
+	int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		wlr_log_errno(WLR_DEBUG, "Failed to open %s", tmp_path);
+		free(data);
+		return;
+	}
+
+	const uint8_t *p = data;
+	size_t left = size;
+	while (left > 0) {
+		ssize_t n = write(fd, p, left);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			wlr_log_errno(WLR_DEBUG, "Failed to write %s", tmp_path);
+			break;
+		}
+		p += n;
+		left -= n;
+	}
+	close(fd);
+	free(data);
+
+	if (left > 0 || rename(tmp_path, path) != 0) {
+		unlink(tmp_path);
+		return;
+	}
+
+	wlr_log(WLR_DEBUG, "Saved vulkan pipeline cache to %s (%zu bytes)",
+		path, size);
+}
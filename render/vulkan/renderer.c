@@ -26,8 +26,6 @@
 
 // TODO:
 // - simplify stage allocation, don't track allocations but use ringbuffer-like
-// - use a pipeline cache (not sure when to save though, after every pipeline
-//   creation?)
 // - create pipelines as derivatives of each other
 // - evaluate if creating VkDeviceMemory pools is a good idea.
 //   We can expect wayland client images to be fairly large (and shouldn't
@@ -545,6 +543,12 @@ static void vulkan_begin(struct wlr_renderer *wlr_renderer,
 	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 	vkBeginCommandBuffer(cb, &begin_info);
 
+	if (renderer->timestamp_pool != VK_NULL_HANDLE) {
+		vkCmdResetQueryPool(cb, renderer->timestamp_pool, 0, 2);
+		vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+			renderer->timestamp_pool, 0);
+	}
+
 	// begin render pass
 	VkFramebuffer fb = renderer->current_render_buffer->framebuffer;
 
@@ -680,6 +684,11 @@ static void vulkan_end(struct wlr_renderer *wlr_renderer) {
 	free(acquire_barriers);
 	free(release_barriers);
 
+	if (renderer->timestamp_pool != VK_NULL_HANDLE) {
+		vkCmdWriteTimestamp(render_cb, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+			renderer->timestamp_pool, 1);
+	}
+
 	vkEndCommandBuffer(renderer->cb);
 
 	unsigned submit_count = 0u;
@@ -726,6 +735,21 @@ static void vulkan_end(struct wlr_renderer *wlr_renderer) {
 	++renderer->frame;
 	release_stage_allocations(renderer);
 
+	// We just waited for the fence, so the timestamps are available
+	if (renderer->timestamp_pool != VK_NULL_HANDLE) {
+		uint64_t ts[2];
+		res = vkGetQueryPoolResults(renderer->dev->dev,
+			renderer->timestamp_pool, 0, 2, sizeof(ts), ts, sizeof(ts[0]),
+			VK_QUERY_RESULT_64_BIT);
+		if (res == VK_SUCCESS) {
+			uint32_t bits = renderer->dev->timestamp_valid_bits;
+			uint64_t mask = bits >= 64 ? UINT64_MAX : (UINT64_C(1) << bits) - 1;
+			uint64_t ticks = ((ts[1] & mask) - (ts[0] & mask)) & mask;
+			renderer->gpu_time_ns =
+				(int64_t)(ticks * (double)renderer->dev->timestamp_period);
+		}
+	}
+
 	// destroy pending textures
 	wl_list_for_each_safe(texture, tmp_tex, &renderer->destroy_textures, destroy_link) {
 		wlr_texture_destroy(&texture->wlr_texture);
@@ -946,6 +970,8 @@ static void vulkan_destroy(struct wlr_renderer *wlr_renderer) {
 	vkDestroyShaderModule(dev->dev, renderer->quad_frag_module, NULL);
 
 	vkDestroyFence(dev->dev, renderer->fence, NULL);
+	vkDestroyQueryPool(dev->dev, renderer->timestamp_pool, NULL);
+	vkDestroyPipelineCache(dev->dev, renderer->pipeline_cache, NULL);
 	vkDestroyPipelineLayout(dev->dev, renderer->pipe_layout, NULL);
 	vkDestroyDescriptorSetLayout(dev->dev, renderer->ds_layout, NULL);
 	vkDestroySampler(dev->dev, renderer->sampler, NULL);
@@ -975,6 +1001,11 @@ static uint32_t vulkan_get_render_buffer_caps(struct wlr_renderer *wlr_renderer)
 	return WLR_BUFFER_CAP_DMABUF;
 }
 
+static int64_t vulkan_get_gpu_time(struct wlr_renderer *wlr_renderer) {
+	struct wlr_vk_renderer *renderer = vulkan_get_renderer(wlr_renderer);
+	return renderer->gpu_time_ns;
+}
+
 static const struct wlr_renderer_impl renderer_impl = {
 	.bind_buffer = vulkan_bind_buffer,
 	.begin = vulkan_begin,
@@ -992,6 +1023,7 @@ static const struct wlr_renderer_impl renderer_impl = {
 	.get_drm_fd = vulkan_get_drm_fd,
 	.get_render_buffer_caps = vulkan_get_render_buffer_caps,
 	.texture_from_buffer = vulkan_texture_from_buffer,
+	.get_gpu_time = vulkan_get_gpu_time,
 };
 
 // Initializes the VkDescriptorSetLayout and VkPipelineLayout needed
@@ -1134,10 +1166,8 @@ static bool init_tex_pipeline(struct wlr_vk_renderer *renderer,
 	pinfo.pDynamicState = &dynamic;
 	pinfo.pVertexInputState = &vertex;
 
-	// NOTE: use could use a cache here for faster loading
-	// store it somewhere like $XDG_CACHE_HOME/wlroots/vk_pipe_cache
-	VkPipelineCache cache = VK_NULL_HANDLE;
-	res = vkCreateGraphicsPipelines(dev, cache, 1, &pinfo, NULL, pipe);
+	res = vkCreateGraphicsPipelines(dev, renderer->pipeline_cache, 1, &pinfo,
+		NULL, pipe);
 	if (res != VK_SUCCESS) {
 		wlr_vk_error("failed to create vulkan pipelines:", res);
 		return false;
@@ -1211,16 +1241,9 @@ static bool init_static_render_data(struct wlr_vk_renderer *renderer) {
 	return true;
 }
 
-static struct wlr_vk_render_format_setup *find_or_create_render_setup(
+static struct wlr_vk_render_format_setup *create_render_setup(
 		struct wlr_vk_renderer *renderer, VkFormat format) {
-	struct wlr_vk_render_format_setup *setup;
-	wl_list_for_each(setup, &renderer->render_format_setups, link) {
-		if (setup->render_format == format) {
-			return setup;
-		}
-	}
-
-	setup = calloc(1u, sizeof(*setup));
+	struct wlr_vk_render_format_setup *setup = calloc(1u, sizeof(*setup));
 	if (!setup) {
 		wlr_log(WLR_ERROR, "Allocation failed");
 		return NULL;
@@ -1377,10 +1400,8 @@ static struct wlr_vk_render_format_setup *find_or_create_render_setup(
 	pinfo.pDynamicState = &dynamic;
 	pinfo.pVertexInputState = &vertex;
 
-	// NOTE: use could use a cache here for faster loading
-	// store it somewhere like $XDG_CACHE_HOME/wlroots/vk_pipe_cache.bin
-	VkPipelineCache cache = VK_NULL_HANDLE;
-	res = vkCreateGraphicsPipelines(dev, cache, 1, &pinfo, NULL, &setup->quad_pipe);
+	res = vkCreateGraphicsPipelines(dev, renderer->pipeline_cache, 1, &pinfo,
+		NULL, &setup->quad_pipe);
 	if (res != VK_SUCCESS) {
 		wlr_log(WLR_ERROR, "failed to create vulkan quad pipeline: %d", res);
 		goto error;
@@ -1394,6 +1415,63 @@ error:
 	return NULL;
 }
 
+static struct wlr_vk_render_format_setup *find_or_create_render_setup(
+		struct wlr_vk_renderer *renderer, VkFormat format) {
+	struct wlr_vk_render_format_setup *setup;
+	wl_list_for_each(setup, &renderer->render_format_setups, link) {
+		if (setup->render_format == format) {
+			return setup;
+		}
+	}
+
+	setup = create_render_setup(renderer, format);
+	if (setup) {
+		// new pipelines were compiled, persist them for the next start
+		vulkan_save_pipeline_cache(renderer->dev, renderer->pipeline_cache);
+	}
+	return setup;
+}
+
+// Eagerly creates the render passes and pipelines for every format we can
+// render to, so that the first frame on a new output (or after hotplug)
+// doesn't stall on pipeline compilation.
+static void init_render_setups(struct wlr_vk_renderer *renderer) {
+	size_t format_count;
+	const struct wlr_vk_format *formats = vulkan_get_format_list(&format_count);
+
+	bool created = false;
+	for (size_t i = 0; i < format_count; ++i) {
+		const struct wlr_vk_format *fmt = &formats[i];
+		if (!wlr_drm_format_set_get(&renderer->dev->dmabuf_render_formats,
+				fmt->drm_format)) {
+			continue;
+		}
+
+		bool found = false;
+		struct wlr_vk_render_format_setup *setup;
+		wl_list_for_each(setup, &renderer->render_format_setups, link) {
+			if (setup->render_format == fmt->vk_format) {
+				found = true;
+				break;
+			}
+		}
+		if (found) {
+			continue;
+		}
+
+		if (!create_render_setup(renderer, fmt->vk_format)) {
+			wlr_log(WLR_DEBUG, "Failed to create render setup for "
+				"format 0x%"PRIX32, fmt->drm_format);
+			continue;
+		}
+		created = true;
+	}
+
+	if (created) {
+		vulkan_save_pipeline_cache(renderer->dev, renderer->pipeline_cache);
+	}
+}
+
 struct wlr_renderer *vulkan_renderer_create_for_device(struct wlr_vk_device *dev) {
 	struct wlr_vk_renderer *renderer;
 	VkResult res;
@@ -1412,10 +1490,14 @@ struct wlr_renderer *vulkan_renderer_create_for_device(struct wlr_vk_device *dev
 	wl_list_init(&renderer->render_format_setups);
 	wl_list_init(&renderer->render_buffers);
 
+	renderer->pipeline_cache = vulkan_load_pipeline_cache(dev);
+
 	if (!init_static_render_data(renderer)) {
 		goto error;
 	}
 
+	init_render_setups(renderer);
+
 	// command pool
 	VkCommandPoolCreateInfo cpool_info = {0};
 	cpool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
@@ -1448,6 +1530,21 @@ struct wlr_renderer *vulkan_renderer_create_for_device(struct wlr_vk_device *dev
 		goto error;
 	}
 
+	renderer->gpu_time_ns = -1;
+	if (dev->timestamp_valid_bits > 0) {
+		VkQueryPoolCreateInfo query_info = {0};
+		query_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		query_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		query_info.queryCount = 2;
+		res = vkCreateQueryPool(dev->dev, &query_info, NULL,
+			&renderer->timestamp_pool);
+		if (res != VK_SUCCESS) {
+			// not fatal, we just won't report GPU times
+			wlr_vk_error("vkCreateQueryPool", res);
+			renderer->timestamp_pool = VK_NULL_HANDLE;
+		}
+	}
+
 	// staging command buffer
 	VkCommandBufferAllocateInfo cmd_buf_info = {0};
 	cmd_buf_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -10,6 +10,7 @@
 #include <wlr/util/log.h>
 #include "render/pixel_format.h"
 #include "render/vulkan.h"
+#include "util/pixel_convert.h"
 
 static const struct wlr_texture_impl texture_impl;
 
@@ -97,17 +98,8 @@ static bool write_pixels(struct wlr_texture *wlr_texture,
 	// write data into staging buffer span
 	pdata += stride * src_y;
 	pdata += bytespb * src_x;
-	if (src_x == 0 && width == texture->wlr_texture.width &&
-			stride == packed_stride) {
-		memcpy(map, pdata, packed_stride * height);
-		map += packed_stride * height;
-	} else {
-		for (unsigned i = 0u; i < height; ++i) {
-			memcpy(map, pdata, packed_stride);
-			pdata += stride;
-			map += packed_stride;
-		}
-	}
+	pixel_copy(map, packed_stride, pdata, stride, packed_stride, height);
+	map += packed_stride * height;
 
 	VkBufferImageCopy copy;
 	copy.imageExtent.width = width;
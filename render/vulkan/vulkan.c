@@ -462,11 +462,16 @@ struct wlr_vk_device *vulkan_device_create(struct wlr_vk_instance *ini,
 			graphics_found = queue_props[i].queueFlags & VK_QUEUE_GRAPHICS_BIT;
 			if (graphics_found) {
 				dev->queue_family = i;
+				dev->timestamp_valid_bits = queue_props[i].timestampValidBits;
 				break;
 			}
 		}
 
 		assert(graphics_found);
+
+		VkPhysicalDeviceProperties props;
+		vkGetPhysicalDeviceProperties(phdev, &props);
+		dev->timestamp_period = props.limits.timestampPeriod;
 	}
 
 	const float prio = 1.f;
@@ -1,8 +1,10 @@
 #define _POSIX_C_SOURCE 200809L
 #include <assert.h>
 #include <fcntl.h>
+#include <math.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 #include <wlr/render/interface.h>
 #include <wlr/render/pixman.h>
@@ -27,6 +29,7 @@
 
 #include "backend/backend.h"
 #include "util/signal.h"
+#include "util/time.h"
 #include "render/pixel_format.h"
 #include "render/wlr_renderer.h"
 
@@ -40,6 +43,7 @@ void wlr_renderer_init(struct wlr_renderer *renderer,
 	assert(impl->get_shm_texture_formats);
 	assert(impl->get_render_buffer_caps);
 	renderer->impl = impl;
+	renderer->stats.last.gpu_time_ns = -1;
 
 	wl_signal_init(&renderer->events.destroy);
 }
@@ -71,6 +75,13 @@ bool renderer_bind_buffer(struct wlr_renderer *r, struct wlr_buffer *buffer) {
 void wlr_renderer_begin(struct wlr_renderer *r, uint32_t width, uint32_t height) {
 	assert(!r->rendering);
 
+	r->stats.current = (struct wlr_render_pass_stats){0};
+	r->stats.texture = NULL;
+	r->stats.width = width;
+	r->stats.height = height;
+	r->stats.scissor_area = (uint64_t)width * height;
+	clock_gettime(CLOCK_MONOTONIC, &r->stats.start);
+
 	r->impl->begin(r, width, height);
 
 	r->rendering = true;
@@ -93,6 +104,17 @@ void wlr_renderer_end(struct wlr_renderer *r) {
 		r->impl->end(r);
 	}
 
+	struct wlr_render_pass_stats *stats = &r->stats.current;
+	struct timespec now, elapsed;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	timespec_sub(&elapsed, &now, &r->stats.start);
+	stats->cpu_time_ns = (int64_t)elapsed.tv_sec * 1000000000 + elapsed.tv_nsec;
+	stats->gpu_time_ns = -1;
+	if (r->impl->get_gpu_time) {
+		stats->gpu_time_ns = r->impl->get_gpu_time(r);
+	}
+	r->stats.last = *stats;
+
 	r->rendering = false;
 
 	if (r->rendering_with_buffer) {
@@ -103,14 +125,32 @@ void wlr_renderer_end(struct wlr_renderer *r) {
 
 void wlr_renderer_clear(struct wlr_renderer *r, const float color[static 4]) {
 	assert(r->rendering);
+	r->stats.current.clears++;
+	r->stats.current.pixels += r->stats.scissor_area;
 	r->impl->clear(r, color);
 }
 
 void wlr_renderer_scissor(struct wlr_renderer *r, struct wlr_box *box) {
 	assert(r->rendering);
+	r->stats.current.scissor_changes++;
+	if (box != NULL) {
+		r->stats.scissor_area = (uint64_t)box->width * box->height;
+	} else {
+		r->stats.scissor_area = (uint64_t)r->stats.width * r->stats.height;
+	}
 	r->impl->scissor(r, box);
 }
 
+// Accounts for a draw of the unit square transformed by matrix, which maps
+// to normalized device coordinates
+static void account_draw(struct wlr_renderer *r, const float matrix[static 9]) {
+	struct wlr_render_pass_stats *stats = &r->stats.current;
+	stats->draws++;
+	double area = fabs((double)matrix[0] * matrix[4] -
+		(double)matrix[1] * matrix[3]);
+	stats->pixels += (uint64_t)(area * r->stats.width * r->stats.height / 4);
+}
+
 bool wlr_render_texture(struct wlr_renderer *r, struct wlr_texture *texture,
 		const float projection[static 9], int x, int y, float alpha) {
 	struct wlr_box box = {
@@ -143,6 +183,11 @@ bool wlr_render_subtexture_with_matrix(struct wlr_renderer *r,
 		struct wlr_texture *texture, const struct wlr_fbox *box,
 		const float matrix[static 9], float alpha) {
 	assert(r->rendering);
+	account_draw(r, matrix);
+	if (texture != r->stats.texture) {
+		r->stats.current.texture_binds++;
+		r->stats.texture = texture;
+	}
 	return r->impl->render_subtexture_with_matrix(r, texture,
 		box, matrix, alpha);
 }
@@ -163,6 +208,7 @@ void wlr_render_rect(struct wlr_renderer *r, const struct wlr_box *box,
 void wlr_render_quad_with_matrix(struct wlr_renderer *r,
 		const float color[static 4], const float matrix[static 9]) {
 	assert(r->rendering);
+	account_draw(r, matrix);
 	r->impl->render_quad_with_matrix(r, color, matrix);
 }
 
@@ -202,6 +248,11 @@ bool wlr_renderer_read_pixels(struct wlr_renderer *r, uint32_t fmt,
 		src_x, src_y, dst_x, dst_y, data);
 }
 
+void wlr_renderer_get_pass_stats(struct wlr_renderer *r,
+		struct wlr_render_pass_stats *stats) {
+	*stats = r->stats.last;
+}
+
 bool wlr_renderer_init_wl_shm(struct wlr_renderer *r,
 		struct wl_display *wl_display) {
 	if (wl_display_init_shm(wl_display) != 0) {
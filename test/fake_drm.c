@@ -0,0 +1,1529 @@
+#define _POSIX_C_SOURCE 200809L
+#include <assert.h>
+#include <drm_fourcc.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+#include <wayland-server-core.h>
+#include <wlr/backend/session.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include "fake_drm.h"
+
+#define FAKE_DRM_MAX_CRTCS 8
+#define FAKE_DRM_MAX_PLANES 32
+#define FAKE_DRM_MAX_CONNECTORS 8
+#define FAKE_DRM_MAX_FORMATS 8
+#define FAKE_DRM_MAX_MODES 8
+#define FAKE_DRM_MAX_FB_SIZE 16384
+
+enum fake_drm_prop {
+	PROP_CRTC_ID,
+	PROP_DPMS,
+	PROP_LINK_STATUS,
+	PROP_NON_DESKTOP,
+	PROP_VRR_CAPABLE,
+	PROP_ACTIVE,
+	PROP_MODE_ID,
+	PROP_VRR_ENABLED,
+	PROP_GAMMA_LUT,
+	PROP_GAMMA_LUT_SIZE,
+	PROP_TYPE,
+	PROP_FB_ID,
+	PROP_SRC_X,
+	PROP_SRC_Y,
+	PROP_SRC_W,
+	PROP_SRC_H,
+	PROP_CRTC_X,
+	PROP_CRTC_Y,
+	PROP_CRTC_W,
+	PROP_CRTC_H,
+	PROP_ZPOS,
+	PROP_COUNT,
+};
+
+static const struct {
+	const char *name;
+	uint32_t flags;
+} prop_info[PROP_COUNT] = {
+	[PROP_CRTC_ID] = { "CRTC_ID", DRM_MODE_PROP_OBJECT },
+	[PROP_DPMS] = { "DPMS", DRM_MODE_PROP_ENUM },
+	[PROP_LINK_STATUS] = { "link-status", DRM_MODE_PROP_ENUM },
+	[PROP_NON_DESKTOP] = { "non-desktop",
+		DRM_MODE_PROP_RANGE | DRM_MODE_PROP_IMMUTABLE },
+	[PROP_VRR_CAPABLE] = { "vrr_capable",
+		DRM_MODE_PROP_RANGE | DRM_MODE_PROP_IMMUTABLE },
+	[PROP_ACTIVE] = { "ACTIVE", DRM_MODE_PROP_RANGE },
+	[PROP_MODE_ID] = { "MODE_ID", DRM_MODE_PROP_BLOB },
+	[PROP_VRR_ENABLED] = { "VRR_ENABLED", DRM_MODE_PROP_RANGE },
+	[PROP_GAMMA_LUT] = { "GAMMA_LUT", DRM_MODE_PROP_BLOB },
+	[PROP_GAMMA_LUT_SIZE] = { "GAMMA_LUT_SIZE",
+		DRM_MODE_PROP_RANGE | DRM_MODE_PROP_IMMUTABLE },
+	[PROP_TYPE] = { "type", DRM_MODE_PROP_ENUM | DRM_MODE_PROP_IMMUTABLE },
+	[PROP_FB_ID] = { "FB_ID", DRM_MODE_PROP_OBJECT },
+	[PROP_SRC_X] = { "SRC_X", DRM_MODE_PROP_RANGE },
+	[PROP_SRC_Y] = { "SRC_Y", DRM_MODE_PROP_RANGE },
+	[PROP_SRC_W] = { "SRC_W", DRM_MODE_PROP_RANGE },
+	[PROP_SRC_H] = { "SRC_H", DRM_MODE_PROP_RANGE },
+	[PROP_CRTC_X] = { "CRTC_X", DRM_MODE_PROP_SIGNED_RANGE },
+	[PROP_CRTC_Y] = { "CRTC_Y", DRM_MODE_PROP_SIGNED_RANGE },
+	[PROP_CRTC_W] = { "CRTC_W", DRM_MODE_PROP_RANGE },
+	[PROP_CRTC_H] = { "CRTC_H", DRM_MODE_PROP_RANGE },
+	[PROP_ZPOS] = { "zpos", DRM_MODE_PROP_RANGE | DRM_MODE_PROP_IMMUTABLE },
+};
+
+struct fake_drm_object {
+	uint32_t id;
+	uint32_t type;
+	uint32_t props; // bitmask of enum fake_drm_prop
+	uint64_t values[PROP_COUNT];
+};
+
+struct fake_drm_crtc {
+	struct fake_drm_object obj;
+	bool flip_pending;
+	uint64_t seq;
+	uint64_t vblank_ns;
+};
+
+struct fake_drm_plane {
+	struct fake_drm_object obj;
+	uint32_t possible_crtcs;
+	uint32_t formats[FAKE_DRM_MAX_FORMATS];
+	size_t formats_len;
+};
+
+struct fake_drm_connector {
+	struct fake_drm_object obj;
+	uint32_t encoder_id;
+	uint32_t type_id;
+	uint32_t possible_crtcs;
+	bool connected;
+	drmModeModeInfo modes[FAKE_DRM_MAX_MODES];
+	size_t modes_len;
+};
+
+struct fake_drm_blob {
+	uint32_t id;
+	size_t size;
+	struct wl_list link;
+	uint8_t data[];
+};
+
+struct fake_drm_fb {
+	uint32_t id;
+	uint32_t width, height;
+	uint32_t format;
+	struct wl_list link;
+};
+
+struct fake_drm_handle {
+	uint32_t handle;
+	struct wl_list link;
+};
+
+struct fake_drm_event {
+	uint32_t crtc_id;
+	void *user_data;
+	struct wl_list link;
+};
+
+struct fake_drm_device {
+	int fd;
+	bool opened;
+	bool atomic;
+	uint32_t next_id;
+	uint32_t next_handle;
+
+	struct fake_drm_crtc crtcs[FAKE_DRM_MAX_CRTCS];
+	size_t crtcs_len;
+	struct fake_drm_plane planes[FAKE_DRM_MAX_PLANES];
+	size_t planes_len;
+	struct fake_drm_connector connectors[FAKE_DRM_MAX_CONNECTORS];
+	size_t connectors_len;
+
+	struct wl_list blobs; // fake_drm_blob.link
+	struct wl_list fbs; // fake_drm_fb.link
+	struct wl_list handles; // fake_drm_handle.link
+	struct wl_list events; // fake_drm_event.link
+
+	int fail_commits;
+	int fail_error;
+
+	struct fake_drm_device_stats stats;
+
+	struct wl_list link;
+};
+
+struct fake_drm_atomic_item {
+	uint32_t obj_id;
+	uint32_t prop_id;
+	uint64_t value;
+};
+
+// libdrm keeps this type opaque
+struct _drmModeAtomicReq {
+	struct fake_drm_atomic_item *items;
+	size_t len, cap;
+};
+
+// Properties of all objects, saved to roll back atomic commits
+struct fake_drm_state {
+	struct fake_drm_object crtcs[FAKE_DRM_MAX_CRTCS];
+	struct fake_drm_object planes[FAKE_DRM_MAX_PLANES];
+	struct fake_drm_object connectors[FAKE_DRM_MAX_CONNECTORS];
+};
+
+// Property IDs come first, object IDs are allocated after them
+static const uint32_t prop_id_base = 1;
+
+static struct wl_list devices = { &devices, &devices };
+
+static struct fake_drm_device *device_from_fd(int fd) {
+	struct fake_drm_device *dev;
+	wl_list_for_each(dev, &devices, link) {
+		if (dev->fd == fd) {
+			return dev;
+		}
+	}
+	abort();
+}
+
+static struct fake_drm_device *device_ioctl(int fd) {
+	struct fake_drm_device *dev = device_from_fd(fd);
+	dev->stats.ioctls++;
+	return dev;
+}
+
+static int fake_error(int error) {
+	errno = error;
+	return -error;
+}
+
+static int64_t get_time_ns(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void object_init(struct fake_drm_device *dev,
+		struct fake_drm_object *obj, uint32_t type) {
+	obj->id = dev->next_id++;
+	obj->type = type;
+}
+
+static void object_add_prop(struct fake_drm_object *obj,
+		enum fake_drm_prop prop, uint64_t value) {
+	obj->props |= 1u << prop;
+	obj->values[prop] = value;
+}
+
+static struct fake_drm_crtc *get_crtc(struct fake_drm_device *dev,
+		uint64_t id) {
+	for (size_t i = 0; i < dev->crtcs_len; i++) {
+		if (dev->crtcs[i].obj.id == id) {
+			return &dev->crtcs[i];
+		}
+	}
+	return NULL;
+}
+
+static struct fake_drm_plane *get_plane(struct fake_drm_device *dev,
+		uint64_t id) {
+	for (size_t i = 0; i < dev->planes_len; i++) {
+		if (dev->planes[i].obj.id == id) {
+			return &dev->planes[i];
+		}
+	}
+	return NULL;
+}
+
+static struct fake_drm_connector *get_connector(struct fake_drm_device *dev,
+		uint64_t id) {
+	for (size_t i = 0; i < dev->connectors_len; i++) {
+		if (dev->connectors[i].obj.id == id) {
+			return &dev->connectors[i];
+		}
+	}
+	return NULL;
+}
+
+static struct fake_drm_object *get_object(struct fake_drm_device *dev,
+		uint32_t id, uint32_t type) {
+	struct fake_drm_object *obj = NULL;
+	struct fake_drm_crtc *crtc;
+	struct fake_drm_plane *plane;
+	struct fake_drm_connector *conn;
+	if ((crtc = get_crtc(dev, id)) != NULL) {
+		obj = &crtc->obj;
+	} else if ((plane = get_plane(dev, id)) != NULL) {
+		obj = &plane->obj;
+	} else if ((conn = get_connector(dev, id)) != NULL) {
+		obj = &conn->obj;
+	}
+	if (obj == NULL || (type != DRM_MODE_OBJECT_ANY && obj->type != type)) {
+		return NULL;
+	}
+	return obj;
+}
+
+static struct fake_drm_blob *get_blob(struct fake_drm_device *dev,
+		uint64_t id) {
+	struct fake_drm_blob *blob;
+	wl_list_for_each(blob, &dev->blobs, link) {
+		if (blob->id == id) {
+			return blob;
+		}
+	}
+	return NULL;
+}
+
+static struct fake_drm_fb *get_fb(struct fake_drm_device *dev, uint64_t id) {
+	struct fake_drm_fb *fb;
+	wl_list_for_each(fb, &dev->fbs, link) {
+		if (fb->id == id) {
+			return fb;
+		}
+	}
+	return NULL;
+}
+
+static struct fake_drm_handle *get_handle(struct fake_drm_device *dev,
+		uint32_t handle) {
+	struct fake_drm_handle *h;
+	wl_list_for_each(h, &dev->handles, link) {
+		if (h->handle == handle) {
+			return h;
+		}
+	}
+	return NULL;
+}
+
+static struct fake_drm_plane *get_crtc_primary(struct fake_drm_device *dev,
+		uint32_t crtc_id) {
+	for (size_t i = 0; i < dev->planes_len; i++) {
+		struct fake_drm_plane *plane = &dev->planes[i];
+		if (plane->obj.values[PROP_TYPE] == DRM_PLANE_TYPE_PRIMARY &&
+				plane->obj.values[PROP_CRTC_ID] == crtc_id) {
+			return plane;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Get the bitmask of the CRTCs an object is bound to.
+ */
+static uint32_t object_get_crtc_mask(struct fake_drm_device *dev,
+		const struct fake_drm_object *obj) {
+	uint64_t crtc_id = obj->id;
+	if (obj->type != DRM_MODE_OBJECT_CRTC) {
+		crtc_id = obj->values[PROP_CRTC_ID];
+	}
+	struct fake_drm_crtc *crtc = get_crtc(dev, crtc_id);
+	if (crtc == NULL) {
+		return 0;
+	}
+	return 1u << (crtc - dev->crtcs);
+}
+
+static bool object_fill_props(const struct fake_drm_object *obj,
+		uint32_t *count, uint32_t **props, uint64_t **values) {
+	*count = 0;
+	*props = calloc(PROP_COUNT, sizeof(**props));
+	*values = calloc(PROP_COUNT, sizeof(**values));
+	if (*props == NULL || *values == NULL) {
+		free(*props);
+		free(*values);
+		*props = NULL;
+		*values = NULL;
+		return false;
+	}
+
+	for (size_t i = 0; i < PROP_COUNT; i++) {
+		if (obj->props & (1u << i)) {
+			(*props)[*count] = prop_id_base + i;
+			(*values)[*count] = obj->values[i];
+			(*count)++;
+		}
+	}
+	return true;
+}
+
+struct fake_drm_device *fake_drm_device_create(void) {
+	struct fake_drm_device *dev = calloc(1, sizeof(*dev));
+	if (dev == NULL) {
+		return NULL;
+	}
+
+	// Stands in for the device FD: readable while DRM events are pending
+	dev->fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (dev->fd < 0) {
+		free(dev);
+		return NULL;
+	}
+
+	dev->next_id = prop_id_base + PROP_COUNT;
+	dev->next_handle = 1;
+	wl_list_init(&dev->blobs);
+	wl_list_init(&dev->fbs);
+	wl_list_init(&dev->handles);
+	wl_list_init(&dev->events);
+	wl_list_insert(&devices, &dev->link);
+	return dev;
+}
+
+void fake_drm_device_destroy(struct fake_drm_device *dev) {
+	if (dev == NULL) {
+		return;
+	}
+	assert(!dev->opened);
+
+	struct fake_drm_blob *blob, *blob_tmp;
+	wl_list_for_each_safe(blob, blob_tmp, &dev->blobs, link) {
+		wl_list_remove(&blob->link);
+		free(blob);
+	}
+	struct fake_drm_fb *fb, *fb_tmp;
+	wl_list_for_each_safe(fb, fb_tmp, &dev->fbs, link) {
+		wl_list_remove(&fb->link);
+		free(fb);
+	}
+	struct fake_drm_handle *handle, *handle_tmp;
+	wl_list_for_each_safe(handle, handle_tmp, &dev->handles, link) {
+		wl_list_remove(&handle->link);
+		free(handle);
+	}
+	struct fake_drm_event *event, *event_tmp;
+	wl_list_for_each_safe(event, event_tmp, &dev->events, link) {
+		wl_list_remove(&event->link);
+		free(event);
+	}
+
+	wl_list_remove(&dev->link);
+	close(dev->fd);
+	free(dev);
+}
+
+struct wlr_device *fake_drm_device_open(struct fake_drm_device *dev) {
+	assert(!dev->opened);
+
+	struct wlr_device *wlr_dev = calloc(1, sizeof(*wlr_dev));
+	if (wlr_dev == NULL) {
+		return NULL;
+	}
+	wlr_dev->fd = dev->fd;
+	wl_list_init(&wlr_dev->link);
+	wl_signal_init(&wlr_dev->events.change);
+	wl_signal_init(&wlr_dev->events.remove);
+
+	dev->opened = true;
+	return wlr_dev;
+}
+
+uint32_t fake_drm_device_add_crtc(struct fake_drm_device *dev) {
+	assert(!dev->opened && dev->crtcs_len < FAKE_DRM_MAX_CRTCS);
+
+	struct fake_drm_crtc *crtc = &dev->crtcs[dev->crtcs_len++];
+	object_init(dev, &crtc->obj, DRM_MODE_OBJECT_CRTC);
+	object_add_prop(&crtc->obj, PROP_ACTIVE, 0);
+	object_add_prop(&crtc->obj, PROP_MODE_ID, 0);
+	object_add_prop(&crtc->obj, PROP_VRR_ENABLED, 0);
+	object_add_prop(&crtc->obj, PROP_GAMMA_LUT, 0);
+	object_add_prop(&crtc->obj, PROP_GAMMA_LUT_SIZE, FAKE_DRM_GAMMA_SIZE);
+	return crtc->obj.id;
+}
+
+uint32_t fake_drm_device_add_plane(struct fake_drm_device *dev, uint32_t type,
+		uint32_t possible_crtcs, const uint32_t *formats, size_t formats_len) {
+	assert(!dev->opened && dev->planes_len < FAKE_DRM_MAX_PLANES);
+	assert(formats_len <= FAKE_DRM_MAX_FORMATS);
+
+	struct fake_drm_plane *plane = &dev->planes[dev->planes_len++];
+	object_init(dev, &plane->obj, DRM_MODE_OBJECT_PLANE);
+	plane->possible_crtcs = possible_crtcs;
+	memcpy(plane->formats, formats, formats_len * sizeof(formats[0]));
+	plane->formats_len = formats_len;
+
+	object_add_prop(&plane->obj, PROP_TYPE, type);
+	object_add_prop(&plane->obj, PROP_FB_ID, 0);
+	object_add_prop(&plane->obj, PROP_CRTC_ID, 0);
+	for (enum fake_drm_prop prop = PROP_SRC_X; prop <= PROP_CRTC_H; prop++) {
+		object_add_prop(&plane->obj, prop, 0);
+	}
+	if (type == DRM_PLANE_TYPE_OVERLAY) {
+		object_add_prop(&plane->obj, PROP_ZPOS, dev->planes_len);
+	}
+	return plane->obj.id;
+}
+
+uint32_t fake_drm_device_add_connector(struct fake_drm_device *dev,
+		uint32_t possible_crtcs, const drmModeModeInfo *modes,
+		size_t modes_len) {
+	assert(!dev->opened && dev->connectors_len < FAKE_DRM_MAX_CONNECTORS);
+	assert(modes_len <= FAKE_DRM_MAX_MODES);
+
+	struct fake_drm_connector *conn = &dev->connectors[dev->connectors_len++];
+	object_init(dev, &conn->obj, DRM_MODE_OBJECT_CONNECTOR);
+	conn->encoder_id = dev->next_id++;
+	conn->type_id = dev->connectors_len;
+	conn->possible_crtcs = possible_crtcs;
+	conn->connected = true;
+	memcpy(conn->modes, modes, modes_len * sizeof(modes[0]));
+	conn->modes_len = modes_len;
+
+	object_add_prop(&conn->obj, PROP_CRTC_ID, 0);
+	object_add_prop(&conn->obj, PROP_DPMS, DRM_MODE_DPMS_ON);
+	object_add_prop(&conn->obj, PROP_LINK_STATUS, DRM_MODE_LINK_STATUS_GOOD);
+	object_add_prop(&conn->obj, PROP_NON_DESKTOP, 0);
+	object_add_prop(&conn->obj, PROP_VRR_CAPABLE, 0);
+	return conn->obj.id;
+}
+
+void fake_drm_device_set_connected(struct fake_drm_device *dev,
+		uint32_t conn_id, bool connected) {
+	struct fake_drm_connector *conn = get_connector(dev, conn_id);
+	assert(conn != NULL);
+	conn->connected = connected;
+}
+
+void fake_drm_device_fail_commits(struct fake_drm_device *dev, int count,
+		int error) {
+	dev->fail_commits = count;
+	dev->fail_error = error;
+}
+
+bool fake_drm_device_get_prop(struct fake_drm_device *dev, uint32_t obj_id,
+		const char *name, uint64_t *value) {
+	struct fake_drm_object *obj =
+		get_object(dev, obj_id, DRM_MODE_OBJECT_ANY);
+	if (obj == NULL) {
+		return false;
+	}
+	for (size_t i = 0; i < PROP_COUNT; i++) {
+		if ((obj->props & (1u << i)) && strcmp(prop_info[i].name, name) == 0) {
+			*value = obj->values[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+const struct fake_drm_device_stats *fake_drm_device_get_stats(
+		struct fake_drm_device *dev) {
+	return &dev->stats;
+}
+
+static void fake_close(struct wlr_session *session, struct wlr_device *wlr_dev) {
+	struct fake_drm_device *dev = device_from_fd(wlr_dev->fd);
+	dev->opened = false;
+	dev->atomic = false;
+
+	wl_list_remove(&wlr_dev->link);
+	free(wlr_dev);
+}
+
+static char *fake_get_device_name_from_fd2(int fd) {
+	device_from_fd(fd);
+	return strdup("/dev/dri/fake");
+}
+
+static drmVersion *fake_get_version(int fd) {
+	device_ioctl(fd);
+
+	drmVersion *version = calloc(1, sizeof(*version));
+	if (version == NULL) {
+		return NULL;
+	}
+	version->name = strdup("fake");
+	version->date = strdup("0");
+	version->desc = strdup("Fake KMS device");
+	if (version->name == NULL || version->date == NULL ||
+			version->desc == NULL) {
+		drmFreeVersion(version);
+		return NULL;
+	}
+	version->name_len = strlen(version->name);
+	version->date_len = strlen(version->date);
+	version->desc_len = strlen(version->desc);
+	return version;
+}
+
+static int fake_get_cap(int fd, uint64_t cap, uint64_t *value) {
+	device_ioctl(fd);
+
+	switch (cap) {
+	case DRM_CAP_CURSOR_WIDTH:
+	case DRM_CAP_CURSOR_HEIGHT:
+		*value = 64;
+		return 0;
+	case DRM_CAP_PRIME:
+		*value = DRM_PRIME_CAP_IMPORT | DRM_PRIME_CAP_EXPORT;
+		return 0;
+	case DRM_CAP_TIMESTAMP_MONOTONIC:
+	case DRM_CAP_CRTC_IN_VBLANK_EVENT:
+		*value = 1;
+		return 0;
+	case DRM_CAP_ADDFB2_MODIFIERS:
+	case DRM_CAP_ASYNC_PAGE_FLIP:
+		*value = 0;
+		return 0;
+	default:
+		return fake_error(EINVAL);
+	}
+}
+
+static int fake_set_client_cap(int fd, uint64_t cap, uint64_t value) {
+	struct fake_drm_device *dev = device_ioctl(fd);
+
+	switch (cap) {
+	case DRM_CLIENT_CAP_UNIVERSAL_PLANES:
+		return 0;
+	case DRM_CLIENT_CAP_ATOMIC:
+		dev->atomic = value != 0;
+		return 0;
+	default:
+		return fake_error(EINVAL);
+	}
+}
+
+static drmModeRes *fake_get_resources(int fd) {
+	struct fake_drm_device *dev = device_ioctl(fd);
+
+	drmModeRes *res = calloc(1, sizeof(*res));
+	if (res == NULL) {
+		return NULL;
+	}
+	res->crtcs = calloc(FAKE_DRM_MAX_CRTCS, sizeof(uint32_t));
+	res->connectors = calloc(FAKE_DRM_MAX_CONNECTORS, sizeof(uint32_t));
+	res->encoders = calloc(FAKE_DRM_MAX_CONNECTORS, sizeof(uint32_t));
+	if (res->crtcs == NULL || res->connectors == NULL ||
+			res->encoders == NULL) {
+		drmModeFreeResources(res);
+		return NULL;
+	}
+
+	for (size_t i = 0; i < dev->crtcs_len; i++) {
+		res->crtcs[res->count_crtcs++] = dev->crtcs[i].obj.id;
+	}
+	for (size_t i = 0; i < dev->connectors_len; i++) {
+		res->connectors[res->count_connectors++] = dev->connectors[i].obj.id;
+		res->encoders[res->count_encoders++] = dev->connectors[i].encoder_id;
+	}
+	res->max_width = FAKE_DRM_MAX_FB_SIZE;
+	res->max_height = FAKE_DRM_MAX_FB_SIZE;
+	return res;
+}
+
+static drmModeCrtc *fake_get_crtc(int fd, uint32_t crtc_id) {
+	struct fake_drm_device *dev = device_ioctl(fd);
+
+	struct fake_drm_crtc *crtc = get_crtc(dev, crtc_id);
+	if (crtc == NULL) {
+		fake_error(ENOENT);
+		return NULL;
+	}
+
+	drmModeCrtc *drm_crtc = calloc(1, sizeof(*drm_crtc));
+	if (drm_crtc == NULL) {
+		return NULL;
+	}
+	drm_crtc->crtc_id = crtc->obj.id;
+	drm_crtc->gamma_size = FAKE_DRM_GAMMA_SIZE;
+
+	struct fake_drm_blob *mode = get_blob(dev, crtc->obj.values[PROP_MODE_ID]);
+	if (mode != NULL) {
+		drm_crtc->mode_valid = 1;
+		memcpy(&drm_crtc->mode, mode->data, sizeof(drm_crtc->mode));
+		drm_crtc->width = drm_crtc->mode.hdisplay;
+		drm_crtc->height = drm_crtc->mode.vdisplay;
+	}
+
+	struct fake_drm_plane *primary = get_crtc_primary(dev, crtc->obj.id);
+	if (primary != NULL) {
+		drm_crtc->buffer_id = primary->obj.values[PROP_FB_ID];
+	}
+	return drm_crtc;
+}
+
+static drmModeEncoder *fake_get_encoder(int fd, uint32_t encoder_id) {
+	struct fake_drm_device *dev = device_ioctl(fd);
+
+	struct fake_drm_connector *conn = NULL;
+	for (size_t i = 0; i < dev->connectors_len; i++) {
+		if (dev->connectors[i].encoder_id == encoder_id) {
+			conn = &dev->connectors[i];
+			break;
+		}
+	}
+	if (conn == NULL) {
+		fake_error(ENOENT);
+		return NULL;
+	}
+
+	drmModeEncoder *enc = calloc(1, sizeof(*enc));
+	if (enc == NULL) {
+		return NULL;
+	}
+	enc->encoder_id = encoder_id;
+	enc->crtc_id = conn->obj.values[PROP_CRTC_ID];
+	enc->possible_crtcs = conn->possible_crtcs;
+	return enc;
+}
+
+static drmModeConnector *fake_get_connector(int fd, uint32_t connector_id) {
+	struct fake_drm_device *dev = device_ioctl(fd);
+
+	struct fake_drm_connector *conn = get_connector(dev, connector_id);
+	if (conn == NULL) {
+		fake_error(ENOENT);
+		return NULL;
+	}
+
+	drmModeConnector *drm_conn = calloc(1, sizeof(*drm_conn));
+	if (drm_conn == NULL) {
+		return NULL;
+	}
+	drm_conn->connector_id = conn->obj.id;
+	drm_conn->connector_type = DRM_MODE_CONNECTOR_HDMIA;
+	drm_conn->connector_type_id = conn->type_id;
+	drm_conn->subpixel = DRM_MODE_SUBPIXEL_UNKNOWN;
+	if (conn->obj.values[PROP_CRTC_ID] != 0) {
+		drm_conn->encoder_id = conn->encoder_id;
+	}
+
+	drm_conn->encoders = calloc(1, sizeof(uint32_t));
+	drm_conn->modes = calloc(FAKE_DRM_MAX_MODES, sizeof(drmModeModeInfo));
+	uint32_t props_len;
+	if (drm_conn->encoders == NULL || drm_conn->modes == NULL ||
+			!object_fill_props(&conn->obj, &props_len, &drm_conn->props,
+				&drm_conn->prop_values)) {
+		drmModeFreeConnector(drm_conn);
+		return NULL;
+	}
+	drm_conn->count_props = props_len;
+	drm_conn->encoders[drm_conn->count_encoders++] = conn->encoder_id;
+
+	if (conn->connected) {
+		drm_conn->connection = DRM_MODE_CONNECTED;
+		drm_conn->mmWidth = 600;
+		drm_conn->mmHeight = 340;
+		memcpy(drm_conn->modes, conn->modes,
+			conn->modes_len * sizeof(conn->modes[0]));
+		drm_conn->count_modes = conn->modes_len;
+	} else {
+		drm_conn->connection = DRM_MODE_DISCONNECTED;
+	}
+	return drm_conn;
+}
+
+static drmModePlaneRes *fake_get_plane_resources(int fd) {
+	struct fake_drm_device *dev = device_ioctl(fd);
+
+	drmModePlaneRes *res = calloc(1, sizeof(*res));
+	if (res == NULL) {
+		return NULL;
+	}
+	res->planes = calloc(FAKE_DRM_MAX_PLANES, sizeof(uint32_t));
+	if (res->planes == NULL) {
+		drmModeFreePlaneResources(res);
+		return NULL;
+	}
+	for (size_t i = 0; i < dev->planes_len; i++) {
+		res->planes[res->count_planes++] = dev->planes[i].obj.id;
+	}
+	return res;
+}
+
+static drmModePlane *fake_get_plane(int fd, uint32_t plane_id) {
+	struct fake_drm_device *dev = device_ioctl(fd);
+
+	struct fake_drm_plane *plane = get_plane(dev, plane_id);
+	if (plane == NULL) {
+		fake_error(ENOENT);
+		return NULL;
+	}
+
+	drmModePlane *drm_plane = calloc(1, sizeof(*drm_plane));
+	if (drm_plane == NULL) {
+		return NULL;
+	}
+	drm_plane->formats = calloc(FAKE_DRM_MAX_FORMATS, sizeof(uint32_t));
+	if (drm_plane->formats == NULL) {
+		drmModeFreePlane(drm_plane);
+		return NULL;
+	}
+	memcpy(drm_plane->formats, plane->formats,
+		plane->formats_len * sizeof(plane->formats[0]));
+	drm_plane->count_formats = plane->formats_len;
+	drm_plane->plane_id = plane->obj.id;
+	drm_plane->crtc_id = plane->obj.values[PROP_CRTC_ID];
+	drm_plane->fb_id = plane->obj.values[PROP_FB_ID];
+	drm_plane->possible_crtcs = plane->possible_crtcs;
+	return drm_plane;
+}
+
+static drmModeFB *fake_get_fb(int fd, uint32_t fb_id) {
+	struct fake_drm_device *dev = device_ioctl(fd);
+
+	struct fake_drm_fb *fb = get_fb(dev, fb_id);
+	if (fb == NULL) {
+		fake_error(ENOENT);
+		return NULL;
+	}
+
+	drmModeFB *drm_fb = calloc(1, sizeof(*drm_fb));
+	if (drm_fb == NULL) {
+		return NULL;
+	}
+	drm_fb->fb_id = fb->id;
+	drm_fb->width = fb->width;
+	drm_fb->height = fb->height;
+	drm_fb->pitch = fb->width * 4;
+	drm_fb->bpp = 32;
+	drm_fb->depth = fb->format == DRM_FORMAT_ARGB8888 ? 32 : 24;
+	return drm_fb;
+}
+
+static drmModeObjectProperties *fake_object_get_properties(int fd,
+		uint32_t obj_id, uint32_t obj_type) {
+	struct fake_drm_device *dev = device_ioctl(fd);
+
+	struct fake_drm_object *obj = get_object(dev, obj_id, obj_type);
+	if (obj == NULL) {
+		fake_error(ENOENT);
+		return NULL;
+	}
+
+	drmModeObjectProperties *props = calloc(1, sizeof(*props));
+	if (props == NULL) {
+		return NULL;
+	}
+	if (!object_fill_props(obj, &props->count_props, &props->props,
+			&props->prop_values)) {
+		free(props);
+		return NULL;
+	}
+	return props;
+}
+
+static drmModePropertyRes *fake_get_property(int fd, uint32_t prop_id) {
+	device_ioctl(fd);
+
+	uint32_t index = prop_id - prop_id_base;
+	if (prop_id < prop_id_base || index >= PROP_COUNT) {
+		fake_error(ENOENT);
+		return NULL;
+	}
+
+	drmModePropertyRes *prop = calloc(1, sizeof(*prop));
+	if (prop == NULL) {
+		return NULL;
+	}
+	prop->prop_id = prop_id;
+	prop->flags = prop_info[index].flags;
+	snprintf(prop->name, sizeof(prop->name), "%s", prop_info[index].name);
+	return prop;
+}
+
+static drmModePropertyBlobRes *fake_get_property_blob(int fd,
+		uint32_t blob_id) {
+	struct fake_drm_device *dev = device_ioctl(fd);
+
+	struct fake_drm_blob *blob = get_blob(dev, blob_id);
+	if (blob == NULL) {
+		fake_error(ENOENT);
+		return NULL;
+	}
+
+	drmModePropertyBlobRes *res = calloc(1, sizeof(*res));
+	if (res == NULL) {
+		return NULL;
+	}
+	res->data = malloc(blob->size);
+	if (res->data == NULL) {
+		free(res);
+		return NULL;
+	}
+	res->id = blob->id;
+	res->length = blob->size;
+	memcpy(res->data, blob->data, blob->size);
+	return res;
+}
+
+static int fake_create_property_blob(int fd, const void *data, size_t size,
+		uint32_t *blob_id) {
+	struct fake_drm_device *dev = device_ioctl(fd);
+
+	if (size == 0) {
+		return fake_error(EINVAL);
+	}
+
+	struct fake_drm_blob *blob = calloc(1, sizeof(*blob) + size);
+	if (blob == NULL) {
+		return fake_error(ENOMEM);
+	}
+	blob->id = dev->next_id++;
+	blob->size = size;
+	memcpy(blob->data, data, size);
+	wl_list_insert(&dev->blobs, &blob->link);
+	dev->stats.blobs++;
+
+	*blob_id = blob->id;
+	return 0;
+}
+
+static int fake_destroy_property_blob(int fd, uint32_t blob_id) {
+	struct fake_drm_device *dev = device_ioctl(fd);
+
+	// The kernel keeps blobs alive while they're in use, properties
+	// referring to destroyed blobs aren't checked
+	struct fake_drm_blob *blob = get_blob(dev, blob_id);
+	if (blob == NULL) {
+		return fake_error(ENOENT);
+	}
+	wl_list_remove(&blob->link);
+	free(blob);
+	dev->stats.blobs--;
+	return 0;
+}
+
+static int fake_prime_fd_to_handle(int fd, int prime_fd, uint32_t *handle) {
+	struct fake_drm_device *dev = device_ioctl(fd);
+
+	if (fcntl(prime_fd, F_GETFD) < 0) {
+		return fake_error(EBADF);
+	}
+
+	struct fake_drm_handle *h = calloc(1, sizeof(*h));
+	if (h == NULL) {
+		return fake_error(ENOMEM);
+	}
+	h->handle = dev->next_handle++;
+	wl_list_insert(&dev->handles, &h->link);
+	dev->stats.handles++;
+
+	*handle = h->handle;
+	return 0;
+}
+
+static int fake_close_buffer_handle(int fd, uint32_t handle) {
+	struct fake_drm_device *dev = device_ioctl(fd);
+
+	struct fake_drm_handle *h = get_handle(dev, handle);
+	if (h == NULL) {
+		return fake_error(EINVAL);
+	}
+	wl_list_remove(&h->link);
+	free(h);
+	dev->stats.handles--;
+	return 0;
+}
+
+static int fb_create(struct fake_drm_device *dev, uint32_t width,
+		uint32_t height, uint32_t format, uint32_t handle, uint32_t *fb_id) {
+	if (width == 0 || height == 0 || width > FAKE_DRM_MAX_FB_SIZE ||
+			height > FAKE_DRM_MAX_FB_SIZE) {
+		return fake_error(EINVAL);
+	}
+	if (get_handle(dev, handle) == NULL) {
+		return fake_error(ENOENT);
+	}
+
+	struct fake_drm_fb *fb = calloc(1, sizeof(*fb));
+	if (fb == NULL) {
+		return fake_error(ENOMEM);
+	}
+	fb->id = dev->next_id++;
+	fb->width = width;
+	fb->height = height;
+	fb->format = format;
+	wl_list_insert(&dev->fbs, &fb->link);
+	dev->stats.fbs++;
+
+	*fb_id = fb->id;
+	return 0;
+}
+
+static int fake_add_fb(int fd, uint32_t width, uint32_t height, uint8_t depth,
+		uint8_t bpp, uint32_t pitch, uint32_t handle, uint32_t *fb_id) {
+	struct fake_drm_device *dev = device_ioctl(fd);
+
+	uint32_t format;
+	if (depth == 24 && bpp == 32) {
+		format = DRM_FORMAT_XRGB8888;
+	} else if (depth == 32 && bpp == 32) {
+		format = DRM_FORMAT_ARGB8888;
+	} else {
+		return fake_error(EINVAL);
+	}
+	return fb_create(dev, width, height, format, handle, fb_id);
+}
+
+static int fake_add_fb2(int fd, uint32_t width, uint32_t height,
+		uint32_t format, const uint32_t handles[static 4],
+		const uint32_t pitches[static 4], const uint32_t offsets[static 4],
+		uint32_t *fb_id, uint32_t flags) {
+	struct fake_drm_device *dev = device_ioctl(fd);
+
+	if (flags != 0) {
+		return fake_error(EINVAL);
+	}
+	return fb_create(dev, width, height, format, handles[0], fb_id);
+}
+
+static int fake_add_fb2_with_modifiers(int fd, uint32_t width,
+		uint32_t height, uint32_t format, const uint32_t handles[static 4],
+		const uint32_t pitches[static 4], const uint32_t offsets[static 4],
+		const uint64_t modifiers[static 4], uint32_t *fb_id, uint32_t flags) {
+	device_ioctl(fd);
+
+	// DRM_CAP_ADDFB2_MODIFIERS isn't advertised
+	return fake_error(EINVAL);
+}
+
+static int fake_rm_fb(int fd, uint32_t fb_id) {
+	struct fake_drm_device *dev = device_ioctl(fd);
+
+	struct fake_drm_fb *fb = get_fb(dev, fb_id);
+	if (fb == NULL) {
+		return fake_error(ENOENT);
+	}
+
+	// The kernel disables the planes scanning out the FB
+	for (size_t i = 0; i < dev->planes_len; i++) {
+		struct fake_drm_object *obj = &dev->planes[i].obj;
+		if (obj->values[PROP_FB_ID] == fb_id) {
+			obj->values[PROP_FB_ID] = 0;
+			obj->values[PROP_CRTC_ID] = 0;
+			dev->stats.busy_fbs_removed++;
+		}
+	}
+
+	wl_list_remove(&fb->link);
+	free(fb);
+	dev->stats.fbs--;
+	return 0;
+}
+
+static drmModeAtomicReq *fake_atomic_alloc(void) {
+	return calloc(1, sizeof(drmModeAtomicReq));
+}
+
+static void fake_atomic_free(drmModeAtomicReq *req) {
+	if (req == NULL) {
+		return;
+	}
+	free(req->items);
+	free(req);
+}
+
+static int fake_atomic_add_property(drmModeAtomicReq *req, uint32_t obj_id,
+		uint32_t prop_id, uint64_t value) {
+	if (req == NULL) {
+		return -EINVAL;
+	}
+
+	if (req->len == req->cap) {
+		size_t cap = req->cap > 0 ? 2 * req->cap : 16;
+		struct fake_drm_atomic_item *items =
+			realloc(req->items, cap * sizeof(*items));
+		if (items == NULL) {
+			return -ENOMEM;
+		}
+		req->items = items;
+		req->cap = cap;
+	}
+
+	req->items[req->len++] = (struct fake_drm_atomic_item){
+		.obj_id = obj_id,
+		.prop_id = prop_id,
+		.value = value,
+	};
+	return req->len;
+}
+
+static void state_save(struct fake_drm_device *dev,
+		struct fake_drm_state *state) {
+	for (size_t i = 0; i < dev->crtcs_len; i++) {
+		state->crtcs[i] = dev->crtcs[i].obj;
+	}
+	for (size_t i = 0; i < dev->planes_len; i++) {
+		state->planes[i] = dev->planes[i].obj;
+	}
+	for (size_t i = 0; i < dev->connectors_len; i++) {
+		state->connectors[i] = dev->connectors[i].obj;
+	}
+}
+
+static void state_restore(struct fake_drm_device *dev,
+		const struct fake_drm_state *state) {
+	for (size_t i = 0; i < dev->crtcs_len; i++) {
+		dev->crtcs[i].obj = state->crtcs[i];
+	}
+	for (size_t i = 0; i < dev->planes_len; i++) {
+		dev->planes[i].obj = state->planes[i];
+	}
+	for (size_t i = 0; i < dev->connectors_len; i++) {
+		dev->connectors[i].obj = state->connectors[i];
+	}
+}
+
+static int check_prop_value(struct fake_drm_device *dev,
+		enum fake_drm_prop prop, uint64_t value) {
+	struct fake_drm_blob *blob;
+	switch (prop) {
+	case PROP_CRTC_ID:
+		return value == 0 || get_crtc(dev, value) != NULL ? 0 : -ENOENT;
+	case PROP_FB_ID:
+		return value == 0 || get_fb(dev, value) != NULL ? 0 : -ENOENT;
+	case PROP_MODE_ID:
+		if (value == 0) {
+			return 0;
+		}
+		blob = get_blob(dev, value);
+		if (blob == NULL) {
+			return -ENOENT;
+		}
+		return blob->size == sizeof(drmModeModeInfo) ? 0 : -EINVAL;
+	case PROP_GAMMA_LUT:
+		if (value == 0) {
+			return 0;
+		}
+		blob = get_blob(dev, value);
+		if (blob == NULL) {
+			return -ENOENT;
+		}
+		return blob->size == FAKE_DRM_GAMMA_SIZE *
+			sizeof(struct drm_color_lut) ? 0 : -EINVAL;
+	case PROP_ACTIVE:
+	case PROP_VRR_ENABLED:
+	case PROP_LINK_STATUS:
+		return value <= 1 ? 0 : -EINVAL;
+	case PROP_DPMS:
+		return value <= DRM_MODE_DPMS_OFF ? 0 : -EINVAL;
+	case PROP_CRTC_X:
+	case PROP_CRTC_Y:
+		return (int64_t)value >= INT32_MIN && (int64_t)value <= INT32_MAX ?
+			0 : -ERANGE;
+	default:
+		return value <= UINT32_MAX ? 0 : -ERANGE;
+	}
+}
+
+/**
+ * Apply the properties of an atomic request, collecting the CRTCs affected by
+ * the commit.
+ */
+static int atomic_apply(struct fake_drm_device *dev,
+		const drmModeAtomicReq *req, uint32_t *crtcs) {
+	for (size_t i = 0; i < req->len; i++) {
+		const struct fake_drm_atomic_item *item = &req->items[i];
+
+		struct fake_drm_object *obj =
+			get_object(dev, item->obj_id, DRM_MODE_OBJECT_ANY);
+		uint32_t prop = item->prop_id - prop_id_base;
+		if (obj == NULL || item->prop_id < prop_id_base ||
+				prop >= PROP_COUNT || !(obj->props & (1u << prop))) {
+			return -ENOENT;
+		}
+		if (prop_info[prop].flags & DRM_MODE_PROP_IMMUTABLE) {
+			return -EINVAL;
+		}
+		int ret = check_prop_value(dev, prop, item->value);
+		if (ret != 0) {
+			return ret;
+		}
+
+		*crtcs |= object_get_crtc_mask(dev, obj);
+		obj->values[prop] = item->value;
+		*crtcs |= object_get_crtc_mask(dev, obj);
+	}
+	return 0;
+}
+
+static bool crtc_has_connectors(struct fake_drm_device *dev,
+		uint32_t crtc_id) {
+	for (size_t i = 0; i < dev->connectors_len; i++) {
+		if (dev->connectors[i].obj.values[PROP_CRTC_ID] == crtc_id) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool plane_has_format(const struct fake_drm_plane *plane,
+		uint32_t format) {
+	for (size_t i = 0; i < plane->formats_len; i++) {
+		if (plane->formats[i] == format) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static int check_plane(struct fake_drm_device *dev,
+		struct fake_drm_plane *plane) {
+	const uint64_t *values = plane->obj.values;
+	uint64_t fb_id = values[PROP_FB_ID];
+	uint64_t crtc_id = values[PROP_CRTC_ID];
+	if ((fb_id == 0) != (crtc_id == 0)) {
+		return -EINVAL;
+	}
+	if (crtc_id == 0) {
+		return 0;
+	}
+
+	struct fake_drm_crtc *crtc = get_crtc(dev, crtc_id);
+	if (!(plane->possible_crtcs & (1u << (crtc - dev->crtcs))) ||
+			!crtc->obj.values[PROP_ACTIVE]) {
+		return -EINVAL;
+	}
+
+	struct fake_drm_fb *fb = get_fb(dev, fb_id);
+	assert(fb != NULL);
+	if (!plane_has_format(plane, fb->format)) {
+		return -EINVAL;
+	}
+
+	// The src_* properties are in 16.16 fixed point
+	if (values[PROP_SRC_W] == 0 || values[PROP_SRC_H] == 0 ||
+			values[PROP_CRTC_W] == 0 || values[PROP_CRTC_H] == 0) {
+		return -EINVAL;
+	}
+	if (values[PROP_SRC_X] + values[PROP_SRC_W] > (uint64_t)fb->width << 16 ||
+			values[PROP_SRC_Y] + values[PROP_SRC_H] >
+			(uint64_t)fb->height << 16) {
+		return -ENOSPC;
+	}
+	return 0;
+}
+
+/**
+ * Check the state resulting from an atomic request, like the kernel's
+ * atomic check phase.
+ */
+static int atomic_check(struct fake_drm_device *dev,
+		const struct fake_drm_state *prev, uint32_t flags, uint32_t crtcs,
+		bool *modeset) {
+	*modeset = false;
+
+	for (size_t i = 0; i < dev->connectors_len; i++) {
+		struct fake_drm_connector *conn = &dev->connectors[i];
+		uint64_t crtc_id = conn->obj.values[PROP_CRTC_ID];
+		if (crtc_id != prev->connectors[i].values[PROP_CRTC_ID]) {
+			*modeset = true;
+		}
+		if (crtc_id != 0 && !(conn->possible_crtcs &
+				object_get_crtc_mask(dev, &conn->obj))) {
+			return -EINVAL;
+		}
+	}
+
+	for (size_t i = 0; i < dev->crtcs_len; i++) {
+		struct fake_drm_crtc *crtc = &dev->crtcs[i];
+		const uint64_t *values = crtc->obj.values;
+		if (values[PROP_ACTIVE] != prev->crtcs[i].values[PROP_ACTIVE] ||
+				values[PROP_MODE_ID] != prev->crtcs[i].values[PROP_MODE_ID]) {
+			*modeset = true;
+		}
+
+		bool enabled = values[PROP_MODE_ID] != 0;
+		if (values[PROP_ACTIVE] && !enabled) {
+			return -EINVAL;
+		}
+		if (enabled != crtc_has_connectors(dev, crtc->obj.id)) {
+			return -EINVAL;
+		}
+		if (values[PROP_ACTIVE] &&
+				get_crtc_primary(dev, crtc->obj.id) == NULL) {
+			return -EINVAL;
+		}
+	}
+
+	for (size_t i = 0; i < dev->planes_len; i++) {
+		int ret = check_plane(dev, &dev->planes[i]);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+
+	if (*modeset && !(flags & DRM_MODE_ATOMIC_ALLOW_MODESET)) {
+		return -EINVAL;
+	}
+
+	for (size_t i = 0; i < dev->crtcs_len; i++) {
+		struct fake_drm_crtc *crtc = &dev->crtcs[i];
+		if (!(crtcs & (1u << i))) {
+			continue;
+		}
+		if ((flags & DRM_MODE_PAGE_FLIP_EVENT) &&
+				!crtc->obj.values[PROP_ACTIVE]) {
+			return -EINVAL;
+		}
+		// Non-blocking commits can't be queued behind a pending page-flip
+		if ((flags & DRM_MODE_ATOMIC_NONBLOCK) &&
+				!(flags & DRM_MODE_ATOMIC_TEST_ONLY) && crtc->flip_pending) {
+			return -EBUSY;
+		}
+	}
+
+	return 0;
+}
+
+static int fake_atomic_commit(int fd, drmModeAtomicReq *req, uint32_t flags,
+		void *user_data) {
+	struct fake_drm_device *dev = device_ioctl(fd);
+
+	// Async page-flips aren't advertised
+	uint32_t supported = DRM_MODE_ATOMIC_TEST_ONLY | DRM_MODE_ATOMIC_NONBLOCK |
+		DRM_MODE_ATOMIC_ALLOW_MODESET | DRM_MODE_PAGE_FLIP_EVENT;
+	bool test_only = flags & DRM_MODE_ATOMIC_TEST_ONLY;
+	if (!dev->atomic || (flags & ~supported) ||
+			(test_only && (flags & DRM_MODE_PAGE_FLIP_EVENT))) {
+		return fake_error(EINVAL);
+	}
+
+	if (test_only) {
+		dev->stats.tests++;
+	}
+
+	struct fake_drm_state prev;
+	state_save(dev, &prev);
+
+	uint32_t crtcs = 0;
+	bool modeset = false;
+	int ret = atomic_apply(dev, req, &crtcs);
+	if (ret == 0) {
+		ret = atomic_check(dev, &prev, flags, crtcs, &modeset);
+	}
+	if (ret == 0 && !test_only && dev->fail_commits > 0) {
+		dev->fail_commits--;
+		ret = -dev->fail_error;
+	}
+
+	// Allocate the events before the point of no return
+	struct wl_list events;
+	wl_list_init(&events);
+	for (size_t i = 0; ret == 0 && !test_only && i < dev->crtcs_len; i++) {
+		if (!(flags & DRM_MODE_PAGE_FLIP_EVENT) || !(crtcs & (1u << i))) {
+			continue;
+		}
+		struct fake_drm_event *event = calloc(1, sizeof(*event));
+		if (event == NULL) {
+			ret = -ENOMEM;
+			break;
+		}
+		event->crtc_id = dev->crtcs[i].obj.id;
+		event->user_data = user_data;
+		wl_list_insert(events.prev, &event->link);
+	}
+
+	if (ret != 0 || test_only) {
+		struct fake_drm_event *event, *tmp;
+		wl_list_for_each_safe(event, tmp, &events, link) {
+			wl_list_remove(&event->link);
+			free(event);
+		}
+		state_restore(dev, &prev);
+		return ret != 0 ? fake_error(-ret) : 0;
+	}
+
+	dev->stats.commits++;
+	if (modeset) {
+		dev->stats.modesets++;
+	}
+
+	for (size_t i = 0; i < dev->crtcs_len; i++) {
+		struct fake_drm_crtc *crtc = &dev->crtcs[i];
+		if (!(crtcs & (1u << i))) {
+			continue;
+		}
+		// Blocking commits return once the new state is displayed
+		crtc->flip_pending = (flags & DRM_MODE_ATOMIC_NONBLOCK) &&
+			(flags & DRM_MODE_PAGE_FLIP_EVENT);
+	}
+
+	if (!wl_list_empty(&events)) {
+		wl_list_insert_list(dev->events.prev, &events);
+		uint64_t count = 1;
+		if (write(dev->fd, &count, sizeof(count)) != sizeof(count)) {
+			abort();
+		}
+	}
+
+	return 0;
+}
+
+static int fake_set_crtc(int fd, uint32_t crtc_id, uint32_t fb_id, uint32_t x,
+		uint32_t y, uint32_t *connectors, int connectors_len,
+		drmModeModeInfo *mode) {
+	device_ioctl(fd);
+	return fake_error(EOPNOTSUPP);
+}
+
+static int fake_page_flip(int fd, uint32_t crtc_id, uint32_t fb_id,
+		uint32_t flags, void *user_data) {
+	device_ioctl(fd);
+	return fake_error(EOPNOTSUPP);
+}
+
+static int fake_set_cursor(int fd, uint32_t crtc_id, uint32_t handle,
+		uint32_t width, uint32_t height) {
+	device_ioctl(fd);
+	return fake_error(EOPNOTSUPP);
+}
+
+static int fake_move_cursor(int fd, uint32_t crtc_id, int x, int y) {
+	struct fake_drm_device *dev = device_ioctl(fd);
+
+	if (get_crtc(dev, crtc_id) == NULL) {
+		return fake_error(ENOENT);
+	}
+
+	// Like atomic drivers, update the cursor plane bound to the CRTC
+	for (size_t i = 0; i < dev->planes_len; i++) {
+		struct fake_drm_object *obj = &dev->planes[i].obj;
+		if (obj->values[PROP_TYPE] == DRM_PLANE_TYPE_CURSOR &&
+				obj->values[PROP_CRTC_ID] == crtc_id) {
+			obj->values[PROP_CRTC_X] = (uint64_t)x;
+			obj->values[PROP_CRTC_Y] = (uint64_t)y;
+		}
+	}
+	return 0;
+}
+
+static int fake_crtc_set_gamma(int fd, uint32_t crtc_id, uint32_t size,
+		uint16_t *r, uint16_t *g, uint16_t *b) {
+	device_ioctl(fd);
+	return fake_error(EOPNOTSUPP);
+}
+
+static int fake_connector_set_property(int fd, uint32_t connector_id,
+		uint32_t prop_id, uint64_t value) {
+	device_ioctl(fd);
+	return fake_error(EOPNOTSUPP);
+}
+
+static int fake_object_set_property(int fd, uint32_t obj_id,
+		uint32_t obj_type, uint32_t prop_id, uint64_t value) {
+	device_ioctl(fd);
+	return fake_error(EOPNOTSUPP);
+}
+
+static int fake_crtc_get_sequence(int fd, uint32_t crtc_id, uint64_t *seq,
+		uint64_t *ns) {
+	struct fake_drm_device *dev = device_ioctl(fd);
+
+	struct fake_drm_crtc *crtc = get_crtc(dev, crtc_id);
+	if (crtc == NULL) {
+		return fake_error(ENOENT);
+	}
+	if (!crtc->obj.values[PROP_ACTIVE]) {
+		return fake_error(EINVAL);
+	}
+	*seq = crtc->seq;
+	*ns = crtc->vblank_ns;
+	return 0;
+}
+
+static int fake_handle_event(int fd, drmEventContext *context) {
+	struct fake_drm_device *dev = device_from_fd(fd);
+
+	uint64_t count;
+	if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+		return -1;
+	}
+
+	// Events queued by the handlers are delivered on the next read
+	struct wl_list events;
+	wl_list_init(&events);
+	wl_list_insert_list(&events, &dev->events);
+	wl_list_init(&dev->events);
+
+	struct fake_drm_event *event, *tmp;
+	wl_list_for_each_safe(event, tmp, &events, link) {
+		uint32_t crtc_id = event->crtc_id;
+		void *user_data = event->user_data;
+		wl_list_remove(&event->link);
+		free(event);
+
+		struct fake_drm_crtc *crtc = get_crtc(dev, crtc_id);
+		int64_t now_ns = get_time_ns();
+		crtc->flip_pending = false;
+		crtc->seq++;
+		crtc->vblank_ns = now_ns;
+		dev->stats.page_flip_events++;
+
+		if (context->version >= 3 && context->page_flip_handler2 != NULL) {
+			context->page_flip_handler2(fd, crtc->seq,
+				now_ns / 1000000000, now_ns % 1000000000 / 1000,
+				crtc_id, user_data);
+		}
+	}
+	return 0;
+}
+
+static int fake_create_lease(int fd, const uint32_t *objects,
+		int objects_len, int flags, uint32_t *lessee_id) {
+	device_ioctl(fd);
+	return fake_error(EOPNOTSUPP);
+}
+
+static drmModeLesseeListRes *fake_list_lessees(int fd) {
+	device_ioctl(fd);
+	return calloc(1, sizeof(drmModeLesseeListRes));
+}
+
+static int fake_revoke_lease(int fd, uint32_t lessee_id) {
+	device_ioctl(fd);
+	return fake_error(EOPNOTSUPP);
+}
+
+const struct wlr_drm_device_impl fake_drm_device_impl = {
+	.close = fake_close,
+	.get_device_name_from_fd2 = fake_get_device_name_from_fd2,
+	.get_version = fake_get_version,
+	.get_cap = fake_get_cap,
+	.set_client_cap = fake_set_client_cap,
+	.get_resources = fake_get_resources,
+	.get_crtc = fake_get_crtc,
+	.get_encoder = fake_get_encoder,
+	.get_connector = fake_get_connector,
+	.get_connector_current = fake_get_connector,
+	.get_plane_resources = fake_get_plane_resources,
+	.get_plane = fake_get_plane,
+	.get_fb = fake_get_fb,
+	.object_get_properties = fake_object_get_properties,
+	.get_property = fake_get_property,
+	.get_property_blob = fake_get_property_blob,
+	.create_property_blob = fake_create_property_blob,
+	.destroy_property_blob = fake_destroy_property_blob,
+	.prime_fd_to_handle = fake_prime_fd_to_handle,
+	.close_buffer_handle = fake_close_buffer_handle,
+	.add_fb = fake_add_fb,
+	.add_fb2 = fake_add_fb2,
+	.add_fb2_with_modifiers = fake_add_fb2_with_modifiers,
+	.rm_fb = fake_rm_fb,
+	.atomic_alloc = fake_atomic_alloc,
+	.atomic_free = fake_atomic_free,
+	.atomic_add_property = fake_atomic_add_property,
+	.atomic_commit = fake_atomic_commit,
+	.set_crtc = fake_set_crtc,
+	.page_flip = fake_page_flip,
+	.set_cursor = fake_set_cursor,
+	.move_cursor = fake_move_cursor,
+	.crtc_set_gamma = fake_crtc_set_gamma,
+	.connector_set_property = fake_connector_set_property,
+	.object_set_property = fake_object_set_property,
+	.crtc_get_sequence = fake_crtc_get_sequence,
+	.handle_event = fake_handle_event,
+	.create_lease = fake_create_lease,
+	.list_lessees = fake_list_lessees,
+	.revoke_lease = fake_revoke_lease,
+};
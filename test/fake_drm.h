@@ -0,0 +1,75 @@
+#ifndef TEST_FAKE_DRM_H
+#define TEST_FAKE_DRM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <xf86drmMode.h>
+#include "backend/drm/device.h"
+
+/**
+ * A fake KMS device, to run the DRM backend without a GPU.
+ *
+ * It implements the atomic API: objects and their properties, property blobs,
+ * framebuffers, and atomic commits checked roughly like the kernel does.
+ * Legacy modesetting and leases aren't supported.
+ *
+ * Page-flips complete as soon as the compositor reads the DRM events, on the
+ * next dispatch of the event loop.
+ */
+struct fake_drm_device;
+
+// Gamma LUT size of all CRTCs
+#define FAKE_DRM_GAMMA_SIZE 256
+
+struct fake_drm_device_stats {
+	// Requests which would be ioctls on a real device
+	uint64_t ioctls;
+	uint64_t commits, tests, modesets;
+	uint64_t page_flip_events;
+	// Objects currently allocated by the compositor
+	uint64_t fbs, blobs, handles;
+	// FBs removed while being scanned out
+	uint64_t busy_fbs_removed;
+};
+
+extern const struct wlr_drm_device_impl fake_drm_device_impl;
+
+struct fake_drm_device *fake_drm_device_create(void);
+void fake_drm_device_destroy(struct fake_drm_device *dev);
+/**
+ * Open the device, the returned struct wlr_device is released by
+ * fake_drm_device_impl.close.
+ */
+struct wlr_device *fake_drm_device_open(struct fake_drm_device *dev);
+
+/**
+ * Add KMS objects to the device, returning their ID. Objects must be added
+ * before the device is opened. CRTCs are referred to by their index in the
+ * possible_crtcs bitmasks.
+ */
+uint32_t fake_drm_device_add_crtc(struct fake_drm_device *dev);
+uint32_t fake_drm_device_add_plane(struct fake_drm_device *dev, uint32_t type,
+	uint32_t possible_crtcs, const uint32_t *formats, size_t formats_len);
+uint32_t fake_drm_device_add_connector(struct fake_drm_device *dev,
+	uint32_t possible_crtcs, const drmModeModeInfo *modes, size_t modes_len);
+
+/**
+ * Plug or unplug a monitor. The compositor needs to be notified with a
+ * hotplug event.
+ */
+void fake_drm_device_set_connected(struct fake_drm_device *dev,
+	uint32_t conn_id, bool connected);
+/**
+ * Make the next commits fail with the specified error. Test-only commits
+ * aren't affected.
+ */
+void fake_drm_device_fail_commits(struct fake_drm_device *dev, int count,
+	int error);
+
+bool fake_drm_device_get_prop(struct fake_drm_device *dev, uint32_t obj_id,
+	const char *name, uint64_t *value);
+const struct fake_drm_device_stats *fake_drm_device_get_stats(
+	struct fake_drm_device *dev);
+
+#endif
@@ -0,0 +1,544 @@
+#define _POSIX_C_SOURCE 200809L
+#include <drm_fourcc.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <wayland-server-core.h>
+#include <wlr/backend.h>
+#include <wlr/backend/drm.h>
+#include <wlr/backend/session.h>
+#include <wlr/render/dmabuf.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/util/log.h>
+#include <xf86drmMode.h>
+#include "backend/drm/cvt.h"
+#include "backend/drm/drm.h"
+#include "fake_drm.h"
+
+/*
+ * Runs the DRM backend against a fake KMS device: modesets, page-flips,
+ * commit failures, frame repeats and CRTC re-allocation on hotplug. Also reports the number
+ * of KMS requests per frame and the commit latency.
+ */
+
+#define WIDTH 1920
+#define HEIGHT 1080
+#define BENCH_FRAMES 240
+#define REPEAT_FRAMES 10
+#define MAX_OUTPUTS 4
+
+static void check_failed(const char *expr, const char *file, int line) {
+	fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expr);
+	exit(EXIT_FAILURE);
+}
+
+// Unlike assert(), checks aren't compiled out in release builds
+#define CHECK(cond) ((cond) ? (void)0 : check_failed(#cond, __FILE__, __LINE__))
+
+struct test_buffer {
+	struct wlr_buffer base;
+	int fd;
+};
+
+struct test_output {
+	struct wlr_output *output;
+	bool frame, destroyed;
+	int presented;
+	struct wl_listener frame_listener;
+	struct wl_listener present;
+	struct wl_listener destroy;
+};
+
+struct test_state {
+	struct wl_display *display;
+	struct wl_event_loop *loop;
+	struct wlr_session *session;
+
+	struct fake_drm_device *dev;
+	struct wlr_device *wlr_dev;
+	uint32_t crtc_id, primary_id;
+	uint32_t conn_ids[2];
+
+	struct wlr_backend *backend;
+	struct wl_listener new_output;
+	struct test_output *outputs[MAX_OUTPUTS];
+	size_t outputs_len;
+
+	struct test_buffer *buffers[2];
+};
+
+static int64_t get_time_ns(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void buffer_destroy(struct wlr_buffer *wlr_buffer) {
+	struct test_buffer *buffer = wl_container_of(wlr_buffer, buffer, base);
+	close(buffer->fd);
+	free(buffer);
+}
+
+static bool buffer_get_dmabuf(struct wlr_buffer *wlr_buffer,
+		struct wlr_dmabuf_attributes *attribs) {
+	struct test_buffer *buffer = wl_container_of(wlr_buffer, buffer, base);
+	*attribs = (struct wlr_dmabuf_attributes){
+		.width = wlr_buffer->width,
+		.height = wlr_buffer->height,
+		.format = DRM_FORMAT_XRGB8888,
+		.modifier = DRM_FORMAT_MOD_INVALID,
+		.n_planes = 1,
+		.stride = { wlr_buffer->width * 4 },
+		.fd = { buffer->fd },
+	};
+	return true;
+}
+
+static const struct wlr_buffer_impl buffer_impl = {
+	.name = "test",
+	.destroy = buffer_destroy,
+	.get_dmabuf = buffer_get_dmabuf,
+};
+
+static struct test_buffer *buffer_create(int width, int height) {
+	struct test_buffer *buffer = calloc(1, sizeof(*buffer));
+	CHECK(buffer != NULL);
+	// The fake device only needs a valid FD to import
+	buffer->fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	CHECK(buffer->fd >= 0);
+	wlr_buffer_init(&buffer->base, &buffer_impl, width, height);
+	return buffer;
+}
+
+static void output_handle_frame(struct wl_listener *listener, void *data) {
+	struct test_output *out = wl_container_of(listener, out, frame_listener);
+	out->frame = true;
+}
+
+static void output_handle_present(struct wl_listener *listener, void *data) {
+	struct test_output *out = wl_container_of(listener, out, present);
+	struct wlr_output_event_present *event = data;
+	if (event->presented) {
+		out->presented++;
+	}
+}
+
+static void output_handle_destroy(struct wl_listener *listener, void *data) {
+	struct test_output *out = wl_container_of(listener, out, destroy);
+	wl_list_remove(&out->frame_listener.link);
+	wl_list_remove(&out->present.link);
+	wl_list_remove(&out->destroy.link);
+	out->output = NULL;
+	out->destroyed = true;
+}
+
+static void handle_new_output(struct wl_listener *listener, void *data) {
+	struct test_state *state = wl_container_of(listener, state, new_output);
+	struct wlr_output *output = data;
+	CHECK(state->outputs_len < MAX_OUTPUTS);
+
+	struct test_output *out = calloc(1, sizeof(*out));
+	CHECK(out != NULL);
+	out->output = output;
+	out->frame_listener.notify = output_handle_frame;
+	wl_signal_add(&output->events.frame, &out->frame_listener);
+	out->present.notify = output_handle_present;
+	wl_signal_add(&output->events.present, &out->present);
+	out->destroy.notify = output_handle_destroy;
+	wl_signal_add(&output->events.destroy, &out->destroy);
+	state->outputs[state->outputs_len++] = out;
+}
+
+static bool dispatch_until(struct test_state *state, const bool *done) {
+	for (int i = 0; i < 100 && !*done; i++) {
+		if (wl_event_loop_dispatch(state->loop, 10) < 0) {
+			return false;
+		}
+	}
+	return *done;
+}
+
+static void dispatch_for(struct test_state *state, int64_t duration_ns,
+		int64_t *last_flip_ns, int64_t *max_gap_ns) {
+	const struct fake_drm_device_stats *stats =
+		fake_drm_device_get_stats(state->dev);
+	int64_t deadline_ns = get_time_ns() + duration_ns;
+	int64_t now_ns;
+	while ((now_ns = get_time_ns()) < deadline_ns) {
+		uint64_t page_flip_events = stats->page_flip_events;
+		int timeout_ms = (deadline_ns - now_ns) / 1000000 + 1;
+		CHECK(wl_event_loop_dispatch(state->loop, timeout_ms) >= 0);
+		if (last_flip_ns == NULL ||
+				stats->page_flip_events == page_flip_events) {
+			continue;
+		}
+		now_ns = get_time_ns();
+		if (*last_flip_ns != 0 && now_ns - *last_flip_ns > *max_gap_ns) {
+			*max_gap_ns = now_ns - *last_flip_ns;
+		}
+		*last_flip_ns = now_ns;
+	}
+}
+
+static uint64_t get_prop(struct test_state *state, uint32_t obj_id,
+		const char *name) {
+	uint64_t value;
+	CHECK(fake_drm_device_get_prop(state->dev, obj_id, name, &value));
+	return value;
+}
+
+static void send_hotplug(struct test_state *state, uint32_t conn_id) {
+	struct wlr_device_change_event event = {
+		.type = WLR_DEVICE_HOTPLUG,
+		.hotplug = { .connector_id = conn_id },
+	};
+	wl_signal_emit(&state->wlr_dev->events.change, &event);
+}
+
+static bool enable_output(struct test_output *out, struct test_buffer *buffer) {
+	struct wlr_output *output = out->output;
+	wlr_output_set_mode(output, wlr_output_preferred_mode(output));
+	wlr_output_enable(output, true);
+	wlr_output_attach_buffer(output, &buffer->base);
+	out->frame = false;
+	if (!wlr_output_commit(output)) {
+		wlr_output_rollback(output);
+		return false;
+	}
+	return true;
+}
+
+static bool commit_frame(struct test_output *out, struct test_buffer *buffer) {
+	wlr_output_attach_buffer(out->output, &buffer->base);
+	out->frame = false;
+	return wlr_output_commit(out->output);
+}
+
+static void setup(struct test_state *state) {
+	state->display = wl_display_create();
+	CHECK(state->display != NULL);
+	state->loop = wl_display_get_event_loop(state->display);
+
+	// The backend only needs the session signals and its active state
+	state->session = calloc(1, sizeof(*state->session));
+	CHECK(state->session != NULL);
+	state->session->active = true;
+	state->session->display = state->display;
+	wl_list_init(&state->session->devices);
+	wl_signal_init(&state->session->events.active);
+	wl_signal_init(&state->session->events.add_drm_card);
+	wl_signal_init(&state->session->events.destroy);
+
+	// One CRTC shared by two connectors, the second one starts unplugged
+	state->dev = fake_drm_device_create();
+	CHECK(state->dev != NULL);
+	state->crtc_id = fake_drm_device_add_crtc(state->dev);
+	const uint32_t primary_formats[] =
+		{ DRM_FORMAT_XRGB8888, DRM_FORMAT_ARGB8888 };
+	state->primary_id = fake_drm_device_add_plane(state->dev,
+		DRM_PLANE_TYPE_PRIMARY, 1, primary_formats,
+		sizeof(primary_formats) / sizeof(primary_formats[0]));
+	const uint32_t cursor_formats[] = { DRM_FORMAT_ARGB8888 };
+	fake_drm_device_add_plane(state->dev, DRM_PLANE_TYPE_CURSOR, 1,
+		cursor_formats, 1);
+
+	drmModeModeInfo mode = {0};
+	generate_cvt_mode(&mode, WIDTH, HEIGHT, 60, false, false);
+	mode.type |= DRM_MODE_TYPE_PREFERRED;
+	for (size_t i = 0; i < 2; i++) {
+		state->conn_ids[i] =
+			fake_drm_device_add_connector(state->dev, 1, &mode, 1);
+	}
+	fake_drm_device_set_connected(state->dev, state->conn_ids[1], false);
+
+	state->wlr_dev = fake_drm_device_open(state->dev);
+	CHECK(state->wlr_dev != NULL);
+	state->backend = drm_backend_create(state->display, state->session,
+		state->wlr_dev, NULL, &fake_drm_device_impl);
+	CHECK(state->backend != NULL);
+
+	state->new_output.notify = handle_new_output;
+	wl_signal_add(&state->backend->events.new_output, &state->new_output);
+	CHECK(wlr_backend_start(state->backend));
+	CHECK(state->outputs_len == 1);
+
+	for (size_t i = 0; i < 2; i++) {
+		state->buffers[i] = buffer_create(WIDTH, HEIGHT);
+	}
+}
+
+static void test_modeset(struct test_state *state) {
+	struct test_output *out = state->outputs[0];
+	CHECK(enable_output(out, state->buffers[0]));
+
+	const struct fake_drm_device_stats *stats =
+		fake_drm_device_get_stats(state->dev);
+	CHECK(stats->modesets == 1);
+	CHECK(get_prop(state, state->conn_ids[0], "CRTC_ID") == state->crtc_id);
+	CHECK(get_prop(state, state->crtc_id, "ACTIVE") == 1);
+	CHECK(get_prop(state, state->crtc_id, "MODE_ID") != 0);
+	CHECK(get_prop(state, state->primary_id, "FB_ID") != 0);
+
+	CHECK(dispatch_until(state, &out->frame));
+	CHECK(stats->page_flip_events == 1);
+}
+
+static void test_page_flips(struct test_state *state) {
+	struct test_output *out = state->outputs[0];
+	const struct fake_drm_device_stats *stats =
+		fake_drm_device_get_stats(state->dev);
+
+	struct wlr_drm_backend_stats start;
+	wlr_drm_backend_get_stats(state->backend, &start);
+	uint64_t page_flip_events = stats->page_flip_events;
+
+	// The first frames import the second buffer and fill the test cache
+	int warmup_frames = 2;
+	uint64_t bench_ioctls = 0;
+	int64_t bench_ns = 0, max_ns = 0;
+	for (int i = 0; i < warmup_frames + BENCH_FRAMES; i++) {
+		struct test_buffer *buffer = state->buffers[(i + 1) % 2];
+		uint64_t ioctls = stats->ioctls;
+		int64_t start_ns = get_time_ns();
+		CHECK(commit_frame(out, buffer));
+		int64_t elapsed_ns = get_time_ns() - start_ns;
+		CHECK(get_prop(state, state->primary_id, "FB_ID") != 0);
+		CHECK(dispatch_until(state, &out->frame));
+
+		if (i < warmup_frames) {
+			continue;
+		}
+		// A single non-blocking atomic commit per frame
+		CHECK(stats->ioctls - ioctls == 1);
+		bench_ioctls += stats->ioctls - ioctls;
+		bench_ns += elapsed_ns;
+		if (elapsed_ns > max_ns) {
+			max_ns = elapsed_ns;
+		}
+	}
+
+	struct wlr_drm_backend_stats end;
+	wlr_drm_backend_get_stats(state->backend, &end);
+	int frames = warmup_frames + BENCH_FRAMES;
+	CHECK(end.commits - start.commits == (uint64_t)frames);
+	CHECK(end.modesets == start.modesets);
+	CHECK(end.failed_commits == start.failed_commits);
+	CHECK(end.fbs_created == 2);
+	CHECK(stats->fbs == 2 && stats->handles == 0);
+	CHECK(stats->page_flip_events - page_flip_events == (uint64_t)frames);
+
+	printf("page-flip: %.2f ioctls/frame, "
+		"wlr_output_commit avg %"PRId64" ns max %"PRId64" ns, "
+		"atomic commit avg %"PRId64" ns max %"PRId64" ns\n",
+		(double)bench_ioctls / BENCH_FRAMES,
+		bench_ns / BENCH_FRAMES, max_ns,
+		(end.total_commit_ns - start.total_commit_ns) / frames,
+		end.max_commit_ns);
+}
+
+static void test_test_cache(struct test_state *state) {
+	struct test_output *out = state->outputs[0];
+	const struct fake_drm_device_stats *stats =
+		fake_drm_device_get_stats(state->dev);
+
+	struct wlr_drm_backend_stats start;
+	wlr_drm_backend_get_stats(state->backend, &start);
+	uint64_t tests = stats->tests;
+
+	for (int i = 0; i < 10; i++) {
+		wlr_output_attach_buffer(out->output, &state->buffers[i % 2]->base);
+		CHECK(wlr_output_test(out->output));
+		wlr_output_rollback(out->output);
+	}
+
+	struct wlr_drm_backend_stats end;
+	wlr_drm_backend_get_stats(state->backend, &end);
+	CHECK(end.test_cache_hits - start.test_cache_hits == 10);
+	CHECK(stats->tests == tests);
+}
+
+static void test_commit_failure(struct test_state *state) {
+	struct test_output *out = state->outputs[0];
+	const struct fake_drm_device_stats *stats =
+		fake_drm_device_get_stats(state->dev);
+
+	struct wlr_drm_backend_stats start;
+	wlr_drm_backend_get_stats(state->backend, &start);
+	uint64_t fb_id = get_prop(state, state->primary_id, "FB_ID");
+	uint64_t commits = stats->commits;
+
+	fake_drm_device_fail_commits(state->dev, 1, EINVAL);
+	CHECK(!commit_frame(out, state->buffers[0]));
+	CHECK(get_prop(state, state->primary_id, "FB_ID") == fb_id);
+	CHECK(stats->commits == commits);
+
+	struct wlr_drm_backend_stats end;
+	wlr_drm_backend_get_stats(state->backend, &end);
+	CHECK(end.failed_commits - start.failed_commits == 1);
+
+	// The output keeps working after a failed commit
+	CHECK(commit_frame(out, state->buffers[0]));
+	CHECK(dispatch_until(state, &out->frame));
+}
+
+static void test_frame_repeat(struct test_state *state) {
+	struct test_output *out = state->outputs[0];
+	struct wlr_output *output = out->output;
+	struct wlr_drm_connector *conn = wl_container_of(output, conn, output);
+	const struct fake_drm_device_stats *stats =
+		fake_drm_device_get_stats(state->dev);
+
+	// The fake device has no EDID, pretend VRR is enabled with a 48 Hz
+	// minimum refresh rate
+	output->adaptive_sync_status = WLR_OUTPUT_ADAPTIVE_SYNC_ENABLED;
+	output->adaptive_sync_min_refresh = 48000;
+	int64_t max_period_ns = 1000000000000LL / output->adaptive_sync_min_refresh;
+
+	// Let the content period of previous tests expire
+	dispatch_for(state, 250000000, NULL, NULL);
+
+	// Content animated at 20 Hz: frames are repeated to stay above the
+	// minimum refresh rate, without presentation events
+	int64_t content_period_ns = 50000000;
+	int warmup_frames = 2;
+	uint64_t page_flip_events = 0;
+	int presented = 0, content_flips = 0;
+	int64_t last_flip_ns = 0, max_gap_ns = 0;
+	for (int i = 0; i < warmup_frames + REPEAT_FRAMES; i++) {
+		if (i == warmup_frames) {
+			page_flip_events = stats->page_flip_events;
+			last_flip_ns = 0;
+			max_gap_ns = 0;
+			presented = out->presented;
+		}
+		CHECK(commit_frame(out, state->buffers[i % 2]));
+		dispatch_for(state, content_period_ns, &last_flip_ns, &max_gap_ns);
+		if (i >= warmup_frames) {
+			content_flips++;
+		}
+	}
+	uint64_t flips = stats->page_flip_events - page_flip_events;
+	CHECK(out->presented - presented == content_flips);
+	CHECK(flips >= 2 * (uint64_t)content_flips);
+	// Leave some slack for scheduling jitter
+	CHECK(max_gap_ns < 2 * max_period_ns);
+
+	printf("frame repeat: %.2f flips/frame, max flip interval %"PRId64" ns "
+		"(minimum refresh interval %"PRId64" ns)\n",
+		(double)flips / content_flips, max_gap_ns, max_period_ns);
+
+	// Wait for a repeat to be in flight
+	for (int i = 0; i < 100 && !conn->page_flip_repeat; i++) {
+		CHECK(wl_event_loop_dispatch(state->loop, 1) >= 0);
+	}
+	CHECK(conn->page_flip_repeat && conn->pending_page_flip_crtc != 0);
+
+	// A commit which can't be queued behind the repeat is deferred until
+	// the repeat completes, without blocking nor dispatching DRM events
+	uint16_t ramp[FAKE_DRM_GAMMA_SIZE];
+	for (size_t i = 0; i < FAKE_DRM_GAMMA_SIZE; i++) {
+		ramp[i] = i * 0xFFFF / (FAKE_DRM_GAMMA_SIZE - 1);
+	}
+	CHECK(wlr_output_get_gamma_size(output) == FAKE_DRM_GAMMA_SIZE);
+	wlr_output_set_gamma(output, FAKE_DRM_GAMMA_SIZE, ramp, ramp, ramp);
+	uint64_t commits = stats->commits;
+	page_flip_events = stats->page_flip_events;
+	int64_t start_ns = get_time_ns();
+	CHECK(commit_frame(out, state->buffers[0]));
+	int64_t elapsed_ns = get_time_ns() - start_ns;
+	CHECK(stats->commits == commits);
+	CHECK(stats->page_flip_events == page_flip_events);
+	CHECK(get_prop(state, state->crtc_id, "GAMMA_LUT") == 0);
+
+	CHECK(dispatch_until(state, &out->frame));
+	CHECK(stats->commits == commits + 1);
+	CHECK(get_prop(state, state->crtc_id, "GAMMA_LUT") != 0);
+	printf("frame repeat: deferred commit took %"PRId64" ns\n", elapsed_ns);
+
+	output->adaptive_sync_status = WLR_OUTPUT_ADAPTIVE_SYNC_DISABLED;
+	output->adaptive_sync_min_refresh = 0;
+	dispatch_for(state, max_period_ns, NULL, NULL);
+	CHECK(conn->pending_page_flip_crtc == 0);
+}
+
+static void test_hotplug(struct test_state *state) {
+	struct test_output *out_a = state->outputs[0];
+	const struct fake_drm_device_stats *stats =
+		fake_drm_device_get_stats(state->dev);
+
+	// The CRTC is in use, the new output can't be enabled
+	fake_drm_device_set_connected(state->dev, state->conn_ids[1], true);
+	send_hotplug(state, state->conn_ids[1]);
+	bool added = false;
+	for (int i = 0; i < 100 && !added; i++) {
+		CHECK(wl_event_loop_dispatch(state->loop, 10) >= 0);
+		added = state->outputs_len == 2;
+	}
+	CHECK(added);
+	struct test_output *out_b = state->outputs[1];
+
+	uint64_t modesets = stats->modesets;
+	CHECK(!enable_output(out_b, state->buffers[0]));
+	CHECK(stats->modesets == modesets);
+	CHECK(get_prop(state, state->conn_ids[0], "CRTC_ID") == state->crtc_id);
+
+	// Unplugging the first output frees up the CRTC
+	fake_drm_device_set_connected(state->dev, state->conn_ids[0], false);
+	send_hotplug(state, state->conn_ids[0]);
+	CHECK(dispatch_until(state, &out_a->destroyed));
+	CHECK(get_prop(state, state->conn_ids[0], "CRTC_ID") == 0);
+	CHECK(get_prop(state, state->crtc_id, "ACTIVE") == 0);
+
+	CHECK(enable_output(out_b, state->buffers[1]));
+	CHECK(get_prop(state, state->conn_ids[1], "CRTC_ID") == state->crtc_id);
+	CHECK(get_prop(state, state->crtc_id, "ACTIVE") == 1);
+	CHECK(dispatch_until(state, &out_b->frame));
+}
+
+static void teardown(struct test_state *state) {
+	wl_list_remove(&state->new_output.link);
+	wlr_backend_destroy(state->backend);
+	wl_display_destroy(state->display);
+	for (size_t i = 0; i < 2; i++) {
+		wlr_buffer_drop(&state->buffers[i]->base);
+	}
+
+	// Everything allocated by the backend has been released, and the CRTC
+	// has been disabled before its FB was removed
+	const struct fake_drm_device_stats *stats =
+		fake_drm_device_get_stats(state->dev);
+	CHECK(stats->fbs == 0);
+	CHECK(stats->blobs == 0);
+	CHECK(stats->handles == 0);
+	CHECK(stats->busy_fbs_removed == 0);
+	printf("total: %"PRIu64" ioctls, %"PRIu64" commits, %"PRIu64" tests, "
+		"%"PRIu64" modesets\n", stats->ioctls, stats->commits, stats->tests,
+		stats->modesets);
+
+	fake_drm_device_destroy(state->dev);
+	for (size_t i = 0; i < state->outputs_len; i++) {
+		CHECK(state->outputs[i]->destroyed);
+		free(state->outputs[i]);
+	}
+	free(state->session);
+}
+
+int main(void) {
+	wlr_log_init(WLR_ERROR, NULL);
+
+	struct test_state state = {0};
+	setup(&state);
+	test_modeset(&state);
+	test_page_flips(&state);
+	test_test_cache(&state);
+	test_commit_failure(&state);
+	test_frame_repeat(&state);
+	test_hotplug(&state);
+	teardown(&state);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,157 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/dma-heap.h>
+#include <linux/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <wayland-server-core.h>
+#include <wlr/render/dmabuf.h>
+#include <wlr/util/log.h>
+#include "render/dmabuf.h"
+
+/*
+ * Exercises the sync_file helpers used by linux-explicit-synchronization with
+ * software fences from sw_sync, so that it runs without a GPU. Needs a kernel
+ * built with CONFIG_SW_SYNC and debugfs mounted, otherwise the test is skipped.
+ */
+
+#define SKIP 77
+
+// Not part of the kernel uapi headers, see drivers/dma-buf/sw_sync.c
+struct sw_sync_create_fence_data {
+	__u32 value;
+	char name[32];
+	__s32 fence;
+};
+
+#define SW_SYNC_IOC_CREATE_FENCE _IOWR('W', 0, struct sw_sync_create_fence_data)
+#define SW_SYNC_IOC_INC _IOW('W', 1, __u32)
+
+static void check_failed(const char *expr, const char *file, int line) {
+	fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expr);
+	exit(EXIT_FAILURE);
+}
+
+// Unlike assert(), checks aren't compiled out in release builds
+#define CHECK(cond) ((cond) ? (void)0 : check_failed(#cond, __FILE__, __LINE__))
+
+static int create_fence(int timeline_fd, uint32_t value) {
+	struct sw_sync_create_fence_data data = {
+		.value = value,
+		.name = "wlroots-test",
+	};
+	CHECK(ioctl(timeline_fd, SW_SYNC_IOC_CREATE_FENCE, &data) == 0);
+	return data.fence;
+}
+
+static void timeline_inc(int timeline_fd, uint32_t count) {
+	CHECK(ioctl(timeline_fd, SW_SYNC_IOC_INC, &count) == 0);
+}
+
+static void test_is_valid(int timeline_fd) {
+	int fence_fd = create_fence(timeline_fd, 1);
+	CHECK(sync_file_is_valid(fence_fd));
+	close(fence_fd);
+
+	int event_fd = eventfd(0, EFD_CLOEXEC);
+	CHECK(event_fd >= 0);
+	CHECK(!sync_file_is_valid(event_fd));
+	close(event_fd);
+}
+
+static void test_is_signaled(int timeline_fd) {
+	int fence_fd = create_fence(timeline_fd, 1);
+	CHECK(!sync_file_is_signaled(fence_fd));
+	timeline_inc(timeline_fd, 1);
+	CHECK(sync_file_is_signaled(fence_fd));
+	close(fence_fd);
+}
+
+static int handle_fence_readable(int fd, uint32_t mask, void *data) {
+	bool *signaled = data;
+	*signaled = true;
+	return 0;
+}
+
+// Same as the acquire fence wait: the client commit is held back until the
+// event loop reports the fence as readable
+static void test_event_loop_wait(int timeline_fd) {
+	struct wl_event_loop *loop = wl_event_loop_create();
+	CHECK(loop != NULL);
+
+	int fence_fd = create_fence(timeline_fd, 1);
+	bool signaled = false;
+	struct wl_event_source *source = wl_event_loop_add_fd(loop, fence_fd,
+		WL_EVENT_READABLE, handle_fence_readable, &signaled);
+	CHECK(source != NULL);
+
+	CHECK(wl_event_loop_dispatch(loop, 0) == 0);
+	CHECK(!signaled);
+
+	timeline_inc(timeline_fd, 1);
+	CHECK(wl_event_loop_dispatch(loop, 1000) == 0);
+	CHECK(signaled);
+
+	wl_event_source_remove(source);
+	close(fence_fd);
+	wl_event_loop_destroy(loop);
+}
+
+static void test_export(void) {
+	int heap_fd = open("/dev/dma_heap/system", O_RDONLY | O_CLOEXEC);
+	if (heap_fd < 0) {
+		fprintf(stderr, "No DMA-BUF heap, skipping export test\n");
+		return;
+	}
+
+	struct dma_heap_allocation_data alloc = {
+		.len = 4096,
+		.fd_flags = O_RDWR | O_CLOEXEC,
+	};
+	CHECK(ioctl(heap_fd, DMA_HEAP_IOCTL_ALLOC, &alloc) == 0);
+	close(heap_fd);
+
+	struct wlr_dmabuf_attributes dmabuf = {
+		.width = 32,
+		.height = 32,
+		.n_planes = 2,
+		.fd = { alloc.fd, alloc.fd },
+	};
+	int fence_fd = dmabuf_export_sync_file(&dmabuf, DMA_BUF_SYNC_WRITE);
+	if (fence_fd < 0) {
+		// Kernels older than 6.0 don't support the export ioctl
+		fprintf(stderr, "DMA-BUF sync_file export unsupported, skipping\n");
+	} else {
+		// Nothing accessed the buffer, so there is nothing to wait on
+		CHECK(sync_file_is_valid(fence_fd));
+		CHECK(sync_file_is_signaled(fence_fd));
+		close(fence_fd);
+	}
+
+	close(alloc.fd);
+}
+
+int main(void) {
+	wlr_log_init(WLR_ERROR, NULL);
+
+	int timeline_fd = open("/sys/kernel/debug/sync/sw_sync",
+		O_RDWR | O_CLOEXEC);
+	if (timeline_fd < 0) {
+		fprintf(stderr, "sw_sync unavailable (%s), skipping\n",
+			strerror(errno));
+		return SKIP;
+	}
+
+	test_is_valid(timeline_fd);
+	test_is_signaled(timeline_fd);
+	test_event_loop_wait(timeline_fd);
+	test_export();
+
+	close(timeline_fd);
+	return EXIT_SUCCESS;
+}
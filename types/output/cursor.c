@@ -436,7 +436,9 @@ static void output_cursor_commit(struct wlr_output_cursor *cursor,
 		return;
 	}
 
-	// Fallback to software cursor
+	// Fallback to software cursor. It's rendered during the output's render
+	// pass, upload the buffer now.
+	wlr_surface_get_texture(surface);
 	output_cursor_damage_whole(cursor);
 }
 
@@ -0,0 +1,63 @@
+#include <stdlib.h>
+#include <wlr/types/wlr_output_layer.h>
+#include <wlr/util/log.h>
+#include "types/wlr_output.h"
+
+struct wlr_output_layer *wlr_output_layer_create(struct wlr_output *output) {
+	struct wlr_output_layer *layer = calloc(1, sizeof(*layer));
+	if (layer == NULL) {
+		wlr_log_errno(WLR_ERROR, "Allocation failed");
+		return NULL;
+	}
+
+	layer->output = output;
+	wlr_addon_set_init(&layer->addons);
+	wl_list_insert(output->layers.prev, &layer->link);
+
+	return layer;
+}
+
+void wlr_output_layer_destroy(struct wlr_output_layer *layer) {
+	if (layer == NULL) {
+		return;
+	}
+
+	wlr_addon_set_finish(&layer->addons);
+	wl_list_remove(&layer->link);
+	free(layer);
+}
+
+bool output_layers_test(struct wlr_output *output,
+		const struct wlr_output_state *state) {
+	for (size_t i = 0; i < state->layers_len; i++) {
+		const struct wlr_output_layer_state *layer_state = &state->layers[i];
+		if (layer_state->layer->output != output) {
+			wlr_log(WLR_DEBUG, "Tried to set a layer of another output");
+			return false;
+		}
+		for (size_t j = 0; j < i; j++) {
+			if (state->layers[j].layer == layer_state->layer) {
+				wlr_log(WLR_DEBUG, "Tried to set the same layer twice");
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+void output_layers_reset_feedback(const struct wlr_output_state *state) {
+	for (size_t i = 0; i < state->layers_len; i++) {
+		state->layers[i].accepted = false;
+	}
+}
+
+void output_layers_apply_order(struct wlr_output *output,
+		const struct wlr_output_state *state) {
+	// Layers which aren't part of the state keep their relative order below
+	// the ones which are
+	for (size_t i = 0; i < state->layers_len; i++) {
+		struct wlr_output_layer *layer = state->layers[i].layer;
+		wl_list_remove(&layer->link);
+		wl_list_insert(output->layers.prev, &layer->link);
+	}
+}
@@ -5,7 +5,9 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <wlr/interfaces/wlr_output.h>
+#include <wlr/render/wlr_renderer.h>
 #include <wlr/types/wlr_matrix.h>
+#include <wlr/types/wlr_output_layer.h>
 #include <wlr/types/wlr_surface.h>
 #include <wlr/util/log.h>
 #include "render/allocator/allocator.h"
@@ -13,9 +15,13 @@
 #include "types/wlr_output.h"
 #include "util/global.h"
 #include "util/signal.h"
+#include "util/time.h"
 
 #define OUTPUT_VERSION 4
 
+// Commits with a buffer further apart than this mean content is idle
+#define CONTENT_IDLE_NSEC 200000000
+
 static void send_geometry(struct wl_resource *resource) {
 	struct wlr_output *output = wlr_output_from_resource(resource);
 	wl_output_send_geometry(resource, 0, 0,
@@ -316,6 +322,17 @@ void wlr_output_enable_adaptive_sync(struct wlr_output *output, bool enabled) {
 	output->pending.adaptive_sync_enabled = enabled;
 }
 
+void wlr_output_set_present_mode(struct wlr_output *output,
+		enum wlr_output_present_mode mode) {
+	if (output->present_mode == mode) {
+		output->pending.committed &= ~WLR_OUTPUT_STATE_PRESENT_MODE;
+		return;
+	}
+
+	output->pending.committed |= WLR_OUTPUT_STATE_PRESENT_MODE;
+	output->pending.present_mode = mode;
+}
+
 void wlr_output_set_render_format(struct wlr_output *output, uint32_t format) {
 	if (output->render_format == format) {
 		output->pending.committed &= ~WLR_OUTPUT_STATE_RENDER_FORMAT;
@@ -391,6 +408,7 @@ void wlr_output_init(struct wlr_output *output, struct wlr_backend *backend,
 	output->scale = 1;
 	output->commit_seq = 0;
 	wl_list_init(&output->cursors);
+	wl_list_init(&output->layers);
 	wl_list_init(&output->resources);
 	wl_signal_init(&output->events.frame);
 	wl_signal_init(&output->events.damage);
@@ -437,6 +455,11 @@ void wlr_output_destroy(struct wlr_output *output) {
 		wlr_output_cursor_destroy(cursor);
 	}
 
+	struct wlr_output_layer *layer, *tmp_layer;
+	wl_list_for_each_safe(layer, tmp_layer, &output->layers, link) {
+		wlr_output_layer_destroy(layer);
+	}
+
 	wlr_swapchain_destroy(output->cursor_swapchain);
 	wlr_buffer_unlock(output->cursor_front_buffer);
 
@@ -526,9 +549,16 @@ static void output_state_clear_ctm(struct wlr_output_state *state) {
 	state->committed &= ~WLR_OUTPUT_STATE_CTM;
 }
 
+static void output_state_clear_layers(struct wlr_output_state *state) {
+	state->layers = NULL;
+	state->layers_len = 0;
+	state->committed &= ~WLR_OUTPUT_STATE_LAYERS;
+}
+
 static void output_state_clear(struct wlr_output_state *state) {
 	output_state_clear_buffer(state);
 	output_state_clear_gamma_lut(state);
+	output_state_clear_layers(state);
 	pixman_region32_clear(&state->damage);
 	state->committed = 0;
 }
@@ -645,6 +675,15 @@ static bool output_basic_test(struct wlr_output *output) {
 		wlr_log(WLR_DEBUG, "Tried to set the ctm on a disabled output");
 		return false;
 	}
+	if (output->pending.committed & WLR_OUTPUT_STATE_LAYERS) {
+		if (!enabled && output->pending.layers_len > 0) {
+			wlr_log(WLR_DEBUG, "Tried to set layers on a disabled output");
+			return false;
+		}
+		if (!output_layers_test(output, &output->pending)) {
+			return false;
+		}
+	}
 
 	return true;
 }
@@ -656,12 +695,31 @@ bool wlr_output_test(struct wlr_output *output) {
 	if (!output_ensure_buffer(output)) {
 		return false;
 	}
+	if (output->pending.committed & WLR_OUTPUT_STATE_LAYERS) {
+		output_layers_reset_feedback(&output->pending);
+	}
 	if (!output->impl->test) {
 		return true;
 	}
 	return output->impl->test(output);
 }
 
+static void output_update_content_period(struct wlr_output *output,
+		const struct timespec *now) {
+	int64_t now_ns = timespec_to_nsec(now);
+	int64_t interval = now_ns - output->last_buffer_commit_ns;
+	if (output->last_buffer_commit_ns == 0 || interval > CONTENT_IDLE_NSEC) {
+		output->content_period_ns = 0;
+	} else if (output->content_period_ns == 0) {
+		output->content_period_ns = interval;
+	} else {
+		// Smooth out jitter
+		output->content_period_ns =
+			(3 * output->content_period_ns + interval) / 4;
+	}
+	output->last_buffer_commit_ns = now_ns;
+}
+
 bool wlr_output_commit(struct wlr_output *output) {
 	if (!output_basic_test(output)) {
 		wlr_log(WLR_ERROR, "Basic output test failed for %s", output->name);
@@ -692,10 +750,16 @@ bool wlr_output_commit(struct wlr_output *output) {
 	// implicit rendering synchronization point. The backend needs it to avoid
 	// displaying a buffer when asynchronous GPU work isn't finished.
 	struct wlr_buffer *back_buffer = NULL;
+	struct wlr_render_pass_stats render_stats = {0};
 	if ((output->pending.committed & WLR_OUTPUT_STATE_BUFFER) &&
 			output->back_buffer != NULL) {
 		back_buffer = wlr_buffer_lock(output->back_buffer);
 		output_clear_back_buffer(output);
+		wlr_renderer_get_pass_stats(output->renderer, &render_stats);
+	}
+
+	if (output->pending.committed & WLR_OUTPUT_STATE_LAYERS) {
+		output_layers_reset_feedback(&output->pending);
 	}
 
 	if (!output->impl->commit(output)) {
@@ -705,6 +769,8 @@ bool wlr_output_commit(struct wlr_output *output) {
 	}
 
 	if (output->pending.committed & WLR_OUTPUT_STATE_BUFFER) {
+		output_update_content_period(output, &now);
+
 		struct wlr_output_cursor *cursor;
 		wl_list_for_each(cursor, &output->cursors, link) {
 			if (!cursor->enabled || !cursor->visible || cursor->surface == NULL) {
@@ -718,6 +784,14 @@ bool wlr_output_commit(struct wlr_output *output) {
 		output->render_format = output->pending.render_format;
 	}
 
+	if (output->pending.committed & WLR_OUTPUT_STATE_PRESENT_MODE) {
+		output->present_mode = output->pending.present_mode;
+	}
+
+	if (output->pending.committed & WLR_OUTPUT_STATE_LAYERS) {
+		output_layers_apply_order(output, &output->pending);
+	}
+
 	output->commit_seq++;
 
 	bool scale_updated = output->pending.committed & WLR_OUTPUT_STATE_SCALE;
@@ -771,6 +845,7 @@ bool wlr_output_commit(struct wlr_output *output) {
 		.committed = committed,
 		.when = &now,
 		.buffer = back_buffer,
+		.render_stats = back_buffer != NULL ? &render_stats : NULL,
 	};
 	wlr_signal_emit_safe(&output->events.commit, &event);
 
@@ -860,6 +935,14 @@ void wlr_output_set_ctm(struct wlr_output *output, const uint32_t *ctm) {
 	output->pending.committed |= WLR_OUTPUT_STATE_CTM;
 }
 
+void wlr_output_set_layers(struct wlr_output *output,
+		struct wlr_output_layer_state *layers, size_t layers_len) {
+	output_state_clear_layers(&output->pending);
+	output->pending.layers = layers;
+	output->pending.layers_len = layers_len;
+	output->pending.committed |= WLR_OUTPUT_STATE_LAYERS;
+}
+
 void wlr_output_set_gamma(struct wlr_output *output, size_t size,
 		const uint16_t *r, const uint16_t *g, const uint16_t *b) {
 	output_state_clear_gamma_lut(&output->pending);
@@ -884,6 +967,59 @@ size_t wlr_output_get_gamma_size(struct wlr_output *output) {
 	return output->impl->get_gamma_size(output);
 }
 
+bool wlr_output_get_next_vblank(struct wlr_output *output,
+		struct timespec *when) {
+	if (!output->enabled || !output->impl->get_next_vblank) {
+		return false;
+	}
+	return output->impl->get_next_vblank(output, when);
+}
+
+static bool output_content_is_animated(struct wlr_output *output) {
+	if (output->content_period_ns == 0) {
+		return false;
+	}
+
+	// Content is being animated if the next frame is expected soon
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int64_t elapsed = timespec_to_nsec(&now) - output->last_buffer_commit_ns;
+	return elapsed < 2 * output->content_period_ns;
+}
+
+int64_t output_get_frame_repeat_period(struct wlr_output *output) {
+	if (output->adaptive_sync_status != WLR_OUTPUT_ADAPTIVE_SYNC_ENABLED ||
+			output->adaptive_sync_min_refresh <= 0) {
+		return 0;
+	}
+
+	// Leave some slack for scheduling jitter
+	int64_t max_period =
+		1000000000000LL / output->adaptive_sync_min_refresh * 9 / 10;
+	int64_t min_period = 0;
+	if (output->adaptive_sync_max_refresh > 0) {
+		min_period = 1000000000000LL / output->adaptive_sync_max_refresh;
+	}
+
+	// Only content animated below the minimum refresh rate needs help: the
+	// display refreshes on its own while the desktop is idle
+	int64_t content_period = output->content_period_ns;
+	if (content_period <= max_period || !output_content_is_animated(output)) {
+		return 0;
+	}
+
+	// Repeat each frame the same number of times, so that refreshes are
+	// evenly spaced and content doesn't judder
+	int64_t n = (content_period + max_period - 1) / max_period;
+	int64_t period = content_period / n;
+	return period >= min_period ? period : max_period;
+}
+
+bool output_defer_cursor_update(struct wlr_output *output) {
+	return output->adaptive_sync_status == WLR_OUTPUT_ADAPTIVE_SYNC_ENABLED &&
+		output_content_is_animated(output);
+}
+
 void wlr_output_update_needs_frame(struct wlr_output *output) {
 	if (output->needs_frame) {
 		return;
@@ -5,6 +5,7 @@
 #include <wlr/render/wlr_renderer.h>
 #include <wlr/types/wlr_matrix.h>
 #include <wlr/types/wlr_output_damage.h>
+#include <wlr/types/wlr_output_layer.h>
 #include <wlr/types/wlr_presentation_time.h>
 #include <wlr/types/wlr_scene.h>
 #include <wlr/types/wlr_surface.h>
@@ -120,6 +121,7 @@ void wlr_scene_node_destroy(struct wlr_scene_node *node) {
 		}
 
 		wl_list_remove(&scene_surface->surface_commit.link);
+		wl_list_remove(&scene_surface->surface_queue.link);
 		wl_list_remove(&scene_surface->surface_destroy.link);
 
 		free(scene_surface);
@@ -256,13 +258,17 @@ static void scene_surface_handle_surface_commit(struct wl_listener *listener,
 		return;
 	}
 
+	pixman_region32_t surface_damage;
+	pixman_region32_init(&surface_damage);
+	wlr_surface_get_effective_damage(surface, &surface_damage);
+
 	struct wlr_scene_output *scene_output;
 	wl_list_for_each(scene_output, &scene->outputs, link) {
 		struct wlr_output *output = scene_output->output;
 
 		pixman_region32_t damage;
 		pixman_region32_init(&damage);
-		wlr_surface_get_effective_damage(surface, &damage);
+		pixman_region32_copy(&damage, &surface_damage);
 
 		pixman_region32_translate(&damage,
 			lx - scene_output->x, ly - scene_output->y);
@@ -277,6 +283,44 @@ static void scene_surface_handle_surface_commit(struct wl_listener *listener,
 		wlr_output_damage_add(scene_output->damage, &damage);
 		pixman_region32_fini(&damage);
 	}
+
+	pixman_region32_fini(&surface_damage);
+}
+
+static void scene_surface_handle_surface_queue(struct wl_listener *listener,
+		void *data) {
+	struct wlr_scene_surface *scene_surface =
+		wl_container_of(listener, scene_surface, surface_queue);
+	struct wlr_surface *surface = scene_surface->surface;
+
+	int lx, ly;
+	if (!wlr_scene_node_coords(&scene_surface->node, &lx, &ly)) {
+		return;
+	}
+
+	// The queued commit is latched by wlr_scene_output_commit(), make sure
+	// it runs even if nothing else changed on the outputs
+	struct wlr_box surface_box = {
+		.x = lx,
+		.y = ly,
+		.width = surface->current.width,
+		.height = surface->current.height,
+	};
+	struct wlr_scene *scene = scene_node_get_root(&scene_surface->node);
+	struct wlr_scene_output *scene_output;
+	wl_list_for_each(scene_output, &scene->outputs, link) {
+		struct wlr_box output_box = {
+			.x = scene_output->x,
+			.y = scene_output->y,
+		};
+		wlr_output_effective_resolution(scene_output->output,
+			&output_box.width, &output_box.height);
+
+		struct wlr_box intersection;
+		if (wlr_box_intersection(&intersection, &surface_box, &output_box)) {
+			wlr_output_schedule_frame(scene_output->output);
+		}
+	}
 }
 
 struct wlr_scene_surface *wlr_scene_surface_create(struct wlr_scene_node *parent,
@@ -296,6 +340,9 @@ struct wlr_scene_surface *wlr_scene_surface_create(struct wlr_scene_node *parent
 	scene_surface->surface_commit.notify = scene_surface_handle_surface_commit;
 	wl_signal_add(&surface->events.commit, &scene_surface->surface_commit);
 
+	scene_surface->surface_queue.notify = scene_surface_handle_surface_queue;
+	wl_signal_add(&surface->events.queue, &scene_surface->surface_queue);
+
 	scene_node_damage_whole(&scene_surface->node);
 
 	scene_node_update_surface_outputs(&scene_surface->node);
@@ -774,6 +821,10 @@ struct render_data {
 
 	// May be NULL
 	struct wlr_presentation *presentation;
+
+	// Nodes displayed by output layers, which must not be composited
+	struct wlr_scene_node **skip_nodes;
+	size_t skip_nodes_len;
 };
 
 static void render_node_iterator(struct wlr_scene_node *node,
@@ -782,6 +833,12 @@ static void render_node_iterator(struct wlr_scene_node *node,
 	struct wlr_output *output = data->output;
 	pixman_region32_t *output_damage = data->damage;
 
+	for (size_t i = 0; i < data->skip_nodes_len; i++) {
+		if (data->skip_nodes[i] == node) {
+			return;
+		}
+	}
+
 	struct wlr_box dst_box = {
 		.x = x,
 		.y = y,
@@ -864,8 +921,9 @@ static void scene_node_for_each_node(struct wlr_scene_node *node,
 	}
 }
 
-void wlr_scene_render_output(struct wlr_scene *scene, struct wlr_output *output,
-		int lx, int ly, pixman_region32_t *damage) {
+static void scene_render_output(struct wlr_scene *scene,
+		struct wlr_output *output, int lx, int ly, pixman_region32_t *damage,
+		struct wlr_scene_node **skip_nodes, size_t skip_nodes_len) {
 	pixman_region32_t full_region;
 	pixman_region32_init_rect(&full_region, 0, 0, output->width, output->height);
 	if (damage == NULL) {
@@ -880,6 +938,8 @@ void wlr_scene_render_output(struct wlr_scene *scene, struct wlr_output *output,
 			.output = output,
 			.damage = damage,
 			.presentation = scene->presentation,
+			.skip_nodes = skip_nodes,
+			.skip_nodes_len = skip_nodes_len,
 		};
 		scene_node_for_each_node(&scene->node, -lx, -ly,
 			render_node_iterator, &data);
@@ -889,6 +949,11 @@ void wlr_scene_render_output(struct wlr_scene *scene, struct wlr_output *output,
 	pixman_region32_fini(&full_region);
 }
 
+void wlr_scene_render_output(struct wlr_scene *scene, struct wlr_output *output,
+		int lx, int ly, pixman_region32_t *damage) {
+	scene_render_output(scene, output, lx, ly, damage, NULL, 0);
+}
+
 static void scene_handle_presentation_destroy(struct wl_listener *listener,
 		void *data) {
 	struct wlr_scene *scene =
@@ -932,6 +997,8 @@ struct wlr_scene_output *wlr_scene_output_create(struct wlr_scene *scene,
 
 	scene_output->output = output;
 	scene_output->scene = scene;
+	wl_array_init(&scene_output->frame_done_surfaces);
+	wl_array_init(&scene_output->latch_surfaces);
 	wlr_addon_init(&scene_output->addon, &output->addons, scene, &output_addon_impl);
 	wl_list_insert(&scene->outputs, &scene_output->link);
 
@@ -946,6 +1013,16 @@ static void scene_output_send_leave_iterator(struct wlr_surface *surface,
 	wlr_surface_send_leave(surface, output);
 }
 
+static void scene_output_finish_layers(struct wlr_scene_output *scene_output) {
+	for (size_t i = 0; i < scene_output->max_layers; i++) {
+		wlr_output_layer_destroy(scene_output->layers[i]);
+	}
+	free(scene_output->layers);
+	free(scene_output->layer_states);
+	free(scene_output->layer_nodes);
+	free(scene_output->offloaded_nodes);
+}
+
 void wlr_scene_output_destroy(struct wlr_scene_output *scene_output) {
 	wlr_addon_finish(&scene_output->addon);
 	wl_list_remove(&scene_output->link);
@@ -953,6 +1030,9 @@ void wlr_scene_output_destroy(struct wlr_scene_output *scene_output) {
 	wlr_scene_output_for_each_surface(scene_output,
 		scene_output_send_leave_iterator, scene_output->output);
 
+	scene_output_finish_layers(scene_output);
+	wl_array_release(&scene_output->frame_done_surfaces);
+	wl_array_release(&scene_output->latch_surfaces);
 	free(scene_output);
 }
 
@@ -981,6 +1061,51 @@ void wlr_scene_output_set_position(struct wlr_scene_output *scene_output,
 	scene_node_update_surface_outputs(&scene_output->scene->node);
 }
 
+bool wlr_scene_output_set_max_layers(struct wlr_scene_output *scene_output,
+		size_t max_layers) {
+	if (scene_output->max_layers == max_layers) {
+		return true;
+	}
+
+	struct wlr_scene_output new = {
+		.output = scene_output->output,
+	};
+	if (max_layers > 0) {
+		new.layers = calloc(max_layers, sizeof(*new.layers));
+		new.layer_states = calloc(max_layers, sizeof(*new.layer_states));
+		new.layer_nodes = calloc(max_layers, sizeof(*new.layer_nodes));
+		new.offloaded_nodes = calloc(max_layers, sizeof(*new.offloaded_nodes));
+		if (new.layers == NULL || new.layer_states == NULL ||
+				new.layer_nodes == NULL || new.offloaded_nodes == NULL) {
+			goto error;
+		}
+		for (; new.max_layers < max_layers; new.max_layers++) {
+			new.layers[new.max_layers] =
+				wlr_output_layer_create(scene_output->output);
+			if (new.layers[new.max_layers] == NULL) {
+				goto error;
+			}
+		}
+	}
+
+	scene_output_finish_layers(scene_output);
+	scene_output->layers = new.layers;
+	scene_output->layer_states = new.layer_states;
+	scene_output->layer_nodes = new.layer_nodes;
+	scene_output->max_layers = max_layers;
+	scene_output->offloaded_nodes = new.offloaded_nodes;
+	scene_output->offloaded_nodes_len = 0;
+
+	// The old layers may still be displayed until the next commit
+	wlr_output_damage_add_whole(scene_output->damage);
+	return true;
+
+error:
+	wlr_log(WLR_ERROR, "Failed to allocate output layers");
+	scene_output_finish_layers(&new);
+	return false;
+}
+
 struct check_scanout_data {
 	// in
 	struct wlr_box viewport_box;
@@ -1032,7 +1157,7 @@ static bool scene_output_scanout(struct wlr_scene_output *scene_output) {
 	switch (node->type) {
 	case WLR_SCENE_NODE_SURFACE:;
 		struct wlr_scene_surface *scene_surface = wlr_scene_surface_from_node(node);
-		if (scene_surface->surface->buffer == NULL ||
+		if (wlr_surface_get_texture(scene_surface->surface) == NULL ||
 				scene_surface->surface->current.viewport.has_src ||
 				scene_surface->surface->current.transform != output->transform) {
 			return false;
@@ -1053,6 +1178,10 @@ static bool scene_output_scanout(struct wlr_scene_output *scene_output) {
 	}
 
 	wlr_output_attach_buffer(output, buffer);
+	if (scene_output->max_layers > 0) {
+		// Nothing may be displayed on top of the scanned out buffer
+		wlr_output_set_layers(output, NULL, 0);
+	}
 	if (!wlr_output_test(output)) {
 		wlr_output_rollback(output);
 		return false;
@@ -1073,12 +1202,247 @@ static bool scene_output_scanout(struct wlr_scene_output *scene_output) {
 	return wlr_output_commit(output);
 }
 
+static struct wlr_buffer *scene_node_get_layer_buffer(
+		struct wlr_scene_node *node, struct wlr_fbox *src_box) {
+	switch (node->type) {
+	case WLR_SCENE_NODE_SURFACE:;
+		struct wlr_surface *surface = wlr_scene_surface_from_node(node)->surface;
+		if (wlr_surface_get_texture(surface) == NULL ||
+				surface->current.transform != WL_OUTPUT_TRANSFORM_NORMAL) {
+			return NULL;
+		}
+		wlr_surface_get_buffer_source_box(surface, src_box);
+		return &surface->buffer->base;
+	case WLR_SCENE_NODE_BUFFER:;
+		struct wlr_scene_buffer *scene_buffer = scene_buffer_from_node(node);
+		if (scene_buffer->buffer == NULL ||
+				scene_buffer->transform != WL_OUTPUT_TRANSFORM_NORMAL) {
+			return NULL;
+		}
+		*src_box = scene_buffer->src_box;
+		return scene_buffer->buffer;
+	default:
+		return NULL;
+	}
+}
+
+struct collect_layers_data {
+	struct wlr_scene_output *scene_output;
+	struct wlr_box viewport_box;
+	size_t len;
+};
+
+static void collect_layers_iterator(struct wlr_scene_node *node,
+		int x, int y, void *_data) {
+	struct collect_layers_data *data = _data;
+	struct wlr_scene_output *scene_output = data->scene_output;
+
+	if (node->type == WLR_SCENE_NODE_ROOT ||
+			node->type == WLR_SCENE_NODE_TREE) {
+		return;
+	}
+
+	struct wlr_box node_box = { .x = x, .y = y };
+	scene_node_get_size(node, &node_box.width, &node_box.height);
+
+	struct wlr_box intersection;
+	if (!wlr_box_intersection(&intersection, &data->viewport_box, &node_box)) {
+		return;
+	}
+
+	// Only an uninterrupted run of eligible nodes at the top of the scene
+	// can be displayed above the composited primary buffer
+	struct wlr_fbox src_box = {0};
+	struct wlr_buffer *buffer = scene_node_get_layer_buffer(node, &src_box);
+	if (buffer == NULL) {
+		data->len = 0;
+		return;
+	}
+
+	if (data->len == scene_output->max_layers) {
+		memmove(&scene_output->layer_states[0], &scene_output->layer_states[1],
+			(data->len - 1) * sizeof(scene_output->layer_states[0]));
+		memmove(&scene_output->layer_nodes[0], &scene_output->layer_nodes[1],
+			(data->len - 1) * sizeof(scene_output->layer_nodes[0]));
+		data->len--;
+	}
+
+	struct wlr_box dst_box = {
+		.x = node_box.x - data->viewport_box.x,
+		.y = node_box.y - data->viewport_box.y,
+		.width = node_box.width,
+		.height = node_box.height,
+	};
+	scale_box(&dst_box, scene_output->output->scale);
+
+	scene_output->layer_states[data->len] = (struct wlr_output_layer_state){
+		.buffer = buffer,
+		.src_box = src_box,
+		.dst_box = dst_box,
+	};
+	scene_output->layer_nodes[data->len] = node;
+	data->len++;
+}
+
+static bool scene_output_can_use_layers(struct wlr_scene_output *scene_output) {
+	struct wlr_output *output = scene_output->output;
+	if (output->transform != WL_OUTPUT_TRANSFORM_NORMAL) {
+		return false;
+	}
+
+	// Software cursors are composited, layers would be displayed on top of
+	// them
+	struct wlr_output_cursor *cursor;
+	wl_list_for_each(cursor, &output->cursors, link) {
+		if (cursor->enabled && cursor->visible &&
+				cursor != output->hardware_cursor) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Try to display the top-most buffers of the scene with output layers. The
+ * nodes accepted by the backend are stored in offloaded_nodes and must not be
+ * composited.
+ */
+static void scene_output_update_layers(struct wlr_scene_output *scene_output) {
+	struct wlr_output *output = scene_output->output;
+
+	struct collect_layers_data data = {
+		.scene_output = scene_output,
+		.viewport_box = { .x = scene_output->x, .y = scene_output->y },
+	};
+	if (scene_output_can_use_layers(scene_output)) {
+		wlr_output_effective_resolution(output,
+			&data.viewport_box.width, &data.viewport_box.height);
+		scene_node_for_each_node(&scene_output->scene->node, 0, 0,
+			collect_layers_iterator, &data);
+	}
+
+	for (size_t i = 0; i < data.len; i++) {
+		scene_output->layer_states[i].layer = scene_output->layers[i];
+	}
+	wlr_output_set_layers(output, scene_output->layer_states, data.len);
+	if (data.len > 0 && !wlr_output_test(output)) {
+		for (size_t i = 0; i < data.len; i++) {
+			scene_output->layer_states[i].accepted = false;
+		}
+	}
+
+	// Rejected nodes are composited into the primary buffer, which is
+	// displayed below all layers. Only the top-most run of accepted layers
+	// can be offloaded without breaking the stacking order.
+	size_t first_offloaded = data.len;
+	while (first_offloaded > 0 &&
+			scene_output->layer_states[first_offloaded - 1].accepted) {
+		first_offloaded--;
+	}
+	// Disable the other layers, so that the backend can't accept them on
+	// commit and display them on top of their composited copy
+	for (size_t i = 0; i < first_offloaded; i++) {
+		scene_output->layer_states[i].buffer = NULL;
+		scene_output->layer_states[i].accepted = false;
+	}
+
+	bool changed = false;
+	size_t offloaded_len = 0;
+	for (size_t i = first_offloaded; i < data.len; i++) {
+		struct wlr_scene_node *node = scene_output->layer_nodes[i];
+		if (offloaded_len >= scene_output->offloaded_nodes_len ||
+				scene_output->offloaded_nodes[offloaded_len] != node) {
+			changed = true;
+		}
+		scene_output->offloaded_nodes[offloaded_len++] = node;
+	}
+	if (offloaded_len != scene_output->offloaded_nodes_len) {
+		changed = true;
+	}
+	scene_output->offloaded_nodes_len = offloaded_len;
+
+	// Nodes moving to or away from a layer need to be (un)composited
+	if (changed) {
+		wlr_output_damage_add_whole(scene_output->damage);
+	}
+}
+
+/**
+ * The backend may reject at commit time a layer it accepted when testing. In
+ * that case the node hasn't been composited: repaint it on the next frame.
+ */
+static void scene_output_check_layers_feedback(
+		struct wlr_scene_output *scene_output, size_t layers_len) {
+	struct wlr_presentation *presentation = scene_output->scene->presentation;
+	size_t offloaded_index = 0;
+	for (size_t i = 0; i < layers_len; i++) {
+		struct wlr_scene_node *node = scene_output->layer_nodes[i];
+		if (offloaded_index == scene_output->offloaded_nodes_len ||
+				scene_output->offloaded_nodes[offloaded_index] != node) {
+			continue;
+		}
+		offloaded_index++;
+
+		if (!scene_output->layer_states[i].accepted) {
+			scene_output->offloaded_nodes_len = 0;
+			wlr_output_damage_add_whole(scene_output->damage);
+			wlr_output_schedule_frame(scene_output->output);
+			return;
+		}
+
+		if (presentation != NULL && node->type == WLR_SCENE_NODE_SURFACE) {
+			struct wlr_scene_surface *scene_surface =
+				wlr_scene_surface_from_node(node);
+			if (scene_surface->primary_output == scene_output->output) {
+				wlr_presentation_surface_sampled_on_output(presentation,
+					scene_surface->surface, scene_output->output);
+			}
+		}
+	}
+}
+
+static void scene_output_collect_latch_iterator(struct wlr_surface *surface,
+		int sx, int sy, void *data) {
+	struct wl_array *surfaces = data;
+	if (surface->queued == NULL) {
+		return;
+	}
+	struct wlr_surface **surface_ptr =
+		wl_array_add(surfaces, sizeof(*surface_ptr));
+	if (surface_ptr != NULL) {
+		*surface_ptr = surface;
+	}
+}
+
+static void scene_output_upload_iterator(struct wlr_surface *surface,
+		int sx, int sy, void *data) {
+	wlr_surface_get_texture(surface);
+}
+
 bool wlr_scene_output_commit(struct wlr_scene_output *scene_output) {
 	struct wlr_output *output = scene_output->output;
 
 	struct wlr_renderer *renderer = output->renderer;
 	assert(renderer != NULL);
 
+	// Apply the newest commit of surfaces in mailbox mode. This damages the
+	// output, so it needs to happen before we collect the damage. Commit
+	// handlers may change the scene-graph, so don't latch while walking it.
+	struct wl_array *latch_surfaces = &scene_output->latch_surfaces;
+	latch_surfaces->size = 0;
+	wlr_scene_output_for_each_surface(scene_output,
+		scene_output_collect_latch_iterator, latch_surfaces);
+	struct wlr_surface **surface_ptr;
+	wl_array_for_each(surface_ptr, latch_surfaces) {
+		wlr_surface_latch(*surface_ptr);
+	}
+
+	// Surface buffers are uploaded lazily, and textures can't be created
+	// during the render pass
+	wlr_scene_output_for_each_surface(scene_output,
+		scene_output_upload_iterator, NULL);
+
 	bool scanout = scene_output_scanout(scene_output);
 	if (scanout != scene_output->prev_scanout) {
 		wlr_log(WLR_DEBUG, "Direct scan-out %s",
@@ -1088,9 +1452,16 @@ bool wlr_scene_output_commit(struct wlr_scene_output *scene_output) {
 	}
 	scene_output->prev_scanout = scanout;
 	if (scanout) {
+		scene_output->offloaded_nodes_len = 0;
 		return true;
 	}
 
+	size_t layers_len = 0;
+	if (scene_output->max_layers > 0) {
+		scene_output_update_layers(scene_output);
+		layers_len = output->pending.layers_len;
+	}
+
 	bool needs_frame;
 	pixman_region32_t damage;
 	pixman_region32_init(&damage);
@@ -1115,8 +1486,9 @@ bool wlr_scene_output_commit(struct wlr_scene_output *scene_output) {
 		wlr_renderer_clear(renderer, (float[4]){ 0.0, 0.0, 0.0, 1.0 });
 	}
 
-	wlr_scene_render_output(scene_output->scene, output,
-		scene_output->x, scene_output->y, &damage);
+	scene_render_output(scene_output->scene, output,
+		scene_output->x, scene_output->y, &damage,
+		scene_output->offloaded_nodes, scene_output->offloaded_nodes_len);
 	wlr_output_render_software_cursors(output, &damage);
 
 	wlr_renderer_end(renderer);
@@ -1135,11 +1507,16 @@ bool wlr_scene_output_commit(struct wlr_scene_output *scene_output) {
 	wlr_output_set_damage(output, &frame_damage);
 	pixman_region32_fini(&frame_damage);
 
-	return wlr_output_commit(output);
+	if (!wlr_output_commit(output)) {
+		return false;
+	}
+	scene_output_check_layers_feedback(scene_output, layers_len);
+	return true;
 }
 
-static void scene_output_send_frame_done_iterator(struct wlr_scene_node *node,
-		struct wlr_output *output, struct timespec *now) {
+static void scene_output_collect_frame_done_iterator(
+		struct wlr_scene_node *node, struct wlr_output *output,
+		struct wl_array *surfaces) {
 	if (!node->state.enabled) {
 		return;
 	}
@@ -1147,21 +1524,32 @@ static void scene_output_send_frame_done_iterator(struct wlr_scene_node *node,
 	if (node->type == WLR_SCENE_NODE_SURFACE) {
 		struct wlr_scene_surface *scene_surface =
 			wlr_scene_surface_from_node(node);
-		if (scene_surface->primary_output == output) {
-			wlr_surface_send_frame_done(scene_surface->surface, now);
+		struct wlr_surface *surface = scene_surface->surface;
+		if (scene_surface->primary_output == output &&
+				!wl_list_empty(&surface->current.frame_callback_list)) {
+			struct wlr_surface **surface_ptr =
+				wl_array_add(surfaces, sizeof(*surface_ptr));
+			if (surface_ptr != NULL) {
+				*surface_ptr = surface;
+			}
 		}
 	}
 
 	struct wlr_scene_node *child;
 	wl_list_for_each(child, &node->state.children, state.link) {
-		scene_output_send_frame_done_iterator(child, output, now);
+		scene_output_collect_frame_done_iterator(child, output, surfaces);
 	}
 }
 
 void wlr_scene_output_send_frame_done(struct wlr_scene_output *scene_output,
 		struct timespec *now) {
-	scene_output_send_frame_done_iterator(&scene_output->scene->node,
-		scene_output->output, now);
+	struct wl_array *surfaces = &scene_output->frame_done_surfaces;
+	surfaces->size = 0;
+	scene_output_collect_frame_done_iterator(&scene_output->scene->node,
+		scene_output->output, surfaces);
+
+	wlr_surface_send_frame_done_batch(surfaces->data,
+		surfaces->size / sizeof(struct wlr_surface *), now);
 }
 
 static void scene_output_for_each_surface(const struct wlr_box *output_box,
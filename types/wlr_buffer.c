@@ -1,6 +1,11 @@
+#define _POSIX_C_SOURCE 200809L
 #include <assert.h>
 #include <drm_fourcc.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
 #include <wlr/render/wlr_renderer.h>
 #include <wlr/types/wlr_buffer.h>
 #include <wlr/types/wlr_drm.h>
@@ -9,6 +14,331 @@
 #include "render/pixel_format.h"
 #include "types/wlr_buffer.h"
 #include "util/signal.h"
+#include "util/time.h"
+
+/**
+ * Buffer lifetime tracing.
+ *
+ * When enabled, each buffer gets a trace entry recording its owner client and
+ * the last callers to lock and unlock it, and buffer events are recorded in a
+ * ring. Callers are recorded as return addresses, which can be resolved with
+ * addr2line.
+ */
+
+#define BUFFER_TRACE_EVENTS_CAP 1024
+
+enum buffer_trace_event_type {
+	BUFFER_TRACE_CREATE,
+	BUFFER_TRACE_LOCK,
+	BUFFER_TRACE_UNLOCK,
+	BUFFER_TRACE_RELEASE,
+	BUFFER_TRACE_DROP,
+	BUFFER_TRACE_DESTROY,
+};
+
+static const char *const buffer_trace_event_names[] = {
+	[BUFFER_TRACE_CREATE] = "create",
+	[BUFFER_TRACE_LOCK] = "lock",
+	[BUFFER_TRACE_UNLOCK] = "unlock",
+	[BUFFER_TRACE_RELEASE] = "release",
+	[BUFFER_TRACE_DROP] = "drop",
+	[BUFFER_TRACE_DESTROY] = "destroy",
+};
+
+struct buffer_trace_event {
+	struct timespec time;
+	const struct wlr_buffer *buffer;
+	enum buffer_trace_event_type type;
+	size_t n_locks;
+	const void *caller;
+};
+
+struct wlr_buffer_trace_entry {
+	struct wlr_buffer *buffer;
+	struct wl_list link; // buffer_trace.entries
+
+	struct wl_client *client; // NULL if not created from a wl_buffer
+	struct wl_listener client_destroy;
+
+	const void *last_lock_caller, *last_unlock_caller;
+};
+
+static struct {
+	bool initialized, enabled;
+	struct wl_list entries; // wlr_buffer_trace_entry.link
+	size_t entries_len;
+
+	struct buffer_trace_event events[BUFFER_TRACE_EVENTS_CAP];
+	size_t events_len, events_next;
+} buffer_trace = {0};
+
+static bool buffer_trace_init(void) {
+	if (!buffer_trace.initialized) {
+		buffer_trace.initialized = true;
+		wl_list_init(&buffer_trace.entries);
+		const char *env = getenv("WLR_BUFFER_TRACE");
+		buffer_trace.enabled = env != NULL && strcmp(env, "1") == 0;
+	}
+	return buffer_trace.enabled;
+}
+
+void wlr_buffer_trace_enable(bool enabled) {
+	buffer_trace_init();
+	buffer_trace.enabled = enabled;
+}
+
+static void buffer_trace_record(struct wlr_buffer *buffer,
+		enum buffer_trace_event_type type, const void *caller) {
+	struct wlr_buffer_trace_entry *entry = buffer->trace;
+	if (entry == NULL) {
+		return;
+	}
+
+	switch (type) {
+	case BUFFER_TRACE_LOCK:
+		entry->last_lock_caller = caller;
+		break;
+	case BUFFER_TRACE_UNLOCK:
+		entry->last_unlock_caller = caller;
+		break;
+	default:
+		break;
+	}
+
+	struct buffer_trace_event *event =
+		&buffer_trace.events[buffer_trace.events_next];
+	clock_gettime(CLOCK_MONOTONIC, &event->time);
+	event->buffer = buffer;
+	event->type = type;
+	event->n_locks = buffer->n_locks;
+	event->caller = caller;
+
+	buffer_trace.events_next =
+		(buffer_trace.events_next + 1) % BUFFER_TRACE_EVENTS_CAP;
+	if (buffer_trace.events_len < BUFFER_TRACE_EVENTS_CAP) {
+		buffer_trace.events_len++;
+	}
+}
+
+static void buffer_trace_entry_handle_client_destroy(
+		struct wl_listener *listener, void *data) {
+	struct wlr_buffer_trace_entry *entry =
+		wl_container_of(listener, entry, client_destroy);
+	entry->client = NULL;
+	wl_list_remove(&entry->client_destroy.link);
+	wl_list_init(&entry->client_destroy.link);
+}
+
+static void buffer_trace_create(struct wlr_buffer *buffer,
+		const void *caller) {
+	buffer->trace = NULL;
+	if (!buffer_trace_init()) {
+		return;
+	}
+
+	struct wlr_buffer_trace_entry *entry = calloc(1, sizeof(*entry));
+	if (entry == NULL) {
+		return;
+	}
+	entry->buffer = buffer;
+	wl_list_init(&entry->client_destroy.link);
+	wl_list_insert(&buffer_trace.entries, &entry->link);
+	buffer_trace.entries_len++;
+
+	buffer->trace = entry;
+	buffer_trace_record(buffer, BUFFER_TRACE_CREATE, caller);
+}
+
+static void buffer_trace_destroy(struct wlr_buffer *buffer) {
+	struct wlr_buffer_trace_entry *entry = buffer->trace;
+	if (entry == NULL) {
+		return;
+	}
+
+	buffer_trace_record(buffer, BUFFER_TRACE_DESTROY, NULL);
+
+	wl_list_remove(&entry->client_destroy.link);
+	wl_list_remove(&entry->link);
+	buffer_trace.entries_len--;
+	free(entry);
+	buffer->trace = NULL;
+}
+
+static void buffer_trace_set_client(struct wlr_buffer *buffer,
+		struct wl_client *client) {
+	struct wlr_buffer_trace_entry *entry = buffer->trace;
+	if (entry == NULL || entry->client == client) {
+		return;
+	}
+
+	wl_list_remove(&entry->client_destroy.link);
+	entry->client = client;
+	entry->client_destroy.notify = buffer_trace_entry_handle_client_destroy;
+	wl_client_add_destroy_listener(client, &entry->client_destroy);
+}
+
+static const char *buffer_get_impl_name(const struct wlr_buffer *buffer) {
+	return buffer->impl->name != NULL ? buffer->impl->name : "unknown";
+}
+
+// Estimates the amount of memory backing the buffer, without mapping it
+static size_t buffer_get_size(struct wlr_buffer *buffer) {
+	struct wlr_dmabuf_attributes dmabuf;
+	struct wlr_shm_attributes shm;
+	if (wlr_client_buffer_get(buffer) != NULL) {
+		// Imported DMA-BUFs share memory with their source buffer, other
+		// client buffers hold a texture copy
+		if (wlr_buffer_get_dmabuf(buffer, &dmabuf)) {
+			return 0;
+		}
+	} else if (wlr_buffer_get_dmabuf(buffer, &dmabuf)) {
+		size_t size = 0;
+		for (int i = 0; i < dmabuf.n_planes; i++) {
+			size += (size_t)dmabuf.stride[i] * dmabuf.height;
+		}
+		return size;
+	} else if (wlr_buffer_get_shm(buffer, &shm)) {
+		return (size_t)shm.stride * shm.height;
+	}
+	return (size_t)buffer->width * buffer->height * 4;
+}
+
+static void buffer_trace_stats_add(struct wlr_buffer_trace_stats *stats,
+		struct wlr_buffer *buffer) {
+	stats->buffers++;
+	stats->bytes += buffer_get_size(buffer);
+	if (buffer->n_locks > 0) {
+		stats->locked++;
+	}
+	if (buffer->dropped) {
+		stats->dropped++;
+	}
+}
+
+bool wlr_buffer_trace_get_stats(const char *impl_name,
+		struct wl_client *client, struct wlr_buffer_trace_stats *stats) {
+	memset(stats, 0, sizeof(*stats));
+	if (!buffer_trace_init() && wl_list_empty(&buffer_trace.entries)) {
+		return false;
+	}
+
+	struct wlr_buffer_trace_entry *entry;
+	wl_list_for_each(entry, &buffer_trace.entries, link) {
+		if (impl_name != NULL &&
+				strcmp(buffer_get_impl_name(entry->buffer), impl_name) != 0) {
+			continue;
+		}
+		if (client != NULL && entry->client != client) {
+			continue;
+		}
+		buffer_trace_stats_add(stats, entry->buffer);
+	}
+	return true;
+}
+
+struct buffer_trace_group {
+	const void *key;
+	struct wlr_buffer_trace_stats stats;
+};
+
+static void buffer_trace_group_add(struct wl_array *groups, const void *key,
+		struct wlr_buffer *buffer) {
+	struct buffer_trace_group *group;
+	wl_array_for_each(group, groups) {
+		if (group->key == key) {
+			buffer_trace_stats_add(&group->stats, buffer);
+			return;
+		}
+	}
+
+	group = wl_array_add(groups, sizeof(*group));
+	if (group == NULL) {
+		return;
+	}
+	memset(group, 0, sizeof(*group));
+	group->key = key;
+	buffer_trace_stats_add(&group->stats, buffer);
+}
+
+static pid_t client_get_pid(struct wl_client *client) {
+	pid_t pid = 0;
+	if (client != NULL) {
+		wl_client_get_credentials(client, &pid, NULL, NULL);
+	}
+	return pid;
+}
+
+bool wlr_buffer_trace_dump(const char *path) {
+	FILE *f = fopen(path, "w");
+	if (f == NULL) {
+		wlr_log_errno(WLR_ERROR, "Failed to open %s", path);
+		return false;
+	}
+
+	buffer_trace_init();
+	fprintf(f, "# wlr_buffer trace (%s)\n",
+		buffer_trace.enabled ? "enabled" : "disabled");
+
+	struct wl_array impls, clients;
+	wl_array_init(&impls);
+	wl_array_init(&clients);
+	struct wlr_buffer_trace_entry *entry;
+	wl_list_for_each(entry, &buffer_trace.entries, link) {
+		// Impl names are static strings, compare them by address
+		buffer_trace_group_add(&impls, buffer_get_impl_name(entry->buffer),
+			entry->buffer);
+		buffer_trace_group_add(&clients, entry->client, entry->buffer);
+	}
+
+	struct buffer_trace_group *group;
+	fprintf(f, "\n# impl buffers bytes locked dropped\n");
+	wl_array_for_each(group, &impls) {
+		fprintf(f, "%s %zu %zu %zu %zu\n", (const char *)group->key,
+			group->stats.buffers, group->stats.bytes, group->stats.locked,
+			group->stats.dropped);
+	}
+
+	fprintf(f, "\n# client_pid buffers bytes locked dropped\n");
+	wl_array_for_each(group, &clients) {
+		fprintf(f, "%d %zu %zu %zu %zu\n",
+			(int)client_get_pid((struct wl_client *)group->key),
+			group->stats.buffers, group->stats.bytes, group->stats.locked,
+			group->stats.dropped);
+	}
+
+	wl_array_release(&impls);
+	wl_array_release(&clients);
+
+	fprintf(f, "\n# buffer impl width height bytes n_locks dropped "
+		"client_pid last_lock_caller last_unlock_caller\n");
+	wl_list_for_each(entry, &buffer_trace.entries, link) {
+		struct wlr_buffer *buffer = entry->buffer;
+		fprintf(f, "%p %s %d %d %zu %zu %d %d %p %p\n", (void *)buffer,
+			buffer_get_impl_name(buffer), buffer->width, buffer->height,
+			buffer_get_size(buffer), buffer->n_locks, buffer->dropped,
+			(int)client_get_pid(entry->client), entry->last_lock_caller,
+			entry->last_unlock_caller);
+	}
+
+	fprintf(f, "\n# time buffer event n_locks caller\n");
+	size_t start = (buffer_trace.events_next + BUFFER_TRACE_EVENTS_CAP -
+		buffer_trace.events_len) % BUFFER_TRACE_EVENTS_CAP;
+	for (size_t i = 0; i < buffer_trace.events_len; i++) {
+		const struct buffer_trace_event *event =
+			&buffer_trace.events[(start + i) % BUFFER_TRACE_EVENTS_CAP];
+		fprintf(f, "%lld.%09ld %p %s %zu %p\n",
+			(long long)event->time.tv_sec, event->time.tv_nsec,
+			(const void *)event->buffer,
+			buffer_trace_event_names[event->type], event->n_locks,
+			event->caller);
+	}
+
+	if (fclose(f) != 0) {
+		wlr_log_errno(WLR_ERROR, "Failed to write %s", path);
+		return false;
+	}
+	return true;
+}
 
 void wlr_buffer_init(struct wlr_buffer *buffer,
 		const struct wlr_buffer_impl *impl, int width, int height) {
@@ -22,6 +352,7 @@ void wlr_buffer_init(struct wlr_buffer *buffer,
 	wl_signal_init(&buffer->events.destroy);
 	wl_signal_init(&buffer->events.release);
 	wlr_addon_set_init(&buffer->addons);
+	buffer_trace_create(buffer, __builtin_return_address(0));
 }
 
 static void buffer_consider_destroy(struct wlr_buffer *buffer) {
@@ -33,6 +364,7 @@ static void buffer_consider_destroy(struct wlr_buffer *buffer) {
 
 	wlr_signal_emit_safe(&buffer->events.destroy, NULL);
 	wlr_addon_set_finish(&buffer->addons);
+	buffer_trace_destroy(buffer);
 
 	buffer->impl->destroy(buffer);
 }
@@ -44,11 +376,15 @@ void wlr_buffer_drop(struct wlr_buffer *buffer) {
 
 	assert(!buffer->dropped);
 	buffer->dropped = true;
+	buffer_trace_record(buffer, BUFFER_TRACE_DROP,
+		__builtin_return_address(0));
 	buffer_consider_destroy(buffer);
 }
 
 struct wlr_buffer *wlr_buffer_lock(struct wlr_buffer *buffer) {
 	buffer->n_locks++;
+	buffer_trace_record(buffer, BUFFER_TRACE_LOCK,
+		__builtin_return_address(0));
 	return buffer;
 }
 
@@ -60,7 +396,11 @@ void wlr_buffer_unlock(struct wlr_buffer *buffer) {
 	assert(buffer->n_locks > 0);
 	buffer->n_locks--;
 
+	const void *caller = __builtin_return_address(0);
+	buffer_trace_record(buffer, BUFFER_TRACE_UNLOCK, caller);
+
 	if (buffer->n_locks == 0) {
+		buffer_trace_record(buffer, BUFFER_TRACE_RELEASE, caller);
 		wl_signal_emit(&buffer->events.release, NULL);
 	}
 
@@ -141,6 +481,7 @@ static bool client_buffer_get_dmabuf(struct wlr_buffer *buffer,
 }
 
 static const struct wlr_buffer_impl client_buffer_impl = {
+	.name = "client",
 	.destroy = client_buffer_destroy,
 	.get_dmabuf = client_buffer_get_dmabuf,
 };
@@ -231,6 +572,8 @@ struct wlr_buffer *wlr_buffer_from_resource(struct wl_resource *resource) {
 		buffer = wlr_buffer_lock(custom_buffer);
 	}
 
+	buffer_trace_set_client(buffer, wl_resource_get_client(resource));
+
 	return buffer;
 }
 
@@ -337,6 +680,8 @@ static void shm_client_buffer_destroy(struct wlr_buffer *wlr_buffer) {
 		shm_client_buffer_from_buffer(wlr_buffer);
 	wl_list_remove(&buffer->resource_destroy.link);
 	wl_list_remove(&buffer->release.link);
+	wl_list_remove(&buffer->link);
+	wl_list_remove(&buffer->cache_link);
 	if (buffer->saved_shm_pool != NULL) {
 		wl_shm_pool_unref(buffer->saved_shm_pool);
 	}
@@ -367,20 +712,165 @@ static void shm_client_buffer_end_data_ptr_access(struct wlr_buffer *wlr_buffer)
 }
 
 static const struct wlr_buffer_impl shm_client_buffer_impl = {
+	.name = "shm_client",
 	.destroy = shm_client_buffer_destroy,
 	.begin_data_ptr_access = shm_client_buffer_begin_data_ptr_access,
 	.end_data_ptr_access = shm_client_buffer_end_data_ptr_access,
 };
 
+/**
+ * Clients often create a new wl_buffer for each frame, at the same place in
+ * the same wl_shm_pool. Wrappers of destroyed wl_buffers are kept around for a
+ * little while so that they can be recycled, along with the state consumers
+ * have attached to them (e.g. Pixman images).
+ *
+ * Each client has its own cache, so that clients can't evict each other's
+ * entries. Cached wrappers are keyed by data address, size, stride and
+ * format: a consumer's state referring to the data of the old wl_buffer is
+ * valid for a new wl_buffer with the same key.
+ *
+ * Cached wrappers don't reference their pool. libwayland defers pool resizes
+ * while the pool is referenced, so a reference would make the client's
+ * requests fail against the old pool size. The old mapping may be gone while
+ * a wrapper is cached, but cached wrappers are never accessed.
+ */
+#define SHM_CLIENT_BUFFER_CACHE_SIZE 4
+#define SHM_CLIENT_BUFFER_CACHE_TIMEOUT_MSEC 1000
+
+struct shm_client_buffer_cache {
+	struct wl_list buffers; // wlr_shm_client_buffer.link
+	// Most recently cached first
+	struct wl_list cached; // wlr_shm_client_buffer.cache_link
+	size_t cached_len;
+
+	struct wl_listener client_destroy;
+};
+
+static void shm_client_buffer_cache_remove(
+		struct wlr_shm_client_buffer *buffer) {
+	wl_list_remove(&buffer->cache_link);
+	wl_list_init(&buffer->cache_link);
+	buffer->cache->cached_len--;
+}
+
+static void shm_client_buffer_cache_evict(
+		struct wlr_shm_client_buffer *buffer) {
+	shm_client_buffer_cache_remove(buffer);
+	wlr_buffer_drop(&buffer->base);
+}
+
+static void shm_client_buffer_cache_handle_client_destroy(
+		struct wl_listener *listener, void *data) {
+	struct shm_client_buffer_cache *cache =
+		wl_container_of(listener, cache, client_destroy);
+
+	struct wlr_shm_client_buffer *buffer, *tmp;
+	wl_list_for_each_safe(buffer, tmp, &cache->cached, cache_link) {
+		shm_client_buffer_cache_evict(buffer);
+	}
+	// Wrappers still in use outlive the client
+	wl_list_for_each_safe(buffer, tmp, &cache->buffers, link) {
+		buffer->cache = NULL;
+		wl_list_remove(&buffer->link);
+		wl_list_init(&buffer->link);
+	}
+
+	wl_list_remove(&cache->client_destroy.link);
+	free(cache);
+}
+
+static struct shm_client_buffer_cache *shm_client_buffer_cache_get(
+		struct wl_client *client) {
+	struct wl_listener *listener = wl_client_get_destroy_listener(client,
+		shm_client_buffer_cache_handle_client_destroy);
+	if (listener != NULL) {
+		struct shm_client_buffer_cache *cache =
+			wl_container_of(listener, cache, client_destroy);
+		return cache;
+	}
+
+	struct shm_client_buffer_cache *cache = calloc(1, sizeof(*cache));
+	if (cache == NULL) {
+		return NULL;
+	}
+	wl_list_init(&cache->buffers);
+	wl_list_init(&cache->cached);
+	cache->client_destroy.notify = shm_client_buffer_cache_handle_client_destroy;
+	wl_client_add_destroy_listener(client, &cache->client_destroy);
+	return cache;
+}
+
+static void shm_client_buffer_cache_expire(
+		struct shm_client_buffer_cache *cache) {
+	uint32_t now = get_current_time_msec();
+	struct wlr_shm_client_buffer *buffer, *tmp;
+	wl_list_for_each_reverse_safe(buffer, tmp, &cache->cached, cache_link) {
+		if (now - buffer->cached_msec < SHM_CLIENT_BUFFER_CACHE_TIMEOUT_MSEC) {
+			break;
+		}
+		shm_client_buffer_cache_evict(buffer);
+	}
+}
+
+static void shm_client_buffer_cache_add(struct wlr_shm_client_buffer *buffer) {
+	struct shm_client_buffer_cache *cache = buffer->cache;
+	shm_client_buffer_cache_expire(cache);
+	if (cache->cached_len == SHM_CLIENT_BUFFER_CACHE_SIZE) {
+		struct wlr_shm_client_buffer *oldest =
+			wl_container_of(cache->cached.prev, oldest, cache_link);
+		shm_client_buffer_cache_evict(oldest);
+	}
+
+	buffer->cached_msec = get_current_time_msec();
+	wl_list_insert(&cache->cached, &buffer->cache_link);
+	cache->cached_len++;
+}
+
+static struct wlr_shm_client_buffer *shm_client_buffer_cache_take(
+		struct shm_client_buffer_cache *cache, struct wl_shm_buffer *shm_buffer) {
+	shm_client_buffer_cache_expire(cache);
+
+	void *data = wl_shm_buffer_get_data(shm_buffer);
+	int32_t width = wl_shm_buffer_get_width(shm_buffer);
+	int32_t height = wl_shm_buffer_get_height(shm_buffer);
+	size_t stride = wl_shm_buffer_get_stride(shm_buffer);
+	uint32_t format =
+		convert_wl_shm_format_to_drm(wl_shm_buffer_get_format(shm_buffer));
+
+	struct wlr_shm_client_buffer *buffer, *found = NULL;
+	wl_list_for_each(buffer, &cache->cached, cache_link) {
+		if (buffer->cached_data == data && buffer->base.width == width &&
+				buffer->base.height == height &&
+				buffer->stride == stride && buffer->format == format) {
+			found = buffer;
+			break;
+		}
+	}
+	if (found == NULL) {
+		return NULL;
+	}
+
+	shm_client_buffer_cache_remove(found);
+	found->cached_data = NULL;
+	return found;
+}
+
 static void shm_client_buffer_resource_handle_destroy(
 		struct wl_listener *listener, void *data) {
 	struct wlr_shm_client_buffer *buffer =
 		wl_container_of(listener, buffer, resource_destroy);
 
-	// In order to still be able to access the shared memory region, we need to
-	// keep a reference to the wl_shm_pool
-	buffer->saved_shm_pool = wl_shm_buffer_ref_pool(buffer->shm_buffer);
-	buffer->saved_data = wl_shm_buffer_get_data(buffer->shm_buffer);
+	// Nobody is using the buffer anymore, keep it for recycling unless the
+	// client is going away
+	bool cache = buffer->base.n_locks == 0 && buffer->cache != NULL;
+	if (cache) {
+		buffer->cached_data = wl_shm_buffer_get_data(buffer->shm_buffer);
+	} else {
+		// In order to still be able to access the shared memory region, we
+		// need to keep a reference to the wl_shm_pool
+		buffer->saved_shm_pool = wl_shm_buffer_ref_pool(buffer->shm_buffer);
+		buffer->saved_data = wl_shm_buffer_get_data(buffer->shm_buffer);
+	}
 
 	// The wl_shm_buffer destroys itself with the wl_resource
 	buffer->resource = NULL;
@@ -388,10 +878,24 @@ static void shm_client_buffer_resource_handle_destroy(
 	wl_list_remove(&buffer->resource_destroy.link);
 	wl_list_init(&buffer->resource_destroy.link);
 
+	if (cache) {
+		shm_client_buffer_cache_add(buffer);
+		return;
+	}
+
 	// This might destroy the buffer
 	wlr_buffer_drop(&buffer->base);
 }
 
+static void shm_client_buffer_attach_resource(
+		struct wlr_shm_client_buffer *buffer, struct wl_resource *resource) {
+	buffer->resource = resource;
+	buffer->shm_buffer = wl_shm_buffer_get(resource);
+
+	buffer->resource_destroy.notify = shm_client_buffer_resource_handle_destroy;
+	wl_resource_add_destroy_listener(resource, &buffer->resource_destroy);
+}
+
 static void shm_client_buffer_handle_release(struct wl_listener *listener,
 		void *data) {
 	struct wlr_shm_client_buffer *buffer =
@@ -415,23 +919,39 @@ static struct wlr_shm_client_buffer *shm_client_buffer_get_or_create(
 		return buffer;
 	}
 
+	struct shm_client_buffer_cache *cache =
+		shm_client_buffer_cache_get(wl_resource_get_client(resource));
+	struct wlr_shm_client_buffer *buffer = NULL;
+	if (cache != NULL) {
+		buffer = shm_client_buffer_cache_take(cache, shm_buffer);
+	}
+	if (buffer != NULL) {
+		shm_client_buffer_attach_resource(buffer, resource);
+		return buffer;
+	}
+
 	int32_t width = wl_shm_buffer_get_width(shm_buffer);
 	int32_t height = wl_shm_buffer_get_height(shm_buffer);
 
-	struct wlr_shm_client_buffer *buffer = calloc(1, sizeof(*buffer));
+	buffer = calloc(1, sizeof(*buffer));
 	if (buffer == NULL) {
 		return NULL;
 	}
 	wlr_buffer_init(&buffer->base, &shm_client_buffer_impl, width, height);
-	buffer->resource = resource;
-	buffer->shm_buffer = shm_buffer;
 
 	enum wl_shm_format wl_shm_format = wl_shm_buffer_get_format(shm_buffer);
 	buffer->format = convert_wl_shm_format_to_drm(wl_shm_format);
 	buffer->stride = wl_shm_buffer_get_stride(shm_buffer);
 
-	buffer->resource_destroy.notify = shm_client_buffer_resource_handle_destroy;
-	wl_resource_add_destroy_listener(resource, &buffer->resource_destroy);
+	shm_client_buffer_attach_resource(buffer, resource);
+
+	wl_list_init(&buffer->cache_link);
+	buffer->cache = cache;
+	if (cache != NULL) {
+		wl_list_insert(&cache->buffers, &buffer->link);
+	} else {
+		wl_list_init(&buffer->link);
+	}
 
 	buffer->release.notify = shm_client_buffer_handle_release;
 	wl_signal_add(&buffer->base.events.release, &buffer->release);
@@ -475,6 +995,7 @@ static void readonly_data_buffer_end_data_ptr_access(struct wlr_buffer *wlr_buff
 }
 
 static const struct wlr_buffer_impl readonly_data_buffer_impl = {
+	.name = "readonly_data",
 	.destroy = readonly_data_buffer_destroy,
 	.begin_data_ptr_access = readonly_data_buffer_begin_data_ptr_access,
 	.end_data_ptr_access = readonly_data_buffer_end_data_ptr_access,
@@ -546,6 +1067,7 @@ static bool dmabuf_buffer_get_dmabuf(struct wlr_buffer *wlr_buffer,
 }
 
 static const struct wlr_buffer_impl dmabuf_buffer_impl = {
+	.name = "dmabuf",
 	.destroy = dmabuf_buffer_destroy,
 	.get_dmabuf = dmabuf_buffer_get_dmabuf,
 };
@@ -0,0 +1,458 @@
+#define _POSIX_C_SOURCE 200809L
+#include <assert.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <wlr/render/dmabuf.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_linux_explicit_synchronization_v1.h>
+#include <wlr/types/wlr_surface.h>
+#include <wlr/util/addon.h>
+#include <wlr/util/log.h>
+#include "linux-explicit-synchronization-unstable-v1-protocol.h"
+#include "render/dmabuf.h"
+#include "util/signal.h"
+
+#define LINUX_EXPLICIT_SYNCHRONIZATION_V1_VERSION 2
+
+struct wlr_linux_surface_synchronization_v1 {
+	struct wl_resource *resource;
+	struct wlr_surface *surface;
+
+	// Applied to the next commit
+	int pending_fence_fd;
+	struct wlr_linux_buffer_release_v1 *pending_release;
+
+	struct wlr_addon addon;
+	struct wl_listener surface_client_commit;
+};
+
+struct wlr_linux_buffer_release_v1 {
+	struct wl_resource *resource;
+	// Set until committed, the release object may be destroyed first
+	struct wlr_linux_surface_synchronization_v1 *surface_sync;
+	struct wlr_buffer *buffer; // NULL until committed
+
+	struct wl_listener buffer_release;
+	struct wl_listener buffer_destroy;
+};
+
+// A commit waiting for its acquire fence to be signaled
+struct wlr_linux_acquire_wait_v1 {
+	struct wlr_surface *surface;
+	uint32_t seq;
+	int fence_fd;
+	struct wl_event_source *event_source;
+
+	struct wl_listener surface_destroy;
+};
+
+static const struct zwp_linux_explicit_synchronization_v1_interface
+	explicit_sync_impl;
+static const struct zwp_linux_surface_synchronization_v1_interface
+	surface_sync_impl;
+
+static struct wlr_linux_explicit_synchronization_v1 *explicit_sync_from_resource(
+		struct wl_resource *resource) {
+	assert(wl_resource_instance_of(resource,
+		&zwp_linux_explicit_synchronization_v1_interface, &explicit_sync_impl));
+	return wl_resource_get_user_data(resource);
+}
+
+// Returns NULL if the surface synchronization object is inert
+static struct wlr_linux_surface_synchronization_v1 *surface_sync_from_resource(
+		struct wl_resource *resource) {
+	assert(wl_resource_instance_of(resource,
+		&zwp_linux_surface_synchronization_v1_interface, &surface_sync_impl));
+	return wl_resource_get_user_data(resource);
+}
+
+static void buffer_release_send(struct wlr_linux_buffer_release_v1 *release) {
+	int fence_fd = -1;
+	struct wlr_dmabuf_attributes dmabuf;
+	if (release->buffer != NULL &&
+			wlr_buffer_get_dmabuf(release->buffer, &dmabuf)) {
+		// Wait for all readers, including the compositor's GPU work
+		fence_fd = dmabuf_export_sync_file(&dmabuf, DMA_BUF_SYNC_WRITE);
+	}
+
+	if (fence_fd >= 0) {
+		zwp_linux_buffer_release_v1_send_fenced_release(release->resource,
+			fence_fd);
+		close(fence_fd);
+	} else {
+		zwp_linux_buffer_release_v1_send_immediate_release(release->resource);
+	}
+
+	// The release object is destroyed after sending either event
+	wl_resource_destroy(release->resource);
+}
+
+static void buffer_release_handle_buffer_release(struct wl_listener *listener,
+		void *data) {
+	struct wlr_linux_buffer_release_v1 *release =
+		wl_container_of(listener, release, buffer_release);
+	buffer_release_send(release);
+}
+
+static void buffer_release_handle_buffer_destroy(struct wl_listener *listener,
+		void *data) {
+	struct wlr_linux_buffer_release_v1 *release =
+		wl_container_of(listener, release, buffer_destroy);
+	release->buffer = NULL;
+	buffer_release_send(release);
+}
+
+static void buffer_release_handle_resource_destroy(
+		struct wl_resource *resource) {
+	struct wlr_linux_buffer_release_v1 *release =
+		wl_resource_get_user_data(resource);
+	if (release->surface_sync != NULL) {
+		release->surface_sync->pending_release = NULL;
+	}
+	wl_list_remove(&release->buffer_release.link);
+	wl_list_remove(&release->buffer_destroy.link);
+	free(release);
+}
+
+static void buffer_release_attach(struct wlr_linux_buffer_release_v1 *release,
+		struct wlr_buffer *buffer) {
+	release->surface_sync->pending_release = NULL;
+	release->surface_sync = NULL;
+	release->buffer = buffer;
+	release->buffer_release.notify = buffer_release_handle_buffer_release;
+	wl_signal_add(&buffer->events.release, &release->buffer_release);
+	release->buffer_destroy.notify = buffer_release_handle_buffer_destroy;
+	wl_signal_add(&buffer->events.destroy, &release->buffer_destroy);
+}
+
+static void acquire_wait_destroy(struct wlr_linux_acquire_wait_v1 *wait) {
+	wl_event_source_remove(wait->event_source);
+	close(wait->fence_fd);
+	wl_list_remove(&wait->surface_destroy.link);
+	free(wait);
+}
+
+static int acquire_wait_handle_fence(int fd, uint32_t mask, void *data) {
+	struct wlr_linux_acquire_wait_v1 *wait = data;
+
+	if (mask & (WL_EVENT_HANGUP | WL_EVENT_ERROR)) {
+		wlr_log(WLR_ERROR, "Failed to wait for acquire fence");
+	}
+
+	struct wlr_surface *surface = wait->surface;
+	uint32_t seq = wait->seq;
+	acquire_wait_destroy(wait);
+
+	wlr_surface_unlock_cached(surface, seq);
+	return 0;
+}
+
+static void acquire_wait_handle_surface_destroy(struct wl_listener *listener,
+		void *data) {
+	struct wlr_linux_acquire_wait_v1 *wait =
+		wl_container_of(listener, wait, surface_destroy);
+	acquire_wait_destroy(wait);
+}
+
+// Takes ownership of the fence FD
+static void acquire_wait_create(struct wlr_surface *surface, int fence_fd) {
+	if (sync_file_is_signaled(fence_fd)) {
+		close(fence_fd);
+		return;
+	}
+
+	struct wlr_linux_acquire_wait_v1 *wait = calloc(1, sizeof(*wait));
+	if (wait == NULL) {
+		wl_resource_post_no_memory(surface->resource);
+		close(fence_fd);
+		return;
+	}
+
+	struct wl_client *client = wl_resource_get_client(surface->resource);
+	struct wl_event_loop *loop =
+		wl_display_get_event_loop(wl_client_get_display(client));
+	wait->event_source = wl_event_loop_add_fd(loop, fence_fd,
+		WL_EVENT_READABLE, acquire_wait_handle_fence, wait);
+	if (wait->event_source == NULL) {
+		wlr_log(WLR_ERROR, "Failed to add acquire fence to event loop");
+		close(fence_fd);
+		free(wait);
+		return;
+	}
+
+	wait->surface = surface;
+	wait->fence_fd = fence_fd;
+	wait->seq = wlr_surface_lock_pending(surface);
+
+	wait->surface_destroy.notify = acquire_wait_handle_surface_destroy;
+	wl_signal_add(&surface->events.destroy, &wait->surface_destroy);
+}
+
+static void surface_sync_handle_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static void surface_sync_handle_set_acquire_fence(struct wl_client *client,
+		struct wl_resource *resource, int32_t fd) {
+	struct wlr_linux_surface_synchronization_v1 *surface_sync =
+		surface_sync_from_resource(resource);
+	if (surface_sync == NULL) {
+		close(fd);
+		wl_resource_post_error(resource,
+			ZWP_LINUX_SURFACE_SYNCHRONIZATION_V1_ERROR_NO_SURFACE,
+			"The surface has been destroyed");
+		return;
+	}
+
+	if (surface_sync->pending_fence_fd >= 0) {
+		close(fd);
+		wl_resource_post_error(resource,
+			ZWP_LINUX_SURFACE_SYNCHRONIZATION_V1_ERROR_DUPLICATE_FENCE,
+			"An acquire fence has already been set for this commit");
+		return;
+	}
+
+	if (!sync_file_is_valid(fd)) {
+		close(fd);
+		wl_resource_post_error(resource,
+			ZWP_LINUX_SURFACE_SYNCHRONIZATION_V1_ERROR_INVALID_FENCE,
+			"The acquire fence is not a sync_file");
+		return;
+	}
+
+	surface_sync->pending_fence_fd = fd;
+}
+
+static void surface_sync_handle_get_release(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id) {
+	struct wlr_linux_surface_synchronization_v1 *surface_sync =
+		surface_sync_from_resource(resource);
+	if (surface_sync == NULL) {
+		wl_resource_post_error(resource,
+			ZWP_LINUX_SURFACE_SYNCHRONIZATION_V1_ERROR_NO_SURFACE,
+			"The surface has been destroyed");
+		return;
+	}
+
+	if (surface_sync->pending_release != NULL) {
+		wl_resource_post_error(resource,
+			ZWP_LINUX_SURFACE_SYNCHRONIZATION_V1_ERROR_DUPLICATE_RELEASE,
+			"A release object has already been requested for this commit");
+		return;
+	}
+
+	struct wlr_linux_buffer_release_v1 *release = calloc(1, sizeof(*release));
+	if (release == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	release->resource = wl_resource_create(client,
+		&zwp_linux_buffer_release_v1_interface,
+		wl_resource_get_version(resource), id);
+	if (release->resource == NULL) {
+		wl_client_post_no_memory(client);
+		free(release);
+		return;
+	}
+	wl_resource_set_implementation(release->resource, NULL, release,
+		buffer_release_handle_resource_destroy);
+
+	wl_list_init(&release->buffer_release.link);
+	wl_list_init(&release->buffer_destroy.link);
+
+	release->surface_sync = surface_sync;
+	surface_sync->pending_release = release;
+}
+
+static const struct zwp_linux_surface_synchronization_v1_interface
+		surface_sync_impl = {
+	.destroy = surface_sync_handle_destroy,
+	.set_acquire_fence = surface_sync_handle_set_acquire_fence,
+	.get_release = surface_sync_handle_get_release,
+};
+
+static void surface_sync_destroy(
+		struct wlr_linux_surface_synchronization_v1 *surface_sync) {
+	if (surface_sync == NULL) {
+		return;
+	}
+
+	if (surface_sync->pending_fence_fd >= 0) {
+		close(surface_sync->pending_fence_fd);
+	}
+	if (surface_sync->pending_release != NULL) {
+		// Never attached to a buffer
+		struct wlr_linux_buffer_release_v1 *release =
+			surface_sync->pending_release;
+		release->surface_sync = NULL;
+		surface_sync->pending_release = NULL;
+		buffer_release_send(release);
+	}
+
+	wl_resource_set_user_data(surface_sync->resource, NULL);
+	wlr_addon_finish(&surface_sync->addon);
+	wl_list_remove(&surface_sync->surface_client_commit.link);
+	free(surface_sync);
+}
+
+static void surface_sync_handle_resource_destroy(struct wl_resource *resource) {
+	struct wlr_linux_surface_synchronization_v1 *surface_sync =
+		surface_sync_from_resource(resource);
+	surface_sync_destroy(surface_sync);
+}
+
+static void surface_sync_addon_destroy(struct wlr_addon *addon) {
+	struct wlr_linux_surface_synchronization_v1 *surface_sync =
+		wl_container_of(addon, surface_sync, addon);
+	surface_sync_destroy(surface_sync);
+}
+
+static const struct wlr_addon_interface surface_sync_addon_impl = {
+	.name = "wlr_linux_surface_synchronization_v1",
+	.destroy = surface_sync_addon_destroy,
+};
+
+static void surface_sync_handle_surface_client_commit(
+		struct wl_listener *listener, void *data) {
+	struct wlr_linux_surface_synchronization_v1 *surface_sync =
+		wl_container_of(listener, surface_sync, surface_client_commit);
+	struct wlr_surface_state *pending = &surface_sync->surface->pending;
+
+	if (surface_sync->pending_fence_fd < 0 &&
+			surface_sync->pending_release == NULL) {
+		return;
+	}
+
+	if (!(pending->committed & WLR_SURFACE_STATE_BUFFER) ||
+			pending->buffer == NULL) {
+		wl_resource_post_error(surface_sync->resource,
+			ZWP_LINUX_SURFACE_SYNCHRONIZATION_V1_ERROR_NO_BUFFER,
+			"Fence or release object set without a buffer attached");
+		return;
+	}
+
+	struct wlr_dmabuf_attributes dmabuf;
+	if (surface_sync->pending_fence_fd >= 0 &&
+			!wlr_buffer_get_dmabuf(pending->buffer, &dmabuf)) {
+		wl_resource_post_error(surface_sync->resource,
+			ZWP_LINUX_SURFACE_SYNCHRONIZATION_V1_ERROR_UNSUPPORTED_BUFFER,
+			"Acquire fence set for a buffer which isn't a DMA-BUF");
+		return;
+	}
+
+	if (surface_sync->pending_release != NULL) {
+		buffer_release_attach(surface_sync->pending_release, pending->buffer);
+	}
+
+	if (surface_sync->pending_fence_fd >= 0) {
+		acquire_wait_create(surface_sync->surface,
+			surface_sync->pending_fence_fd);
+		surface_sync->pending_fence_fd = -1;
+	}
+}
+
+static void explicit_sync_handle_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static void explicit_sync_handle_get_synchronization(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id,
+		struct wl_resource *surface_resource) {
+	struct wlr_linux_explicit_synchronization_v1 *explicit_sync =
+		explicit_sync_from_resource(resource);
+	struct wlr_surface *surface = wlr_surface_from_resource(surface_resource);
+
+	if (wlr_addon_find(&surface->addons, explicit_sync,
+			&surface_sync_addon_impl) != NULL) {
+		wl_resource_post_error(resource,
+			ZWP_LINUX_EXPLICIT_SYNCHRONIZATION_V1_ERROR_SYNCHRONIZATION_EXISTS,
+			"A synchronization object already exists for this surface");
+		return;
+	}
+
+	struct wlr_linux_surface_synchronization_v1 *surface_sync =
+		calloc(1, sizeof(*surface_sync));
+	if (surface_sync == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	surface_sync->resource = wl_resource_create(client,
+		&zwp_linux_surface_synchronization_v1_interface,
+		wl_resource_get_version(resource), id);
+	if (surface_sync->resource == NULL) {
+		wl_client_post_no_memory(client);
+		free(surface_sync);
+		return;
+	}
+	wl_resource_set_implementation(surface_sync->resource, &surface_sync_impl,
+		surface_sync, surface_sync_handle_resource_destroy);
+
+	surface_sync->surface = surface;
+	surface_sync->pending_fence_fd = -1;
+
+	wlr_addon_init(&surface_sync->addon, &surface->addons, explicit_sync,
+		&surface_sync_addon_impl);
+
+	surface_sync->surface_client_commit.notify =
+		surface_sync_handle_surface_client_commit;
+	wl_signal_add(&surface->events.client_commit,
+		&surface_sync->surface_client_commit);
+}
+
+static const struct zwp_linux_explicit_synchronization_v1_interface
+		explicit_sync_impl = {
+	.destroy = explicit_sync_handle_destroy,
+	.get_synchronization = explicit_sync_handle_get_synchronization,
+};
+
+static void explicit_sync_bind(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct wlr_linux_explicit_synchronization_v1 *explicit_sync = data;
+
+	struct wl_resource *resource = wl_resource_create(client,
+		&zwp_linux_explicit_synchronization_v1_interface, version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &explicit_sync_impl,
+		explicit_sync, NULL);
+}
+
+static void handle_display_destroy(struct wl_listener *listener, void *data) {
+	struct wlr_linux_explicit_synchronization_v1 *explicit_sync =
+		wl_container_of(listener, explicit_sync, display_destroy);
+	wlr_signal_emit_safe(&explicit_sync->events.destroy, NULL);
+	wl_list_remove(&explicit_sync->display_destroy.link);
+	wl_global_destroy(explicit_sync->global);
+	free(explicit_sync);
+}
+
+struct wlr_linux_explicit_synchronization_v1 *
+		wlr_linux_explicit_synchronization_v1_create(struct wl_display *display) {
+	struct wlr_linux_explicit_synchronization_v1 *explicit_sync =
+		calloc(1, sizeof(*explicit_sync));
+	if (explicit_sync == NULL) {
+		return NULL;
+	}
+
+	explicit_sync->global = wl_global_create(display,
+		&zwp_linux_explicit_synchronization_v1_interface,
+		LINUX_EXPLICIT_SYNCHRONIZATION_V1_VERSION, explicit_sync,
+		explicit_sync_bind);
+	if (explicit_sync->global == NULL) {
+		free(explicit_sync);
+		return NULL;
+	}
+
+	wl_signal_init(&explicit_sync->events.destroy);
+
+	explicit_sync->display_destroy.notify = handle_display_destroy;
+	wl_display_add_destroy_listener(display, &explicit_sync->display_destroy);
+
+	return explicit_sync;
+}
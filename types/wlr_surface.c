@@ -10,6 +10,7 @@
 #include <wlr/types/wlr_output.h>
 #include <wlr/util/log.h>
 #include <wlr/util/region.h>
+#include "render/pixel_format.h"
 #include "types/wlr_surface.h"
 #include "util/signal.h"
 #include "util/time.h"
@@ -211,6 +212,8 @@ static void surface_update_damage(pixman_region32_t *buffer_damage,
 		// Damage the whole buffer on resize
 		pixman_region32_union_rect(buffer_damage, buffer_damage, 0, 0,
 			pending->buffer_width, pending->buffer_height);
+	} else if (!pixman_region32_not_empty(&pending->surface_damage)) {
+		pixman_region32_copy(buffer_damage, &pending->buffer_damage);
 	} else {
 		// Copy over surface damage + buffer damage
 		pixman_region32_t surface_damage;
@@ -315,30 +318,34 @@ static void surface_state_move(struct wlr_surface_state *state,
 	next->cached_state_locks = 0;
 }
 
+// Uploads or imports the buffer committed last, if it hasn't been already.
+// This is deferred until the texture is needed, so that buffers which are
+// replaced before they are ever displayed never hit the renderer.
 static void surface_apply_damage(struct wlr_surface *surface) {
 	if (surface->current.buffer == NULL) {
-		// NULL commit
-		if (surface->buffer != NULL) {
-			wlr_buffer_unlock(&surface->buffer->base);
-		}
-		surface->buffer = NULL;
 		return;
 	}
 
-	if (surface->buffer != NULL) {
-		if (wlr_client_buffer_apply_damage(surface->buffer,
-				surface->current.buffer, &surface->buffer_damage)) {
-			wlr_buffer_unlock(surface->current.buffer);
-			surface->current.buffer = NULL;
-			return;
-		}
-	}
+	struct wlr_buffer *next = surface->current.buffer;
+	surface->current.buffer = NULL;
 
-	struct wlr_client_buffer *buffer = wlr_client_buffer_create(
-			surface->current.buffer, surface->renderer);
+	// The damage may have been accumulated over several buffers with
+	// different sizes
+	pixman_region32_intersect_rect(&surface->texture_damage,
+		&surface->texture_damage, 0, 0, next->width, next->height);
 
-	wlr_buffer_unlock(surface->current.buffer);
-	surface->current.buffer = NULL;
+	if (surface->buffer != NULL &&
+			wlr_client_buffer_apply_damage(surface->buffer, next,
+				&surface->texture_damage)) {
+		pixman_region32_clear(&surface->texture_damage);
+		wlr_buffer_unlock(next);
+		return;
+	}
+
+	struct wlr_client_buffer *buffer =
+		wlr_client_buffer_create(next, surface->renderer);
+	pixman_region32_clear(&surface->texture_damage);
+	wlr_buffer_unlock(next);
 
 	if (buffer == NULL) {
 		wlr_log(WLR_ERROR, "Failed to upload buffer");
@@ -351,14 +358,55 @@ static void surface_apply_damage(struct wlr_surface *surface) {
 	surface->buffer = buffer;
 }
 
+static void surface_commit_buffer(struct wlr_surface *surface) {
+	if (surface->current.buffer == NULL) {
+		// NULL commit
+		if (surface->buffer != NULL) {
+			wlr_buffer_unlock(&surface->buffer->base);
+		}
+		surface->buffer = NULL;
+		pixman_region32_clear(&surface->texture_damage);
+		return;
+	}
+
+	// Keep the buffer locked in current.buffer until the texture is needed
+	pixman_region32_union(&surface->texture_damage,
+		&surface->texture_damage, &surface->buffer_damage);
+}
+
+// Checks whether a buffer uses an opaque format without creating a texture
+// for it
+static bool buffer_is_opaque(struct wlr_buffer *buffer) {
+	uint32_t format;
+	struct wlr_dmabuf_attributes dmabuf;
+	void *data;
+	size_t stride;
+	if (wlr_buffer_get_dmabuf(buffer, &dmabuf)) {
+		format = dmabuf.format;
+	} else if (wlr_buffer_begin_data_ptr_access(buffer,
+			WLR_BUFFER_DATA_PTR_ACCESS_READ, &data, &format, &stride)) {
+		wlr_buffer_end_data_ptr_access(buffer);
+	} else {
+		return false;
+	}
+
+	const struct wlr_pixel_format_info *info =
+		drm_get_pixel_format_info(format);
+	return info != NULL && !info->has_alpha;
+}
+
 static void surface_update_opaque_region(struct wlr_surface *surface) {
-	struct wlr_texture *texture = wlr_surface_get_texture(surface);
-	if (texture == NULL) {
+	bool opaque;
+	if (surface->current.buffer != NULL) {
+		opaque = buffer_is_opaque(surface->current.buffer);
+	} else if (surface->buffer != NULL) {
+		opaque = wlr_texture_is_opaque(surface->buffer->texture);
+	} else {
 		pixman_region32_clear(&surface->opaque_region);
 		return;
 	}
 
-	if (wlr_texture_is_opaque(texture)) {
+	if (opaque) {
 		pixman_region32_init_rect(&surface->opaque_region,
 			0, 0, surface->current.width, surface->current.height);
 		return;
@@ -379,14 +427,51 @@ static void surface_state_init(struct wlr_surface_state *state);
 
 static void subsurface_parent_commit(struct wlr_subsurface *subsurface);
 
+// Maximum number of unused cached states kept around per surface
+static const size_t cached_state_pool_max = 4;
+
+static struct wlr_surface_state *surface_get_cached_state(
+		struct wlr_surface *surface) {
+	if (wl_list_empty(&surface->cached_pool)) {
+		struct wlr_surface_state *state = calloc(1, sizeof(*state));
+		if (state == NULL) {
+			return NULL;
+		}
+		surface_state_init(state);
+		surface->cached_state_allocs++;
+		return state;
+	}
+
+	struct wlr_surface_state *state =
+		wl_container_of(surface->cached_pool.next, state, cached_state_link);
+	wl_list_remove(&state->cached_state_link);
+	surface->cached_pool_len--;
+
+	// Reset everything but the regions, so that their storage is reused.
+	// The opaque and input regions are only read when the corresponding
+	// committed bit is set, so their stale contents don't matter.
+	struct wlr_surface_state tmp = {
+		.surface_damage = state->surface_damage,
+		.buffer_damage = state->buffer_damage,
+		.opaque = state->opaque,
+		.input = state->input,
+		.scale = 1,
+		.transform = WL_OUTPUT_TRANSFORM_NORMAL,
+	};
+	*state = tmp;
+	wl_list_init(&state->subsurfaces_above);
+	wl_list_init(&state->subsurfaces_below);
+	wl_list_init(&state->frame_callback_list);
+	return state;
+}
+
 static void surface_cache_pending(struct wlr_surface *surface) {
-	struct wlr_surface_state *cached = calloc(1, sizeof(*cached));
+	struct wlr_surface_state *cached = surface_get_cached_state(surface);
 	if (!cached) {
 		wl_resource_post_no_memory(surface->resource);
 		return;
 	}
 
-	surface_state_init(cached);
 	surface_state_move(cached, &surface->pending);
 
 	wl_list_insert(surface->cached.prev, &cached->cached_state_link);
@@ -394,6 +479,24 @@ static void surface_cache_pending(struct wlr_surface *surface) {
 	surface->pending.seq++;
 }
 
+// Marks the input bounds and extents of the surface and all of its ancestors
+// as needing an update. A surface with dirty bounds always has dirty
+// ancestors, so we can stop early.
+static void surface_invalidate_bounds(struct wlr_surface *surface) {
+	while (surface != NULL &&
+			(!surface->input_bounds_dirty || !surface->extents_dirty)) {
+		surface->input_bounds_dirty = true;
+		surface->extents_dirty = true;
+
+		if (!wlr_surface_is_subsurface(surface)) {
+			break;
+		}
+		struct wlr_subsurface *subsurface =
+			wlr_subsurface_from_wlr_surface(surface);
+		surface = subsurface != NULL ? subsurface->parent : NULL;
+	}
+}
+
 static void surface_commit_state(struct wlr_surface *surface,
 		struct wlr_surface_state *next) {
 	assert(next->cached_state_locks == 0);
@@ -404,6 +507,7 @@ static void surface_commit_state(struct wlr_surface *surface,
 	surface->sy += next->dy;
 	surface_update_damage(&surface->buffer_damage, &surface->current, next);
 
+	surface->effective_damage_valid = false;
 	pixman_region32_clear(&surface->external_damage);
 	if (surface->current.width > next->width ||
 			surface->current.height > next->height ||
@@ -423,7 +527,7 @@ static void surface_commit_state(struct wlr_surface *surface,
 	surface_state_move(&surface->current, next);
 
 	if (invalid_buffer) {
-		surface_apply_damage(surface);
+		surface_commit_buffer(surface);
 	}
 	surface_update_opaque_region(surface);
 	surface_update_input_region(surface);
@@ -447,6 +551,9 @@ static void surface_commit_state(struct wlr_surface *surface,
 		subsurface_parent_commit(subsurface);
 	}
 
+	// The input region, size or subsurface positions may have changed
+	surface_invalidate_bounds(surface);
+
 	// If we're committing the pending state, bump the pending sequence number
 	// here, to allow commit listeners to lock the new pending state.
 	if (next == &surface->pending) {
@@ -461,46 +568,67 @@ static void surface_commit_state(struct wlr_surface *surface,
 }
 
 static bool subsurface_is_synchronized(struct wlr_subsurface *subsurface) {
-	while (subsurface != NULL) {
-		if (subsurface->synchronized) {
-			return true;
-		}
+	return subsurface->effective_synchronized;
+}
 
-		if (!subsurface->parent) {
-			return false;
-		}
+static bool subsurface_parent_is_synchronized(
+		struct wlr_subsurface *subsurface) {
+	if (subsurface->parent == NULL ||
+			!wlr_surface_is_subsurface(subsurface->parent)) {
+		return false;
+	}
+	struct wlr_subsurface *parent =
+		wlr_subsurface_from_wlr_surface(subsurface->parent);
+	return parent != NULL && parent->effective_synchronized;
+}
 
-		if (!wlr_surface_is_subsurface(subsurface->parent)) {
-			break;
-		}
-		subsurface = wlr_subsurface_from_wlr_surface(subsurface->parent);
+static void surface_update_children_synchronized(struct wlr_surface *surface);
+
+// Recomputes the effective synchronization mode of the subsurface, and of its
+// descendants if it changed
+static void subsurface_update_synchronized(struct wlr_subsurface *subsurface) {
+	bool synchronized = subsurface->synchronized ||
+		subsurface_parent_is_synchronized(subsurface);
+	if (synchronized == subsurface->effective_synchronized) {
+		return;
 	}
+	subsurface->effective_synchronized = synchronized;
+	surface_update_children_synchronized(subsurface->surface);
+}
 
-	return false;
+static void surface_update_children_synchronized(struct wlr_surface *surface) {
+	struct wlr_subsurface *child;
+	wl_list_for_each(child, &surface->pending.subsurfaces_below,
+			pending.link) {
+		subsurface_update_synchronized(child);
+	}
+	wl_list_for_each(child, &surface->pending.subsurfaces_above,
+			pending.link) {
+		subsurface_update_synchronized(child);
+	}
 }
 
-static void collect_subsurface_damage_iter(struct wlr_surface *surface,
-		int sx, int sy, void *data) {
-	struct wlr_subsurface *subsurface = data;
+// Damages the area covered by the subsurface tree at its current position,
+// using the cached tree extents
+static void subsurface_damage_extents(struct wlr_subsurface *subsurface) {
+	struct wlr_box box;
+	wlr_surface_get_extends(subsurface->surface, &box);
 	pixman_region32_t *damage = &subsurface->parent->external_damage;
 	pixman_region32_union_rect(damage, damage,
-		subsurface->current.x + sx,
-		subsurface->current.y + sy,
-		surface->current.width, surface->current.height);
+		subsurface->current.x + box.x, subsurface->current.y + box.y,
+		box.width, box.height);
 }
 
 static void subsurface_parent_commit(struct wlr_subsurface *subsurface) {
-	struct wlr_surface *surface = subsurface->surface;
-	
 	bool moved = subsurface->current.x != subsurface->pending.x ||
 		subsurface->current.y != subsurface->pending.y;
 	if (subsurface->mapped && moved) {
-		wlr_surface_for_each_surface(surface,
-			collect_subsurface_damage_iter, subsurface);
+		subsurface_damage_extents(subsurface);
 	}
 
 	if (subsurface->synchronized && subsurface->has_cache) {
-		wlr_surface_unlock_cached(surface, subsurface->cached_seq);
+		wlr_surface_unlock_cached(subsurface->surface,
+			subsurface->cached_seq);
 		subsurface->has_cache = false;
 	}
 
@@ -508,8 +636,7 @@ static void subsurface_parent_commit(struct wlr_subsurface *subsurface) {
 	subsurface->current.y = subsurface->pending.y;
 	if (subsurface->mapped && (moved || subsurface->reordered)) {
 		subsurface->reordered = false;
-		wlr_surface_for_each_surface(surface,
-			collect_subsurface_damage_iter, subsurface);
+		subsurface_damage_extents(subsurface);
 	}
 
 	if (!subsurface->added) {
@@ -533,6 +660,77 @@ static void subsurface_commit(struct wlr_subsurface *subsurface) {
 	}
 }
 
+static bool surface_should_queue_pending(struct wlr_surface *surface) {
+	// Only queue content updates: commits which map, unmap or otherwise
+	// drive the role state machine are applied right away
+	return surface->commit_mailbox && wlr_surface_has_buffer(surface) &&
+		(surface->pending.committed & WLR_SURFACE_STATE_BUFFER) &&
+		surface->pending.buffer != NULL;
+}
+
+static bool surface_state_can_merge(const struct wlr_surface_state *next) {
+	if ((next->committed & WLR_SURFACE_STATE_BUFFER) && next->buffer == NULL) {
+		// Unmapping shouldn't wait for the next latch
+		return false;
+	}
+	// Damage can't be carried over a change of the surface coordinate space
+	return !(next->committed & (WLR_SURFACE_STATE_SCALE |
+			WLR_SURFACE_STATE_TRANSFORM | WLR_SURFACE_STATE_VIEWPORT)) &&
+		next->dx == 0 && next->dy == 0;
+}
+
+/**
+ * Fold a newer state into a queued state which hasn't been applied yet.
+ * Damage accumulates, everything else is superseded.
+ */
+static void surface_state_merge(struct wlr_surface_state *state,
+		struct wlr_surface_state *next) {
+	int32_t dx = state->dx, dy = state->dy;
+
+	pixman_region32_union(&next->surface_damage, &next->surface_damage,
+		&state->surface_damage);
+	pixman_region32_union(&next->buffer_damage, &next->buffer_damage,
+		&state->buffer_damage);
+	next->committed |= state->committed &
+		(WLR_SURFACE_STATE_SURFACE_DAMAGE | WLR_SURFACE_STATE_BUFFER_DAMAGE);
+
+	surface_state_move(state, next);
+
+	state->dx = dx;
+	state->dy = dy;
+}
+
+static void surface_queue_pending(struct wlr_surface *surface) {
+	struct wlr_surface_state *queued = surface->queued;
+	if (queued != NULL && !surface_state_can_merge(&surface->pending)) {
+		wlr_surface_latch(surface);
+		queued = NULL;
+		if (!surface_should_queue_pending(surface)) {
+			surface_commit_state(surface, &surface->pending);
+			return;
+		}
+	}
+
+	if (queued != NULL) {
+		// The superseded buffer is released here
+		surface_state_merge(queued, &surface->pending);
+		surface->queued_merges++;
+	} else {
+		queued = surface_get_cached_state(surface);
+		if (!queued) {
+			wl_resource_post_no_memory(surface->resource);
+			return;
+		}
+		surface_state_move(queued, &surface->pending);
+		wl_list_init(&queued->cached_state_link);
+		surface->queued = queued;
+	}
+
+	surface->pending.seq++;
+
+	wlr_signal_emit_safe(&surface->events.queue, NULL);
+}
+
 static void surface_handle_commit(struct wl_client *client,
 		struct wl_resource *resource) {
 	struct wlr_surface *surface = wlr_surface_from_resource(resource);
@@ -549,8 +747,15 @@ static void surface_handle_commit(struct wl_client *client,
 		surface->role->precommit(surface);
 	}
 
+	wlr_signal_emit_safe(&surface->events.client_commit, NULL);
+
 	if (surface->pending.cached_state_locks > 0 || !wl_list_empty(&surface->cached)) {
+		// Cached states are applied in order, so the queued state needs to
+		// go first
+		wlr_surface_latch(surface);
 		surface_cache_pending(surface);
+	} else if (surface->queued != NULL || surface_should_queue_pending(surface)) {
+		surface_queue_pending(surface);
 	} else {
 		surface_commit_state(surface, &surface->pending);
 	}
@@ -650,6 +855,26 @@ static void surface_state_destroy_cached(struct wlr_surface_state *state) {
 	free(state);
 }
 
+static void surface_release_cached_state(struct wlr_surface *surface,
+		struct wlr_surface_state *state) {
+	if (surface->cached_pool_len >= cached_state_pool_max) {
+		surface_state_destroy_cached(state);
+		return;
+	}
+
+	wlr_buffer_unlock(state->buffer);
+	state->buffer = NULL;
+
+	struct wl_resource *resource, *tmp;
+	wl_resource_for_each_safe(resource, tmp, &state->frame_callback_list) {
+		wl_resource_destroy(resource);
+	}
+
+	wl_list_remove(&state->cached_state_link);
+	wl_list_insert(&surface->cached_pool, &state->cached_state_link);
+	surface->cached_pool_len++;
+}
+
 static void subsurface_unmap(struct wlr_subsurface *subsurface);
 
 static void subsurface_destroy(struct wlr_subsurface *subsurface) {
@@ -677,6 +902,8 @@ static void subsurface_destroy(struct wlr_subsurface *subsurface) {
 	wl_resource_set_user_data(subsurface->resource, NULL);
 	if (subsurface->surface) {
 		subsurface->surface->role_data = NULL;
+		// Children don't inherit the synchronized mode anymore
+		surface_update_children_synchronized(subsurface->surface);
 	}
 	free(subsurface);
 }
@@ -696,15 +923,24 @@ static void surface_handle_resource_destroy(struct wl_resource *resource) {
 
 	wlr_addon_set_finish(&surface->addons);
 
+	if (surface->queued != NULL) {
+		surface_state_destroy_cached(surface->queued);
+	}
 	struct wlr_surface_state *cached, *cached_tmp;
 	wl_list_for_each_safe(cached, cached_tmp, &surface->cached, cached_state_link) {
 		surface_state_destroy_cached(cached);
 	}
+	wl_list_for_each_safe(cached, cached_tmp, &surface->cached_pool,
+			cached_state_link) {
+		surface_state_destroy_cached(cached);
+	}
 
 	wl_list_remove(&surface->renderer_destroy.link);
 	surface_state_finish(&surface->pending);
 	surface_state_finish(&surface->current);
 	pixman_region32_fini(&surface->buffer_damage);
+	pixman_region32_fini(&surface->texture_damage);
+	pixman_region32_fini(&surface->effective_damage);
 	pixman_region32_fini(&surface->external_damage);
 	pixman_region32_fini(&surface->opaque_region);
 	pixman_region32_fini(&surface->input_region);
@@ -745,13 +981,20 @@ struct wlr_surface *surface_create(struct wl_client *client,
 	surface_state_init(&surface->current);
 	surface_state_init(&surface->pending);
 	surface->pending.seq = 1;
+	surface->input_bounds_dirty = true;
+	surface->extents_dirty = true;
 
+	wl_signal_init(&surface->events.client_commit);
 	wl_signal_init(&surface->events.commit);
+	wl_signal_init(&surface->events.queue);
 	wl_signal_init(&surface->events.destroy);
 	wl_signal_init(&surface->events.new_subsurface);
 	wl_list_init(&surface->current_outputs);
 	wl_list_init(&surface->cached);
+	wl_list_init(&surface->cached_pool);
 	pixman_region32_init(&surface->buffer_damage);
+	pixman_region32_init(&surface->texture_damage);
+	pixman_region32_init(&surface->effective_damage);
 	pixman_region32_init(&surface->external_damage);
 	pixman_region32_init(&surface->opaque_region);
 	pixman_region32_init(&surface->input_region);
@@ -764,6 +1007,7 @@ struct wlr_surface *surface_create(struct wl_client *client,
 }
 
 struct wlr_texture *wlr_surface_get_texture(struct wlr_surface *surface) {
+	surface_apply_damage(surface);
 	if (surface->buffer == NULL) {
 		return NULL;
 	}
@@ -771,7 +1015,7 @@ struct wlr_texture *wlr_surface_get_texture(struct wlr_surface *surface) {
 }
 
 bool wlr_surface_has_buffer(struct wlr_surface *surface) {
-	return wlr_surface_get_texture(surface) != NULL;
+	return surface->current.buffer != NULL || surface->buffer != NULL;
 }
 
 bool wlr_surface_set_role(struct wlr_surface *surface,
@@ -844,8 +1088,28 @@ void wlr_surface_unlock_cached(struct wlr_surface *surface, uint32_t seq) {
 		}
 
 		surface_commit_state(surface, next);
-		surface_state_destroy_cached(next);
+		surface_release_cached_state(surface, next);
+	}
+}
+
+void wlr_surface_set_commit_mailbox(struct wlr_surface *surface,
+		bool enabled) {
+	surface->commit_mailbox = enabled;
+	if (!enabled) {
+		wlr_surface_latch(surface);
+	}
+}
+
+bool wlr_surface_latch(struct wlr_surface *surface) {
+	struct wlr_surface_state *queued = surface->queued;
+	if (queued == NULL) {
+		return false;
 	}
+
+	surface->queued = NULL;
+	surface_commit_state(surface, queued);
+	surface_release_cached_state(surface, queued);
+	return true;
 }
 
 static const struct wl_subsurface_interface subsurface_implementation;
@@ -969,6 +1233,7 @@ static void subsurface_handle_set_sync(struct wl_client *client,
 	}
 
 	subsurface->synchronized = true;
+	subsurface_update_synchronized(subsurface);
 }
 
 static void subsurface_handle_set_desync(struct wl_client *client,
@@ -980,6 +1245,7 @@ static void subsurface_handle_set_desync(struct wl_client *client,
 
 	if (subsurface->synchronized) {
 		subsurface->synchronized = false;
+		subsurface_update_synchronized(subsurface);
 
 		if (!subsurface_is_synchronized(subsurface) &&
 				subsurface->has_cache) {
@@ -1026,6 +1292,7 @@ static void subsurface_consider_map(struct wlr_subsurface *subsurface,
 	// Now we can map the subsurface
 	wlr_signal_emit_safe(&subsurface->events.map, subsurface);
 	subsurface->mapped = true;
+	surface_invalidate_bounds(subsurface->parent);
 
 	// Try mapping all children too
 	struct wlr_subsurface *child;
@@ -1046,6 +1313,7 @@ static void subsurface_unmap(struct wlr_subsurface *subsurface) {
 
 	wlr_signal_emit_safe(&subsurface->events.unmap, subsurface);
 	subsurface->mapped = false;
+	surface_invalidate_bounds(subsurface->parent);
 
 	// Unmap all children
 	struct wlr_subsurface *child;
@@ -1098,6 +1366,7 @@ static void subsurface_handle_parent_destroy(struct wl_listener *listener,
 	wl_list_remove(&subsurface->pending.link);
 	wl_list_remove(&subsurface->parent_destroy.link);
 	subsurface->parent = NULL;
+	subsurface_update_synchronized(subsurface);
 }
 
 static void subsurface_handle_surface_destroy(struct wl_listener *listener,
@@ -1118,6 +1387,7 @@ struct wlr_subsurface *subsurface_create(struct wlr_surface *surface,
 		return NULL;
 	}
 	subsurface->synchronized = true;
+	subsurface->effective_synchronized = true;
 	subsurface->surface = surface;
 	subsurface->resource =
 		wl_resource_create(client, &wl_subsurface_interface, version, id);
@@ -1173,8 +1443,68 @@ bool wlr_surface_point_accepts_input(struct wlr_surface *surface,
 		pixman_region32_contains_point(&surface->current.input, floor(sx), floor(sy), NULL);
 }
 
-struct wlr_surface *wlr_surface_surface_at(struct wlr_surface *surface,
-		double sx, double sy, double *sub_x, double *sub_y) {
+static void box_union(pixman_box32_t *dst, const pixman_box32_t *src,
+		int dx, int dy) {
+	if (src->x1 >= src->x2 || src->y1 >= src->y2) {
+		return;
+	}
+	pixman_box32_t box = {
+		.x1 = src->x1 + dx,
+		.y1 = src->y1 + dy,
+		.x2 = src->x2 + dx,
+		.y2 = src->y2 + dy,
+	};
+	if (dst->x1 >= dst->x2 || dst->y1 >= dst->y2) {
+		*dst = box;
+		return;
+	}
+	dst->x1 = box.x1 < dst->x1 ? box.x1 : dst->x1;
+	dst->y1 = box.y1 < dst->y1 ? box.y1 : dst->y1;
+	dst->x2 = box.x2 > dst->x2 ? box.x2 : dst->x2;
+	dst->y2 = box.y2 > dst->y2 ? box.y2 : dst->y2;
+}
+
+static void surface_update_input_bounds(struct wlr_surface *surface) {
+	if (!surface->input_bounds_dirty) {
+		return;
+	}
+
+	pixman_box32_t bounds = {0};
+	box_union(&bounds, pixman_region32_extents(&surface->input_region), 0, 0);
+
+	struct wlr_subsurface *subsurface;
+	wl_list_for_each(subsurface, &surface->current.subsurfaces_above,
+			current.link) {
+		if (!subsurface->mapped) {
+			continue;
+		}
+		surface_update_input_bounds(subsurface->surface);
+		box_union(&bounds, &subsurface->surface->input_bounds,
+			subsurface->current.x, subsurface->current.y);
+	}
+	wl_list_for_each(subsurface, &surface->current.subsurfaces_below,
+			current.link) {
+		if (!subsurface->mapped) {
+			continue;
+		}
+		surface_update_input_bounds(subsurface->surface);
+		box_union(&bounds, &subsurface->surface->input_bounds,
+			subsurface->current.x, subsurface->current.y);
+	}
+
+	surface->input_bounds = bounds;
+	surface->input_bounds_dirty = false;
+}
+
+static struct wlr_surface *surface_tree_surface_at(struct wlr_surface *surface,
+		double sx, double sy, double *sub_x, double *sub_y, size_t *tests) {
+	// Skip the whole tree if the point is outside of its input bounds
+	const pixman_box32_t *bounds = &surface->input_bounds;
+	if (floor(sx) < bounds->x1 || floor(sx) >= bounds->x2 ||
+			floor(sy) < bounds->y1 || floor(sy) >= bounds->y2) {
+		return NULL;
+	}
+
 	struct wlr_subsurface *subsurface;
 	wl_list_for_each_reverse(subsurface, &surface->current.subsurfaces_above,
 			current.link) {
@@ -1184,13 +1514,14 @@ struct wlr_surface *wlr_surface_surface_at(struct wlr_surface *surface,
 
 		double _sub_x = subsurface->current.x;
 		double _sub_y = subsurface->current.y;
-		struct wlr_surface *sub = wlr_surface_surface_at(subsurface->surface,
-			sx - _sub_x, sy - _sub_y, sub_x, sub_y);
+		struct wlr_surface *sub = surface_tree_surface_at(subsurface->surface,
+			sx - _sub_x, sy - _sub_y, sub_x, sub_y, tests);
 		if (sub != NULL) {
 			return sub;
 		}
 	}
 
+	(*tests)++;
 	if (wlr_surface_point_accepts_input(surface, sx, sy)) {
 		if (sub_x) {
 			*sub_x = sx;
@@ -1209,8 +1540,8 @@ struct wlr_surface *wlr_surface_surface_at(struct wlr_surface *surface,
 
 		double _sub_x = subsurface->current.x;
 		double _sub_y = subsurface->current.y;
-		struct wlr_surface *sub = wlr_surface_surface_at(subsurface->surface,
-			sx - _sub_x, sy - _sub_y, sub_x, sub_y);
+		struct wlr_surface *sub = surface_tree_surface_at(subsurface->surface,
+			sx - _sub_x, sy - _sub_y, sub_x, sub_y, tests);
 		if (sub != NULL) {
 			return sub;
 		}
@@ -1219,6 +1550,17 @@ struct wlr_surface *wlr_surface_surface_at(struct wlr_surface *surface,
 	return NULL;
 }
 
+struct wlr_surface *wlr_surface_surface_at(struct wlr_surface *surface,
+		double sx, double sy, double *sub_x, double *sub_y) {
+	surface_update_input_bounds(surface);
+
+	size_t tests = 0;
+	struct wlr_surface *found =
+		surface_tree_surface_at(surface, sx, sy, sub_x, sub_y, &tests);
+	surface->input_region_tests = tests;
+	return found;
+}
+
 static void surface_output_destroy(struct wlr_surface_output *surface_output) {
 	wl_list_remove(&surface_output->bind.link);
 	wl_list_remove(&surface_output->destroy.link);
@@ -1309,6 +1651,47 @@ void wlr_surface_send_frame_done(struct wlr_surface *surface,
 	}
 }
 
+static int surface_cmp_client(const void *a, const void *b) {
+	struct wlr_surface *const *surface_a = a;
+	struct wlr_surface *const *surface_b = b;
+	uintptr_t client_a =
+		(uintptr_t)wl_resource_get_client((*surface_a)->resource);
+	uintptr_t client_b =
+		(uintptr_t)wl_resource_get_client((*surface_b)->resource);
+	return (client_a > client_b) - (client_a < client_b);
+}
+
+void wlr_surface_send_frame_done_batch(struct wlr_surface **surfaces,
+		size_t surfaces_len, const struct timespec *when) {
+	uint32_t time = timespec_to_msec(when);
+
+	qsort(surfaces, surfaces_len, sizeof(surfaces[0]), surface_cmp_client);
+
+	for (size_t i = 0; i < surfaces_len; i++) {
+		struct wl_client *client =
+			wl_resource_get_client(surfaces[i]->resource);
+
+		bool sent = false;
+		for (; i < surfaces_len &&
+				wl_resource_get_client(surfaces[i]->resource) == client; i++) {
+			struct wl_resource *resource, *tmp;
+			wl_resource_for_each_safe(resource, tmp,
+					&surfaces[i]->current.frame_callback_list) {
+				wl_callback_send_done(resource, time);
+				wl_resource_destroy(resource);
+				sent = true;
+			}
+		}
+		i--;
+
+		// Wake up the client right away instead of waiting for the event
+		// loop to flush all clients
+		if (sent) {
+			wl_client_flush(client);
+		}
+	}
+}
+
 static void surface_for_each_surface(struct wlr_surface *surface, int x, int y,
 		wlr_surface_iterator_func_t iterator, void *user_data) {
 	struct wlr_subsurface *subsurface;
@@ -1346,36 +1729,48 @@ void wlr_surface_for_each_surface(struct wlr_surface *surface,
 	surface_for_each_surface(surface, 0, 0, iterator, user_data);
 }
 
-struct bound_acc {
-	int32_t min_x, min_y;
-	int32_t max_x, max_y;
-};
+static void surface_update_extents(struct wlr_surface *surface) {
+	if (!surface->extents_dirty) {
+		return;
+	}
 
-static void handle_bounding_box_surface(struct wlr_surface *surface,
-		int x, int y, void *data) {
-	struct bound_acc *acc = data;
+	pixman_box32_t extents = {
+		.x2 = surface->current.width,
+		.y2 = surface->current.height,
+	};
 
-	acc->min_x = min(x, acc->min_x);
-	acc->min_y = min(y, acc->min_y);
+	struct wlr_subsurface *subsurface;
+	struct wl_list *lists[] = {
+		&surface->current.subsurfaces_below,
+		&surface->current.subsurfaces_above,
+	};
+	for (size_t i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+		wl_list_for_each(subsurface, lists[i], current.link) {
+			if (!subsurface->mapped) {
+				continue;
+			}
+			surface_update_extents(subsurface->surface);
+
+			const pixman_box32_t *child = &subsurface->surface->extents;
+			int32_t x = subsurface->current.x, y = subsurface->current.y;
+			extents.x1 = min(extents.x1, child->x1 + x);
+			extents.y1 = min(extents.y1, child->y1 + y);
+			extents.x2 = max(extents.x2, child->x2 + x);
+			extents.y2 = max(extents.y2, child->y2 + y);
+		}
+	}
 
-	acc->max_x = max(x + surface->current.width, acc->max_x);
-	acc->max_y = max(y + surface->current.height, acc->max_y);
+	surface->extents = extents;
+	surface->extents_dirty = false;
 }
 
 void wlr_surface_get_extends(struct wlr_surface *surface, struct wlr_box *box) {
-	struct bound_acc acc = {
-		.min_x = 0,
-		.min_y = 0,
-		.max_x = surface->current.width,
-		.max_y = surface->current.height,
-	};
-
-	wlr_surface_for_each_surface(surface, handle_bounding_box_surface, &acc);
+	surface_update_extents(surface);
 
-	box->x = acc.min_x;
-	box->y = acc.min_y;
-	box->width = acc.max_x - acc.min_x;
-	box->height = acc.max_y - acc.min_y;
+	box->x = surface->extents.x1;
+	box->y = surface->extents.y1;
+	box->width = surface->extents.x2 - surface->extents.x1;
+	box->height = surface->extents.y2 - surface->extents.y1;
 }
 
 static void crop_region(pixman_region32_t *dst, pixman_region32_t *src,
@@ -1385,8 +1780,13 @@ static void crop_region(pixman_region32_t *dst, pixman_region32_t *src,
 	pixman_region32_translate(dst, -box->x, -box->y);
 }
 
-void wlr_surface_get_effective_damage(struct wlr_surface *surface,
-		pixman_region32_t *damage) {
+static void surface_update_effective_damage(struct wlr_surface *surface) {
+	if (surface->effective_damage_valid) {
+		return;
+	}
+	surface->effective_damage_valid = true;
+
+	pixman_region32_t *damage = &surface->effective_damage;
 	pixman_region32_clear(damage);
 
 	// Transform and copy the buffer damage in terms of surface coordinates.
@@ -1416,6 +1816,12 @@ void wlr_surface_get_effective_damage(struct wlr_surface *surface,
 	pixman_region32_union(damage, damage, &surface->external_damage);
 }
 
+void wlr_surface_get_effective_damage(struct wlr_surface *surface,
+		pixman_region32_t *damage) {
+	surface_update_effective_damage(surface);
+	pixman_region32_copy(damage, &surface->effective_damage);
+}
+
 void wlr_surface_get_buffer_source_box(struct wlr_surface *surface,
 		struct wlr_fbox *box) {
 	box->x = box->y = 0;
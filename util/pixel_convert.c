@@ -0,0 +1,441 @@
+#include <drm_fourcc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wlr/util/log.h>
+#include "util/pixel_convert.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PIXEL_CONVERT_X86 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define PIXEL_CONVERT_NEON 1
+#endif
+
+/*
+ * A 32-bit swizzle swaps the two channels located at bit 0 and at bit `shift`
+ * (both masked by `low` when located at bit 0), copies the `keep` bits as-is
+ * and forces the `set` bits to 1. With shift = 0 and low = 0, it only sets
+ * bits, which is used to make the alpha channel opaque.
+ */
+struct swizzle32 {
+	uint32_t keep, low, set;
+	uint32_t shift;
+};
+
+struct pixel_convert_impl {
+	const char *name;
+	void (*swizzle32)(uint32_t *dst, const uint32_t *src, size_t len,
+		const struct swizzle32 *swizzle);
+	void (*rgb565_to_32)(uint32_t *dst, const uint16_t *src, size_t len,
+		bool swap_rb);
+};
+
+enum conversion_type {
+	CONVERSION_COPY,
+	CONVERSION_SWIZZLE32,
+	CONVERSION_RGB565_TO_32,
+	CONVERSION_32_TO_RGB565,
+};
+
+struct conversion {
+	enum conversion_type type;
+	uint32_t dst_bytes, src_bytes; // bytes per pixel
+	struct swizzle32 swizzle;
+	bool swap_rb; // for RGB565 conversions: the 32-bit format is BGR-ordered
+};
+
+struct format32 {
+	uint32_t format;
+	uint32_t bits; // bits per color channel
+	bool bgr; // red is in the least significant bits
+	bool alpha;
+};
+
+static const struct format32 formats32[] = {
+	{ DRM_FORMAT_ARGB8888, 8, false, true },
+	{ DRM_FORMAT_XRGB8888, 8, false, false },
+	{ DRM_FORMAT_ABGR8888, 8, true, true },
+	{ DRM_FORMAT_XBGR8888, 8, true, false },
+	{ DRM_FORMAT_ARGB2101010, 10, false, true },
+	{ DRM_FORMAT_XRGB2101010, 10, false, false },
+	{ DRM_FORMAT_ABGR2101010, 10, true, true },
+	{ DRM_FORMAT_XBGR2101010, 10, true, false },
+};
+
+static const struct format32 *get_format32(uint32_t format) {
+	for (size_t i = 0; i < sizeof(formats32) / sizeof(formats32[0]); i++) {
+		if (formats32[i].format == format) {
+			return &formats32[i];
+		}
+	}
+	return NULL;
+}
+
+static uint32_t alpha_mask(uint32_t bits) {
+	return ~((UINT32_C(1) << (3 * bits)) - 1);
+}
+
+static void swizzle32_scalar(uint32_t *dst, const uint32_t *src, size_t len,
+		const struct swizzle32 *sw) {
+	for (size_t i = 0; i < len; i++) {
+		uint32_t v = src[i];
+		dst[i] = (v & sw->keep) | ((v >> sw->shift) & sw->low) |
+			((v & sw->low) << sw->shift) | sw->set;
+	}
+}
+
+static uint32_t expand_rgb565(uint16_t p, bool swap_rb) {
+	uint32_t r = (p >> 11) & 0x1F, g = (p >> 5) & 0x3F, b = p & 0x1F;
+	r = (r << 3) | (r >> 2);
+	g = (g << 2) | (g >> 4);
+	b = (b << 3) | (b >> 2);
+	if (swap_rb) {
+		uint32_t tmp = r;
+		r = b;
+		b = tmp;
+	}
+	return 0xFF000000 | (r << 16) | (g << 8) | b;
+}
+
+static void rgb565_to_32_scalar(uint32_t *dst, const uint16_t *src,
+		size_t len, bool swap_rb) {
+	for (size_t i = 0; i < len; i++) {
+		dst[i] = expand_rgb565(src[i], swap_rb);
+	}
+}
+
+static void rgb32_to_565(uint16_t *dst, const uint32_t *src, size_t len,
+		bool swap_rb) {
+	for (size_t i = 0; i < len; i++) {
+		uint32_t v = src[i];
+		uint32_t r = (v >> 16) & 0xFF, g = (v >> 8) & 0xFF, b = v & 0xFF;
+		if (swap_rb) {
+			uint32_t tmp = r;
+			r = b;
+			b = tmp;
+		}
+		dst[i] = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+	}
+}
+
+static const struct pixel_convert_impl scalar_impl = {
+	.name = "scalar",
+	.swizzle32 = swizzle32_scalar,
+	.rgb565_to_32 = rgb565_to_32_scalar,
+};
+
+#ifdef PIXEL_CONVERT_X86
+__attribute__((target("sse2")))
+static void swizzle32_sse2(uint32_t *dst, const uint32_t *src, size_t len,
+		const struct swizzle32 *sw) {
+	const __m128i keep = _mm_set1_epi32((int)sw->keep);
+	const __m128i low = _mm_set1_epi32((int)sw->low);
+	const __m128i set = _mm_set1_epi32((int)sw->set);
+	const __m128i shift = _mm_cvtsi32_si128((int)sw->shift);
+
+	size_t i = 0;
+	for (; i + 4 <= len; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *)&src[i]);
+		__m128i r = _mm_and_si128(v, keep);
+		r = _mm_or_si128(r, _mm_and_si128(_mm_srl_epi32(v, shift), low));
+		r = _mm_or_si128(r, _mm_sll_epi32(_mm_and_si128(v, low), shift));
+		r = _mm_or_si128(r, set);
+		_mm_storeu_si128((__m128i *)&dst[i], r);
+	}
+	swizzle32_scalar(&dst[i], &src[i], len - i, sw);
+}
+
+__attribute__((target("sse2")))
+static __m128i expand_rgb565_sse2(__m128i p, bool swap_rb) {
+	const __m128i mask5 = _mm_set1_epi32(0x1F);
+	const __m128i mask6 = _mm_set1_epi32(0x3F);
+	__m128i r = _mm_and_si128(_mm_srli_epi32(p, 11), mask5);
+	__m128i g = _mm_and_si128(_mm_srli_epi32(p, 5), mask6);
+	__m128i b = _mm_and_si128(p, mask5);
+	r = _mm_or_si128(_mm_slli_epi32(r, 3), _mm_srli_epi32(r, 2));
+	g = _mm_or_si128(_mm_slli_epi32(g, 2), _mm_srli_epi32(g, 4));
+	b = _mm_or_si128(_mm_slli_epi32(b, 3), _mm_srli_epi32(b, 2));
+	__m128i hi = swap_rb ? b : r;
+	__m128i lo = swap_rb ? r : b;
+	__m128i out = _mm_or_si128(_mm_slli_epi32(hi, 16), _mm_slli_epi32(g, 8));
+	out = _mm_or_si128(out, lo);
+	return _mm_or_si128(out, _mm_set1_epi32((int)0xFF000000));
+}
+
+__attribute__((target("sse2")))
+static void rgb565_to_32_sse2(uint32_t *dst, const uint16_t *src,
+		size_t len, bool swap_rb) {
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+	for (; i + 8 <= len; i += 8) {
+		__m128i p = _mm_loadu_si128((const __m128i *)&src[i]);
+		__m128i lo = expand_rgb565_sse2(_mm_unpacklo_epi16(p, zero), swap_rb);
+		__m128i hi = expand_rgb565_sse2(_mm_unpackhi_epi16(p, zero), swap_rb);
+		_mm_storeu_si128((__m128i *)&dst[i], lo);
+		_mm_storeu_si128((__m128i *)&dst[i + 4], hi);
+	}
+	rgb565_to_32_scalar(&dst[i], &src[i], len - i, swap_rb);
+}
+
+static const struct pixel_convert_impl sse2_impl = {
+	.name = "SSE2",
+	.swizzle32 = swizzle32_sse2,
+	.rgb565_to_32 = rgb565_to_32_sse2,
+};
+
+__attribute__((target("avx2")))
+static void swizzle32_avx2(uint32_t *dst, const uint32_t *src, size_t len,
+		const struct swizzle32 *sw) {
+	const __m256i keep = _mm256_set1_epi32((int)sw->keep);
+	const __m256i low = _mm256_set1_epi32((int)sw->low);
+	const __m256i set = _mm256_set1_epi32((int)sw->set);
+	const __m128i shift = _mm_cvtsi32_si128((int)sw->shift);
+
+	size_t i = 0;
+	for (; i + 8 <= len; i += 8) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)&src[i]);
+		__m256i r = _mm256_and_si256(v, keep);
+		r = _mm256_or_si256(r,
+			_mm256_and_si256(_mm256_srl_epi32(v, shift), low));
+		r = _mm256_or_si256(r,
+			_mm256_sll_epi32(_mm256_and_si256(v, low), shift));
+		r = _mm256_or_si256(r, set);
+		_mm256_storeu_si256((__m256i *)&dst[i], r);
+	}
+	swizzle32_scalar(&dst[i], &src[i], len - i, sw);
+}
+
+__attribute__((target("avx2")))
+static void rgb565_to_32_avx2(uint32_t *dst, const uint16_t *src,
+		size_t len, bool swap_rb) {
+	const __m256i mask5 = _mm256_set1_epi32(0x1F);
+	const __m256i mask6 = _mm256_set1_epi32(0x3F);
+	const __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+
+	size_t i = 0;
+	for (; i + 8 <= len; i += 8) {
+		__m256i p = _mm256_cvtepu16_epi32(
+			_mm_loadu_si128((const __m128i *)&src[i]));
+		__m256i r = _mm256_and_si256(_mm256_srli_epi32(p, 11), mask5);
+		__m256i g = _mm256_and_si256(_mm256_srli_epi32(p, 5), mask6);
+		__m256i b = _mm256_and_si256(p, mask5);
+		r = _mm256_or_si256(_mm256_slli_epi32(r, 3), _mm256_srli_epi32(r, 2));
+		g = _mm256_or_si256(_mm256_slli_epi32(g, 2), _mm256_srli_epi32(g, 4));
+		b = _mm256_or_si256(_mm256_slli_epi32(b, 3), _mm256_srli_epi32(b, 2));
+		__m256i hi = swap_rb ? b : r;
+		__m256i lo = swap_rb ? r : b;
+		__m256i out = _mm256_or_si256(_mm256_slli_epi32(hi, 16),
+			_mm256_slli_epi32(g, 8));
+		out = _mm256_or_si256(_mm256_or_si256(out, lo), alpha);
+		_mm256_storeu_si256((__m256i *)&dst[i], out);
+	}
+	rgb565_to_32_scalar(&dst[i], &src[i], len - i, swap_rb);
+}
+
+static const struct pixel_convert_impl avx2_impl = {
+	.name = "AVX2",
+	.swizzle32 = swizzle32_avx2,
+	.rgb565_to_32 = rgb565_to_32_avx2,
+};
+#endif
+
+#ifdef PIXEL_CONVERT_NEON
+static void swizzle32_neon(uint32_t *dst, const uint32_t *src, size_t len,
+		const struct swizzle32 *sw) {
+	const uint32x4_t keep = vdupq_n_u32(sw->keep);
+	const uint32x4_t low = vdupq_n_u32(sw->low);
+	const uint32x4_t set = vdupq_n_u32(sw->set);
+	const int32x4_t lshift = vdupq_n_s32((int32_t)sw->shift);
+	const int32x4_t rshift = vdupq_n_s32(-(int32_t)sw->shift);
+
+	size_t i = 0;
+	for (; i + 4 <= len; i += 4) {
+		uint32x4_t v = vld1q_u32(&src[i]);
+		uint32x4_t r = vandq_u32(v, keep);
+		r = vorrq_u32(r, vandq_u32(vshlq_u32(v, rshift), low));
+		r = vorrq_u32(r, vshlq_u32(vandq_u32(v, low), lshift));
+		r = vorrq_u32(r, set);
+		vst1q_u32(&dst[i], r);
+	}
+	swizzle32_scalar(&dst[i], &src[i], len - i, sw);
+}
+
+static void rgb565_to_32_neon(uint32_t *dst, const uint16_t *src,
+		size_t len, bool swap_rb) {
+	const uint32x4_t mask5 = vdupq_n_u32(0x1F);
+	const uint32x4_t mask6 = vdupq_n_u32(0x3F);
+	const uint32x4_t alpha = vdupq_n_u32(0xFF000000);
+
+	size_t i = 0;
+	for (; i + 4 <= len; i += 4) {
+		uint32x4_t p = vmovl_u16(vld1_u16(&src[i]));
+		uint32x4_t r = vandq_u32(vshrq_n_u32(p, 11), mask5);
+		uint32x4_t g = vandq_u32(vshrq_n_u32(p, 5), mask6);
+		uint32x4_t b = vandq_u32(p, mask5);
+		r = vorrq_u32(vshlq_n_u32(r, 3), vshrq_n_u32(r, 2));
+		g = vorrq_u32(vshlq_n_u32(g, 2), vshrq_n_u32(g, 4));
+		b = vorrq_u32(vshlq_n_u32(b, 3), vshrq_n_u32(b, 2));
+		uint32x4_t hi = swap_rb ? b : r;
+		uint32x4_t lo = swap_rb ? r : b;
+		uint32x4_t out = vorrq_u32(vshlq_n_u32(hi, 16), vshlq_n_u32(g, 8));
+		out = vorrq_u32(vorrq_u32(out, lo), alpha);
+		vst1q_u32(&dst[i], out);
+	}
+	rgb565_to_32_scalar(&dst[i], &src[i], len - i, swap_rb);
+}
+
+static const struct pixel_convert_impl neon_impl = {
+	.name = "NEON",
+	.swizzle32 = swizzle32_neon,
+	.rgb565_to_32 = rgb565_to_32_neon,
+};
+#endif
+
+static const struct pixel_convert_impl *get_impl(void) {
+	static const struct pixel_convert_impl *impl = NULL;
+	if (impl != NULL) {
+		return impl;
+	}
+
+	impl = &scalar_impl;
+#ifdef PIXEL_CONVERT_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		impl = &avx2_impl;
+	} else if (__builtin_cpu_supports("sse2")) {
+		impl = &sse2_impl;
+	}
+#elif defined(PIXEL_CONVERT_NEON)
+	impl = &neon_impl;
+#endif
+
+	wlr_log(WLR_DEBUG, "Using %s pixel format conversion", impl->name);
+	return impl;
+}
+
+static bool get_conversion(struct conversion *conv, uint32_t dst_format,
+		uint32_t src_format) {
+	*conv = (struct conversion){0};
+
+	if (dst_format == DRM_FORMAT_RGB565 && src_format == DRM_FORMAT_RGB565) {
+		conv->type = CONVERSION_COPY;
+		conv->dst_bytes = conv->src_bytes = 2;
+		return true;
+	}
+
+#if WLR_LITTLE_ENDIAN
+	const struct format32 *dst = get_format32(dst_format);
+	const struct format32 *src = get_format32(src_format);
+#else
+	// Channel masks below assume little-endian pixel loads
+	const struct format32 *dst = dst_format == src_format ?
+		get_format32(dst_format) : NULL;
+	const struct format32 *src = dst;
+#endif
+
+	if (dst != NULL && src_format == DRM_FORMAT_RGB565 && dst->bits == 8) {
+		conv->type = CONVERSION_RGB565_TO_32;
+		conv->dst_bytes = 4;
+		conv->src_bytes = 2;
+		conv->swap_rb = dst->bgr;
+		return true;
+	}
+	if (src != NULL && dst_format == DRM_FORMAT_RGB565 && src->bits == 8) {
+		conv->type = CONVERSION_32_TO_RGB565;
+		conv->dst_bytes = 2;
+		conv->src_bytes = 4;
+		conv->swap_rb = src->bgr;
+		return true;
+	}
+
+	if (dst == NULL || src == NULL || dst->bits != src->bits) {
+		return false;
+	}
+
+	conv->dst_bytes = conv->src_bytes = 4;
+
+	struct swizzle32 *sw = &conv->swizzle;
+	sw->keep = UINT32_MAX;
+	if (dst->bgr != src->bgr) {
+		sw->low = (UINT32_C(1) << dst->bits) - 1;
+		sw->shift = 2 * dst->bits;
+		sw->keep = alpha_mask(dst->bits) | (sw->low << dst->bits);
+	}
+	if (dst->alpha && !src->alpha) {
+		sw->set = alpha_mask(dst->bits);
+	}
+
+	conv->type = (sw->low == 0 && sw->set == 0) ?
+		CONVERSION_COPY : CONVERSION_SWIZZLE32;
+	return true;
+}
+
+bool pixel_convert_supported(uint32_t dst_format, uint32_t src_format) {
+	struct conversion conv;
+	return get_conversion(&conv, dst_format, src_format);
+}
+
+static void convert_rect(const struct conversion *conv,
+		uint8_t *dst, size_t dst_stride, const uint8_t *src, size_t src_stride,
+		uint32_t width, uint32_t height) {
+	if (conv->type == CONVERSION_COPY) {
+		pixel_copy(dst, dst_stride, src, src_stride,
+			(size_t)width * conv->src_bytes, height);
+		return;
+	}
+
+	const struct pixel_convert_impl *impl = get_impl();
+	for (uint32_t y = 0; y < height; y++) {
+		uint8_t *dst_row = dst + y * dst_stride;
+		const uint8_t *src_row = src + y * src_stride;
+		switch (conv->type) {
+		case CONVERSION_COPY:
+			abort(); // unreachable
+		case CONVERSION_SWIZZLE32:
+			impl->swizzle32((uint32_t *)dst_row, (const uint32_t *)src_row,
+				width, &conv->swizzle);
+			break;
+		case CONVERSION_RGB565_TO_32:
+			impl->rgb565_to_32((uint32_t *)dst_row, (const uint16_t *)src_row,
+				width, conv->swap_rb);
+			break;
+		case CONVERSION_32_TO_RGB565:
+			rgb32_to_565((uint16_t *)dst_row, (const uint32_t *)src_row,
+				width, conv->swap_rb);
+			break;
+		}
+	}
+}
+
+bool pixel_convert(uint32_t dst_format, void *dst, size_t dst_stride,
+		uint32_t src_format, const void *src, size_t src_stride,
+		uint32_t width, uint32_t height) {
+	struct conversion conv;
+	if (!get_conversion(&conv, dst_format, src_format)) {
+		return false;
+	}
+
+	convert_rect(&conv, dst, dst_stride, src, src_stride, width, height);
+	return true;
+}
+
+void pixel_copy(void *dst, size_t dst_stride, const void *src,
+		size_t src_stride, size_t row_size, uint32_t height) {
+	if (dst == src && dst_stride == src_stride) {
+		return;
+	}
+
+	if (dst_stride == src_stride && row_size == src_stride) {
+		memcpy(dst, src, row_size * height);
+		return;
+	}
+
+	uint8_t *dst_row = dst;
+	const uint8_t *src_row = src;
+	for (uint32_t y = 0; y < height; y++) {
+		memcpy(dst_row, src_row, row_size);
+		dst_row += dst_stride;
+		src_row += src_stride;
+	}
+}
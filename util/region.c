@@ -4,6 +4,31 @@
 #include <stdlib.h>
 #include <wlr/util/region.h>
 
+// Most regions only have a few rectangles, use a stack buffer for those
+#define STACK_RECTS_LEN 16
+
+static pixman_box32_t *rects_alloc(pixman_box32_t *stack_rects, int nrects) {
+	if (nrects <= STACK_RECTS_LEN) {
+		return stack_rects;
+	}
+	return malloc(nrects * sizeof(pixman_box32_t));
+}
+
+// Replaces the contents of dst, which may be the source of rects
+static void region_set_rects(pixman_region32_t *dst, pixman_box32_t *rects,
+		int nrects, pixman_box32_t *stack_rects) {
+	pixman_region32_fini(dst);
+	if (nrects == 1) {
+		pixman_region32_init_rect(dst, rects[0].x1, rects[0].y1,
+			rects[0].x2 - rects[0].x1, rects[0].y2 - rects[0].y1);
+	} else {
+		pixman_region32_init_rects(dst, rects, nrects);
+	}
+	if (rects != stack_rects) {
+		free(rects);
+	}
+}
+
 void wlr_region_scale(pixman_region32_t *dst, pixman_region32_t *src,
 		float scale) {
 	wlr_region_scale_xy(dst, src, scale, scale);
@@ -18,22 +43,36 @@ void wlr_region_scale_xy(pixman_region32_t *dst, pixman_region32_t *src,
 
 	int nrects;
 	pixman_box32_t *src_rects = pixman_region32_rectangles(src, &nrects);
+	if (nrects == 0) {
+		pixman_region32_clear(dst);
+		return;
+	}
 
-	pixman_box32_t *dst_rects = malloc(nrects * sizeof(pixman_box32_t));
+	pixman_box32_t stack_rects[STACK_RECTS_LEN];
+	pixman_box32_t *dst_rects = rects_alloc(stack_rects, nrects);
 	if (dst_rects == NULL) {
 		return;
 	}
 
-	for (int i = 0; i < nrects; ++i) {
-		dst_rects[i].x1 = floor(src_rects[i].x1 * scale_x);
-		dst_rects[i].x2 = ceil(src_rects[i].x2 * scale_x);
-		dst_rects[i].y1 = floor(src_rects[i].y1 * scale_y);
-		dst_rects[i].y2 = ceil(src_rects[i].y2 * scale_y);
+	int int_scale_x = (int)scale_x, int_scale_y = (int)scale_y;
+	if (int_scale_x == scale_x && int_scale_y == scale_y) {
+		// No rounding needed
+		for (int i = 0; i < nrects; ++i) {
+			dst_rects[i].x1 = src_rects[i].x1 * int_scale_x;
+			dst_rects[i].x2 = src_rects[i].x2 * int_scale_x;
+			dst_rects[i].y1 = src_rects[i].y1 * int_scale_y;
+			dst_rects[i].y2 = src_rects[i].y2 * int_scale_y;
+		}
+	} else {
+		for (int i = 0; i < nrects; ++i) {
+			dst_rects[i].x1 = floor(src_rects[i].x1 * scale_x);
+			dst_rects[i].x2 = ceil(src_rects[i].x2 * scale_x);
+			dst_rects[i].y1 = floor(src_rects[i].y1 * scale_y);
+			dst_rects[i].y2 = ceil(src_rects[i].y2 * scale_y);
+		}
 	}
 
-	pixman_region32_fini(dst);
-	pixman_region32_init_rects(dst, dst_rects, nrects);
-	free(dst_rects);
+	region_set_rects(dst, dst_rects, nrects, stack_rects);
 }
 
 void wlr_region_transform(pixman_region32_t *dst, pixman_region32_t *src,
@@ -45,8 +84,13 @@ void wlr_region_transform(pixman_region32_t *dst, pixman_region32_t *src,
 
 	int nrects;
 	pixman_box32_t *src_rects = pixman_region32_rectangles(src, &nrects);
+	if (nrects == 0) {
+		pixman_region32_clear(dst);
+		return;
+	}
 
-	pixman_box32_t *dst_rects = malloc(nrects * sizeof(pixman_box32_t));
+	pixman_box32_t stack_rects[STACK_RECTS_LEN];
+	pixman_box32_t *dst_rects = rects_alloc(stack_rects, nrects);
 	if (dst_rects == NULL) {
 		return;
 	}
@@ -104,9 +148,7 @@ void wlr_region_transform(pixman_region32_t *dst, pixman_region32_t *src,
 		}
 	}
 
-	pixman_region32_fini(dst);
-	pixman_region32_init_rects(dst, dst_rects, nrects);
-	free(dst_rects);
+	region_set_rects(dst, dst_rects, nrects, stack_rects);
 }
 
 void wlr_region_expand(pixman_region32_t *dst, pixman_region32_t *src,
@@ -118,8 +160,13 @@ void wlr_region_expand(pixman_region32_t *dst, pixman_region32_t *src,
 
 	int nrects;
 	pixman_box32_t *src_rects = pixman_region32_rectangles(src, &nrects);
+	if (nrects == 0) {
+		pixman_region32_clear(dst);
+		return;
+	}
 
-	pixman_box32_t *dst_rects = malloc(nrects * sizeof(pixman_box32_t));
+	pixman_box32_t stack_rects[STACK_RECTS_LEN];
+	pixman_box32_t *dst_rects = rects_alloc(stack_rects, nrects);
 	if (dst_rects == NULL) {
 		return;
 	}
@@ -131,9 +178,7 @@ void wlr_region_expand(pixman_region32_t *dst, pixman_region32_t *src,
 		dst_rects[i].y2 = src_rects[i].y2 + distance;
 	}
 
-	pixman_region32_fini(dst);
-	pixman_region32_init_rects(dst, dst_rects, nrects);
-	free(dst_rects);
+	region_set_rects(dst, dst_rects, nrects, stack_rects);
 }
 
 void wlr_region_rotated_bounds(pixman_region32_t *dst, pixman_region32_t *src,